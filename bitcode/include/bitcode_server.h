@@ -4,14 +4,20 @@
 #ifndef ERROR_SPECIFICATIONS_BITCODE_SERVER_H
 #define ERROR_SPECIFICATIONS_BITCODE_SERVER_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <unordered_map>
 
-#include "tbb/task.h"
+#include "tbb/mutex.h"
 
+#include "async_server.h"
+#include "executor.h"
+#include "module_cache.h"
 #include "operations_service.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
+#include "result_cache.h"
 #include "servers.h"
 
 namespace error_specifications {
@@ -21,6 +27,8 @@ constexpr int kChunkSize = 1048576;
 // Logic and data behind the server's behavior.
 class BitcodeServiceImpl final : public BitcodeService::Service {
   // A map from the ID to the file location of registered bitcode files.
+  // Guarded by file_stats_mutex_, since RPCs register and look up files
+  // concurrently.
   std::unordered_map<std::string, Uri> registered_bitcode_files_;
 
   grpc::Status RegisterBitcode(grpc::ServerContext *context,
@@ -57,20 +65,86 @@ class BitcodeServiceImpl final : public BitcodeService::Service {
   grpc::Status DoRegisterBitcodeFile(const Uri &uri,
                                      std::string *out_bitcode_id);
 
+  // Hashes the local file at `file_path` into `out_bitcode_id`, switching to
+  // a tree hash for files of at least tree_hash_min_bytes_.
+  grpc::Status HashBitcodeFile(const std::string &file_path, uint64_t size,
+                               std::string *out_bitcode_id) const;
+
+  // Parsed modules shared by the tasks, keyed by bitcode ID.
+  ModuleCache module_cache_;
+
+  // What a local file looked like when it was last hashed.
+  struct FileStat {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t inode = 0;
+    uint64_t device = 0;
+    std::string bitcode_id;
+  };
+
+  // Lets re-registering an unchanged local file skip hashing it, keyed by
+  // file path.
+  std::unordered_map<std::string, FileStat> file_stats_;
+  // Guards file_stats_ and registered_bitcode_files_.
+  mutable tbb::mutex file_stats_mutex_;
+
+  // Local files at least this large are hashed with TreeHashBytes. Zero
+  // disables tree hashing.
+  const uint64_t tree_hash_min_bytes_;
+
  public:
+  explicit BitcodeServiceImpl(
+      uint64_t module_cache_bytes = kDefaultModuleCacheBytes,
+      uint64_t tree_hash_min_bytes = 0,
+      const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+      const OperationExecutorOptions &executor_options =
+          OperationExecutorOptions())
+      : module_cache_(module_cache_bytes),
+        tree_hash_min_bytes_(tree_hash_min_bytes),
+        result_cache(result_cache_options),
+        executor(executor_options, "bitcode") {
+    operations_service.SetResultCache(&result_cache);
+  }
+
+  // Opens the chunks of the requested bitcode file for DownloadBitcode, on
+  // both the synchronous and the asynchronous server.
+  grpc::Status OpenDownloadBitcode(
+      grpc::ServerContext *context, const DownloadBitcodeRequest *request,
+      std::unique_ptr<ServerStream<DataChunk>> *out_stream);
+
+  // Serves the BitcodeService and operations RPCs on `server`, which must not
+  // outlive this service.
+  void AddToAsyncServer(AsyncServer *server);
+
   // Given a bitcode handle, returns the associated file path.
   // Returns an empty string if the handle could not be found.
   grpc::Status GetBitcodeUriForHandle(const Handle &handle, Uri *out_uri) const;
 
+  // Given a bitcode handle, returns the parsed module, parsing it only if it
+  // is not already in the module cache. The module is shared and must not be
+  // modified.
+  grpc::Status GetModuleForHandle(const Handle &handle,
+                                  std::shared_ptr<ParsedModule> *out_module);
+
+  // Returns the hit, miss, and eviction counters of the module cache.
+  ModuleCacheStats GetModuleCacheStats() const;
+
   // The operations service for managing long-running tasks.
   OperationsServiceImpl operations_service;
+
+  // Memoized results of finished GetDefinedFunctions operations.
+  ResultCache result_cache;
+
+  // Runs the tasks of the long-running RPCs. Declared last so that it is
+  // destroyed first, waiting for the tasks that still use the members above.
+  OperationExecutor executor;
 };
 
 // Handles setting up a task to execute a CalledFunctionsPass related to the
 // CalledFunctionsRequest.
-class GetCalledFunctionsTask : public tbb::task {
+class GetCalledFunctionsTask {
  public:
-  tbb::task *execute(void);
+  void Run();
 
   std::string task_name;
   CalledFunctionsRequest request;
@@ -80,9 +154,9 @@ class GetCalledFunctionsTask : public tbb::task {
 
 // Handles setting up a task to execute a LocalCalledFunctionsPass related
 // to the LocalCalledFunctionsRequest.
-class GetLocalCalledFunctionsTask : public tbb::task {
+class GetLocalCalledFunctionsTask {
  public:
-  tbb::task *execute(void);
+  void Run();
 
   std::string task_name;
   LocalCalledFunctionsRequest request;
@@ -92,9 +166,9 @@ class GetLocalCalledFunctionsTask : public tbb::task {
 
 // Handles setting up a task to execute a FileCalledFunctionsPass related to
 // the FileCalledFunctionsRequest.
-class GetFileCalledFunctionsTask : public tbb::task {
+class GetFileCalledFunctionsTask {
  public:
-  tbb::task *execute(void);
+  void Run();
 
   std::string task_name;
   FileCalledFunctionsRequest request;
@@ -104,18 +178,26 @@ class GetFileCalledFunctionsTask : public tbb::task {
 
 // Handles setting up a task to executed a DefinedFunctionsPass related to the
 // DefinedFunctionsRequest.
-class GetDefinedFunctionsTask : public tbb::task {
+class GetDefinedFunctionsTask {
  public:
-  tbb::task *execute(void);
+  void Run();
 
   std::string task_name;
   DefinedFunctionsRequest request;
   BitcodeServiceImpl *bitcode_service;
   OperationsServiceImpl *operations_service;
+  std::string result_key;
 };
 
 // Start up the BitcodeService.
-void RunBitcodeServer(std::string server_address);
+void RunBitcodeServer(
+    std::string server_address,
+    uint64_t module_cache_bytes = kDefaultModuleCacheBytes,
+    uint64_t tree_hash_min_bytes = 0,
+    const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+    const OperationExecutorOptions &executor_options =
+        OperationExecutorOptions(),
+    const AsyncServerOptions &async_server_options = AsyncServerOptions());
 
 }  // namespace error_specifications.
 
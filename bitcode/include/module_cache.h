@@ -0,0 +1,99 @@
+// A bounded cache of parsed LLVM modules shared by the BitcodeService tasks.
+//
+// Parsing a large bitcode file takes much longer than running any of the
+// read-only passes over it, so the parsed module is kept around and keyed by
+// the sha256 bitcode ID. Entries are evicted in least-recently-used order once
+// the total size of the cached bitcode exceeds the byte budget.
+
+#ifndef ERROR_SPECIFICATIONS_BITCODE_INCLUDE_MODULE_CACHE_H_
+#define ERROR_SPECIFICATIONS_BITCODE_INCLUDE_MODULE_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "include/grpcpp/grpcpp.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "tbb/mutex.h"
+
+#include "proto/operations.grpc.pb.h"
+
+namespace error_specifications {
+
+// Default budget for the module cache, measured in bytes of bitcode.
+constexpr uint64_t kDefaultModuleCacheBytes = 1ULL << 31;
+
+// A parsed module together with the context that owns it.
+struct ParsedModule {
+  // The context must outlive the module, so it is declared first.
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<llvm::Module> module;
+
+  // Size of the bitcode the module was parsed from.
+  uint64_t size_bytes = 0;
+
+  // An LLVMContext is not thread-safe, so tasks sharing a cached module must
+  // hold this lock while running passes over it.
+  tbb::mutex pass_mutex;
+};
+
+// Counters describing how effective the cache has been.
+struct ModuleCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t size_bytes = 0;
+};
+
+// Reads and parses the bitcode at `uri` into a fresh context. Callers that
+// mutate the module (e.g. Annotate) should use this instead of the cache.
+grpc::Status ParseModuleFromUri(const Uri &uri,
+                                std::unique_ptr<ParsedModule> *out_module);
+
+class ModuleCache {
+ public:
+  explicit ModuleCache(uint64_t max_bytes = kDefaultModuleCacheBytes)
+      : max_bytes_(max_bytes) {}
+
+  // Returns the module for `bitcode_id`, parsing it from `uri` on a miss.
+  // The returned module must be treated as read-only.
+  grpc::Status GetOrParse(const std::string &bitcode_id, const Uri &uri,
+                          std::shared_ptr<ParsedModule> *out_module);
+
+  // Drops the module for `bitcode_id`, if cached.
+  void Erase(const std::string &bitcode_id);
+
+  ModuleCacheStats GetStats() const;
+
+ private:
+  struct Entry {
+    std::shared_ptr<ParsedModule> parsed_module;
+    // Position of the bitcode ID in lru_.
+    std::list<std::string>::iterator lru_position;
+  };
+
+  // Evicts least-recently-used entries until the cache fits its budget.
+  // Must be called with mutex_ held.
+  void EvictLocked();
+
+  const uint64_t max_bytes_;
+  uint64_t size_bytes_ = 0;
+
+  // Bitcode IDs ordered from most to least recently used.
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, Entry> entries_;
+  mutable tbb::mutex mutex_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> evictions_{0};
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_BITCODE_INCLUDE_MODULE_CACHE_H_
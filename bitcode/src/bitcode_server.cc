@@ -1,5 +1,7 @@
 #include "bitcode_server.h"
 
+#include <algorithm>
+#include <chrono>
 #include <ctime>
 #include <fstream>
 #include <iostream>
@@ -15,64 +17,48 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/SourceMgr.h"
-#include "tbb/task.h"
 
 #include "annotate_pass.h"
 #include "called_functions_pass.h"
 #include "defined_functions_pass.h"
 #include "file_called_functions_pass.h"
 #include "local_called_functions_pass.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "module_cache.h"
 #include "servers.h"
 
 namespace error_specifications {
 
-tbb::task *GetCalledFunctionsTask::execute(void) {
+void GetCalledFunctionsTask::Run() {
   LOG(INFO) << task_name;
 
   Operation result;
   result.set_name(task_name);
 
-  Handle request_handle = request.bitcode_id();
-  Uri bitcode_uri;
-  grpc::Status err =
-      bitcode_service->GetBitcodeUriForHandle(request_handle, &bitcode_uri);
+  // The parsed module is shared with other tasks on the same handle.
+  std::shared_ptr<ParsedModule> parsed_module;
+  grpc::Status err = bitcode_service->GetModuleForHandle(request.bitcode_id(),
+                                                         &parsed_module);
   if (!err.ok()) {
-    LOG(ERROR) << "Unable to get bitcode URI for handle.";
+    LOG(ERROR) << "Unable to get module for handle.";
     google::rpc::Status *error_pb_message = result.mutable_error();
     error_pb_message->set_code(err.error_code());
     error_pb_message->set_message(err.error_message());
     result.set_done(1);
     operations_service->UpdateOperation(task_name, result);
-    return NULL;
-  }
-
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
-
-  // Parse IR into an llvm Module.
-  llvm::SMDiagnostic llvm_err;
-  llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), llvm_err, llvm_context));
-  if (!module) {
-    llvm_err.print("server", llvm::errs());
-    google::rpc::Status *error_pb_message = result.mutable_error();
-    error_pb_message->set_code(grpc::StatusCode::DATA_LOSS);
-    error_pb_message->set_message("Unable to read bitcode file.");
-    result.set_done(1);
-    operations_service->UpdateOperation(task_name, result);
-    return NULL;
+    return;
   }
 
   CalledFunctionsPass *called_functions_pass = new CalledFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(called_functions_pass);
-  pass_manager.run(*module);
+  {
+    tbb::mutex::scoped_lock lock(parsed_module->pass_mutex);
+    pass_manager.run(*parsed_module->module);
+  }
 
   CalledFunctionsResponse response =
       called_functions_pass->GetCalledFunctions();
@@ -83,57 +69,36 @@ tbb::task *GetCalledFunctionsTask::execute(void) {
   result.mutable_response()->PackFrom(response);
 
   operations_service->UpdateOperation(task_name, result);
-
-  return NULL;
 }
 
-tbb::task *GetLocalCalledFunctionsTask::execute(void) {
+void GetLocalCalledFunctionsTask::Run() {
   LOG(INFO) << task_name;
 
   Operation result;
   result.set_name(task_name);
 
-  Handle request_handle = request.bitcode_id();
-  Uri bitcode_uri;
-  grpc::Status err =
-      bitcode_service->GetBitcodeUriForHandle(request_handle, &bitcode_uri);
+  // The parsed module is shared with other tasks on the same handle.
+  std::shared_ptr<ParsedModule> parsed_module;
+  grpc::Status err = bitcode_service->GetModuleForHandle(request.bitcode_id(),
+                                                         &parsed_module);
   if (!err.ok()) {
-    LOG(ERROR) << "Unable to get bitcode URI for handle.";
+    LOG(ERROR) << "Unable to get module for handle.";
     google::rpc::Status *error_pb_message = result.mutable_error();
     error_pb_message->set_code(err.error_code());
     error_pb_message->set_message(err.error_message());
     result.set_done(1);
     operations_service->UpdateOperation(task_name, result);
-    return NULL;
-  }
-
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
-
-  // Parse IR into an llvm Module.
-  llvm::SMDiagnostic llvm_err;
-  llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), llvm_err, llvm_context));
-  if (!module) {
-    llvm_err.print("server", llvm::errs());
-    google::rpc::Status *error_pb_message = result.mutable_error();
-    error_pb_message->set_code(grpc::StatusCode::DATA_LOSS);
-    error_pb_message->set_message("Unable to read bitcode file.");
-    result.set_done(1);
-    operations_service->UpdateOperation(task_name, result);
-    return NULL;
+    return;
   }
 
   LocalCalledFunctionsPass *local_called_functions_pass =
       new LocalCalledFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(local_called_functions_pass);
-  pass_manager.run(*module);
+  {
+    tbb::mutex::scoped_lock lock(parsed_module->pass_mutex);
+    pass_manager.run(*parsed_module->module);
+  }
 
   LocalCalledFunctionsResponse response =
       local_called_functions_pass->GetLocalCalledFunctions();
@@ -144,57 +109,36 @@ tbb::task *GetLocalCalledFunctionsTask::execute(void) {
   result.mutable_response()->PackFrom(response);
 
   operations_service->UpdateOperation(task_name, result);
-
-  return NULL;
 }
 
-tbb::task *GetFileCalledFunctionsTask::execute(void) {
+void GetFileCalledFunctionsTask::Run() {
   LOG(INFO) << task_name;
 
   Operation result;
   result.set_name(task_name);
 
-  Handle request_handle = request.bitcode_id();
-  Uri bitcode_uri;
-  grpc::Status err =
-      bitcode_service->GetBitcodeUriForHandle(request_handle, &bitcode_uri);
+  // The parsed module is shared with other tasks on the same handle.
+  std::shared_ptr<ParsedModule> parsed_module;
+  grpc::Status err = bitcode_service->GetModuleForHandle(request.bitcode_id(),
+                                                         &parsed_module);
   if (!err.ok()) {
-    LOG(ERROR) << "Unable to get bitcode URI for handle.";
+    LOG(ERROR) << "Unable to get module for handle.";
     google::rpc::Status *error_pb_message = result.mutable_error();
     error_pb_message->set_code(err.error_code());
     error_pb_message->set_message(err.error_message());
     result.set_done(1);
     operations_service->UpdateOperation(task_name, result);
-    return NULL;
-  }
-
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
-
-  // Parse IR into an llvm Module.
-  llvm::SMDiagnostic llvm_err;
-  llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), llvm_err, llvm_context));
-  if (!module) {
-    llvm_err.print("server", llvm::errs());
-    google::rpc::Status *error_pb_message = result.mutable_error();
-    error_pb_message->set_code(grpc::StatusCode::DATA_LOSS);
-    error_pb_message->set_message("Unable to read bitcode file.");
-    result.set_done(1);
-    operations_service->UpdateOperation(task_name, result);
-    return NULL;
+    return;
   }
 
   FileCalledFunctionsPass *file_called_functions_pass =
       new FileCalledFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(file_called_functions_pass);
-  pass_manager.run(*module);
+  {
+    tbb::mutex::scoped_lock lock(parsed_module->pass_mutex);
+    pass_manager.run(*parsed_module->module);
+  }
 
   FileCalledFunctionsResponse response =
       file_called_functions_pass->GetFileCalledFunctions();
@@ -205,56 +149,35 @@ tbb::task *GetFileCalledFunctionsTask::execute(void) {
   result.mutable_response()->PackFrom(response);
 
   operations_service->UpdateOperation(task_name, result);
-
-  return NULL;
 }
 
-tbb::task *GetDefinedFunctionsTask::execute(void) {
+void GetDefinedFunctionsTask::Run() {
   LOG(INFO) << task_name;
 
   Operation result;
   result.set_name(task_name);
 
-  Handle request_handle = request.bitcode_id();
-  Uri bitcode_uri;
-  grpc::Status err =
-      bitcode_service->GetBitcodeUriForHandle(request_handle, &bitcode_uri);
+  // The parsed module is shared with other tasks on the same handle.
+  std::shared_ptr<ParsedModule> parsed_module;
+  grpc::Status err = bitcode_service->GetModuleForHandle(request.bitcode_id(),
+                                                         &parsed_module);
   if (!err.ok()) {
-    LOG(ERROR) << "Unable to get bitcode URI for handle.";
+    LOG(ERROR) << "Unable to get module for handle.";
     google::rpc::Status *error_pb_message = result.mutable_error();
     error_pb_message->set_code(err.error_code());
     error_pb_message->set_message(err.error_message());
     result.set_done(1);
     operations_service->UpdateOperation(task_name, result);
-    return NULL;
-  }
-
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
-
-  // Parse IR into an llvm Module.
-  llvm::SMDiagnostic llvm_err;
-  llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), llvm_err, llvm_context));
-  if (!module) {
-    llvm_err.print("server", llvm::errs());
-    google::rpc::Status *error_pb_message = result.mutable_error();
-    error_pb_message->set_code(grpc::StatusCode::DATA_LOSS);
-    error_pb_message->set_message("Unable to read bitcode file.");
-    result.set_done(1);
-    operations_service->UpdateOperation(task_name, result);
-    return NULL;
+    return;
   }
 
   DefinedFunctionsPass *defined_functions_pass = new DefinedFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(defined_functions_pass);
-  pass_manager.run(*module);
+  {
+    tbb::mutex::scoped_lock lock(parsed_module->pass_mutex);
+    pass_manager.run(*parsed_module->module);
+  }
 
   DefinedFunctionsResponse response =
       defined_functions_pass->get_defined_functions();
@@ -264,9 +187,8 @@ tbb::task *GetDefinedFunctionsTask::execute(void) {
   // Packing into google.protobuf.Any
   result.mutable_response()->PackFrom(response);
 
+  bitcode_service->result_cache.Insert(result_key, result);
   operations_service->UpdateOperation(task_name, result);
-
-  return NULL;
 }
 
 grpc::Status BitcodeServiceImpl::RegisterBitcode(
@@ -287,44 +209,153 @@ grpc::Status BitcodeServiceImpl::RegisterBitcode(
   return grpc::Status::OK;
 }
 
+// Returns the identity of the file at `file_path` as used by the stat memo.
+static std::error_code StatFile(const std::string &file_path,
+                                uint64_t *out_size, int64_t *out_mtime_ns,
+                                uint64_t *out_inode, uint64_t *out_device) {
+  llvm::sys::fs::file_status status;
+  std::error_code error_code = llvm::sys::fs::status(file_path, status);
+  if (error_code) {
+    return error_code;
+  }
+  *out_size = status.getSize();
+  *out_mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      status.getLastModificationTime().time_since_epoch())
+                      .count();
+  *out_inode = status.getUniqueID().getFile();
+  *out_device = status.getUniqueID().getDevice();
+  return error_code;
+}
+
+grpc::Status BitcodeServiceImpl::HashBitcodeFile(
+    const std::string &file_path, uint64_t size,
+    std::string *out_bitcode_id) const {
+  if (tree_hash_min_bytes_ == 0 || size < tree_hash_min_bytes_) {
+    return HashFile(file_path, *out_bitcode_id);
+  }
+
+  // Blocks of a mapped file can be hashed in parallel.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(file_path);
+  if (!buffer) {
+    const std::string err_msg = "Unable to read bitcode file.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+  return TreeHashBytes((*buffer)->getBufferStart(), (*buffer)->getBufferSize(),
+                       *out_bitcode_id);
+}
+
 grpc::Status BitcodeServiceImpl::DoRegisterBitcodeFile(
     const Uri &uri, std::string *out_bitcode_id) {
-  std::string bitcode_data_str;
-  grpc::Status read_status = ReadUriIntoString(uri, bitcode_data_str);
-  if (!read_status.ok()) {
+  if (uri.scheme() != Scheme::SCHEME_FILE) {
+    std::unique_ptr<llvm::MemoryBuffer> bitcode_buffer;
+    grpc::Status read_status = ReadUriIntoBuffer(uri, &bitcode_buffer);
+    if (!read_status.ok()) {
+      const std::string err_msg = "Unable to read bitcode file.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+    }
+
+    // Hash the bitcode file and use that as unique identifier (handle).
+    grpc::Status err =
+        HashBytes(bitcode_buffer->getBufferStart(),
+                  bitcode_buffer->getBufferSize(), *out_bitcode_id);
+    if (!err.ok()) {
+      LOG(ERROR) << "Unable to hash bitcode data.";
+      return err;
+    }
+
+    tbb::mutex::scoped_lock lock(file_stats_mutex_);
+    registered_bitcode_files_[*out_bitcode_id] = uri;
+
+    return grpc::Status::OK;
+  }
+
+  std::string file_path;
+  grpc::Status err = ConvertUriToFilePath(uri, file_path);
+  if (!err.ok()) {
+    return err;
+  }
+
+  FileStat before;
+  if (StatFile(file_path, &before.size, &before.mtime_ns, &before.inode,
+               &before.device)) {
     const std::string err_msg = "Unable to read bitcode file.";
     LOG(ERROR) << err_msg;
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
 
+  // A file that has not changed since it was last hashed keeps its ID.
+  {
+    tbb::mutex::scoped_lock lock(file_stats_mutex_);
+    auto stat_it = file_stats_.find(file_path);
+    if (stat_it != file_stats_.end() && stat_it->second.size == before.size &&
+        stat_it->second.mtime_ns == before.mtime_ns &&
+        stat_it->second.inode == before.inode &&
+        stat_it->second.device == before.device) {
+      LOG(INFO) << "Reusing bitcode ID for unchanged file " << file_path;
+      *out_bitcode_id = stat_it->second.bitcode_id;
+      registered_bitcode_files_[*out_bitcode_id] = uri;
+      return grpc::Status::OK;
+    }
+  }
+
   // Hash the bitcode file and use that as unique identifier (handle).
-  grpc::Status err = HashString(bitcode_data_str, *out_bitcode_id);
+  err = HashBitcodeFile(file_path, before.size, out_bitcode_id);
   if (!err.ok()) {
     LOG(ERROR) << "Unable to hash bitcode data.";
     return err;
   }
 
+  // Only remember the ID if the file did not change while it was hashed.
+  FileStat after;
+  const bool unchanged =
+      !StatFile(file_path, &after.size, &after.mtime_ns, &after.inode,
+                &after.device) &&
+      after.size == before.size && after.mtime_ns == before.mtime_ns &&
+      after.inode == before.inode && after.device == before.device;
+
+  tbb::mutex::scoped_lock lock(file_stats_mutex_);
   registered_bitcode_files_[*out_bitcode_id] = uri;
+  if (unchanged) {
+    before.bitcode_id = *out_bitcode_id;
+    file_stats_[file_path] = before;
+  }
 
   return grpc::Status::OK;
 }
 
 grpc::Status BitcodeServiceImpl::GetBitcodeUriForHandle(const Handle &handle,
                                                         Uri *out_uri) const {
-  std::string ret;
-  Uri registered_uri;
-  if (registered_bitcode_files_.find(handle.id()) ==
-      registered_bitcode_files_.end()) {
+  tbb::mutex::scoped_lock lock(file_stats_mutex_);
+  auto uri_it = registered_bitcode_files_.find(handle.id());
+  if (uri_it == registered_bitcode_files_.end()) {
     const std::string &err_msg = "Handle not registered.";
     LOG(ERROR) << err_msg;
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
 
-  *out_uri = registered_bitcode_files_.at(handle.id());
+  *out_uri = uri_it->second;
 
   return grpc::Status::OK;
 }
 
+grpc::Status BitcodeServiceImpl::GetModuleForHandle(
+    const Handle &handle, std::shared_ptr<ParsedModule> *out_module) {
+  Uri bitcode_uri;
+  grpc::Status err = GetBitcodeUriForHandle(handle, &bitcode_uri);
+  if (!err.ok()) {
+    return err;
+  }
+
+  return module_cache_.GetOrParse(handle.id(), bitcode_uri, out_module);
+}
+
+ModuleCacheStats BitcodeServiceImpl::GetModuleCacheStats() const {
+  return module_cache_.GetStats();
+}
+
 grpc::Status BitcodeServiceImpl::Annotate(grpc::ServerContext *context,
                                           const AnnotateRequest *request,
                                           AnnotateResponse *response) {
@@ -338,28 +369,19 @@ grpc::Status BitcodeServiceImpl::Annotate(grpc::ServerContext *context,
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
 
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
-
-  // Parse IR into an llvm Module.
-  llvm::SMDiagnostic llvm_err;
-  llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), llvm_err, llvm_context));
-  if (!module) {
-    const std::string err_msg = "Unable to read bitcode file.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+  // The annotate pass modifies the module, so it gets its own copy rather
+  // than the one shared through the module cache.
+  std::unique_ptr<ParsedModule> parsed_module;
+  err = ParseModuleFromUri(bitcode_uri, &parsed_module);
+  if (!err.ok()) {
+    return err;
   }
+  llvm::Module &module = *parsed_module->module;
 
   AnnotatePass *annotate_pass = new AnnotatePass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(annotate_pass);
-  pass_manager.run(*module);
+  pass_manager.run(module);
 
   // Write out the annotated bitcode file to disk. Only writing to
   // local disk is supported currently.
@@ -374,7 +396,7 @@ grpc::Status BitcodeServiceImpl::Annotate(grpc::ServerContext *context,
     return grpc::Status(grpc::StatusCode::DATA_LOSS,
                         "Unable to write annotated bitcode file.");
   }
-  llvm::WriteBitcodeToFile(*module, ostream);
+  llvm::WriteBitcodeToFile(module, ostream);
   ostream.flush();
 
   std::string annotated_bitcode_id;
@@ -397,17 +419,28 @@ grpc::Status BitcodeServiceImpl::GetDefinedFunctions(
   // Return the name of the operation so client can check on progress.
   std::string task_name =
       GetTaskName("GetDefinedFunctions", request->bitcode_id().id());
+  const std::string result_key = ResultCache::MakeKey(
+      "GetDefinedFunctions", request->bitcode_id().id(), *request);
+  if (operations_service.FinishFromResultCache(task_name, result_key,
+                                               operation)) {
+    return grpc::Status::OK;
+  }
   operation->set_name(task_name);
   operation->set_done(0);
   operations_service.UpdateOperation(task_name, *operation);
 
-  GetDefinedFunctionsTask *task =
-      new (tbb::task::allocate_root()) GetDefinedFunctionsTask();
+  auto task = std::make_shared<GetDefinedFunctionsTask>();
   task->bitcode_service = this;
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  task->result_key = result_key;
+  grpc::Status submit_status = executor.Submit(
+      OperationPriority::kHigh, [task] { task->Run(); });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name);
+    return submit_status;
+  }
   return grpc::Status::OK;
 }
 
@@ -423,13 +456,17 @@ grpc::Status BitcodeServiceImpl::GetCalledFunctions(
   operation->set_done(0);
   operations_service.UpdateOperation(task_name, *operation);
 
-  GetCalledFunctionsTask *task =
-      new (tbb::task::allocate_root()) GetCalledFunctionsTask();
+  auto task = std::make_shared<GetCalledFunctionsTask>();
   task->bitcode_service = this;
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  grpc::Status submit_status = executor.Submit(
+      OperationPriority::kNormal, [task] { task->Run(); });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name);
+    return submit_status;
+  }
 
   return grpc::Status::OK;
 }
@@ -445,13 +482,17 @@ grpc::Status BitcodeServiceImpl::GetLocalCalledFunctions(
   operation->set_done(0);
   operations_service.UpdateOperation(task_name, *operation);
 
-  GetLocalCalledFunctionsTask *task =
-      new (tbb::task::allocate_root()) GetLocalCalledFunctionsTask();
+  auto task = std::make_shared<GetLocalCalledFunctionsTask>();
   task->bitcode_service = this;
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  grpc::Status submit_status = executor.Submit(
+      OperationPriority::kNormal, [task] { task->Run(); });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name);
+    return submit_status;
+  }
 
   return grpc::Status::OK;
 }
@@ -467,58 +508,140 @@ grpc::Status BitcodeServiceImpl::GetFileCalledFunctions(
   operation->set_done(0);
   operations_service.UpdateOperation(task_name, *operation);
 
-  GetFileCalledFunctionsTask *task =
-      new (tbb::task::allocate_root()) GetFileCalledFunctionsTask();
+  auto task = std::make_shared<GetFileCalledFunctionsTask>();
   task->bitcode_service = this;
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  grpc::Status submit_status = executor.Submit(
+      OperationPriority::kNormal, [task] { task->Run(); });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name);
+    return submit_status;
+  }
 
   return grpc::Status::OK;
 }
 
+// The chunks of a bitcode file, serialized straight out of its (mapped)
+// buffer.
+class BitcodeChunkStream final : public ServerStream<DataChunk> {
+ public:
+  explicit BitcodeChunkStream(std::unique_ptr<llvm::MemoryBuffer> buffer)
+      : buffer_(std::move(buffer)) {}
+
+  bool Next(DataChunk *chunk, grpc::Status *status) override {
+    if (sent_last_) {
+      *status = grpc::Status::OK;
+      return false;
+    }
+    // An empty file is still sent as one empty chunk.
+    const size_t total_size = buffer_->getBufferSize();
+    if (offset_ == 0) {
+      chunk->set_total_size(total_size);
+    }
+    const size_t chunk_size =
+        std::min(total_size - offset_, static_cast<size_t>(kChunkSize));
+    chunk->set_content(buffer_->getBufferStart() + offset_, chunk_size);
+    offset_ += chunk_size;
+    sent_last_ = offset_ == total_size;
+    return true;
+  }
+
+ private:
+  const std::unique_ptr<llvm::MemoryBuffer> buffer_;
+  size_t offset_ = 0;
+  bool sent_last_ = false;
+};
+
 grpc::Status BitcodeServiceImpl::DownloadBitcode(
     grpc::ServerContext *context, const DownloadBitcodeRequest *request,
     grpc::ServerWriter<DataChunk> *writer) {
+  std::unique_ptr<ServerStream<DataChunk>> stream;
+  grpc::Status open_status = OpenDownloadBitcode(context, request, &stream);
+  if (!open_status.ok()) {
+    return open_status;
+  }
+
+  return WriteServerStream(stream.get(), writer);
+}
+
+grpc::Status BitcodeServiceImpl::OpenDownloadBitcode(
+    grpc::ServerContext *context, const DownloadBitcodeRequest *request,
+    std::unique_ptr<ServerStream<DataChunk>> *out_stream) {
   LOG(INFO) << "DownloadBitcode-" << std::string(request->bitcode_id().id());
 
-  Handle request_handle = request->bitcode_id();
-  Uri uri = registered_bitcode_files_.at(request_handle.id());
+  Uri uri;
+  grpc::Status err = GetBitcodeUriForHandle(request->bitcode_id(), &uri);
+  if (!err.ok()) {
+    return err;
+  }
 
-  std::vector<char> bitcode_bytes;
-  std::string bitcode_data_str;
-  grpc::Status read_status = ReadUriIntoString(uri, bitcode_data_str);
+  std::unique_ptr<llvm::MemoryBuffer> bitcode_buffer;
+  grpc::Status read_status = ReadUriIntoBuffer(uri, &bitcode_buffer);
   if (!read_status.ok()) {
     return read_status;
   }
-  bitcode_bytes =
-      std::vector<char>(bitcode_data_str.begin(), bitcode_data_str.end());
-
-  auto chunk_begin = bitcode_bytes.begin();
-  auto chunk_end = bitcode_bytes.begin();
-  auto bytes_end = bitcode_bytes.end();
-  do {
-    if (std::distance(chunk_end, bytes_end) < kChunkSize) {
-      chunk_end = bytes_end;
-    } else {
-      std::advance(chunk_end, kChunkSize);
-    }
-    DataChunk chunk;
-    std::vector<char> chunk_bytes(chunk_begin, chunk_end);
-    chunk.set_content(&chunk_bytes[0], chunk_bytes.size());
-    writer->Write(chunk);
-    chunk_begin = chunk_end;
-  } while (std::distance(chunk_end, bytes_end) > 0);
+  *out_stream =
+      std::make_unique<BitcodeChunkStream>(std::move(bitcode_buffer));
 
   return grpc::Status::OK;
 }
 
-void RunBitcodeServer(std::string server_address) {
-  BitcodeServiceImpl service;
+void BitcodeServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<BitcodeService::AsyncService>();
+  // Registering hashes the file and annotating writes one, so neither may
+  // hold up a polling thread. The operation RPCs may read a memoized result
+  // from disk.
+  server->AddUnary(async_service,
+                   &BitcodeService::AsyncService::RequestRegisterBitcode, this,
+                   &BitcodeService::Service::RegisterBitcode,
+                   /*blocking=*/true);
+  server->AddUnary(async_service,
+                   &BitcodeService::AsyncService::RequestAnnotate, this,
+                   &BitcodeService::Service::Annotate, /*blocking=*/true);
+  server->AddUnary(async_service,
+                   &BitcodeService::AsyncService::RequestGetDefinedFunctions,
+                   this, &BitcodeService::Service::GetDefinedFunctions,
+                   /*blocking=*/true);
+  server->AddUnary(async_service,
+                   &BitcodeService::AsyncService::RequestGetCalledFunctions,
+                   this, &BitcodeService::Service::GetCalledFunctions);
+  server->AddUnary(
+      async_service,
+      &BitcodeService::AsyncService::RequestGetLocalCalledFunctions, this,
+      &BitcodeService::Service::GetLocalCalledFunctions);
+  server->AddUnary(
+      async_service,
+      &BitcodeService::AsyncService::RequestGetFileCalledFunctions, this,
+      &BitcodeService::Service::GetFileCalledFunctions);
+  server->AddServerStreaming(
+      async_service, &BitcodeService::AsyncService::RequestDownloadBitcode,
+      this, &BitcodeServiceImpl::OpenDownloadBitcode);
+  operations_service.AddToAsyncServer(server);
+}
+
+void RunBitcodeServer(std::string server_address, uint64_t module_cache_bytes,
+                      uint64_t tree_hash_min_bytes,
+                      const ResultCacheOptions &result_cache_options,
+                      const OperationExecutorOptions &executor_options,
+                      const AsyncServerOptions &async_server_options) {
+  BitcodeServiceImpl service(module_cache_bytes, tree_hash_min_bytes,
+                             result_cache_options, executor_options);
+  if (async_server_options.enabled) {
+    AsyncServer server(async_server_options);
+    service.AddToAsyncServer(&server);
+    if (server.Start(server_address).ok()) {
+      server.Wait();
+    }
+    return;
+  }
+
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder);
   // Register "service" as the instance through which we'll communicate with
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
@@ -6,15 +6,84 @@
 #include "absl/flags/parse.h"
 #include "glog/logging.h"
 
+#include "metrics_server.h"
 #include "servers.h"
 
 ABSL_FLAG(std::string, listen, "localhost:50051", "The address to listen on.");
+ABSL_FLAG(uint64_t, module_cache_bytes,
+          error_specifications::kDefaultModuleCacheBytes,
+          "Size of bitcode, in bytes, to keep parsed in memory.");
+ABSL_FLAG(uint64_t, tree_hash_min_bytes, 0,
+          "Hash local bitcode files of at least this many bytes in parallel "
+          "blocks. Such files get a different bitcode ID. 0 disables it.");
+ABSL_FLAG(uint64_t, result_cache_bytes,
+          error_specifications::kDefaultResultCacheMemoryBytes,
+          "Size of finished operation results, in bytes, to keep in memory "
+          "for identical requests. 0 disables it.");
+ABSL_FLAG(std::string, result_cache_dir, "",
+          "Directory in which to keep finished operation results across "
+          "restarts. Results are only kept in memory if empty.");
+ABSL_FLAG(uint64_t, result_cache_disk_bytes,
+          error_specifications::kDefaultResultCacheDiskBytes,
+          "Size of finished operation results, in bytes, to keep in "
+          "--result_cache_dir.");
+ABSL_FLAG(int, max_concurrent_operations,
+          error_specifications::kDefaultMaxConcurrentOperations,
+          "Number of long-running operations to run at the same time.");
+ABSL_FLAG(int, max_queued_operations,
+          error_specifications::kDefaultMaxQueuedOperations,
+          "Number of operations that may wait to run. Further requests fail "
+          "with RESOURCE_EXHAUSTED.");
+ABSL_FLAG(bool, async_server, false,
+          "Serve from completion queues polled by a few threads instead of "
+          "one thread per call.");
+ABSL_FLAG(int, async_polling_threads,
+          error_specifications::kDefaultAsyncPollingThreads,
+          "Number of threads polling for calls with --async_server.");
+ABSL_FLAG(int, async_worker_threads,
+          error_specifications::kDefaultAsyncWorkerThreads,
+          "Number of threads serving streaming and blocking calls with "
+          "--async_server.");
+ABSL_FLAG(int, async_max_queued_calls,
+          error_specifications::kDefaultAsyncMaxQueuedCalls,
+          "Number of streaming and blocking calls that may wait for a worker "
+          "thread with --async_server. Further calls fail with "
+          "RESOURCE_EXHAUSTED.");
+ABSL_FLAG(std::string, metrics_listen, "",
+          "The address to serve metrics on, in the Prometheus text format at "
+          "/metrics. Disabled if empty.");
 
 int main(int argc, char **argv) {
   google::InitGoogleLogging("bitcode-service");
   absl::ParseCommandLine(argc, argv);
   std::string listen_address = absl::GetFlag(FLAGS_listen);
-  error_specifications::RunBitcodeServer(listen_address);
+  error_specifications::ResultCacheOptions result_cache_options;
+  result_cache_options.memory_bytes = absl::GetFlag(FLAGS_result_cache_bytes);
+  result_cache_options.directory = absl::GetFlag(FLAGS_result_cache_dir);
+  result_cache_options.disk_bytes =
+      absl::GetFlag(FLAGS_result_cache_disk_bytes);
+  error_specifications::OperationExecutorOptions executor_options;
+  executor_options.max_concurrent_operations =
+      absl::GetFlag(FLAGS_max_concurrent_operations);
+  executor_options.max_queued_operations =
+      absl::GetFlag(FLAGS_max_queued_operations);
+  error_specifications::AsyncServerOptions async_server_options;
+  async_server_options.enabled = absl::GetFlag(FLAGS_async_server);
+  async_server_options.polling_threads =
+      absl::GetFlag(FLAGS_async_polling_threads);
+  async_server_options.worker_threads =
+      absl::GetFlag(FLAGS_async_worker_threads);
+  async_server_options.max_queued_calls =
+      absl::GetFlag(FLAGS_async_max_queued_calls);
+  error_specifications::MetricsEndpoint metrics_endpoint;
+  const std::string metrics_address = absl::GetFlag(FLAGS_metrics_listen);
+  if (!metrics_address.empty()) {
+    metrics_endpoint.Start(metrics_address);
+  }
+  error_specifications::RunBitcodeServer(
+      listen_address, absl::GetFlag(FLAGS_module_cache_bytes),
+      absl::GetFlag(FLAGS_tree_hash_min_bytes), result_cache_options,
+      executor_options, async_server_options);
   google::FlushLogFiles(google::INFO);
 
   return 0;
@@ -0,0 +1,131 @@
+#include "module_cache.h"
+
+#include <string>
+
+#include "glog/logging.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include "llvm.h"
+#include "servers.h"
+
+namespace error_specifications {
+
+grpc::Status ParseModuleFromUri(const Uri &uri,
+                                std::unique_ptr<ParsedModule> *out_module) {
+  // Local files are mapped rather than copied.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  grpc::Status read_status = ReadUriIntoBuffer(uri, &buffer);
+  if (!read_status.ok()) {
+    const std::string &err_msg = "Unable to read bitcode file.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+  }
+
+  // Parse IR into an llvm Module.
+  std::unique_ptr<ParsedModule> parsed_module(new ParsedModule());
+  parsed_module->context.reset(new llvm::LLVMContext());
+  llvm::SMDiagnostic llvm_err;
+  parsed_module->module = llvm::parseIR(buffer->getMemBufferRef(), llvm_err,
+                                        *parsed_module->context);
+  if (!parsed_module->module) {
+    llvm_err.print("server", llvm::errs());
+    const std::string &err_msg = "Unable to read bitcode file.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+  }
+  parsed_module->size_bytes = buffer->getBufferSize();
+  RecordParsedModuleMetrics(*parsed_module->module, parsed_module->size_bytes);
+
+  *out_module = std::move(parsed_module);
+
+  return grpc::Status::OK;
+}
+
+grpc::Status ModuleCache::GetOrParse(
+    const std::string &bitcode_id, const Uri &uri,
+    std::shared_ptr<ParsedModule> *out_module) {
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    auto entry_it = entries_.find(bitcode_id);
+    if (entry_it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, entry_it->second.lru_position);
+      *out_module = entry_it->second.parsed_module;
+      hits_++;
+      return grpc::Status::OK;
+    }
+  }
+  misses_++;
+
+  // Parse without holding the lock so that other handles stay available.
+  std::unique_ptr<ParsedModule> parsed_module;
+  grpc::Status parse_status = ParseModuleFromUri(uri, &parsed_module);
+  if (!parse_status.ok()) {
+    return parse_status;
+  }
+
+  tbb::mutex::scoped_lock lock(mutex_);
+
+  // Another task may have parsed the same handle in the meantime. Keep the
+  // cached copy so that all tasks share one module.
+  auto entry_it = entries_.find(bitcode_id);
+  if (entry_it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, entry_it->second.lru_position);
+    *out_module = entry_it->second.parsed_module;
+    return grpc::Status::OK;
+  }
+
+  Entry entry;
+  entry.parsed_module = std::move(parsed_module);
+  lru_.push_front(bitcode_id);
+  entry.lru_position = lru_.begin();
+  size_bytes_ += entry.parsed_module->size_bytes;
+  *out_module = entry.parsed_module;
+  entries_[bitcode_id] = std::move(entry);
+
+  EvictLocked();
+
+  return grpc::Status::OK;
+}
+
+void ModuleCache::Erase(const std::string &bitcode_id) {
+  tbb::mutex::scoped_lock lock(mutex_);
+  auto entry_it = entries_.find(bitcode_id);
+  if (entry_it == entries_.end()) {
+    return;
+  }
+  size_bytes_ -= entry_it->second.parsed_module->size_bytes;
+  lru_.erase(entry_it->second.lru_position);
+  entries_.erase(entry_it);
+}
+
+void ModuleCache::EvictLocked() {
+  // Always keep the most recently used module, even if it alone is larger
+  // than the budget; the task that asked for it is about to use it.
+  while (size_bytes_ > max_bytes_ && lru_.size() > 1) {
+    const std::string &bitcode_id = lru_.back();
+    auto entry_it = entries_.find(bitcode_id);
+    LOG(INFO) << "Evicting parsed module " << bitcode_id;
+    // Tasks still holding the module keep it alive until they finish.
+    size_bytes_ -= entry_it->second.parsed_module->size_bytes;
+    entries_.erase(entry_it);
+    lru_.pop_back();
+    evictions_++;
+  }
+}
+
+ModuleCacheStats ModuleCache::GetStats() const {
+  ModuleCacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = evictions_;
+
+  tbb::mutex::scoped_lock lock(mutex_);
+  stats.entries = entries_.size();
+  stats.size_bytes = size_bytes_;
+
+  return stats;
+}
+
+}  // namespace error_specifications
@@ -4,18 +4,26 @@
 #include "bitcode/include/bitcode_server.h"
 
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <numeric>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "include/grpcpp/grpcpp.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "async_server.h"
 #include "llvm.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "servers.h"
@@ -135,6 +143,42 @@ TEST_F(BitcodeServiceTest, DefinedFunctionsBadHandle) {
   ASSERT_EQ(operation.error().code(), grpc::INVALID_ARGUMENT);
 }
 
+// Test that watching an operation streams it until it is done.
+TEST_F(BitcodeServiceTest, WatchDefinedFunctionsBadHandle) {
+  DefinedFunctionsRequest req;
+  Operation operation;
+  grpc::ClientContext context;
+  Handle *bitcode_handle = req.mutable_bitcode_id();
+  bitcode_handle->set_id("42");
+
+  grpc::Status status = stub_->GetDefinedFunctions(&context, req, &operation);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+
+  grpc::ClientContext watch_context;
+  watch_context.set_deadline(std::chrono::system_clock::now() +
+                             std::chrono::seconds(30));
+  WatchOperationRequest watch_req;
+  watch_req.set_name(operation.name());
+  std::unique_ptr<grpc::ClientReader<Operation>> reader(
+      operations_stub_->WatchOperation(&watch_context, watch_req));
+  while (reader->Read(&operation)) {
+    ASSERT_EQ(operation.name(), watch_req.name());
+  }
+  status = reader->Finish();
+  ASSERT_EQ(status.error_code(), grpc::OK);
+
+  ASSERT_TRUE(operation.done());
+  ASSERT_EQ(operation.error().code(), grpc::INVALID_ARGUMENT);
+
+  // Finished operations are not kept around.
+  grpc::ClientContext get_operation_context;
+  GetOperationRequest get_operation_req;
+  get_operation_req.set_name(operation.name());
+  status = operations_stub_->GetOperation(&get_operation_context,
+                                          get_operation_req, &operation);
+  ASSERT_EQ(status.error_code(), grpc::INVALID_ARGUMENT);
+}
+
 // Test that invalid handles are rejected.
 TEST_F(BitcodeServiceTest, CalledFunctionsBadHandle) {
   CalledFunctionsRequest req;
@@ -437,13 +481,20 @@ TEST_F(BitcodeServiceTest, DownloadBitcode) {
   std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
       stub_->DownloadBitcode(&download_context, download_req));
   std::vector<std::string> chunks;
+  uint64_t total_size = 0;
   DataChunk chunk;
   while (reader->Read(&chunk)) {
+    if (chunks.empty()) {
+      total_size = chunk.total_size();
+    }
     chunks.push_back(chunk.content());
   }
   std::string bitcode_bytes =
       std::accumulate(chunks.begin(), chunks.end(), std::string(""));
 
+  // The first chunk announces the size of the whole file.
+  ASSERT_EQ(total_size, bitcode_bytes.size());
+
   // Initialize an LLVM MemoryBuffer.
   static std::unique_ptr<llvm::MemoryBuffer> buffer =
       llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
@@ -492,4 +543,298 @@ TEST_F(BitcodeServiceTest, HashBitcodeIdReg2mem) {
             "931a2c9dd167f8db8b7d23bdeb1a5f5121025f2c2c6a2c351767bf42e68e8216");
 }
 
+// Test that registering an unchanged file again returns the same ID.
+TEST_F(BitcodeServiceTest, ReregisterUnchanged) {
+  const Uri &file_uri = FilePathToUri("testdata/programs/hello.ll");
+  std::string bitcode_ids[2];
+  for (std::string &bitcode_id : bitcode_ids) {
+    grpc::ClientContext register_context;
+    RegisterBitcodeResponse register_res;
+    RegisterBitcodeRequest register_req;
+    register_req.mutable_uri()->CopyFrom(file_uri);
+
+    grpc::Status status =
+        stub_->RegisterBitcode(&register_context, register_req, &register_res);
+    ASSERT_EQ(status.error_code(), grpc::OK);
+    bitcode_id = register_res.bitcode_id().id();
+  }
+  ASSERT_EQ(bitcode_ids[0], bitcode_ids[1]);
+}
+
+// Test that a repeated DefinedFunctions request is answered from the result
+// cache until the results for its bitcode are invalidated.
+TEST_F(BitcodeServiceTest, DefinedFunctionsMemoized) {
+  RegisterBitcodeRequest register_req;
+  RegisterBitcodeResponse register_res;
+  grpc::ClientContext register_context;
+  register_req.mutable_uri()->CopyFrom(
+      FilePathToUri("testdata/programs/foo_calls_bar.ll"));
+  grpc::Status status =
+      stub_->RegisterBitcode(&register_context, register_req, &register_res);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+
+  DefinedFunctionsRequest defined_req;
+  defined_req.mutable_bitcode_id()->CopyFrom(register_res.bitcode_id());
+
+  // Run the request once and wait until it is finished.
+  Operation operation;
+  grpc::ClientContext defined_context;
+  status =
+      stub_->GetDefinedFunctions(&defined_context, defined_req, &operation);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+  int number_of_tries = 0;
+  while (!operation.done()) {
+    grpc::ClientContext get_operation_context;
+    GetOperationRequest get_operation_req;
+    get_operation_req.set_name(operation.name());
+    status = operations_stub_->GetOperation(&get_operation_context,
+                                            get_operation_req, &operation);
+    ASSERT_EQ(status.error_code(), grpc::OK);
+    ASSERT_LE(number_of_tries, 10);
+    number_of_tries++;
+    usleep(1000 * 1000);
+  }
+  DefinedFunctionsResponse first_res;
+  ASSERT_TRUE(operation.response().UnpackTo(&first_res));
+
+  // The same request is finished as soon as it is made.
+  Operation memoized_operation;
+  grpc::ClientContext memoized_context;
+  status = stub_->GetDefinedFunctions(&memoized_context, defined_req,
+                                      &memoized_operation);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+  ASSERT_TRUE(memoized_operation.done());
+  DefinedFunctionsResponse memoized_res;
+  ASSERT_TRUE(memoized_operation.response().UnpackTo(&memoized_res));
+  EXPECT_EQ(memoized_res.SerializeAsString(), first_res.SerializeAsString());
+  EXPECT_EQ(service_.result_cache.GetStats().hits, 1);
+
+  // Clients can still fetch the memoized operation by name.
+  grpc::ClientContext get_operation_context;
+  GetOperationRequest get_operation_req;
+  get_operation_req.set_name(memoized_operation.name());
+  status = operations_stub_->GetOperation(&get_operation_context,
+                                          get_operation_req, &operation);
+  EXPECT_EQ(status.error_code(), grpc::OK);
+  EXPECT_TRUE(operation.done());
+
+  // After invalidation the request starts a new task.
+  InvalidateResultsRequest invalidate_req;
+  InvalidateResultsResponse invalidate_res;
+  grpc::ClientContext invalidate_context;
+  invalidate_req.mutable_bitcode_id()->CopyFrom(register_res.bitcode_id());
+  status = operations_stub_->InvalidateResults(
+      &invalidate_context, invalidate_req, &invalidate_res);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+  EXPECT_EQ(invalidate_res.results_removed(), 1);
+
+  grpc::ClientContext recomputed_context;
+  status = stub_->GetDefinedFunctions(&recomputed_context, defined_req,
+                                      &operation);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+  EXPECT_FALSE(operation.done());
+  EXPECT_EQ(service_.result_cache.GetStats().misses, 2);
+
+  // Let the task finish before the service is shut down.
+  number_of_tries = 0;
+  while (!operation.done()) {
+    grpc::ClientContext get_operation_context;
+    GetOperationRequest get_operation_req;
+    get_operation_req.set_name(operation.name());
+    status = operations_stub_->GetOperation(&get_operation_context,
+                                            get_operation_req, &operation);
+    ASSERT_EQ(status.error_code(), grpc::OK);
+    ASSERT_LE(number_of_tries, 10);
+    number_of_tries++;
+    usleep(1000 * 1000);
+  }
+}
+
+// Test that the asynchronous server serves unary and streaming calls with
+// the same implementations as the synchronous one.
+TEST(AsyncBitcodeServiceTest, RegisterDownloadAndWatch) {
+  constexpr char kTestAsyncServerAddress[] = "localhost:60052";
+  BitcodeServiceImpl service;
+  AsyncServerOptions async_server_options;
+  async_server_options.enabled = true;
+  async_server_options.worker_threads = 1;
+  AsyncServer server(async_server_options);
+  service.AddToAsyncServer(&server);
+  ASSERT_TRUE(server.Start(kTestAsyncServerAddress).ok());
+  std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(
+      kTestAsyncServerAddress, grpc::InsecureChannelCredentials());
+  std::unique_ptr<BitcodeService::Stub> stub = BitcodeService::NewStub(channel);
+  std::unique_ptr<OperationsService::Stub> operations_stub =
+      OperationsService::NewStub(channel);
+
+  RegisterBitcodeRequest register_req;
+  RegisterBitcodeResponse register_res;
+  grpc::ClientContext register_context;
+  const Uri file_uri = FilePathToUri("testdata/programs/hello.ll");
+  register_req.mutable_uri()->CopyFrom(file_uri);
+  grpc::Status status =
+      stub->RegisterBitcode(&register_context, register_req, &register_res);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+
+  // The downloaded chunks add up to the registered file.
+  grpc::ClientContext download_context;
+  DownloadBitcodeRequest download_req;
+  download_req.mutable_bitcode_id()->CopyFrom(register_res.bitcode_id());
+  std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
+      stub->DownloadBitcode(&download_context, download_req));
+  std::string bitcode_bytes;
+  DataChunk chunk;
+  while (reader->Read(&chunk)) {
+    bitcode_bytes += chunk.content();
+  }
+  ASSERT_EQ(reader->Finish().error_code(), grpc::OK);
+  std::string file_contents;
+  ASSERT_TRUE(ReadUriIntoString(file_uri, file_contents).ok());
+  EXPECT_EQ(bitcode_bytes, file_contents);
+
+  // Watching an operation streams it until it is done.
+  DefinedFunctionsRequest defined_req;
+  defined_req.mutable_bitcode_id()->CopyFrom(register_res.bitcode_id());
+  Operation operation;
+  grpc::ClientContext defined_context;
+  status = stub->GetDefinedFunctions(&defined_context, defined_req, &operation);
+  ASSERT_EQ(status.error_code(), grpc::OK);
+  WatchOperationRequest watch_req;
+  watch_req.set_name(operation.name());
+  grpc::ClientContext watch_context;
+  std::unique_ptr<grpc::ClientReader<Operation>> watch_reader(
+      operations_stub->WatchOperation(&watch_context, watch_req));
+  while (watch_reader->Read(&operation)) {
+  }
+  ASSERT_EQ(watch_reader->Finish().error_code(), grpc::OK);
+  EXPECT_TRUE(operation.done());
+  EXPECT_FALSE(operation.has_error());
+
+  server.Shutdown();
+}
+
+// Test that downloads whose clients stop reading do not hold the worker
+// threads that blocking calls need, and that every download still ends
+// with the whole file.
+TEST(AsyncBitcodeServiceTest, DownloadsDoNotHoldWorkers) {
+  constexpr char kTestAsyncServerAddress[] = "localhost:60053";
+  constexpr std::chrono::seconds kCallDeadline(10);
+  constexpr int kDownloads = 8;
+  BitcodeServiceImpl service;
+  AsyncServerOptions async_server_options;
+  async_server_options.enabled = true;
+  async_server_options.worker_threads = 1;
+  AsyncServer server(async_server_options);
+  service.AddToAsyncServer(&server);
+  ASSERT_TRUE(server.Start(kTestAsyncServerAddress).ok());
+  std::unique_ptr<BitcodeService::Stub> stub =
+      BitcodeService::NewStub(grpc::CreateChannel(
+          kTestAsyncServerAddress, grpc::InsecureChannelCredentials()));
+
+  // The file is many chunks long, more than flow control lets the server
+  // write ahead of a client that does not read.
+  llvm::SmallString<128> file_path;
+  ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("download", "bc", file_path));
+  const std::string file_contents(32 * kChunkSize, 'x');
+  {
+    std::error_code error_code;
+    llvm::raw_fd_ostream file(file_path, error_code);
+    ASSERT_FALSE(error_code);
+    file << file_contents;
+  }
+  RegisterBitcodeRequest register_req;
+  RegisterBitcodeResponse register_res;
+  grpc::ClientContext register_context;
+  register_req.mutable_uri()->CopyFrom(FilePathToUri(file_path.str().str()));
+  ASSERT_TRUE(
+      stub->RegisterBitcode(&register_context, register_req, &register_res)
+          .ok());
+
+  std::atomic<int> started(0);
+  std::atomic<int> finished(0);
+  std::atomic<bool> resume(false);
+  std::vector<std::thread> downloads;
+  for (int i = 0; i < kDownloads; i++) {
+    downloads.emplace_back([&] {
+      DownloadBitcodeRequest download_req;
+      download_req.mutable_bitcode_id()->CopyFrom(register_res.bitcode_id());
+      grpc::ClientContext context;
+      context.set_deadline(std::chrono::system_clock::now() +
+                           2 * kCallDeadline);
+      std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
+          stub->DownloadBitcode(&context, download_req));
+      DataChunk chunk;
+      size_t size = 0;
+      if (reader->Read(&chunk)) {
+        size += chunk.content().size();
+      }
+      started++;
+      while (!resume) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      while (reader->Read(&chunk)) {
+        size += chunk.content().size();
+      }
+      if (reader->Finish().ok() && size == file_contents.size()) {
+        finished++;
+      }
+    });
+  }
+  const auto deadline = std::chrono::steady_clock::now() + kCallDeadline;
+  while (started < kDownloads && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(started, kDownloads);
+
+  // RegisterBitcode needs the only worker thread.
+  RegisterBitcodeResponse reregister_res;
+  grpc::ClientContext reregister_context;
+  reregister_context.set_deadline(std::chrono::system_clock::now() +
+                                  kCallDeadline);
+  EXPECT_TRUE(
+      stub->RegisterBitcode(&reregister_context, register_req, &reregister_res)
+          .ok());
+
+  resume = true;
+  for (std::thread &download : downloads) {
+    download.join();
+  }
+  EXPECT_EQ(finished, kDownloads);
+
+  server.Shutdown();
+  llvm::sys::fs::remove(file_path);
+}
+
+// Test that hashing a file in blocks matches hashing its contents at once.
+TEST(HashTest, HashFileMatchesHashString) {
+  std::string contents;
+  ASSERT_TRUE(ReadUriIntoString(FilePathToUri("testdata/programs/hello.ll"),
+                                contents)
+                  .ok());
+
+  std::string string_hash;
+  std::string file_hash;
+  ASSERT_TRUE(HashString(contents, string_hash).ok());
+  ASSERT_TRUE(HashFile("testdata/programs/hello.ll", file_hash).ok());
+  ASSERT_EQ(string_hash, file_hash);
+}
+
+// Test that tree hashes are prefixed and independent of thread scheduling.
+TEST(HashTest, TreeHashBytes) {
+  const std::string data(kTreeHashBlockSize * 2 + 1, 'x');
+
+  std::string first_hash;
+  std::string second_hash;
+  ASSERT_TRUE(TreeHashBytes(data.data(), data.size(), first_hash).ok());
+  ASSERT_TRUE(TreeHashBytes(data.data(), data.size(), second_hash).ok());
+  ASSERT_EQ(first_hash, second_hash);
+  ASSERT_EQ(first_hash.compare(0, strlen(kTreeHashPrefix), kTreeHashPrefix),
+            0);
+
+  std::string matching_hash;
+  ASSERT_TRUE(
+      HashBytesLike(first_hash, data.data(), data.size(), matching_hash).ok());
+  ASSERT_EQ(first_hash, matching_hash);
+}
+
 }  // namespace error_specifications
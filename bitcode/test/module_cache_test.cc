@@ -0,0 +1,63 @@
+#include "module_cache.h"
+
+#include "gtest/gtest.h"
+
+#include "servers.h"
+
+namespace error_specifications {
+
+// Tests that a second lookup of the same handle reuses the parsed module.
+TEST(ModuleCacheTest, HitAfterMiss) {
+  ModuleCache module_cache;
+  const Uri uri = FilePathToUri("testdata/programs/hello.ll");
+
+  std::shared_ptr<ParsedModule> first;
+  ASSERT_TRUE(module_cache.GetOrParse("hello", uri, &first).ok());
+  std::shared_ptr<ParsedModule> second;
+  ASSERT_TRUE(module_cache.GetOrParse("hello", uri, &second).ok());
+
+  EXPECT_EQ(first.get(), second.get());
+  ModuleCacheStats stats = module_cache.GetStats();
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.evictions, 0);
+  EXPECT_EQ(stats.entries, 1);
+}
+
+// Tests that the least recently used module is evicted once the byte budget
+// is exceeded, and that evicted modules stay valid for their holders.
+TEST(ModuleCacheTest, EvictLeastRecentlyUsed) {
+  ModuleCache module_cache(/*max_bytes=*/1);
+  const Uri hello_uri = FilePathToUri("testdata/programs/hello.ll");
+  const Uri foo_uri = FilePathToUri("testdata/programs/foo_calls_bar.ll");
+
+  std::shared_ptr<ParsedModule> hello;
+  ASSERT_TRUE(module_cache.GetOrParse("hello", hello_uri, &hello).ok());
+  std::shared_ptr<ParsedModule> foo;
+  ASSERT_TRUE(module_cache.GetOrParse("foo", foo_uri, &foo).ok());
+
+  ModuleCacheStats stats = module_cache.GetStats();
+  EXPECT_EQ(stats.evictions, 1);
+  EXPECT_EQ(stats.entries, 1);
+  EXPECT_NE(hello->module->getFunction("main"), nullptr);
+
+  // The evicted module is parsed again.
+  std::shared_ptr<ParsedModule> hello_again;
+  ASSERT_TRUE(module_cache.GetOrParse("hello", hello_uri, &hello_again).ok());
+  EXPECT_NE(hello.get(), hello_again.get());
+  EXPECT_EQ(module_cache.GetStats().misses, 3);
+}
+
+// Tests that unreadable bitcode is reported and not cached.
+TEST(ModuleCacheTest, MissingFile) {
+  ModuleCache module_cache;
+  const Uri uri = FilePathToUri("thisfiledoesnotexistljfsdklsdfklsfjd");
+
+  std::shared_ptr<ParsedModule> parsed_module;
+  grpc::Status status = module_cache.GetOrParse("missing", uri, &parsed_module);
+
+  EXPECT_EQ(status.error_code(), grpc::DATA_LOSS);
+  EXPECT_EQ(module_cache.GetStats().entries, 0);
+}
+
+}  // namespace error_specifications
@@ -7,14 +7,34 @@
 #include <string>
 #include <unordered_map>
 
+#include "async_server.h"
+#include "bitcode_client.h"
+#include "executor.h"
+#include "fact_cache.h"
 #include "operations_service.h"
 #include "proto/checker.grpc.pb.h"
+#include "result_cache.h"
 
 namespace error_specifications {
 
 // Logic and data behind the server's behavior.
 class CheckerServiceImpl final : public CheckerService::Service {
  public:
+  explicit CheckerServiceImpl(
+      const std::string &bitcode_cache_directory = "",
+      const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+      const OperationExecutorOptions &executor_options =
+          OperationExecutorOptions(),
+      const std::string &trace_directory = "",
+      const std::string &fact_cache_directory = "")
+      : bitcode_cache_(bitcode_cache_directory),
+        result_cache_(result_cache_options),
+        fact_cache_(fact_cache_directory),
+        trace_directory_(trace_directory),
+        executor_(executor_options, "checker") {
+    operations_service_.SetResultCache(&result_cache_);
+  }
+
   // TBB can throw exceptions.
   ~CheckerServiceImpl() throw() {}
 
@@ -22,13 +42,45 @@ class CheckerServiceImpl final : public CheckerService::Service {
                              const GetViolationsRequest *request,
                              Operation *operation);
 
+  // Serves the CheckerService and operations RPCs on `server`, which must not
+  // outlive this service.
+  void AddToAsyncServer(AsyncServer *server);
+
   // The operations service is responsible for keeping track of the status
   // of running tasks.
   OperationsServiceImpl operations_service_;
+
+  // Local copies of bitcode previously downloaded from the bitcode service.
+  LocalBitcodeCache bitcode_cache_;
+
+  // Memoized results of finished GetViolations operations.
+  ResultCache result_cache_;
+
+  // Dataflow facts of previously analysed bitcode.
+  FactCache fact_cache_;
+
+  // Directory the performance traces of finished operations are written
+  // to. No traces are written if it is empty.
+  const std::string trace_directory_;
+
+  // Runs the GetViolations tasks. Declared last so that it is destroyed
+  // first, waiting for the tasks that still use the members above.
+  OperationExecutor executor_;
 };
 
-// Start the Checker service.
-void RunCheckerServer(const std::string &server_address);
+// Start the Checker service. Downloaded bitcode is cached in
+// `bitcode_cache_directory` and its dataflow facts in `fact_cache_directory`
+// unless they are empty. The performance traces of finished operations are
+// written to `trace_directory` unless it is empty.
+void RunCheckerServer(
+    const std::string &server_address,
+    const std::string &bitcode_cache_directory = "",
+    const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+    const OperationExecutorOptions &executor_options =
+        OperationExecutorOptions(),
+    const AsyncServerOptions &async_server_options = AsyncServerOptions(),
+    const std::string &trace_directory = "",
+    const std::string &fact_cache_directory = "");
 
 }  // namespace error_specifications
 
@@ -1,9 +1,12 @@
 #include "checker_server.h"
 
+#include <cstdint>
 #include <iostream>
-#include <numeric>
+#include <memory>
 #include <string>
 
+#include "bitcode_client.h"
+#include "dataflow_analyses.h"
 #include "glog/logging.h"
 #include "include/grpcpp/grpcpp.h"
 #include "insufficient_checks_pass.h"
@@ -12,58 +15,74 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "operation_progress.h"
+#include "progress.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "servers.h"
-#include "tbb/task.h"
 #include "unused_calls_pass.h"
 
 namespace error_specifications {
 
-class GetViolationsTask : public tbb::task {
+class GetViolationsTask {
  public:
   GetViolationsTask(ViolationType violation_type)
       : violation_type(violation_type){};
 
-  tbb::task *execute(void) {
+  // Fetches the bitcode and sets its size. Returns false if the operation
+  // is over.
+  bool Fetch(uint64_t *bitcode_bytes) {
     LOG(INFO) << task_name_;
     LOG(INFO) << "Downloading bitcode...";
 
-    Operation result;
-    result.set_name(task_name_);
+    // Every pass run by the pass manager can publish its progress.
+    progress_ = std::make_unique<OperationProgressReporter>(operations_service_,
+                                                            task_name_);
 
-    // Connect to the bitcode service.
-    std::shared_ptr<grpc::Channel> channel;
-    std::unique_ptr<BitcodeService::Stub> stub;
-    channel = grpc::CreateChannel(bitcode_server_address_,
-                                  grpc::InsecureChannelCredentials());
-    stub = BitcodeService::NewStub(channel);
-
-    grpc::ClientContext download_context;
-    DownloadBitcodeRequest download_req;
-    download_req.mutable_bitcode_id()->CopyFrom(request_.bitcode_id());
-    std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
-        stub->DownloadBitcode(&download_context, download_req));
-    std::vector<std::string> chunks;
-    DataChunk chunk;
-    while (reader->Read(&chunk)) {
-      chunks.push_back(chunk.content());
+    // Fetch the bitcode, from the local cache if possible, and parse it in
+    // place.
+    StepTimer download_timer(progress_.get(), StepTimer::Kind::kPhase,
+                             "download");
+    grpc::Status download_status = bitcode_cache_->GetBitcode(
+        bitcode_server_address_, request_.bitcode_id(), &buffer_);
+    download_timer.Stop();
+    if (!download_status.ok()) {
+      Operation result;
+      result.set_name(task_name_);
+      result.mutable_error()->set_code(download_status.error_code());
+      result.mutable_error()->set_message(download_status.error_message());
+      result.set_done(1);
+      operations_service_->UpdateOperation(task_name_, result);
+      LOG(ERROR) << "Unable to download bitcode.";
+      return false;
     }
 
-    std::string bitcode_bytes =
-        std::accumulate(chunks.begin(), chunks.end(), std::string(""));
+    admission_timer_ = std::make_unique<StepTimer>(
+        progress_.get(), StepTimer::Kind::kPhase, "admission");
+    *bitcode_bytes = buffer_->getBufferSize();
+    return true;
+  }
 
-    LOG(INFO) << "Parsing bitcode\n";
+  // Checks the fetched bitcode once the memory budget admitted it.
+  void Analyze(std::unique_ptr<MemoryReservation> memory_reservation) {
+    admission_timer_->Stop();
+    OperationProgressReporter &progress = *progress_;
 
-    // Initialize an LLVM MemoryBuffer.
-    std::unique_ptr<llvm::MemoryBuffer> buffer =
-        llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+    Operation result;
+    result.set_name(task_name_);
+
+    LOG(INFO) << "Parsing bitcode\n";
 
     // Parse IR into an llvm Module.
+    StepTimer parse_timer(&progress, StepTimer::Kind::kPhase, "parse");
     llvm::SMDiagnostic err;
     llvm::LLVMContext llvm_context;
     std::unique_ptr<llvm::Module> module(
-        llvm::parseIR(buffer->getMemBufferRef(), err, llvm_context));
+        llvm::parseIR(buffer_->getMemBufferRef(), err, llvm_context));
 
     if (!module) {
       const std::string &err_msg = "Unable to parse bitcode file.";
@@ -71,10 +90,25 @@ class GetViolationsTask : public tbb::task {
       result.mutable_error()->set_message(err_msg);
       operations_service_->UpdateOperation(task_name_, result);
       LOG(ERROR) << err_msg;
-      return NULL;
+      return;
     }
+    RecordParsedModuleMetrics(*module, buffer_->getBufferSize());
+    parse_timer.Stop();
+
+    // Caches the dataflow analyses that several passes share.
+    llvm::ModuleAnalysisManager analysis_manager;
+    RegisterDataflowAnalyses(&analysis_manager, nullptr, fact_cache_,
+                             request_.bitcode_id().id());
 
     llvm::legacy::PassManager pass_manager;
+    pass_manager.add(new ProgressReporterPass(&progress));
+    pass_manager.add(new AnalysisManagerPass(&analysis_manager));
+
+    // Grow the reservation by the facts of the passes.
+    StepTimer growth_timer(&progress, StepTimer::Kind::kPhase, "growth");
+    executor_->GetMemoryBudget()->Grow(memory_reservation.get(),
+                                       CountInstructions(*module), nullptr);
+    growth_timer.Stop();
 
     // Which LLVM pass is run is determined by the type of violation that
     // has been requested.
@@ -99,18 +133,35 @@ class GetViolationsTask : public tbb::task {
     result.set_done(1);
 
     // Packing into google.protobuf.Any
+    StepTimer pack_timer(&progress, StepTimer::Kind::kPhase, "pack");
     result.mutable_response()->PackFrom(get_violations_response);
+    pack_timer.Stop();
+    progress.FillMetadata(&result);
+    if (!trace_directory_.empty()) {
+      progress.WriteTrace(trace_directory_);
+    }
 
+    result_cache_->Insert(result_key_, result);
     operations_service_->UpdateOperation(task_name_, result);
-
-    return NULL;
   }
 
   std::string task_name_;
   std::string bitcode_server_address_;
   GetViolationsRequest request_;
   OperationsServiceImpl *operations_service_;
+  LocalBitcodeCache *bitcode_cache_;
+  ResultCache *result_cache_;
+  std::string result_key_;
+  FactCache *fact_cache_;
+  std::string trace_directory_;
+  OperationExecutor *executor_;
   ViolationType violation_type;
+
+ private:
+  // Kept from Fetch to Analyze.
+  std::unique_ptr<OperationProgressReporter> progress_;
+  std::unique_ptr<llvm::MemoryBuffer> buffer_;
+  std::unique_ptr<StepTimer> admission_timer_;
 };
 
 grpc::Status CheckerServiceImpl::GetViolations(
@@ -126,32 +177,89 @@ grpc::Status CheckerServiceImpl::GetViolations(
   }
 
   // Return the name of the operation so client can check on progress.
-  // Include violation_type as part of task name so that results
-  // for different violation types do not collide.
-  const std::string &task_name = "GetViolations-" +
-                                 std::to_string(request->violation_type()) +
-                                 "-" + request->bitcode_id().id();
+  // Include violation_type as part of task name so that operations for
+  // different violation types are told apart.
+  const std::string task_name = GetTaskName(
+      "GetViolations-" + std::to_string(request->violation_type()),
+      request->bitcode_id().id());
+  const std::string result_key = ResultCache::MakeKey(
+      "GetViolations", request->bitcode_id().id(), *request);
+  if (operations_service_.FinishFromResultCache(task_name, result_key,
+                                                operation)) {
+    return grpc::Status::OK;
+  }
   operation->set_name(task_name);
   operation->set_done(0);
+  // Identical requests made while this one runs share its task.
+  if (operations_service_.AttachToRunningTask(task_name, result_key,
+                                              operation)) {
+    return grpc::Status::OK;
+  }
   operations_service_.UpdateOperation(task_name, *operation);
 
-  GetViolationsTask *task = new (tbb::task::allocate_root())
-      GetViolationsTask((ViolationType)request->violation_type());
+  auto task = std::make_shared<GetViolationsTask>(
+      (ViolationType)request->violation_type());
   task->operations_service_ = &operations_service_;
+  task->bitcode_cache_ = &bitcode_cache_;
   task->request_ = *request;
   task->task_name_ = task_name;
   task->bitcode_server_address_ = bitcode_server_address;
-  tbb::task::enqueue(*task);
+  task->result_cache_ = &result_cache_;
+  task->result_key_ = result_key;
+  task->fact_cache_ = &fact_cache_;
+  task->trace_directory_ = trace_directory_;
+  task->executor_ = &executor_;
+  // Wait, without holding a slot of the executor, until the analysis fits
+  // next to the running ones: first the parsed module, then the facts of the
+  // passes over its instructions.
+  grpc::Status submit_status = executor_.SubmitAnalysis(
+      OperationPriority::kNormal, nullptr,
+      [task](uint64_t *bitcode_bytes) { return task->Fetch(bitcode_bytes); },
+      [task](std::unique_ptr<MemoryReservation> memory_reservation) {
+        task->Analyze(std::move(memory_reservation));
+      });
+  if (!submit_status.ok()) {
+    operations_service_.DiscardOperation(task_name, submit_status);
+    return submit_status;
+  }
 
   return grpc::Status::OK;
 }
 
-void RunCheckerServer(const std::string &server_address) {
-  CheckerServiceImpl service;
+void CheckerServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<CheckerService::AsyncService>();
+  // May read a memoized result from disk.
+  server->AddUnary(async_service,
+                   &CheckerService::AsyncService::RequestGetViolations, this,
+                   &CheckerService::Service::GetViolations,
+                   /*blocking=*/true);
+  operations_service_.AddToAsyncServer(server);
+}
+
+void RunCheckerServer(const std::string &server_address,
+                      const std::string &bitcode_cache_directory,
+                      const ResultCacheOptions &result_cache_options,
+                      const OperationExecutorOptions &executor_options,
+                      const AsyncServerOptions &async_server_options,
+                      const std::string &trace_directory,
+                      const std::string &fact_cache_directory) {
+  CheckerServiceImpl service(bitcode_cache_directory, result_cache_options,
+                             executor_options, trace_directory,
+                             fact_cache_directory);
+  if (async_server_options.enabled) {
+    AsyncServer server(async_server_options);
+    service.AddToAsyncServer(&server);
+    if (server.Start(server_address).ok()) {
+      server.Wait();
+    }
+    return;
+  }
 
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder);
   // Register "service" as the instance through which we'll communicate with
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
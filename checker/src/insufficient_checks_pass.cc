@@ -8,6 +8,7 @@
 #include "llvm.h"
 #include "llvm/IR/Function.h"
 #include "llvm/Pass.h"
+#include "progress.h"
 #include "proto/checker.pb.h"
 #include "return_constraints_pass.h"
 #include "return_propagation_pass.h"
@@ -16,6 +17,7 @@
 namespace error_specifications {
 
 bool InsufficientChecksPass::runOnModule(llvm::Module &module) {
+  PassTimer pass_timer(this, "InsufficientChecksPass");
   std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &fn : module) {
     module_functions.push_back(&fn);
@@ -55,15 +57,18 @@ std::set<SignLatticeElement> InsufficientChecksPass::CollectConstraints(
     const llvm::Function &parent_function, const std::string &fn_name) {
   std::set<SignLatticeElement> ret;
 
-  ReturnConstraintsPass &return_constraints_pass =
-      getAnalysis<ReturnConstraintsPass>();
+  const ReturnConstraints &return_constraints =
+      getAnalysis<ReturnConstraintsPass>().GetResult();
+  FunctionId fn_id;
+  if (!return_constraints.GetFunctionIds().Find(fn_name, &fn_id)) {
+    return ret;
+  }
 
   // Go over every instruction in parent_function.
   for (auto &basic_block : parent_function) {
-    for (auto &inst : basic_block) {
-      ReturnConstraintsFact return_constraints_fact =
-          return_constraints_pass.GetInFact(&inst);
-      const auto &fn_constraint = return_constraints_fact.value.find(fn_name);
+    for (const ReturnConstraintsFact &return_constraints_fact :
+         return_constraints.GetBlockInFacts(basic_block)) {
+      const auto &fn_constraint = return_constraints_fact.value.find(fn_id);
       // If there there is constraint on the instruction associated with
       // fn_name.
       if (fn_constraint != return_constraints_fact.value.end()) {
@@ -146,16 +151,17 @@ bool InsufficientChecksPass::IsPropagated(
         continue;
       }
 
-      // The fact at the return instruction.
-      auto return_fact = return_propagation_pass.input_facts_.at(return_inst);
       if (return_inst->getNumOperands() != 1) {
         continue;
       }
+      // The fact at the return instruction.
+      const ReturnPropagationFact return_fact =
+          return_propagation_pass.GetResult().GetInFact(return_inst);
 
       // Get the values that can be returned.
       llvm::Value *returned = return_inst->getOperand(0);
-      const auto &idx = return_fact->value.find(returned);
-      if (idx == return_fact->value.end()) {
+      const auto &idx = return_fact.value.find(returned);
+      if (idx == return_fact.value.end()) {
         continue;
       }
 
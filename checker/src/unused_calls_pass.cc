@@ -7,12 +7,14 @@
 #include "llvm.h"
 #include "llvm/IR/Function.h"
 #include "llvm/Pass.h"
+#include "progress.h"
 #include "proto/checker.pb.h"
 #include "tbb/tbb.h"
 
 namespace error_specifications {
 
 bool UnusedCallsPass::runOnModule(llvm::Module &module) {
+  PassTimer pass_timer(this, "UnusedCallsPass");
   LOG(INFO) << "Running unused calls pass on module...";
 
   std::vector<const llvm::Function *> module_functions;
@@ -2,14 +2,21 @@
     in requests and then send them to the appropriate service
     and then wait until finished.
 """
+import queue
+import threading
 import time
 
 import glog as log
+import grpc
 
 import proto.operations_pb2
 
-def wait_for_one_operation(operations_stub, operation):
-    """Waits for a single operation to finish and returns the final response."""
+def poll_for_one_operation(operations_stub, operation):
+    """Polls GetOperation until a single operation finishes and returns the
+       final response. Only needed for servers without WatchOperation. An
+       operation that the server does not know is returned as finished with
+       the error of GetOperation.
+    """
     done = False
     while not done:
         try:
@@ -19,14 +26,45 @@ def wait_for_one_operation(operations_stub, operation):
             response = operations_stub.GetOperation(request)
             done = response.done
             time.sleep(1)
+        except grpc.RpcError as e:
+            # The server no longer knows the operation, e.g. because it
+            # restarted, so polling again would never finish.
+            if e.code() in (grpc.StatusCode.INVALID_ARGUMENT,
+                            grpc.StatusCode.NOT_FOUND):
+                log.warning("Operation {} is gone: {}".format(
+                    operation.name, e.details()))
+                response = proto.operations_pb2.Operation(
+                    name=operation.name,
+                    done=True,
+                )
+                response.error.code = e.code().value[0]
+                response.error.message = e.details()
+                return response
+            log.warning("GetOperation failed, retrying: {}".format(e))
+            time.sleep(1)
         #TODO (): This is too general, we need a
         #better/elegant solution.
         except Exception as e:
-            print(e)
+            log.warning("GetOperation failed, retrying: {}".format(e))
             time.sleep(1)
 
     return response
 
+def wait_for_one_operation(operations_stub, operation):
+    """Waits for a single operation to finish and returns the final response."""
+    try:
+        request = proto.operations_pb2.WatchOperationRequest(
+            name=operation.name,
+        )
+        # The server pushes every update and closes the stream once done.
+        for response in operations_stub.WatchOperation(request):
+            if response.done:
+                return response
+    except grpc.RpcError as e:
+        log.warning("WatchOperation failed, polling instead: {}".format(e))
+
+    return poll_for_one_operation(operations_stub, operation)
+
 def wait_for_operations(operations_stub, id_requests, request_function,
                         max_tasks, notify):
     """Sends all requests to the relevant service and waits until all finish.
@@ -49,6 +87,12 @@ def wait_for_operations(operations_stub, id_requests, request_function,
     task_id = {}
     # Dictionary from task name to request
     task_requests = {}
+    # Finished operations, pushed by one watcher thread per task
+    finished_operations = queue.Queue()
+
+    def watch(operation):
+        finished_operations.put(
+            wait_for_one_operation(operations_stub, operation))
 
     # Waiting for all sent requests to finish and for all requests to be sent
     while waiting_for_results or id_requests:
@@ -68,32 +112,29 @@ def wait_for_operations(operations_stub, id_requests, request_function,
             task_id[get_response.name] = unique_id
             task_requests[get_response.name] = request
             to_remove.add(unique_id)
+            threading.Thread(target=watch, args=(get_response,),
+                             daemon=True).start()
 
         # Removing the requests that have already been sent
         for unique_id in to_remove:
             id_requests.pop(unique_id)
 
-        # For removing tasks from waiting_for_results
-        finished_tasks = set()
+        if not waiting_for_results:
+            continue
 
-        for task in waiting_for_results:
-            get_operation_request = \
-                proto.operations_pb2.GetOperationRequest(
-                    name=task)
-            get_operation_response = operations_stub.GetOperation(
-                get_operation_request)
-
-            if get_operation_response.done:
-                unique_id = task_id[task]
-                id_finished_responses[unique_id] = get_operation_response
-                finished_tasks.add(task)
-                if notify:
-                    notify(task_requests[task], get_operation_response)
-
-        # Removing tasks that have finished
-        waiting_for_results = waiting_for_results.difference(finished_tasks)
-        # If some tasks still haven't finished, sleep for 5 seconds
-        if waiting_for_results:
-            time.sleep(5)
+        # Block until the next task finishes, then collect any others that
+        # finished at the same time.
+        get_operation_response = finished_operations.get()
+        while True:
+            task = get_operation_response.name
+            unique_id = task_id[task]
+            id_finished_responses[unique_id] = get_operation_response
+            waiting_for_results.discard(task)
+            if notify:
+                notify(task_requests[task], get_operation_response)
+            try:
+                get_operation_response = finished_operations.get_nowait()
+            except queue.Empty:
+                break
 
     return bool(id_finished_responses)
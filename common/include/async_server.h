@@ -0,0 +1,516 @@
+// An asynchronous gRPC server shared by the services.
+//
+// With the synchronous grpc::ServerBuilder model every call is handled on a
+// thread of its own, so a streaming call such as DownloadBitcode pins a
+// thread for as long as the client keeps reading. The asynchronous server
+// instead drains grpc::ServerCompletionQueues with a small pool of polling
+// threads. Unary calls that only look up or start operations are answered on
+// the polling threads. Unary calls that may block on I/O, and the opening of
+// streams, are handed to a bounded pool of worker threads; the rest wait in a
+// bounded queue, so thousands of connected clients do not need one thread
+// each.
+//
+// The services keep their synchronous implementations of unary RPCs.
+// Streaming RPCs are implemented once as a ServerStream, which hands out one
+// message at a time: the synchronous server writes them in a loop, while the
+// asynchronous one writes the next message when the previous write comes
+// back from the completion queue, so no thread waits on a slow client.
+// Streams that mostly wait for something else, such as WatchOperation, drive
+// their calls from the completion queues themselves and are added with
+// AddMethod.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_ASYNC_SERVER_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_ASYNC_SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "include/grpcpp/grpcpp.h"
+#include "include/grpcpp/support/async_stream.h"
+#include "include/grpcpp/support/async_unary_call.h"
+#include "include/grpcpp/support/sync_stream.h"
+
+namespace error_specifications {
+
+// Default number of threads polling the completion queues.
+constexpr int kDefaultAsyncPollingThreads = 2;
+
+// Default number of threads serving blocking calls and opening streams.
+constexpr int kDefaultAsyncWorkerThreads = 16;
+
+// Default number of blocking calls and streams that may wait for a worker
+// thread.
+constexpr int kDefaultAsyncMaxQueuedCalls = 1024;
+
+// Whether and how a service uses the asynchronous server.
+struct AsyncServerOptions {
+  // Serve with AsyncServer instead of the synchronous grpc::ServerBuilder.
+  bool enabled = false;
+  int polling_threads = kDefaultAsyncPollingThreads;
+  int worker_threads = kDefaultAsyncWorkerThreads;
+  int max_queued_calls = kDefaultAsyncMaxQueuedCalls;
+};
+
+// What the polling threads get back from a completion queue.
+class AsyncTag {
+ public:
+  virtual ~AsyncTag() {}
+
+  // `ok` is false if the operation behind the tag did not complete, e.g.
+  // because the server is shutting down or the client went away.
+  virtual void Proceed(bool ok) = 0;
+};
+
+// Calls a function when it comes back from the completion queue.
+class CallbackTag final : public AsyncTag {
+ public:
+  explicit CallbackTag(std::function<void(bool)> callback)
+      : callback_(std::move(callback)) {}
+
+  void Proceed(bool ok) override { callback_(ok); }
+
+ private:
+  std::function<void(bool)> callback_;
+};
+
+// Threads that serve the calls which may block. Unlike OperationExecutor,
+// which runs in a TBB arena, the pool has threads of its own so that calls
+// waiting on slow clients never hold back the threads analyses run on.
+class AsyncWorkerPool {
+ public:
+  AsyncWorkerPool(int num_threads, int max_queued_calls);
+
+  ~AsyncWorkerPool() { Stop(); }
+
+  // Runs `work` on a worker thread. Returns RESOURCE_EXHAUSTED, without
+  // running `work`, if the queue is full or the pool has been stopped.
+  grpc::Status Submit(std::function<void()> work);
+
+  // Finishes the queued calls and joins the threads.
+  void Stop();
+
+ private:
+  void Work();
+
+  const size_t max_queued_calls_;
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::deque<std::function<void()>> queue_;
+  size_t idle_threads_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// Counts the calls whose tags may still come back from a completion queue.
+// A call counts from when it starts waiting for a client until it deletes
+// itself, so that the queues are only shut down once no call can start
+// another operation on them.
+class AsyncCallCounter {
+ public:
+  void Begin();
+  void End();
+
+  // Blocks until every call that began has ended.
+  void WaitForNone();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable ended_;
+  int calls_ = 0;
+};
+
+// Tags are passed to gRPC as void pointers and cast back to AsyncTag, so the
+// pointer passed must be that of the AsyncTag base.
+inline void *AsTag(AsyncTag *tag) { return tag; }
+
+// One call of a unary method. It waits for the call, hands it to the
+// synchronous implementation, sends the response, and then deletes itself.
+template <class Request, class Response>
+class AsyncUnaryCall final : public AsyncTag {
+ public:
+  struct Method {
+    std::function<void(grpc::ServerContext *, Request *,
+                       grpc::ServerAsyncResponseWriter<Response> *,
+                       grpc::ServerCompletionQueue *, void *)>
+        request_call;
+    std::function<grpc::Status(grpc::ServerContext *, const Request *,
+                               Response *)>
+        handler;
+    AsyncCallCounter *calls = nullptr;
+    // Set for methods that may block. They are served by the pool instead
+    // of the polling thread.
+    AsyncWorkerPool *worker_pool = nullptr;
+  };
+
+  // Waits for the next call of `method` on `queue`.
+  static void Start(std::shared_ptr<const Method> method,
+                    grpc::ServerCompletionQueue *queue) {
+    new AsyncUnaryCall(std::move(method), queue);
+  }
+
+  void Proceed(bool ok) override {
+    if (!ok || finishing_) {
+      AsyncCallCounter *calls = method_->calls;
+      delete this;
+      calls->End();
+      return;
+    }
+
+    // Wait for the next call while this one is being served.
+    Start(method_, queue_);
+    if (!method_->worker_pool) {
+      Respond();
+      return;
+    }
+    grpc::Status submit_status =
+        method_->worker_pool->Submit([this] { Respond(); });
+    if (!submit_status.ok()) {
+      finishing_ = true;
+      responder_.FinishWithError(submit_status, AsTag(this));
+    }
+  }
+
+ private:
+  AsyncUnaryCall(std::shared_ptr<const Method> method,
+                 grpc::ServerCompletionQueue *queue)
+      : method_(std::move(method)), queue_(queue), responder_(&context_) {
+    method_->calls->Begin();
+    method_->request_call(&context_, &request_, &responder_, queue_,
+                          AsTag(this));
+  }
+
+  void Respond() {
+    grpc::Status status = method_->handler(&context_, &request_, &response_);
+    // The finished tag may come back on another polling thread as soon as
+    // Finish is called.
+    finishing_ = true;
+    if (status.ok()) {
+      responder_.Finish(response_, status, AsTag(this));
+    } else {
+      responder_.FinishWithError(status, AsTag(this));
+    }
+  }
+
+  const std::shared_ptr<const Method> method_;
+  grpc::ServerCompletionQueue *const queue_;
+  grpc::ServerContext context_;
+  Request request_;
+  Response response_;
+  grpc::ServerAsyncResponseWriter<Response> responder_;
+  bool finishing_ = false;
+};
+
+// The messages of one call of a server-streaming method, handed out one at a
+// time as the client reads them.
+template <class Response>
+class ServerStream {
+ public:
+  virtual ~ServerStream() {}
+
+  // Sets the empty `message` to the next message and returns true, or sets
+  // `status` and returns false once the stream has ended. The asynchronous
+  // server calls it on a polling thread, so it must not block.
+  virtual bool Next(Response *message, grpc::Status *status) = 0;
+};
+
+// Writes every message of `stream` to `writer`, which is how the synchronous
+// server serves a streaming method.
+template <class Response>
+grpc::Status WriteServerStream(ServerStream<Response> *stream,
+                               grpc::ServerWriter<Response> *writer) {
+  while (true) {
+    Response message;
+    grpc::Status status;
+    if (!stream->Next(&message, &status)) {
+      return status;
+    }
+    if (!writer->Write(message)) {
+      return grpc::Status(grpc::StatusCode::CANCELLED,
+                          "Stream cancelled by client.");
+    }
+  }
+}
+
+// One call of a server-streaming method. Opening the stream may block, e.g.
+// on reading a file, so it runs on a worker thread. After that, each write
+// comes back on a polling thread, which writes the next message; no thread
+// waits while the client reads. The call deletes itself once finished_ and
+// done_ have both come back.
+template <class Request, class Response>
+class AsyncServerStreamingCall final : public AsyncTag {
+ public:
+  struct Method {
+    std::function<void(grpc::ServerContext *, Request *,
+                       grpc::ServerAsyncWriter<Response> *,
+                       grpc::ServerCompletionQueue *, void *)>
+        request_call;
+    std::function<grpc::Status(grpc::ServerContext *, const Request *,
+                               std::unique_ptr<ServerStream<Response>> *)>
+        open;
+    AsyncCallCounter *calls = nullptr;
+    AsyncWorkerPool *worker_pool = nullptr;
+  };
+
+  // Waits for the next call of `method` on `queue`.
+  static void Start(std::shared_ptr<const Method> method,
+                    grpc::ServerCompletionQueue *queue) {
+    new AsyncServerStreamingCall(std::move(method), queue);
+  }
+
+  void Proceed(bool ok) override {
+    if (!ok) {
+      // The call never started, so done_ will not come back either.
+      AsyncCallCounter *calls = method_->calls;
+      delete this;
+      calls->End();
+      return;
+    }
+
+    // Wait for the next call while this one is being served.
+    Start(method_, queue_);
+    grpc::Status submit_status =
+        method_->worker_pool->Submit([this] { Open(); });
+    if (!submit_status.ok()) {
+      writer_.Finish(submit_status, AsTag(&finished_));
+    }
+  }
+
+ private:
+  AsyncServerStreamingCall(std::shared_ptr<const Method> method,
+                           grpc::ServerCompletionQueue *queue)
+      : method_(std::move(method)),
+        queue_(queue),
+        writer_(&context_),
+        written_([this](bool ok) { OnWritten(ok); }),
+        finished_([this](bool) { Release(); }),
+        done_([this](bool) { Release(); }) {
+    method_->calls->Begin();
+    // Makes context_.IsCancelled() notice clients that went away.
+    context_.AsyncNotifyWhenDone(AsTag(&done_));
+    method_->request_call(&context_, &request_, &writer_, queue_,
+                          AsTag(this));
+  }
+
+  void Open() {
+    grpc::Status status = method_->open(&context_, &request_, &stream_);
+    if (!status.ok()) {
+      writer_.Finish(status, AsTag(&finished_));
+      return;
+    }
+    WriteNext();
+  }
+
+  void OnWritten(bool ok) {
+    if (!ok) {
+      writer_.Finish(grpc::Status(grpc::StatusCode::CANCELLED,
+                                  "Stream cancelled by client."),
+                     AsTag(&finished_));
+      return;
+    }
+    WriteNext();
+  }
+
+  // Writes the next message of the stream, or finishes the call once the
+  // stream has ended.
+  void WriteNext() {
+    Response message;
+    grpc::Status status;
+    if (!stream_->Next(&message, &status)) {
+      writer_.Finish(status, AsTag(&finished_));
+      return;
+    }
+    writer_.Write(message, AsTag(&written_));
+  }
+
+  // Deletes the call once both finished_ and done_ have come back.
+  void Release() {
+    if (--pending_tags_ == 0) {
+      AsyncCallCounter *calls = method_->calls;
+      delete this;
+      calls->End();
+    }
+  }
+
+  const std::shared_ptr<const Method> method_;
+  grpc::ServerCompletionQueue *const queue_;
+  grpc::ServerContext context_;
+  Request request_;
+  grpc::ServerAsyncWriter<Response> writer_;
+  std::unique_ptr<ServerStream<Response>> stream_;
+  CallbackTag written_;
+  CallbackTag finished_;
+  CallbackTag done_;
+  std::atomic<int> pending_tags_{2};
+};
+
+class AsyncServer {
+ public:
+  explicit AsyncServer(const AsyncServerOptions &options);
+
+  // Shuts the server down if it is still running.
+  ~AsyncServer();
+
+  // Creates an asynchronous service of type `AsyncService`, e.g.
+  // BitcodeService::AsyncService, and registers it with the server. The
+  // service is owned by the server. Must be called before Start.
+  template <class AsyncService>
+  AsyncService *AddService() {
+    auto service = std::make_shared<AsyncService>();
+    builder_.RegisterService(service.get());
+    services_.push_back(service);
+    return service.get();
+  }
+
+  // Serves the unary method `request_method` of `async_service` with the
+  // synchronous implementation `method` of `service`, e.g.
+  //
+  //   server->AddUnary(async_service,
+  //                    &BitcodeService::AsyncService::RequestAnnotate,
+  //                    &service, &BitcodeService::Service::Annotate);
+  //
+  // Methods that may block, e.g. on file I/O, should set `blocking` so that
+  // they do not hold up a polling thread. Must be called before Start.
+  template <class AsyncService, class RequestOwner, class Service,
+            class ServiceBase, class Request, class Response>
+  void AddUnary(AsyncService *async_service,
+                void (RequestOwner::*request_method)(
+                    grpc::ServerContext *, Request *,
+                    grpc::ServerAsyncResponseWriter<Response> *,
+                    grpc::CompletionQueue *, grpc::ServerCompletionQueue *,
+                    void *),
+                Service *service,
+                grpc::Status (ServiceBase::*method)(grpc::ServerContext *,
+                                                    const Request *,
+                                                    Response *),
+                bool blocking = false) {
+    using Call = AsyncUnaryCall<Request, Response>;
+    auto call_method = std::make_shared<typename Call::Method>();
+    RequestOwner *owner = async_service;
+    call_method->request_call =
+        [owner, request_method](
+            grpc::ServerContext *context, Request *request,
+            grpc::ServerAsyncResponseWriter<Response> *responder,
+            grpc::ServerCompletionQueue *queue, void *tag) {
+          (owner->*request_method)(context, request, responder, queue, queue,
+                                   tag);
+        };
+    ServiceBase *implementation = service;
+    call_method->handler = [implementation, method](
+                               grpc::ServerContext *context,
+                               const Request *request, Response *response) {
+      return (implementation->*method)(context, request, response);
+    };
+    call_method->calls = &calls_;
+    if (blocking) {
+      call_method->worker_pool = &worker_pool_;
+    }
+    starts_.push_back([call_method](grpc::ServerCompletionQueue *queue) {
+      Call::Start(call_method, queue);
+    });
+  }
+
+  // Serves the server-streaming method `request_method` of `async_service`
+  // with `open` of `service`, which opens the ServerStream of a call, e.g.
+  //
+  //   server->AddServerStreaming(
+  //       async_service, &BitcodeService::AsyncService::RequestDownloadBitcode,
+  //       &service, &BitcodeServiceImpl::OpenDownloadBitcode);
+  //
+  // Streams are opened by the worker pool and written from the polling
+  // threads. Must be called before Start.
+  template <class AsyncService, class RequestOwner, class Service,
+            class ServiceBase, class Request, class Response>
+  void AddServerStreaming(
+      AsyncService *async_service,
+      void (RequestOwner::*request_method)(
+          grpc::ServerContext *, Request *,
+          grpc::ServerAsyncWriter<Response> *, grpc::CompletionQueue *,
+          grpc::ServerCompletionQueue *, void *),
+      Service *service,
+      grpc::Status (ServiceBase::*open)(
+          grpc::ServerContext *, const Request *,
+          std::unique_ptr<ServerStream<Response>> *)) {
+    using Call = AsyncServerStreamingCall<Request, Response>;
+    auto call_method = std::make_shared<typename Call::Method>();
+    RequestOwner *owner = async_service;
+    call_method->request_call =
+        [owner, request_method](grpc::ServerContext *context,
+                                Request *request,
+                                grpc::ServerAsyncWriter<Response> *writer,
+                                grpc::ServerCompletionQueue *queue,
+                                void *tag) {
+          (owner->*request_method)(context, request, writer, queue, queue,
+                                   tag);
+        };
+    ServiceBase *implementation = service;
+    call_method->open =
+        [implementation, open](
+            grpc::ServerContext *context, const Request *request,
+            std::unique_ptr<ServerStream<Response>> *stream) {
+          return (implementation->*open)(context, request, stream);
+        };
+    call_method->calls = &calls_;
+    call_method->worker_pool = &worker_pool_;
+    starts_.push_back([call_method](grpc::ServerCompletionQueue *queue) {
+      Call::Start(call_method, queue);
+    });
+  }
+
+  // Calls `start` with every completion queue on Start, to wait for the
+  // calls of a method whose calls are served on the polling threads by
+  // their own AsyncTags. Must be called before Start.
+  void AddMethod(std::function<void(grpc::ServerCompletionQueue *)> start) {
+    starts_.push_back(std::move(start));
+  }
+
+  // Counts a call added with AddMethod, like the calls of the other methods,
+  // from when it starts waiting for a client until it deletes itself.
+  // Shutdown waits for the counted calls before it shuts the queues down.
+  void BeginCall() { calls_.Begin(); }
+  void EndCall() { calls_.End(); }
+
+  // Listens on `server_address` and starts serving the methods added so
+  // far. Returns UNAVAILABLE if the server could not be started.
+  grpc::Status Start(const std::string &server_address);
+
+  // Blocks until Shutdown is called from another thread.
+  void Wait();
+
+  // Cancels the calls in flight, waits for the worker threads to finish
+  // them, and stops the polling threads.
+  void Shutdown();
+
+ private:
+  // Serves the tags that come back from `queue` until it is shut down.
+  void Poll(grpc::ServerCompletionQueue *queue);
+
+  const int num_polling_threads_;
+  grpc::ServerBuilder builder_;
+  std::vector<std::shared_ptr<grpc::Service>> services_;
+  // Wait for the first call of each method on a completion queue.
+  std::vector<std::function<void(grpc::ServerCompletionQueue *)>> starts_;
+  std::unique_ptr<grpc::Server> server_;
+  // One completion queue per polling thread.
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> queues_;
+  std::vector<std::thread> polling_threads_;
+  AsyncWorkerPool worker_pool_;
+
+  AsyncCallCounter calls_;
+
+  std::mutex shutdown_mutex_;
+  std::condition_variable shut_down_;
+  bool shutting_down_ = false;
+  bool stopped_ = false;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_ASYNC_SERVER_H_
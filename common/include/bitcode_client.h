@@ -0,0 +1,62 @@
+// Client-side helpers for services that fetch bitcode from the
+// BitcodeService instead of sharing a file system with it.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_BITCODE_CLIENT_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_BITCODE_CLIENT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "include/grpcpp/grpcpp.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "proto/operations.grpc.pb.h"
+
+namespace error_specifications {
+
+// Downloads the bitcode file for `bitcode_id` from the BitcodeService at
+// `bitcode_server_address`. The chunks are written into a single buffer that
+// is allocated from the total size sent with the first chunk, so the result
+// can be handed straight to llvm::parseIR.
+grpc::Status DownloadBitcodeIntoBuffer(
+    const std::string &bitcode_server_address, const Handle &bitcode_id,
+    std::unique_ptr<llvm::MemoryBuffer> *out_buffer);
+
+// A content-addressed cache of downloaded bitcode on local disk. Since
+// handles are sha256 digests, entries are stored under their handle and
+// re-hashed whenever they are read, so a corrupt or truncated entry is simply
+// treated as a miss.
+class LocalBitcodeCache {
+ public:
+  // An empty `cache_directory` disables the cache and every lookup goes to
+  // the bitcode service.
+  explicit LocalBitcodeCache(const std::string &cache_directory);
+
+  // Returns the bitcode for `bitcode_id`, downloading it from the
+  // BitcodeService at `bitcode_server_address` on a miss.
+  grpc::Status GetBitcode(const std::string &bitcode_server_address,
+                          const Handle &bitcode_id,
+                          std::unique_ptr<llvm::MemoryBuffer> *out_buffer);
+
+  uint64_t GetHits() const { return hits_; }
+  uint64_t GetMisses() const { return misses_; }
+
+ private:
+  // Returns true if the cached file for `bitcode_id` exists and matches it.
+  bool ReadEntry(const std::string &bitcode_id,
+                 std::unique_ptr<llvm::MemoryBuffer> *out_buffer) const;
+
+  // Writes `buffer` to the cache. Failures are logged and otherwise ignored.
+  void WriteEntry(const std::string &bitcode_id,
+                  const llvm::MemoryBuffer &buffer) const;
+
+  std::string cache_directory_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_BITCODE_CLIENT_H_
@@ -0,0 +1,35 @@
+// Cooperative cancellation of long-running operations.
+//
+// CancelOperation sets the token of an operation. The task running the
+// operation, and the loops it spends most of its time in, poll the token and
+// stop early once it is set. Nothing is interrupted forcibly.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_CANCELLATION_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_CANCELLATION_H_
+
+#include <atomic>
+
+namespace error_specifications {
+
+class CancellationToken {
+ public:
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // Cheap enough to call from inner loops.
+  bool IsCancelled() const {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<bool> cancelled_{false};
+};
+
+// Returns true if `token` is set and has been cancelled. Passes and loops
+// that may run outside of an operation get a null token.
+inline bool IsCancelled(const CancellationToken *token) {
+  return token != nullptr && token->IsCancelled();
+}
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_CANCELLATION_H_
@@ -0,0 +1,177 @@
+// A bounded, prioritized executor for the tasks behind long-running
+// operations.
+//
+// Without a limit, a handful of large requests would share the machine and
+// all finish late. The executor runs at most a fixed number of operations at
+// a time; the rest wait in a bounded queue and are started highest priority
+// first, in submission order within a priority. Submitting to a full queue
+// fails with RESOURCE_EXHAUSTED so that the client can back off.
+//
+// Running operations still use every core of the machine through the
+// parallel algorithms inside them. Their memory is bounded separately, once
+// the size of their module is known, by the executor's MemoryBudget. An
+// analysis submitted with SubmitAnalysis gives up its slot once it has
+// fetched its bitcode, until the budget admits its module. Admitted analyses
+// get the next free slot before any queued operation, so the memory they
+// hold is always that of running operations.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_EXECUTOR_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_EXECUTOR_H_
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "cancellation.h"
+#include "include/grpcpp/grpcpp.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "tbb/task_arena.h"
+
+namespace error_specifications {
+
+// Default number of operations a service runs at the same time.
+constexpr int kDefaultMaxConcurrentOperations = 2;
+
+// Default number of operations a service lets wait for a free slot.
+constexpr int kDefaultMaxQueuedOperations = 64;
+
+// Priority classes of operations. Cheap operations should not wait behind
+// expensive ones.
+enum class OperationPriority {
+  // Operations that finish in a fraction of the time of a full analysis,
+  // e.g. listing the functions defined in a module.
+  kHigh = 0,
+  // Full analyses such as EESI.
+  kNormal = 1,
+  kNumPriorities = 2,
+};
+
+// Limits of an OperationExecutor.
+struct OperationExecutorOptions {
+  int max_concurrent_operations = kDefaultMaxConcurrentOperations;
+  int max_queued_operations = kDefaultMaxQueuedOperations;
+  // Estimated memory, in bytes, that running analyses may use together. 0
+  // leaves it unlimited.
+  uint64_t memory_budget_bytes = 0;
+};
+
+struct OperationExecutorStats {
+  uint64_t running = 0;
+  uint64_t queued = 0;
+  // Analyses that fetched their bitcode and wait for the memory budget to
+  // admit their module.
+  uint64_t waiting_for_memory = 0;
+  uint64_t completed = 0;
+  uint64_t rejected = 0;
+};
+
+class OperationExecutor {
+ public:
+  // `service_name` labels the queue depth and running operations in the
+  // metrics of the process.
+  explicit OperationExecutor(
+      const OperationExecutorOptions &options = OperationExecutorOptions(),
+      const std::string &service_name = "");
+
+  // Waits for the running and queued operations to finish.
+  ~OperationExecutor();
+
+  // Runs `work` as soon as a slot is free. Returns RESOURCE_EXHAUSTED,
+  // without running `work`, if the queue is full.
+  grpc::Status Submit(OperationPriority priority, std::function<void()> work);
+
+  // Runs an analysis in two parts. `fetch` runs like the work of Submit and
+  // sets the size of the bitcode it fetched, or returns false if the
+  // operation is over. `analyze` then runs with the reservation of the
+  // module parsed from that bitcode, as soon as a slot is free and the
+  // memory budget admits the module, in the order the analyses fetched
+  // their bitcode. No slot is held in between. `analyze` gets a null
+  // reservation if `cancellation_token` is cancelled first, which, as for a
+  // queued operation, is noticed once an operation is submitted or finishes
+  // or memory is released. Returns RESOURCE_EXHAUSTED, without running
+  // either part, if the queue is full.
+  grpc::Status SubmitAnalysis(
+      OperationPriority priority,
+      std::shared_ptr<const CancellationToken> cancellation_token,
+      std::function<bool(uint64_t *bitcode_bytes)> fetch,
+      std::function<void(std::unique_ptr<MemoryReservation>)> analyze);
+
+  OperationExecutorStats GetStats() const;
+
+  // The budget that running operations reserve the memory of their analysis
+  // from.
+  MemoryBudget *GetMemoryBudget() { return &memory_budget_; }
+
+ private:
+  // Runs one part of an operation and returns whether the operation is
+  // over.
+  using Work = std::function<bool()>;
+
+  // An analysis that fetched its bitcode and waits for its module to be
+  // admitted.
+  struct AdmissionWaiter {
+    uint64_t bitcode_bytes;
+    std::shared_ptr<const CancellationToken> cancellation_token;
+    std::function<void(std::unique_ptr<MemoryReservation>)> analyze;
+    std::chrono::steady_clock::time_point queued_time;
+    bool waited = false;
+  };
+
+  // Queues `work` unless the queue is full. Must be called with mutex_
+  // held.
+  grpc::Status EnqueueLocked(OperationPriority priority, Work work);
+
+  // Starts the analyses waiting for admission that were cancelled or that
+  // the budget admits, then queued operations, while there are free slots.
+  // Must be called with mutex_ held.
+  void DispatchLocked();
+
+  // Takes a slot and runs `work` in the arena. Must be called with mutex_
+  // held.
+  void StartLocked(Work work);
+
+  // Runs `work` and dispatches the next operation afterwards.
+  void Run(const Work &work);
+
+  // Copies the counts into the metrics. Must be called with mutex_ held.
+  void PublishLocked();
+
+  const int max_concurrent_operations_;
+  const int max_queued_operations_;
+
+  MemoryBudget memory_budget_;
+
+  // The arena the operations run in. Its concurrency is that of the
+  // machine; max_concurrent_operations_ only limits how many operations
+  // are started.
+  tbb::task_arena arena_;
+
+  mutable std::mutex mutex_;
+  // Signalled whenever an operation finishes.
+  std::condition_variable finished_;
+  std::array<std::deque<Work>,
+             static_cast<size_t>(OperationPriority::kNumPriorities)>
+      queues_;
+  int queued_ = 0;
+  std::deque<AdmissionWaiter> admission_waiters_;
+  int running_ = 0;
+  uint64_t completed_ = 0;
+  uint64_t rejected_ = 0;
+
+  Gauge *running_gauge_;
+  Gauge *queued_gauge_;
+  Gauge *waiting_for_memory_gauge_;
+  Counter *completed_counter_;
+  Counter *rejected_counter_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_EXECUTOR_H_
@@ -2,9 +2,11 @@
 
 #ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_COMMON_H_
 #define ERROR_SPECIFICATIONS_COMMON_INCLUDE_COMMON_H_
+#include <cstdint>
 #include <iostream>
 
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
 
 #include "proto/bitcode.pb.h"
 
@@ -35,6 +37,16 @@ FunctionReturnType GetReturnType(const llvm::Function &function);
 // Returns true if the return type of the function is void.
 bool IsVoidFunction(const llvm::Function &function);
 
+// Returns the number of functions in the module that have a body.
+uint64_t CountDefinedFunctions(const llvm::Module &module);
+
+// Returns the number of instructions of all functions in the module.
+uint64_t CountInstructions(const llvm::Module &module);
+
+// Records the size, defined functions, and instructions of a module parsed
+// from `size_bytes` of bitcode in the metrics of the process.
+void RecordParsedModuleMetrics(const llvm::Module &module, uint64_t size_bytes);
+
 // Converts an LLVM Value to a Function protobuf message.
 // Used by `getCallee`.
 Function LlvmToProtoFunction(const llvm::Function &function);
@@ -0,0 +1,179 @@
+// Memory-aware admission of analysis tasks.
+//
+// The executor bounds how many operations run at a time, but the memory of
+// an analysis grows with the module: a handful of large modules analysed at
+// once can exhaust the host while many small ones fit easily. Before a task
+// parses its module, it asks the service's MemoryBudget to admit it with an
+// estimate of the parsed module, from the size of the bitcode. Once parsed,
+// it grows its reservation by an estimate of the dataflow facts of the
+// passes, from the number of instructions. Tasks whose estimate does not fit
+// next to the ones already admitted wait, in arrival order, until enough
+// memory is released. Admitted tasks that wait to grow go ahead of the tasks
+// waiting to be admitted. A task is always let through when no admitted
+// task is running, so that a module larger than the whole budget still gets
+// analysed, alone.
+//
+// Operations do not wait for admission themselves: OperationExecutor keeps
+// the analyses submitted with SubmitAnalysis aside once they have fetched
+// their bitcode, and starts them once TryAdmit admits them, so that waiting
+// for memory does not hold one of its slots.
+//
+// The bytes per instruction are calibrated from the measured peak of tasks
+// that ran alone and raised the peak resident memory of the process.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_MEMORY_BUDGET_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_MEMORY_BUDGET_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "cancellation.h"
+#include "metrics.h"
+
+namespace error_specifications {
+
+// Bytes of parsed module per byte of bitcode.
+constexpr double kParsedModuleBytesPerBitcodeByte = 8;
+
+// Bytes of analysis per instruction before any task has been measured.
+constexpr double kDefaultBytesPerInstruction = 4096;
+
+class MemoryBudget;
+
+// Memory admitted for one task, released on destruction.
+class MemoryReservation {
+ public:
+  ~MemoryReservation();
+
+  uint64_t EstimatedBytes() const { return estimated_bytes_; }
+
+ private:
+  friend class MemoryBudget;
+
+  MemoryReservation(MemoryBudget *budget, uint64_t estimated_bytes)
+      : budget_(budget), estimated_bytes_(estimated_bytes) {}
+
+  MemoryBudget *budget_;
+  uint64_t estimated_bytes_;
+  uint64_t instructions_ = 0;
+  // Resident memory of the process, and its peak so far, when the task was
+  // admitted, and again once it grew.
+  uint64_t start_rss_bytes_ = 0;
+  uint64_t start_peak_rss_bytes_ = 0;
+  // Whether the task ran alone, so that the peak of the process while it
+  // ran is its own.
+  bool measurable_ = false;
+};
+
+class MemoryBudget {
+ public:
+  // Admits tasks while their estimates add up to at most `budget_bytes`. A
+  // budget of 0 admits every task right away. `service_name` labels the
+  // metrics of the budget.
+  MemoryBudget(uint64_t budget_bytes, const std::string &service_name);
+
+  // Returns the estimated peak memory of analysing a module of
+  // `instructions` parsed from `bitcode_bytes`.
+  uint64_t Estimate(uint64_t bitcode_bytes, uint64_t instructions) const;
+
+  // Waits until the estimate for the module parsed from `bitcode_bytes`
+  // fits in the budget and returns its reservation. Returns null if
+  // `cancellation_token` is cancelled while waiting.
+  std::unique_ptr<MemoryReservation> Admit(
+      uint64_t bitcode_bytes, const CancellationToken *cancellation_token);
+
+  // Admits the module parsed from `bitcode_bytes` right away if no task
+  // waits ahead of it and its estimate fits, and returns its reservation.
+  // Returns null otherwise. For callers that queue the waiting tasks
+  // themselves: `queued_time` is when the task started waiting, and
+  // `waited` whether an earlier call for it returned null.
+  std::unique_ptr<MemoryReservation> TryAdmit(
+      uint64_t bitcode_bytes, std::chrono::steady_clock::time_point queued_time,
+      bool waited);
+
+  // Waits until the estimate for analysing the `instructions` of the parsed
+  // module fits in the budget as well and adds it to `reservation`. Returns
+  // false, leaving `reservation` as it was, if `cancellation_token` is
+  // cancelled while waiting.
+  bool Grow(MemoryReservation *reservation, uint64_t instructions,
+            const CancellationToken *cancellation_token);
+
+  // Sets `callback` to be called whenever memory is released or a waiting
+  // task leaves the queue, i.e. whenever TryAdmit may admit a task that it
+  // did not admit before. It is called without the lock of the budget held.
+  // Must be set before any task is admitted.
+  void SetChangedCallback(std::function<void()> callback) {
+    changed_callback_ = std::move(callback);
+  }
+
+ private:
+  friend class MemoryReservation;
+
+  // Returns the memory of `reservation` to the budget and calibrates the
+  // estimates with its measured peak.
+  void Release(const MemoryReservation &reservation);
+
+  // Queues the waiter `ticket`, for growing a reservation if `grow`, and
+  // waits until it is next and `estimated_bytes` fit. Returns false if
+  // `cancellation_token` is cancelled first. Must be called with `lock`
+  // held; sets `waited` if it had to wait.
+  bool WaitLocked(std::unique_lock<std::mutex> *lock, bool grow,
+                  uint64_t estimated_bytes,
+                  const CancellationToken *cancellation_token, bool *waited);
+
+  // Whether the waiter `ticket` is next and fits. Must be called with
+  // mutex_ held.
+  bool CanAdmitLocked(uint64_t ticket, uint64_t estimated_bytes) const;
+
+  // Whether `estimated_bytes` more fit in the budget. Must be called with
+  // mutex_ held.
+  bool FitsLocked(uint64_t estimated_bytes) const;
+
+  // Reserves `estimated_bytes` for a newly admitted task, which started
+  // waiting at `start_time`. Must be called with mutex_ held.
+  std::unique_ptr<MemoryReservation> AdmitLocked(
+      uint64_t estimated_bytes,
+      std::chrono::steady_clock::time_point start_time, bool waited);
+
+  // Records the resident memory of the process in `reservation` if its task
+  // runs alone. Must be called with mutex_ held.
+  void StartMeasuringLocked(MemoryReservation *reservation);
+
+  const uint64_t budget_bytes_;
+
+  mutable std::mutex mutex_;
+  // Signalled whenever memory is released or a waiter gives up.
+  std::condition_variable changed_;
+  // Tickets of the waiting tasks: the ones growing their reservation, then
+  // the ones waiting to be admitted, each in arrival order.
+  std::deque<uint64_t> waiters_;
+  // How many of waiters_ are growing their reservation.
+  int growing_ = 0;
+  uint64_t next_ticket_ = 0;
+  uint64_t reserved_bytes_ = 0;
+  int admitted_ = 0;
+  // The reservation of the only admitted task, if it is measurable.
+  MemoryReservation *measured_ = nullptr;
+  double bytes_per_instruction_ = kDefaultBytesPerInstruction;
+  std::function<void()> changed_callback_;
+
+  Gauge *reserved_gauge_;
+  Gauge *waiting_gauge_;
+  Gauge *bytes_per_instruction_gauge_;
+  Counter *admitted_immediately_counter_;
+  Counter *admitted_after_wait_counter_;
+  Counter *cancelled_counter_;
+  Histogram *wait_histogram_;
+  Histogram *estimate_histogram_;
+  Histogram *peak_histogram_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_MEMORY_BUDGET_H_
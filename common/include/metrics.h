@@ -0,0 +1,148 @@
+// Process-wide metrics exported in the Prometheus text format.
+//
+// Counters, gauges, and histograms are registered by name and label set in
+// the MetricsRegistry and live as long as the process, so callers can keep
+// the returned pointers, typically in a function-local static. Updating a
+// metric does not touch the registry. The registry does not depend on gRPC,
+// so analysis passes can record metrics; metrics_server.h serves it.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace error_specifications {
+
+// Label names and values of one metric, e.g. {{"service", "eesi"}}.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// A value that only goes up, e.g. bytes downloaded.
+class Counter {
+ public:
+  void Increment(uint64_t amount = 1) {
+    value_.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  uint64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// A value that goes up and down, e.g. the number of queued operations.
+class Gauge {
+ public:
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  void Add(int64_t amount) {
+    value_.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Counts observations, e.g. latencies, into buckets with fixed upper bounds.
+class Histogram {
+ public:
+  // `bounds` are the inclusive upper bounds of the buckets in increasing
+  // order. Observations above the last bound are only counted in +Inf.
+  explicit Histogram(std::vector<double> bounds);
+
+  void Observe(double value);
+
+  const std::vector<double> &Bounds() const { return bounds_; }
+
+  // Copies the non-cumulative bucket counts, the last one being +Inf, and
+  // the sum of all observations.
+  void Snapshot(std::vector<uint64_t> *bucket_counts, double *sum) const;
+
+ private:
+  const std::vector<double> bounds_;
+  mutable std::mutex mutex_;
+  std::vector<uint64_t> bucket_counts_;
+  double sum_ = 0;
+};
+
+// Returns `count` bounds starting at `start`, each `factor` times the last.
+std::vector<double> ExponentialBuckets(double start, double factor, int count);
+
+// Bucket bounds for durations in seconds, from a millisecond to an hour.
+const std::vector<double> &DurationBuckets();
+
+// Observes the seconds between its construction and its destruction into a
+// histogram.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram *histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    histogram_->Observe(std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count());
+  }
+
+ private:
+  Histogram *histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+class MetricsRegistry {
+ public:
+  // The registry of the process.
+  static MetricsRegistry &Global();
+
+  // Return the metric `name` with `labels`, creating it on first use. All
+  // metrics of one name must be of the same type; `help` and `bounds` are
+  // taken from the first registration.
+  Counter *GetCounter(const std::string &name, const std::string &help,
+                      const MetricLabels &labels = MetricLabels());
+  Gauge *GetGauge(const std::string &name, const std::string &help,
+                  const MetricLabels &labels = MetricLabels());
+  Histogram *GetHistogram(const std::string &name, const std::string &help,
+                          const std::vector<double> &bounds,
+                          const MetricLabels &labels = MetricLabels());
+
+  // Renders every metric in the Prometheus text exposition format.
+  std::string RenderPrometheusText() const;
+
+ private:
+  // All metrics of one name.
+  struct Family {
+    std::string help;
+    std::string type;
+    // Shared by every histogram of the family.
+    std::vector<double> bounds;
+    // Keyed by the rendered label set, e.g. `service="eesi"`.
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+
+  // Returns the family `name`, creating it with `help` and `type`. Returns
+  // null if the family exists with another type. Must be called with
+  // mutex_ held.
+  Family *GetFamilyLocked(const std::string &name, const std::string &help,
+                          const std::string &type);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+// Histogram of the wall time of the LLVM pass `pass_name`.
+Histogram *PassDurationHistogram(const std::string &pass_name);
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_H_
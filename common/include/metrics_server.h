@@ -0,0 +1,46 @@
+// Exports the metrics of the process: the latency and status of the calls to
+// its gRPC servers, and the MetricsRegistry over HTTP at /metrics so that
+// Prometheus can scrape it.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_SERVER_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_SERVER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "include/grpcpp/grpcpp.h"
+#include "metrics.h"
+
+namespace error_specifications {
+
+// Records the latency and status code of every call to a server built by
+// `builder`, labelled by service and method.
+void AddRpcMetrics(grpc::ServerBuilder *builder);
+
+// Serves MetricsRegistry::Global() over HTTP at /metrics.
+class MetricsEndpoint {
+ public:
+  MetricsEndpoint() = default;
+
+  // Stops serving.
+  ~MetricsEndpoint();
+
+  // Listens on `address`, given as host:port, and serves scrapes on a
+  // thread of its own. Returns UNAVAILABLE if it cannot listen.
+  grpc::Status Start(const std::string &address);
+
+ private:
+  void Serve();
+
+  // Answers the request on `connection` and closes it.
+  void Respond(int connection);
+
+  int listen_fd_ = -1;
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_SERVER_H_
@@ -0,0 +1,88 @@
+// Publishes the progress of an operation that runs LLVM analysis passes.
+//
+// A task creates an OperationProgressReporter for its operation and hands it
+// to its passes as their ProgressReporter. The reporter publishes a
+// ProgressMetadata through OperationsServiceImpl::UpdateOperation at most
+// once per interval, and keeps the PerformanceReport of the operation.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATION_PROGRESS_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATION_PROGRESS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "tbb/mutex.h"
+
+#include "include/grpcpp/grpcpp.h"
+#include "operations_service.h"
+#include "progress.h"
+#include "proto/operations.grpc.pb.h"
+
+namespace error_specifications {
+
+// Default minimum time between two published progress updates.
+constexpr std::chrono::milliseconds kDefaultProgressInterval(1000);
+
+class OperationProgressReporter final : public ProgressReporter {
+ public:
+  OperationProgressReporter(
+      OperationsServiceImpl *operations_service,
+      const std::string &operation_name,
+      std::chrono::milliseconds min_interval = kDefaultProgressInterval);
+
+  // Always published.
+  void StartPass(const std::string &pass_name, uint64_t sccs_total,
+                 uint64_t functions_total) override;
+
+  void SccDone() override;
+
+  void FunctionAnalyzed() override;
+
+  void AddPhase(const StepUsage &phase) override;
+  void AddPass(const StepUsage &pass) override;
+
+  std::chrono::steady_clock::time_point StartTime() const override {
+    return start_time_;
+  }
+
+  // Returns the progress so far.
+  ProgressMetadata GetProgress() const;
+
+  // Stores the progress so far in the metadata of `operation`.
+  void FillMetadata(Operation *operation) const;
+
+  // Writes the performance report as a Chrome trace, which chrome://tracing
+  // and Perfetto display, to a file named after the operation in
+  // `directory`.
+  grpc::Status WriteTrace(const std::string &directory) const;
+
+ private:
+  // Publishes the progress if min_interval_ has passed since the last time,
+  // or unconditionally if `force` is set.
+  void MaybePublish(bool force);
+
+  OperationsServiceImpl *operations_service_;
+  const std::string operation_name_;
+  const std::chrono::steady_clock::duration min_interval_;
+  const std::chrono::steady_clock::time_point start_time_;
+
+  // Guards current_pass_, performance_, and publishing.
+  mutable tbb::mutex mutex_;
+  std::string current_pass_;
+  PerformanceReport performance_;
+  std::chrono::steady_clock::time_point last_publish_time_;
+
+  // Counters are bumped from the passes' inner loops, so they are atomic and
+  // checking whether to publish does not take the lock.
+  std::atomic<uint64_t> sccs_done_{0};
+  std::atomic<uint64_t> sccs_total_{0};
+  std::atomic<uint64_t> functions_analyzed_{0};
+  std::atomic<uint64_t> functions_total_{0};
+  std::atomic<int64_t> next_publish_ns_{0};
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATION_PROGRESS_H_
@@ -5,27 +5,76 @@
 //
 // The operations service follows the way Google cloud APIs work
 // (see operations.proto).
+//
+// Identical requests that arrive while the first one is still running share
+// its task. Each request gets an operation of its own name, and every
+// update of the shared task, including its result, is published to all of
+// them. Cancelling one of them only detaches it; the task is cancelled once
+// every operation attached to it is.
 
 #ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATIONS_SERVICE_H_
 #define ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATIONS_SERVICE_H_
 
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "async_server.h"
+#include "cancellation.h"
 #include "proto/operations.grpc.pb.h"
+#include "result_cache.h"
 #include "tbb/concurrent_hash_map.h"
 
 namespace error_specifications {
 
+// The latest state of one operation, shared with everyone watching it.
+struct OperationState {
+  Operation operation;
+
+  // Incremented on every update so that watchers can tell whether they have
+  // already sent the current state.
+  uint64_t version = 0;
+
+  // Guards `operation`, `version` and `subscribers`. Signalled on every
+  // update.
+  std::mutex mutex;
+  std::condition_variable updated;
+
+  // Called with `mutex` held after every update, by ID, so that watchers
+  // served on the completion queues need not wait on `updated`. They must
+  // not block.
+  std::unordered_map<uint64_t, std::function<void()>> subscribers;
+  uint64_t next_subscriber_id = 0;
+
+  // Set by CancelOperation and polled by the task running the operation.
+  // Shared so that the task can hold on to it after the state is erased.
+  std::shared_ptr<CancellationToken> cancellation_token =
+      std::make_shared<CancellationToken>();
+};
+
 // Maps string operation task names to the current operation structure.
-using OperationTable = tbb::concurrent_hash_map<std::string, Operation>;
+using OperationTable =
+    tbb::concurrent_hash_map<std::string, std::shared_ptr<OperationState>>;
+
+class WatchOperationCall;
 
 // Logic and data behind the server's behavior.
 class OperationsServiceImpl final : public OperationsService::Service {
+  friend class WatchOperationCall;
+
   grpc::Status GetOperation(grpc::ServerContext *context,
                             const GetOperationRequest *request,
                             Operation *operation) override;
 
+  grpc::Status WatchOperation(grpc::ServerContext *context,
+                              const WatchOperationRequest *request,
+                              grpc::ServerWriter<Operation> *writer) override;
+
   grpc::Status DeleteOperation(grpc::ServerContext *context,
                                const DeleteOperationRequest *request,
                                Operation *operation) override;
@@ -34,14 +83,95 @@ class OperationsServiceImpl final : public OperationsService::Service {
                                const CancelOperationRequest *request,
                                ::google::protobuf::Empty *response) override;
 
+  grpc::Status InvalidateResults(grpc::ServerContext *context,
+                                 const InvalidateResultsRequest *request,
+                                 InvalidateResultsResponse *response) override;
+
+  // Removes `operation_name` from the table if it still maps to `state`.
+  void EraseOperation(const std::string &operation_name,
+                      const std::shared_ptr<OperationState> &state);
+
+  // Stores `operation` as the latest state of `operation_name`.
+  void PublishOperation(const std::string &operation_name,
+                        const Operation &operation);
+
+  // Finishes `operation_name` with an error without touching its task.
+  void FinishWithError(const std::string &operation_name,
+                       grpc::StatusCode code, const std::string &message);
+
+  // One task and the operations attached to it.
+  struct InFlightTask {
+    // The operation the task was started for and publishes its updates to.
+    std::string task_name;
+    // The operations that receive the updates, in order of arrival. The
+    // task's own operation leaves it if it is cancelled before the others.
+    std::vector<std::string> operation_names;
+    // The token the task polls.
+    std::shared_ptr<CancellationToken> cancellation_token;
+  };
+
   // A map from operation names to the latest Operation message.
   OperationTable operation_progress_;
 
+  // Results memoized by the service, if it memoizes any. Not owned.
+  ResultCache *result_cache_ = nullptr;
+
+  // Guards the three maps below. Taken before the lock of any operation.
+  std::mutex in_flight_mutex_;
+  // Running tasks by the key of their request.
+  std::unordered_map<std::string, InFlightTask> in_flight_tasks_;
+  // The request key of every running task by its task name, and of every
+  // operation attached to one by its name.
+  std::unordered_map<std::string, std::string> in_flight_task_keys_;
+  std::unordered_map<std::string, std::string> in_flight_operation_keys_;
+
  public:
   // This is not part of the service API and is meant to be called
   // only from the service to update the progress of a running
   // operation.
   void UpdateOperation(std::string name, Operation operation);
+
+  // Serves the operations RPCs on `server`, which must not outlive this
+  // service.
+  void AddToAsyncServer(AsyncServer *server);
+
+  // Returns the token that CancelOperation sets for `name`. Like
+  // UpdateOperation, this is meant to be called from the service, after the
+  // operation has been created and before its task is started.
+  std::shared_ptr<const CancellationToken> GetCancellationToken(
+      const std::string &name);
+
+  // Forgets the operation `name` without finishing it. Meant for services
+  // that created an operation but could not start its task. Operations that
+  // attached to it in the meantime are finished with `status`.
+  void DiscardOperation(const std::string &name,
+                        const grpc::Status &status = grpc::Status(
+                            grpc::StatusCode::ABORTED,
+                            "The shared operation could not be started."));
+
+  // If a task for an identical request, identified by `request_key`, is
+  // running, attaches the new operation `name` to it, copies its current
+  // state into `operation`, and returns true. The service then does not
+  // need to start a task. Otherwise records `name` as the task for
+  // `request_key` until it finishes and returns false.
+  bool AttachToRunningTask(const std::string &name,
+                           const std::string &request_key,
+                           Operation *operation);
+
+  // Makes InvalidateResults drop entries from `result_cache`, which must
+  // outlive this service.
+  void SetResultCache(ResultCache *result_cache) {
+    result_cache_ = result_cache;
+  }
+
+  // If a result is memoized under `result_key`, finishes the operation
+  // `name` with it, copies it into `operation`, and returns true. The
+  // service then does not need to start a task. Results that `is_valid`
+  // rejects, e.g. because a file they describe has changed, count as misses.
+  bool FinishFromResultCache(
+      const std::string &name, const std::string &result_key,
+      Operation *operation,
+      const std::function<bool(const Operation &)> &is_valid = nullptr);
 };
 
 }  // namespace error_specifications.
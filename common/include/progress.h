@@ -0,0 +1,130 @@
+// Progress reporting and cancellation for operations that run LLVM analysis
+// passes.
+//
+// A task adds a ProgressReporterPass wrapping the ProgressReporter of its
+// operation to the pass manager. Passes look the reporter up with
+// getAnalysisIfAvailable<ProgressReporterPass>(), which also works for
+// passes that the pass manager creates to satisfy addRequired, and report
+// what they have done. The operation's CancellationToken reaches the passes
+// the same way, through a CancellationTokenPass.
+//
+// The task times its phases, such as downloading and parsing the bitcode,
+// with StepTimers, and every pass times itself with a PassTimer.
+//
+// Nothing here depends on gRPC, so the passes can be linked without the
+// servers. OperationProgressReporter, in operation_progress.h, publishes the
+// progress of an operation through the operations service.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_PROGRESS_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_PROGRESS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "llvm/Pass.h"
+
+#include "cancellation.h"
+#include "metrics.h"
+#include "proto/operations.pb.h"
+
+namespace error_specifications {
+
+// Receives what the passes run for one operation have done, and the
+// performance report of the operation.
+class ProgressReporter {
+ public:
+  virtual ~ProgressReporter() = default;
+
+  // Starts reporting for a new pass and resets the per-pass counters.
+  virtual void StartPass(const std::string &pass_name, uint64_t sccs_total,
+                         uint64_t functions_total) = 0;
+
+  // Records that the current pass finished one call graph SCC.
+  virtual void SccDone() = 0;
+
+  // Records that the current pass analyzed one function.
+  virtual void FunctionAnalyzed() = 0;
+
+  // Adds a finished step to the performance report.
+  virtual void AddPhase(const StepUsage &phase) = 0;
+  virtual void AddPass(const StepUsage &pass) = 0;
+
+  // When the operation started, which steps are reported relative to.
+  virtual std::chrono::steady_clock::time_point StartTime() const = 0;
+};
+
+// Makes a ProgressReporter available to every pass run by a pass manager.
+// The pass does not own the reporter.
+class ProgressReporterPass : public llvm::ImmutablePass {
+ public:
+  static char ID;
+
+  ProgressReporterPass() : ProgressReporterPass(nullptr) {}
+  explicit ProgressReporterPass(ProgressReporter *progress_reporter)
+      : llvm::ImmutablePass(ID), progress_reporter_(progress_reporter) {}
+
+  ProgressReporter *GetProgressReporter() const { return progress_reporter_; }
+
+ private:
+  ProgressReporter *progress_reporter_;
+};
+
+// Makes the cancellation token of an operation available to every pass run
+// by a pass manager. The pass does not own the token.
+class CancellationTokenPass : public llvm::ImmutablePass {
+ public:
+  static char ID;
+
+  CancellationTokenPass() : CancellationTokenPass(nullptr) {}
+  explicit CancellationTokenPass(const CancellationToken *cancellation_token)
+      : llvm::ImmutablePass(ID), cancellation_token_(cancellation_token) {}
+
+  const CancellationToken *GetCancellationToken() const {
+    return cancellation_token_;
+  }
+
+ private:
+  const CancellationToken *cancellation_token_;
+};
+
+// Measures one step of an operation from its construction until Stop() or
+// its destruction, and adds it to the performance report of `progress`,
+// unless `progress` is null.
+class StepTimer {
+ public:
+  enum class Kind { kPhase, kPass };
+
+  StepTimer(ProgressReporter *progress, Kind kind, const std::string &name);
+
+  ~StepTimer() { Stop(); }
+
+  // Adds the step to the report. Only the first call has an effect.
+  void Stop();
+
+ private:
+  ProgressReporter *progress_;
+  const Kind kind_;
+  const std::string name_;
+  const std::chrono::steady_clock::time_point start_time_;
+  const double start_cpu_seconds_;
+  const uint64_t start_peak_rss_bytes_;
+  bool stopped_ = false;
+};
+
+// Times a run of `pass`. Constructed at the top of runOnModule, it records
+// the wall time in the pass_duration_seconds metric and, if the pass manager
+// has a ProgressReporterPass, the pass in the performance report of the
+// operation.
+class PassTimer {
+ public:
+  PassTimer(const llvm::Pass *pass, const std::string &pass_name);
+
+ private:
+  ScopedTimer duration_timer_;
+  StepTimer step_timer_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_PROGRESS_H_
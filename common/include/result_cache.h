@@ -0,0 +1,126 @@
+// Memoization of finished operations shared by the services.
+//
+// Long-running RPCs such as GetSpecifications are deterministic for a given
+// bitcode handle and request, so their finished Operation is cached under a
+// key made of the RPC name, the bitcode ID, and a hash of the request. A
+// repeated request is answered with the cached Operation without starting a
+// task. Entries are kept in memory and, if a directory is given, on local
+// disk so that they survive restarts. Both tiers evict in
+// least-recently-used order once they exceed their byte budget.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_RESULT_CACHE_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_RESULT_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "google/protobuf/message.h"
+#include "tbb/mutex.h"
+
+#include "proto/operations.grpc.pb.h"
+
+namespace error_specifications {
+
+// Default budgets for the result cache, measured in bytes of serialized
+// Operations.
+constexpr uint64_t kDefaultResultCacheMemoryBytes = 64ULL << 20;
+constexpr uint64_t kDefaultResultCacheDiskBytes = 1ULL << 30;
+
+// Budgets and location of a ResultCache. A zero budget disables the
+// corresponding tier, and an empty directory keeps results in memory only.
+struct ResultCacheOptions {
+  uint64_t memory_bytes = kDefaultResultCacheMemoryBytes;
+  std::string directory;
+  uint64_t disk_bytes = kDefaultResultCacheDiskBytes;
+};
+
+// Counters describing how effective the cache has been.
+struct ResultCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t memory_entries = 0;
+  uint64_t memory_bytes = 0;
+  uint64_t disk_entries = 0;
+  uint64_t disk_bytes = 0;
+};
+
+class ResultCache {
+ public:
+  explicit ResultCache(
+      const ResultCacheOptions &options = ResultCacheOptions());
+
+  // Returns the key for `request` to the RPC `rpc_name` on `bitcode_id`.
+  // The request is serialized deterministically before it is hashed, so
+  // equal requests always get the same key.
+  static std::string MakeKey(const std::string &rpc_name,
+                             const std::string &bitcode_id,
+                             const google::protobuf::Message &request);
+
+  // Copies the cached operation for `key` into `out_operation` and returns
+  // true on a hit. The name of the cached operation is the name it was
+  // stored under and should be replaced by the caller.
+  bool Lookup(const std::string &key, Operation *out_operation);
+
+  // Caches `operation` under `key` if it finished successfully. Failed and
+  // unfinished operations are never cached.
+  void Insert(const std::string &key, const Operation &operation);
+
+  // Drops every result computed from `bitcode_id`, or every result if it is
+  // empty. Returns the number of entries removed from either tier.
+  uint64_t Invalidate(const std::string &bitcode_id);
+
+  ResultCacheStats GetStats() const;
+
+ private:
+  // Least-recently-used bookkeeping for one tier.
+  struct Tier {
+    struct Entry {
+      // Only set in the memory tier.
+      std::string serialized_operation;
+      uint64_t size_bytes = 0;
+      // Position of the key in lru.
+      std::list<std::string>::iterator lru_position;
+    };
+
+    uint64_t max_bytes = 0;
+    uint64_t size_bytes = 0;
+    // Keys ordered from most to least recently used.
+    std::list<std::string> lru;
+    std::unordered_map<std::string, Entry> entries;
+  };
+
+  // Adds or replaces `key` in `tier` as the most recently used entry.
+  // Must be called with mutex_ held.
+  void PutLocked(Tier *tier, const std::string &key,
+                 std::string serialized_operation, uint64_t size_bytes);
+
+  // Removes `key` from `tier`, and from disk if `tier` is disk_. Must be
+  // called with mutex_ held.
+  void EraseLocked(Tier *tier, const std::string &key);
+
+  // Evicts least-recently-used entries until `tier` fits its budget.
+  // Must be called with mutex_ held.
+  void EvictLocked(Tier *tier);
+
+  // Adds the entries left on disk by a previous run to disk_, oldest first.
+  void LoadDiskEntries();
+
+  std::string EntryPath(const std::string &key) const;
+
+  std::string directory_;
+  Tier memory_;
+  Tier disk_;
+  mutable tbb::mutex mutex_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> evictions_{0};
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_RESULT_CACHE_H_
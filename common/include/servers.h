@@ -4,7 +4,10 @@
 #ifndef ERROR_SPECIFICATIONS_COMMON_SERVERS_H_
 #define ERROR_SPECIFICATIONS_COMMON_SERVERS_H_
 
+#include <memory>
+
 #include "include/grpcpp/grpcpp.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "proto/operations.grpc.pb.h"
 
 namespace error_specifications {
@@ -45,9 +48,39 @@ grpc::Status ConvertUriToFilePath(const Uri &uri, std::string &out_file_path);
 
 Uri FilePathToUri(const std::string &file_path);
 
+// Files are read and hashed this many bytes at a time.
+constexpr size_t kHashBlockSize = 1 << 20;
+
+// Size of the blocks that are hashed in parallel by TreeHashBytes.
+constexpr size_t kTreeHashBlockSize = 16 << 20;
+
+// Prefix that distinguishes tree hashes from plain sha256 hashes.
+constexpr char kTreeHashPrefix[] = "tree-";
+
 grpc::Status HashString(const std::string &bitcode_data,
                         std::string &out_hashed_bitcode_data);
 
+// Same as HashString, but hashes `length` bytes starting at `data` so that
+// callers holding a MemoryBuffer do not need to copy it into a string.
+grpc::Status HashBytes(const char *data, size_t length,
+                       std::string &out_hashed_data);
+
+// Computes the same hash as HashString for the file at `file_path`, reading
+// it in blocks of kHashBlockSize bytes instead of all at once.
+grpc::Status HashFile(const std::string &file_path,
+                      std::string &out_hashed_data);
+
+// Splits the data into blocks of kTreeHashBlockSize bytes, hashes the blocks
+// in parallel, and hashes the concatenated block hashes. The result is
+// prefixed with kTreeHashPrefix and differs from HashBytes for the same data.
+grpc::Status TreeHashBytes(const char *data, size_t length,
+                           std::string &out_hashed_data);
+
+// Hashes the data the same way `hashed_string` was produced, i.e. with
+// TreeHashBytes if it carries kTreeHashPrefix and HashBytes otherwise.
+grpc::Status HashBytesLike(const std::string &hashed_string, const char *data,
+                           size_t length, std::string &out_hashed_data);
+
 // Overriding operator for cleaner Uri printing
 inline std::ostream &operator<<(std::ostream &stream, const Uri& uri) {
   return stream << UriSchemes::scheme_to_string.at(uri.scheme()) + "://" 
@@ -62,8 +95,15 @@ std::string StripSuffixAfterDot(const std::string &string);
 
 grpc::Status ReadUriIntoString(const Uri &uri, std::string &data);
 
+// Reads the contents of `uri` into a MemoryBuffer. Local files are memory
+// mapped by LLVM instead of being copied; other schemes fall back to
+// ReadUriIntoString.
+grpc::Status ReadUriIntoBuffer(const Uri &uri,
+                               std::unique_ptr<llvm::MemoryBuffer> *out_buffer);
+
 // Returns a string representing the task name comprised of the RPC call, the
-// bitcode ID, and a time stamp.
+// bitcode ID, a sequence number, and a time stamp. Names are unique within
+// the process, even for identical requests made at the same time.
 std::string GetTaskName(const std::string &request_name,
                         const std::string &bitcode_id);
 
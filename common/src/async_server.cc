@@ -0,0 +1,165 @@
+#include "async_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "glog/logging.h"
+#include "metrics.h"
+#include "metrics_server.h"
+
+namespace error_specifications {
+
+void AsyncCallCounter::Begin() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  calls_++;
+}
+
+void AsyncCallCounter::End() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  calls_--;
+  ended_.notify_all();
+}
+
+void AsyncCallCounter::WaitForNone() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ended_.wait(lock, [this] { return calls_ == 0; });
+}
+
+AsyncWorkerPool::AsyncWorkerPool(int num_threads, int max_queued_calls)
+    : max_queued_calls_(std::max(max_queued_calls, 0)) {
+  for (int i = 0; i < std::max(num_threads, 1); i++) {
+    threads_.emplace_back([this] { Work(); });
+  }
+}
+
+grpc::Status AsyncWorkerPool::Submit(std::function<void()> work) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Calls that idle threads are about to pick up do not count as waiting.
+  if (stopping_ || queue_.size() >= idle_threads_ + max_queued_calls_) {
+    const std::string &err_msg =
+        "Too many calls are waiting to be served. Try again later.";
+    LOG(WARNING) << err_msg;
+    return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, err_msg);
+  }
+  queue_.push_back(std::move(work));
+  work_available_.notify_one();
+
+  return grpc::Status::OK;
+}
+
+void AsyncWorkerPool::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    work_available_.notify_all();
+  }
+  for (std::thread &thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+void AsyncWorkerPool::Work() {
+  while (true) {
+    std::function<void()> work;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_threads_++;
+      work_available_.wait(lock,
+                           [this] { return stopping_ || !queue_.empty(); });
+      idle_threads_--;
+      if (queue_.empty()) {
+        return;
+      }
+      work = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    work();
+  }
+}
+
+AsyncServer::AsyncServer(const AsyncServerOptions &options)
+    : num_polling_threads_(std::max(options.polling_threads, 1)),
+      worker_pool_(options.worker_threads, options.max_queued_calls) {}
+
+AsyncServer::~AsyncServer() { Shutdown(); }
+
+grpc::Status AsyncServer::Start(const std::string &server_address) {
+  // Listen on the given address without any authentication mechanism.
+  builder_.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder_);
+  for (int i = 0; i < num_polling_threads_; i++) {
+    queues_.push_back(builder_.AddCompletionQueue());
+  }
+  server_ = builder_.BuildAndStart();
+  if (!server_) {
+    const std::string &err_msg =
+        "Unable to start the server on " + server_address + ".";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, err_msg);
+  }
+
+  for (const auto &queue : queues_) {
+    for (const auto &start : starts_) {
+      start(queue.get());
+    }
+    grpc::ServerCompletionQueue *polled_queue = queue.get();
+    polling_threads_.emplace_back([this, polled_queue] { Poll(polled_queue); });
+  }
+  std::cout << "Server listening on " << server_address << std::endl;
+
+  return grpc::Status::OK;
+}
+
+void AsyncServer::Wait() {
+  std::unique_lock<std::mutex> lock(shutdown_mutex_);
+  shut_down_.wait(lock, [this] { return stopped_; });
+}
+
+void AsyncServer::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(shutdown_mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    shutting_down_ = true;
+  }
+
+  if (server_) {
+    // Without a deadline, Shutdown would wait for streams that never end on
+    // their own. Cancelling the calls in flight makes their writes fail,
+    // which finishes them while the polling threads are still running.
+    server_->Shutdown(std::chrono::system_clock::now());
+  }
+  worker_pool_.Stop();
+  // The calls finish once they notice they were cancelled, and the calls
+  // waiting for a client once they notice the server shut down, which takes
+  // a trip through their completion queue.
+  calls_.WaitForNone();
+  for (const auto &queue : queues_) {
+    queue->Shutdown();
+  }
+  for (std::thread &thread : polling_threads_) {
+    thread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(shutdown_mutex_);
+  stopped_ = true;
+  shut_down_.notify_all();
+}
+
+void AsyncServer::Poll(grpc::ServerCompletionQueue *queue) {
+  void *tag;
+  bool ok;
+  // Next keeps returning the tags left in the queue after it is shut down
+  // and returns false once it has been drained.
+  while (queue->Next(&tag, &ok)) {
+    static_cast<AsyncTag *>(tag)->Proceed(ok);
+  }
+}
+
+}  // namespace error_specifications
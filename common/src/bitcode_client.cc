@@ -0,0 +1,213 @@
+#include "bitcode_client.h"
+
+#include <cctype>
+#include <cstring>
+#include <string>
+
+#include "glog/logging.h"
+#include "include/grpcpp/grpcpp.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "metrics.h"
+#include "proto/bitcode.grpc.pb.h"
+#include "servers.h"
+
+namespace error_specifications {
+
+grpc::Status DownloadBitcodeIntoBuffer(
+    const std::string &bitcode_server_address, const Handle &bitcode_id,
+    std::unique_ptr<llvm::MemoryBuffer> *out_buffer) {
+  // Connect to the bitcode service.
+  std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(
+      bitcode_server_address, grpc::InsecureChannelCredentials());
+  std::unique_ptr<BitcodeService::Stub> stub = BitcodeService::NewStub(channel);
+
+  grpc::ClientContext download_context;
+  DownloadBitcodeRequest download_req;
+  download_req.mutable_bitcode_id()->CopyFrom(bitcode_id);
+  std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
+      stub->DownloadBitcode(&download_context, download_req));
+
+  std::unique_ptr<llvm::WritableMemoryBuffer> buffer;
+  // Only used if the server did not send the total size.
+  std::string fallback_bytes;
+  uint64_t received = 0;
+  DataChunk chunk;
+  while (reader->Read(&chunk)) {
+    if (received == 0 && !buffer && chunk.total_size() > 0) {
+      buffer = llvm::WritableMemoryBuffer::getNewUninitMemBuffer(
+          chunk.total_size(), bitcode_id.id());
+    }
+    const std::string &content = chunk.content();
+    if (buffer) {
+      if (received + content.size() > buffer->getBufferSize()) {
+        const std::string &err_msg = "Received more bitcode than announced.";
+        LOG(ERROR) << err_msg;
+        download_context.TryCancel();
+        reader->Finish();
+        return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+      }
+      std::memcpy(buffer->getBufferStart() + received, content.data(),
+                  content.size());
+    } else {
+      fallback_bytes.append(content);
+    }
+    received += content.size();
+  }
+
+  static Counter *downloaded_bytes = MetricsRegistry::Global().GetCounter(
+      "bitcode_downloaded_bytes_total",
+      "Bytes of bitcode downloaded from the bitcode service.");
+  downloaded_bytes->Increment(received);
+
+  grpc::Status status = reader->Finish();
+  if (!status.ok()) {
+    LOG(ERROR) << "Unable to download bitcode: " << status.error_message();
+    return status;
+  }
+
+  if (!buffer) {
+    *out_buffer =
+        llvm::MemoryBuffer::getMemBufferCopy(fallback_bytes, bitcode_id.id());
+    return grpc::Status::OK;
+  }
+
+  if (received != buffer->getBufferSize()) {
+    const std::string &err_msg = "Bitcode download ended early.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+  }
+  *out_buffer = std::move(buffer);
+
+  return grpc::Status::OK;
+}
+
+// Handles are hex sha256 digests. Anything else is never used as a file name.
+static bool IsSha256Hex(const std::string &bitcode_id) {
+  // Tree hashes are the same length once their prefix is stripped.
+  std::string digest = bitcode_id;
+  if (digest.compare(0, strlen(kTreeHashPrefix), kTreeHashPrefix) == 0) {
+    digest = digest.substr(strlen(kTreeHashPrefix));
+  }
+  if (digest.size() != 64) {
+    return false;
+  }
+  for (char c : digest) {
+    if (!std::isxdigit(static_cast<unsigned char>(c))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns true if `buffer` hashes to `bitcode_id`.
+static bool MatchesHandle(const std::string &bitcode_id,
+                          const llvm::MemoryBuffer &buffer) {
+  std::string hash;
+  grpc::Status err = HashBytesLike(bitcode_id, buffer.getBufferStart(),
+                                   buffer.getBufferSize(), hash);
+  return err.ok() && hash == bitcode_id;
+}
+
+LocalBitcodeCache::LocalBitcodeCache(const std::string &cache_directory)
+    : cache_directory_(cache_directory) {
+  if (cache_directory_.empty()) {
+    return;
+  }
+  std::error_code error_code =
+      llvm::sys::fs::create_directories(cache_directory_);
+  if (error_code) {
+    LOG(ERROR) << "Unable to create bitcode cache directory "
+               << cache_directory_ << ": " << error_code.message()
+               << ". Bitcode will not be cached.";
+    cache_directory_.clear();
+  }
+}
+
+grpc::Status LocalBitcodeCache::GetBitcode(
+    const std::string &bitcode_server_address, const Handle &bitcode_id,
+    std::unique_ptr<llvm::MemoryBuffer> *out_buffer) {
+  const std::string &id = bitcode_id.id();
+  const bool cacheable = !cache_directory_.empty() && IsSha256Hex(id);
+
+  if (cacheable && ReadEntry(id, out_buffer)) {
+    hits_++;
+    LOG(INFO) << "Bitcode cache hit for " << id;
+    return grpc::Status::OK;
+  }
+  misses_++;
+
+  grpc::Status err =
+      DownloadBitcodeIntoBuffer(bitcode_server_address, bitcode_id, out_buffer);
+  if (!err.ok() || !cacheable) {
+    return err;
+  }
+
+  // Never cache bytes that do not match the handle they were requested by.
+  if (!MatchesHandle(id, **out_buffer)) {
+    const std::string &err_msg = "Downloaded bitcode does not match handle.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+  }
+  WriteEntry(id, **out_buffer);
+
+  return grpc::Status::OK;
+}
+
+bool LocalBitcodeCache::ReadEntry(
+    const std::string &bitcode_id,
+    std::unique_ptr<llvm::MemoryBuffer> *out_buffer) const {
+  const std::string path = cache_directory_ + "/" + bitcode_id + ".bc";
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return false;
+  }
+
+  if (!MatchesHandle(bitcode_id, **buffer)) {
+    LOG(WARNING) << "Discarding corrupt bitcode cache entry " << path;
+    llvm::sys::fs::remove(path);
+    return false;
+  }
+  *out_buffer = std::move(buffer.get());
+
+  return true;
+}
+
+void LocalBitcodeCache::WriteEntry(const std::string &bitcode_id,
+                                   const llvm::MemoryBuffer &buffer) const {
+  // Write to a unique temporary file and rename it into place so that
+  // concurrent readers never observe a partially written entry.
+  int fd;
+  llvm::SmallString<128> temp_path;
+  std::error_code error_code = llvm::sys::fs::createUniqueFile(
+      cache_directory_ + "/" + bitcode_id + "-%%%%%%.tmp", fd, temp_path);
+  if (error_code) {
+    LOG(ERROR) << "Unable to create bitcode cache entry: "
+               << error_code.message();
+    return;
+  }
+
+  {
+    llvm::raw_fd_ostream ostream(fd, /*shouldClose=*/true);
+    ostream.write(buffer.getBufferStart(), buffer.getBufferSize());
+    ostream.close();
+    if (ostream.has_error()) {
+      LOG(ERROR) << "Unable to write bitcode cache entry " << temp_path.c_str();
+      ostream.clear_error();
+      llvm::sys::fs::remove(temp_path);
+      return;
+    }
+  }
+
+  error_code = llvm::sys::fs::rename(
+      temp_path, cache_directory_ + "/" + bitcode_id + ".bc");
+  if (error_code) {
+    LOG(ERROR) << "Unable to commit bitcode cache entry: "
+               << error_code.message();
+    llvm::sys::fs::remove(temp_path);
+  }
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,191 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+OperationExecutor::OperationExecutor(const OperationExecutorOptions &options,
+                                     const std::string &service_name)
+    : max_concurrent_operations_(
+          std::max(options.max_concurrent_operations, 1)),
+      max_queued_operations_(std::max(options.max_queued_operations, 0)),
+      memory_budget_(options.memory_budget_bytes, service_name) {
+  MetricsRegistry &registry = MetricsRegistry::Global();
+  const MetricLabels labels = {{"service", service_name}};
+  running_gauge_ = registry.GetGauge(
+      "operations_running", "Long-running operations being run.", labels);
+  queued_gauge_ = registry.GetGauge(
+      "operations_queued", "Long-running operations waiting to run.", labels);
+  waiting_for_memory_gauge_ = registry.GetGauge(
+      "operations_waiting_for_memory",
+      "Analyses waiting for their module to fit in the memory budget.",
+      labels);
+  completed_counter_ =
+      registry.GetCounter("operations_completed_total",
+                          "Long-running operations that finished.", labels);
+  rejected_counter_ = registry.GetCounter(
+      "operations_rejected_total",
+      "Long-running operations rejected because the queue was full.", labels);
+  memory_budget_.SetChangedCallback([this] {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DispatchLocked();
+    PublishLocked();
+  });
+}
+
+OperationExecutor::~OperationExecutor() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this] {
+    return running_ == 0 && queued_ == 0 && admission_waiters_.empty();
+  });
+}
+
+grpc::Status OperationExecutor::Submit(OperationPriority priority,
+                                       std::function<void()> work) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return EnqueueLocked(priority, [work] {
+    work();
+    return true;
+  });
+}
+
+grpc::Status OperationExecutor::SubmitAnalysis(
+    OperationPriority priority,
+    std::shared_ptr<const CancellationToken> cancellation_token,
+    std::function<bool(uint64_t *bitcode_bytes)> fetch,
+    std::function<void(std::unique_ptr<MemoryReservation>)> analyze) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return EnqueueLocked(priority, [this, cancellation_token, fetch, analyze] {
+    AdmissionWaiter waiter;
+    if (!fetch(&waiter.bitcode_bytes)) {
+      return true;
+    }
+    waiter.cancellation_token = cancellation_token;
+    waiter.analyze = analyze;
+    waiter.queued_time = std::chrono::steady_clock::now();
+    // Dispatched once this part has given up its slot.
+    std::lock_guard<std::mutex> lock(mutex_);
+    admission_waiters_.push_back(std::move(waiter));
+    return false;
+  });
+}
+
+grpc::Status OperationExecutor::EnqueueLocked(OperationPriority priority,
+                                              Work work) {
+  // Operations that can start right away never count against the queue.
+  // Analyses waiting for memory do, since they were started from it.
+  if (running_ >= max_concurrent_operations_ &&
+      queued_ + static_cast<int>(admission_waiters_.size()) >=
+          max_queued_operations_) {
+    rejected_++;
+    rejected_counter_->Increment();
+    const std::string &err_msg =
+        "Too many operations are waiting to run. Try again later.";
+    LOG(WARNING) << err_msg;
+    return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, err_msg);
+  }
+
+  queues_[static_cast<size_t>(priority)].push_back(std::move(work));
+  queued_++;
+  DispatchLocked();
+  PublishLocked();
+
+  return grpc::Status::OK;
+}
+
+OperationExecutorStats OperationExecutor::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  OperationExecutorStats stats;
+  stats.running = running_;
+  stats.queued = queued_;
+  stats.waiting_for_memory = admission_waiters_.size();
+  stats.completed = completed_;
+  stats.rejected = rejected_;
+
+  return stats;
+}
+
+void OperationExecutor::DispatchLocked() {
+  while (running_ < max_concurrent_operations_) {
+    // Cancelled analyses only need a slot to report that they were
+    // cancelled.
+    auto cancelled = std::find_if(
+        admission_waiters_.begin(), admission_waiters_.end(),
+        [](const AdmissionWaiter &waiter) {
+          return IsCancelled(waiter.cancellation_token.get());
+        });
+    if (cancelled != admission_waiters_.end()) {
+      auto analyze = std::move(cancelled->analyze);
+      admission_waiters_.erase(cancelled);
+      StartLocked([analyze] {
+        analyze(nullptr);
+        return true;
+      });
+      continue;
+    }
+
+    if (!admission_waiters_.empty()) {
+      AdmissionWaiter &waiter = admission_waiters_.front();
+      std::unique_ptr<MemoryReservation> reservation = memory_budget_.TryAdmit(
+          waiter.bitcode_bytes, waiter.queued_time, waiter.waited);
+      if (reservation) {
+        auto analyze = std::move(waiter.analyze);
+        admission_waiters_.pop_front();
+        // Work is copyable, so it holds on to the reservation through a
+        // shared pointer until it hands it over.
+        auto admitted = std::make_shared<std::unique_ptr<MemoryReservation>>(
+            std::move(reservation));
+        StartLocked([analyze, admitted] {
+          analyze(std::move(*admitted));
+          return true;
+        });
+        continue;
+      }
+      waiter.waited = true;
+    }
+
+    // Queued operations fetch their bitcode while the waiting analyses do
+    // not fit.
+    auto queue = std::find_if(
+        queues_.begin(), queues_.end(),
+        [](const std::deque<Work> &queue) { return !queue.empty(); });
+    if (queue == queues_.end()) {
+      break;
+    }
+    Work work = std::move(queue->front());
+    queue->pop_front();
+    queued_--;
+    StartLocked(std::move(work));
+  }
+}
+
+void OperationExecutor::StartLocked(Work work) {
+  running_++;
+  arena_.enqueue([this, work] { Run(work); });
+}
+
+void OperationExecutor::Run(const Work &work) {
+  const bool finished = work();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_--;
+  if (finished) {
+    completed_++;
+    completed_counter_->Increment();
+  }
+  DispatchLocked();
+  PublishLocked();
+  finished_.notify_all();
+}
+
+void OperationExecutor::PublishLocked() {
+  running_gauge_->Set(running_);
+  queued_gauge_->Set(queued_);
+  waiting_for_memory_gauge_->Set(admission_waiters_.size());
+}
+
+}  // namespace error_specifications
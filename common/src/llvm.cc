@@ -3,6 +3,7 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Instructions.h"
 
+#include "metrics.h"
 #include "proto/bitcode.pb.h"
 #include "servers.h"
 
@@ -72,6 +73,41 @@ bool IsVoidFunction(const llvm::Function &function) {
          FunctionReturnType::FUNCTION_RETURN_TYPE_VOID;
 }
 
+uint64_t CountDefinedFunctions(const llvm::Module &module) {
+  uint64_t defined_functions = 0;
+  for (const llvm::Function &function : module) {
+    if (!function.isDeclaration()) {
+      defined_functions++;
+    }
+  }
+  return defined_functions;
+}
+
+uint64_t CountInstructions(const llvm::Module &module) {
+  uint64_t instructions = 0;
+  for (const llvm::Function &function : module) {
+    instructions += function.getInstructionCount();
+  }
+  return instructions;
+}
+
+void RecordParsedModuleMetrics(const llvm::Module &module,
+                               uint64_t size_bytes) {
+  MetricsRegistry &registry = MetricsRegistry::Global();
+  static Counter *parsed_bytes = registry.GetCounter(
+      "bitcode_parsed_bytes_total", "Bytes of bitcode parsed into modules.");
+  static Histogram *module_functions = registry.GetHistogram(
+      "module_functions", "Defined functions of each parsed module.",
+      ExponentialBuckets(1, 4, 12));
+  static Histogram *module_instructions = registry.GetHistogram(
+      "module_instructions", "Instructions of each parsed module.",
+      ExponentialBuckets(16, 4, 12));
+
+  parsed_bytes->Increment(size_bytes);
+  module_functions->Observe(CountDefinedFunctions(module));
+  module_instructions->Observe(CountInstructions(module));
+}
+
 Location GetDebugLocation(const llvm::Instruction &inst) {
   if (llvm::DILocation *loc = inst.getDebugLoc()) {
     Location location;
@@ -0,0 +1,287 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+// How often waiting tasks check whether they were cancelled.
+constexpr std::chrono::milliseconds kAdmissionPollInterval(100);
+
+// Weight of the latest measured task in the bytes per instruction.
+constexpr double kCalibrationWeight = 0.25;
+
+// Reads the field `name`, given in kilobytes, of /proc/self/status. Returns 0
+// if it cannot be read.
+static uint64_t ReadProcessStatusBytes(const std::string &name) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, name.size() + 1, name + ":") == 0) {
+      return std::stoull(line.substr(name.size() + 1)) * 1024;
+    }
+  }
+  return 0;
+}
+
+MemoryReservation::~MemoryReservation() { budget_->Release(*this); }
+
+MemoryBudget::MemoryBudget(uint64_t budget_bytes,
+                           const std::string &service_name)
+    : budget_bytes_(budget_bytes) {
+  MetricsRegistry &registry = MetricsRegistry::Global();
+  const MetricLabels labels = {{"service", service_name}};
+  registry
+      .GetGauge("memory_budget_bytes",
+                "Memory that admitted tasks may use together. 0 if unlimited.",
+                labels)
+      ->Set(budget_bytes_);
+  reserved_gauge_ = registry.GetGauge(
+      "memory_reserved_bytes", "Estimated memory of the admitted tasks.",
+      labels);
+  waiting_gauge_ = registry.GetGauge(
+      "memory_admission_waiting",
+      "Tasks waiting for their estimated memory to fit in the budget.",
+      labels);
+  bytes_per_instruction_gauge_ = registry.GetGauge(
+      "memory_estimate_bytes_per_instruction",
+      "Calibrated analysis memory per instruction of a module.", labels);
+  bytes_per_instruction_gauge_->Set(bytes_per_instruction_);
+  const std::string admissions_help =
+      "Tasks admitted to the memory budget, or cancelled while waiting.";
+  MetricLabels decision_labels = labels;
+  decision_labels.emplace_back("decision", "immediate");
+  admitted_immediately_counter_ = registry.GetCounter(
+      "memory_admissions_total", admissions_help, decision_labels);
+  decision_labels.back().second = "queued";
+  admitted_after_wait_counter_ = registry.GetCounter(
+      "memory_admissions_total", admissions_help, decision_labels);
+  decision_labels.back().second = "cancelled";
+  cancelled_counter_ = registry.GetCounter("memory_admissions_total",
+                                           admissions_help, decision_labels);
+  wait_histogram_ = registry.GetHistogram(
+      "memory_admission_wait_seconds",
+      "Time tasks waited for their estimated memory to fit in the budget.",
+      DurationBuckets(), labels);
+  // From a megabyte to 64 gigabytes.
+  const std::vector<double> byte_buckets =
+      ExponentialBuckets(1 << 20, 2, 17);
+  estimate_histogram_ =
+      registry.GetHistogram("task_memory_estimate_bytes",
+                            "Estimated peak memory of admitted tasks.",
+                            byte_buckets, labels);
+  peak_histogram_ = registry.GetHistogram(
+      "task_memory_peak_bytes",
+      "Measured peak memory of tasks that ran alone, from admission on.",
+      byte_buckets, labels);
+}
+
+uint64_t MemoryBudget::Estimate(uint64_t bitcode_bytes,
+                                uint64_t instructions) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<uint64_t>(
+      kParsedModuleBytesPerBitcodeByte * bitcode_bytes +
+      bytes_per_instruction_ * instructions);
+}
+
+std::unique_ptr<MemoryReservation> MemoryBudget::Admit(
+    uint64_t bitcode_bytes, const CancellationToken *cancellation_token) {
+  const uint64_t estimated_bytes = Estimate(bitcode_bytes, 0);
+  const auto start_time = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool waited = false;
+  if (!WaitLocked(&lock, false, estimated_bytes, cancellation_token,
+                  &waited)) {
+    lock.unlock();
+    if (changed_callback_) {
+      changed_callback_();
+    }
+    return nullptr;
+  }
+  std::unique_ptr<MemoryReservation> reservation =
+      AdmitLocked(estimated_bytes, start_time, waited);
+  lock.unlock();
+  // Tasks queued behind this one may go ahead now.
+  if (waited && changed_callback_) {
+    changed_callback_();
+  }
+
+  return reservation;
+}
+
+std::unique_ptr<MemoryReservation> MemoryBudget::TryAdmit(
+    uint64_t bitcode_bytes, std::chrono::steady_clock::time_point queued_time,
+    bool waited) {
+  const uint64_t estimated_bytes = Estimate(bitcode_bytes, 0);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!waiters_.empty() || !FitsLocked(estimated_bytes)) {
+    return nullptr;
+  }
+  return AdmitLocked(estimated_bytes, queued_time, waited);
+}
+
+std::unique_ptr<MemoryReservation> MemoryBudget::AdmitLocked(
+    uint64_t estimated_bytes, std::chrono::steady_clock::time_point start_time,
+    bool waited) {
+  std::unique_ptr<MemoryReservation> reservation(
+      new MemoryReservation(this, estimated_bytes));
+  // The peak of a task can only be told apart from the others' if it runs
+  // alone.
+  if (measured_) {
+    measured_->measurable_ = false;
+    measured_ = nullptr;
+  }
+  if (admitted_ == 0) {
+    StartMeasuringLocked(reservation.get());
+  }
+  reserved_bytes_ += estimated_bytes;
+  admitted_++;
+  reserved_gauge_->Set(reserved_bytes_);
+  (waited ? admitted_after_wait_counter_ : admitted_immediately_counter_)
+      ->Increment();
+  wait_histogram_->Observe(std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start_time)
+                               .count());
+  // The next waiter may fit as well.
+  changed_.notify_all();
+
+  return reservation;
+}
+
+bool MemoryBudget::Grow(MemoryReservation *reservation, uint64_t instructions,
+                        const CancellationToken *cancellation_token) {
+  const auto start_time = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  const uint64_t extra_bytes =
+      static_cast<uint64_t>(bytes_per_instruction_ * instructions);
+  bool waited = false;
+  if (!WaitLocked(&lock, true, extra_bytes, cancellation_token, &waited)) {
+    lock.unlock();
+    if (changed_callback_) {
+      changed_callback_();
+    }
+    return false;
+  }
+
+  reservation->estimated_bytes_ += extra_bytes;
+  reservation->instructions_ += instructions;
+  // Only the memory of the analysis is calibrated against the instructions,
+  // not that of the module parsed so far.
+  if (reservation->measurable_) {
+    StartMeasuringLocked(reservation);
+  }
+  reserved_bytes_ += extra_bytes;
+  reserved_gauge_->Set(reserved_bytes_);
+  estimate_histogram_->Observe(reservation->estimated_bytes_);
+  wait_histogram_->Observe(std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start_time)
+                               .count());
+  changed_.notify_all();
+  lock.unlock();
+  if (waited && changed_callback_) {
+    changed_callback_();
+  }
+
+  return true;
+}
+
+void MemoryBudget::Release(const MemoryReservation &reservation) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (measured_ == &reservation) {
+    measured_ = nullptr;
+  }
+  // Only a new peak of the process is the peak of the task. Otherwise the
+  // process peaked earlier, on a task that may have been much larger.
+  const uint64_t peak_bytes =
+      reservation.measurable_ ? ReadProcessStatusBytes("VmHWM") : 0;
+  if (peak_bytes > reservation.start_peak_rss_bytes_) {
+    const uint64_t task_peak_bytes = peak_bytes - reservation.start_rss_bytes_;
+    peak_histogram_->Observe(task_peak_bytes);
+    if (reservation.instructions_ > 0) {
+      bytes_per_instruction_ =
+          (1 - kCalibrationWeight) * bytes_per_instruction_ +
+          kCalibrationWeight *
+              (static_cast<double>(task_peak_bytes) /
+               reservation.instructions_);
+      bytes_per_instruction_gauge_->Set(bytes_per_instruction_);
+    }
+  }
+  reserved_bytes_ -= reservation.estimated_bytes_;
+  admitted_--;
+  reserved_gauge_->Set(reserved_bytes_);
+  changed_.notify_all();
+  lock.unlock();
+  if (changed_callback_) {
+    changed_callback_();
+  }
+}
+
+bool MemoryBudget::WaitLocked(std::unique_lock<std::mutex> *lock, bool grow,
+                              uint64_t estimated_bytes,
+                              const CancellationToken *cancellation_token,
+                              bool *waited) {
+  const uint64_t ticket = next_ticket_++;
+  if (grow) {
+    waiters_.insert(waiters_.begin() + growing_, ticket);
+    growing_++;
+  } else {
+    waiters_.push_back(ticket);
+  }
+  while (!CanAdmitLocked(ticket, estimated_bytes)) {
+    if (IsCancelled(cancellation_token)) {
+      waiters_.erase(std::find(waiters_.begin(), waiters_.end(), ticket));
+      if (grow) {
+        growing_--;
+      }
+      waiting_gauge_->Set(waiters_.size());
+      cancelled_counter_->Increment();
+      // The next waiter may fit now that this one is gone.
+      changed_.notify_all();
+      return false;
+    }
+    if (!*waited) {
+      *waited = true;
+      waiting_gauge_->Set(waiters_.size());
+      LOG(INFO) << "Waiting for " << estimated_bytes
+                << " bytes of memory, " << reserved_bytes_ << " of "
+                << budget_bytes_ << " are reserved.";
+    }
+    changed_.wait_for(*lock, kAdmissionPollInterval);
+  }
+  waiters_.pop_front();
+  if (grow) {
+    growing_--;
+  }
+  waiting_gauge_->Set(waiters_.size());
+
+  return true;
+}
+
+bool MemoryBudget::CanAdmitLocked(uint64_t ticket,
+                                  uint64_t estimated_bytes) const {
+  return waiters_.front() == ticket && FitsLocked(estimated_bytes);
+}
+
+bool MemoryBudget::FitsLocked(uint64_t estimated_bytes) const {
+  // When every admitted task waits to grow, none of them releases memory
+  // until the next one goes ahead.
+  return budget_bytes_ == 0 || admitted_ == growing_ ||
+         reserved_bytes_ + estimated_bytes <= budget_bytes_;
+}
+
+void MemoryBudget::StartMeasuringLocked(MemoryReservation *reservation) {
+  reservation->start_rss_bytes_ = ReadProcessStatusBytes("VmRSS");
+  reservation->start_peak_rss_bytes_ = ReadProcessStatusBytes("VmHWM");
+  reservation->measurable_ = reservation->start_rss_bytes_ > 0;
+  measured_ = reservation->measurable_ ? reservation : nullptr;
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,217 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds_(std::move(bounds)), bucket_counts_(bounds_.size() + 1, 0) {}
+
+void Histogram::Observe(double value) {
+  const size_t bucket =
+      std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+      bounds_.begin();
+  std::lock_guard<std::mutex> lock(mutex_);
+  bucket_counts_[bucket]++;
+  sum_ += value;
+}
+
+void Histogram::Snapshot(std::vector<uint64_t> *bucket_counts,
+                         double *sum) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  *bucket_counts = bucket_counts_;
+  *sum = sum_;
+}
+
+std::vector<double> ExponentialBuckets(double start, double factor,
+                                       int count) {
+  std::vector<double> bounds;
+  double bound = start;
+  for (int i = 0; i < count; i++) {
+    bounds.push_back(bound);
+    bound *= factor;
+  }
+  return bounds;
+}
+
+const std::vector<double> &DurationBuckets() {
+  static const std::vector<double> *bounds = new std::vector<double>(
+      {0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300, 900, 3600});
+  return *bounds;
+}
+
+// Renders `labels` as they appear between the braces of a sample.
+static std::string RenderLabels(const MetricLabels &labels) {
+  std::string rendered;
+  for (const auto &label : labels) {
+    if (!rendered.empty()) {
+      rendered += ",";
+    }
+    rendered += label.first + "=\"";
+    for (char c : label.second) {
+      switch (c) {
+        case '\\':
+          rendered += "\\\\";
+          break;
+        case '"':
+          rendered += "\\\"";
+          break;
+        case '\n':
+          rendered += "\\n";
+          break;
+        default:
+          rendered += c;
+      }
+    }
+    rendered += "\"";
+  }
+  return rendered;
+}
+
+// Renders one sample line.
+static void RenderSample(const std::string &name, const std::string &labels,
+                         const std::string &value, std::ostringstream *out) {
+  *out << name;
+  if (!labels.empty()) {
+    *out << "{" << labels << "}";
+  }
+  *out << " " << value << "\n";
+}
+
+static std::string RenderBound(double bound) {
+  std::ostringstream rendered;
+  rendered << bound;
+  return rendered.str();
+}
+
+MetricsRegistry &MetricsRegistry::Global() {
+  // Never destroyed, so metrics can be updated during static destruction.
+  static MetricsRegistry *registry = new MetricsRegistry();
+  return *registry;
+}
+
+MetricsRegistry::Family *MetricsRegistry::GetFamilyLocked(
+    const std::string &name, const std::string &help,
+    const std::string &type) {
+  auto family_it = families_.find(name);
+  if (family_it == families_.end()) {
+    Family &family = families_[name];
+    family.help = help;
+    family.type = type;
+    return &family;
+  }
+  if (family_it->second.type != type) {
+    LOG(ERROR) << "Metric " << name << " is a " << family_it->second.type
+               << ", not a " << type;
+    return nullptr;
+  }
+  return &family_it->second;
+}
+
+Counter *MetricsRegistry::GetCounter(const std::string &name,
+                                     const std::string &help,
+                                     const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Family *family = GetFamilyLocked(name, help, "counter");
+  // Hand out a detached metric so that callers never get null.
+  if (!family) {
+    static Counter *detached_counter = new Counter();
+    return detached_counter;
+  }
+  std::unique_ptr<Counter> &counter = family->counters[RenderLabels(labels)];
+  if (!counter) {
+    counter.reset(new Counter());
+  }
+  return counter.get();
+}
+
+Gauge *MetricsRegistry::GetGauge(const std::string &name,
+                                 const std::string &help,
+                                 const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Family *family = GetFamilyLocked(name, help, "gauge");
+  if (!family) {
+    static Gauge *detached_gauge = new Gauge();
+    return detached_gauge;
+  }
+  std::unique_ptr<Gauge> &gauge = family->gauges[RenderLabels(labels)];
+  if (!gauge) {
+    gauge.reset(new Gauge());
+  }
+  return gauge.get();
+}
+
+Histogram *MetricsRegistry::GetHistogram(const std::string &name,
+                                         const std::string &help,
+                                         const std::vector<double> &bounds,
+                                         const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Family *family = GetFamilyLocked(name, help, "histogram");
+  if (!family) {
+    static Histogram *detached_histogram = new Histogram(bounds);
+    return detached_histogram;
+  }
+  if (family->histograms.empty()) {
+    family->bounds = bounds;
+  }
+  std::unique_ptr<Histogram> &histogram =
+      family->histograms[RenderLabels(labels)];
+  if (!histogram) {
+    histogram.reset(new Histogram(family->bounds));
+  }
+  return histogram.get();
+}
+
+std::string MetricsRegistry::RenderPrometheusText() const {
+  std::ostringstream out;
+  out.precision(17);
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &family_entry : families_) {
+    const std::string &name = family_entry.first;
+    const Family &family = family_entry.second;
+    out << "# HELP " << name << " " << family.help << "\n";
+    out << "# TYPE " << name << " " << family.type << "\n";
+    for (const auto &counter : family.counters) {
+      RenderSample(name, counter.first,
+                   std::to_string(counter.second->Value()), &out);
+    }
+    for (const auto &gauge : family.gauges) {
+      RenderSample(name, gauge.first, std::to_string(gauge.second->Value()),
+                   &out);
+    }
+    for (const auto &histogram : family.histograms) {
+      std::vector<uint64_t> bucket_counts;
+      double sum;
+      histogram.second->Snapshot(&bucket_counts, &sum);
+      const std::vector<double> &bounds = histogram.second->Bounds();
+      const std::string separator = histogram.first.empty() ? "" : ",";
+      uint64_t cumulative_count = 0;
+      for (size_t i = 0; i < bucket_counts.size(); i++) {
+        cumulative_count += bucket_counts[i];
+        const std::string bound =
+            i < bounds.size() ? RenderBound(bounds[i]) : "+Inf";
+        RenderSample(name + "_bucket",
+                     histogram.first + separator + "le=\"" + bound + "\"",
+                     std::to_string(cumulative_count), &out);
+      }
+      std::ostringstream rendered_sum;
+      rendered_sum.precision(17);
+      rendered_sum << sum;
+      RenderSample(name + "_sum", histogram.first, rendered_sum.str(), &out);
+      RenderSample(name + "_count", histogram.first,
+                   std::to_string(cumulative_count), &out);
+    }
+  }
+  return out.str();
+}
+
+Histogram *PassDurationHistogram(const std::string &pass_name) {
+  return MetricsRegistry::Global().GetHistogram(
+      "pass_duration_seconds", "Wall time of LLVM analysis passes.",
+      DurationBuckets(), {{"pass", pass_name}});
+}
+
+}  // namespace error_specifications
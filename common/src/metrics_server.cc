@@ -0,0 +1,208 @@
+#include "metrics_server.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "glog/logging.h"
+#include "include/grpcpp/support/server_interceptor.h"
+
+namespace error_specifications {
+
+// How often the endpoint checks whether it should stop.
+constexpr int kMetricsPollIntervalMs = 200;
+
+// How long the endpoint waits for a scrape request.
+constexpr int kMetricsReadTimeoutSeconds = 1;
+
+// Largest scrape request the endpoint reads.
+constexpr size_t kMaxMetricsRequestBytes = 8192;
+
+// Records the latency and status of one call.
+class RpcMetricsInterceptor : public grpc::experimental::Interceptor {
+ public:
+  explicit RpcMetricsInterceptor(grpc::experimental::ServerRpcInfo *info)
+      : start_(std::chrono::steady_clock::now()) {
+    // Methods are named /package.Service/Method.
+    const std::string full_method = info->method();
+    const size_t method_start = full_method.rfind('/');
+    const size_t service_start = full_method.rfind('.', method_start);
+    if (method_start != std::string::npos &&
+        service_start != std::string::npos) {
+      service_ = full_method.substr(service_start + 1,
+                                    method_start - service_start - 1);
+      method_ = full_method.substr(method_start + 1);
+    } else {
+      method_ = full_method;
+    }
+  }
+
+  void Intercept(
+      grpc::experimental::InterceptorBatchMethods *methods) override {
+    if (methods->QueryInterceptionHookPoint(
+            grpc::experimental::InterceptionHookPoints::PRE_SEND_STATUS)) {
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start_)
+                                 .count();
+      const MetricLabels labels = {{"service", service_}, {"method", method_}};
+      MetricsRegistry::Global()
+          .GetHistogram("rpc_duration_seconds",
+                        "Time from the start of a call to its status.",
+                        DurationBuckets(), labels)
+          ->Observe(seconds);
+      MetricsRegistry::Global()
+          .GetCounter("rpcs_total", "Finished calls by status code.",
+                      {{"service", service_},
+                       {"method", method_},
+                       {"code", std::to_string(
+                                    methods->GetSendStatus().error_code())}})
+          ->Increment();
+    }
+    methods->Proceed();
+  }
+
+ private:
+  const std::chrono::steady_clock::time_point start_;
+  std::string service_;
+  std::string method_;
+};
+
+class RpcMetricsInterceptorFactory
+    : public grpc::experimental::ServerInterceptorFactoryInterface {
+ public:
+  grpc::experimental::Interceptor *CreateServerInterceptor(
+      grpc::experimental::ServerRpcInfo *info) override {
+    return new RpcMetricsInterceptor(info);
+  }
+};
+
+void AddRpcMetrics(grpc::ServerBuilder *builder) {
+  std::vector<
+      std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>>
+      interceptor_creators;
+  interceptor_creators.emplace_back(new RpcMetricsInterceptorFactory());
+  builder->experimental().SetInterceptorCreators(
+      std::move(interceptor_creators));
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+  stopping_ = true;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+}
+
+grpc::Status MetricsEndpoint::Start(const std::string &address) {
+  const size_t port_start = address.rfind(':');
+  if (port_start == std::string::npos) {
+    const std::string &err_msg =
+        "Metrics address " + address + " is not of the form host:port.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+  const std::string host = address.substr(0, port_start);
+  const std::string port = address.substr(port_start + 1);
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo *addresses = nullptr;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints,
+                  &addresses) != 0) {
+    const std::string &err_msg = "Unable to resolve metrics address " + address;
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, err_msg);
+  }
+  for (struct addrinfo *candidate = addresses; candidate;
+       candidate = candidate->ai_next) {
+    int fd = socket(candidate->ai_family, candidate->ai_socktype,
+                    candidate->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0 &&
+        listen(fd, SOMAXCONN) == 0) {
+      listen_fd_ = fd;
+      break;
+    }
+    close(fd);
+  }
+  freeaddrinfo(addresses);
+  if (listen_fd_ < 0) {
+    const std::string &err_msg = "Unable to listen for metrics on " + address;
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, err_msg);
+  }
+
+  thread_ = std::thread([this] { Serve(); });
+  LOG(INFO) << "Serving metrics on " << address;
+
+  return grpc::Status::OK;
+}
+
+void MetricsEndpoint::Serve() {
+  while (!stopping_) {
+    struct pollfd listen_poll = {listen_fd_, POLLIN, 0};
+    if (poll(&listen_poll, 1, kMetricsPollIntervalMs) <= 0) {
+      continue;
+    }
+    int connection = accept(listen_fd_, nullptr, nullptr);
+    if (connection >= 0) {
+      Respond(connection);
+    }
+  }
+}
+
+void MetricsEndpoint::Respond(int connection) {
+  struct timeval timeout = {kMetricsReadTimeoutSeconds, 0};
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Only the request line matters, but read the headers so that the client
+  // is not reset while it is still sending them.
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < kMaxMetricsRequestBytes) {
+    ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      break;
+    }
+    request.append(buffer, received);
+  }
+
+  std::string status = "404 Not Found";
+  std::string body = "Metrics are served at /metrics.\n";
+  if (request.compare(0, 13, "GET /metrics ") == 0 ||
+      request.compare(0, 13, "GET /metrics?") == 0) {
+    status = "200 OK";
+    body = MetricsRegistry::Global().RenderPrometheusText();
+  }
+  const std::string response =
+      "HTTP/1.1 " + status +
+      "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+      std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t written = send(connection, response.data() + sent,
+                           response.size() - sent, MSG_NOSIGNAL);
+    if (written <= 0) {
+      break;
+    }
+    sent += written;
+  }
+  close(connection);
+}
+
+}  // namespace error_specifications
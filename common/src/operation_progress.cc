@@ -0,0 +1,189 @@
+#include "operation_progress.h"
+
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+static int64_t ToNanoseconds(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+OperationProgressReporter::OperationProgressReporter(
+    OperationsServiceImpl *operations_service,
+    const std::string &operation_name, std::chrono::milliseconds min_interval)
+    : operations_service_(operations_service),
+      operation_name_(operation_name),
+      min_interval_(min_interval),
+      start_time_(std::chrono::steady_clock::now()) {}
+
+void OperationProgressReporter::StartPass(const std::string &pass_name,
+                                          uint64_t sccs_total,
+                                          uint64_t functions_total) {
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    current_pass_ = pass_name;
+    sccs_done_ = 0;
+    sccs_total_ = sccs_total;
+    functions_analyzed_ = 0;
+    functions_total_ = functions_total;
+  }
+  MaybePublish(true);
+}
+
+void OperationProgressReporter::SccDone() {
+  sccs_done_++;
+  MaybePublish(false);
+}
+
+void OperationProgressReporter::FunctionAnalyzed() {
+  functions_analyzed_++;
+  MaybePublish(false);
+}
+
+ProgressMetadata OperationProgressReporter::GetProgress() const {
+  ProgressMetadata progress;
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    progress.set_current_pass(current_pass_);
+  }
+  progress.set_sccs_done(sccs_done_);
+  progress.set_sccs_total(sccs_total_);
+  progress.set_functions_analyzed(functions_analyzed_);
+  progress.set_functions_total(functions_total_);
+  progress.set_elapsed_seconds(
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    start_time_)
+          .count());
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    *progress.mutable_performance() = performance_;
+  }
+  return progress;
+}
+
+void OperationProgressReporter::FillMetadata(Operation *operation) const {
+  operation->mutable_metadata()->PackFrom(GetProgress());
+  operation->set_metadata_type(ProgressMetadata::descriptor()->full_name());
+}
+
+void OperationProgressReporter::AddPhase(const StepUsage &phase) {
+  tbb::mutex::scoped_lock lock(mutex_);
+  *performance_.add_phases() = phase;
+}
+
+void OperationProgressReporter::AddPass(const StepUsage &pass) {
+  tbb::mutex::scoped_lock lock(mutex_);
+  *performance_.add_passes() = pass;
+}
+
+// Escapes `text` for use inside a JSON string.
+static std::string JsonEscape(const std::string &text) {
+  std::string escaped;
+  for (char c : text) {
+    switch (c) {
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Appends the Chrome trace event of `step` to `trace`. Phases and passes are
+// shown as two threads so that their events never overlap.
+static void AppendTraceEvent(const StepUsage &step, int thread_id,
+                             std::ostringstream *trace) {
+  *trace << "{\"name\":\"" << JsonEscape(step.name())
+         << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread_id
+         << ",\"ts\":" << static_cast<int64_t>(step.start_seconds() * 1e6)
+         << ",\"dur\":" << static_cast<int64_t>(step.wall_seconds() * 1e6)
+         << ",\"args\":{\"cpu_seconds\":" << step.cpu_seconds()
+         << ",\"peak_rss_delta_bytes\":" << step.peak_rss_delta_bytes()
+         << "}}";
+}
+
+grpc::Status OperationProgressReporter::WriteTrace(
+    const std::string &directory) const {
+  PerformanceReport performance;
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    performance = performance_;
+  }
+
+  std::ostringstream trace;
+  trace << "{\"otherData\":{\"operation\":\"" << JsonEscape(operation_name_)
+        << "\"},\"traceEvents\":[";
+  bool first = true;
+  for (const StepUsage &phase : performance.phases()) {
+    trace << (first ? "" : ",");
+    AppendTraceEvent(phase, 1, &trace);
+    first = false;
+  }
+  for (const StepUsage &pass : performance.passes()) {
+    trace << (first ? "" : ",");
+    AppendTraceEvent(pass, 2, &trace);
+    first = false;
+  }
+  trace << "]}\n";
+
+  // Operation names contain spaces and a time stamp.
+  std::string file_name = operation_name_;
+  for (char &c : file_name) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' &&
+        c != '_' && c != '.') {
+      c = '_';
+    }
+  }
+  const std::string path = directory + "/" + file_name + ".json";
+  std::ofstream trace_file(path);
+  trace_file << trace.str();
+  trace_file.close();
+  if (!trace_file) {
+    const std::string &err_msg = "Unable to write trace file " + path + ".";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+  }
+
+  return grpc::Status::OK;
+}
+
+void OperationProgressReporter::MaybePublish(bool force) {
+  const auto now = std::chrono::steady_clock::now();
+  if (!force && ToNanoseconds(now) < next_publish_ns_) {
+    return;
+  }
+
+  Operation operation;
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    // Another thread may have published while this one waited for the lock.
+    if (!force && ToNanoseconds(now) < next_publish_ns_) {
+      return;
+    }
+    next_publish_ns_ = ToNanoseconds(now + min_interval_);
+  }
+
+  operation.set_name(operation_name_);
+  operation.set_done(0);
+  FillMetadata(&operation);
+
+  // UpdateOperation never replaces a finished operation, so a late update
+  // cannot hide the result.
+  operations_service_->UpdateOperation(operation_name_, operation);
+}
+
+}  // namespace error_specifications
@@ -1,21 +1,410 @@
 #include "operations_service.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "glog/logging.h"
+#include "include/grpcpp/alarm.h"
+#include "metrics.h"
+
 namespace error_specifications {
 
+// How often a synchronous watcher that is waiting for an update checks
+// whether its client went away.
+constexpr std::chrono::milliseconds kWatchCancelCheckInterval(500);
+
 void OperationsServiceImpl::UpdateOperation(std::string operation_name,
                                             Operation operation) {
-  OperationTable::accessor a;
-  if (operation_progress_.find(a, operation_name)) {
+  // Held while publishing so that an operation cancelled in the meantime
+  // does not receive the task's result.
+  std::lock_guard<std::mutex> lock(in_flight_mutex_);
+  auto key_it = in_flight_task_keys_.find(operation_name);
+  if (key_it == in_flight_task_keys_.end()) {
+    PublishOperation(operation_name, operation);
+    return;
+  }
+
+  const std::string request_key = key_it->second;
+  const std::vector<std::string> operation_names =
+      in_flight_tasks_[request_key].operation_names;
+  for (const std::string &name : operation_names) {
+    operation.set_name(name);
+    PublishOperation(name, operation);
+  }
+  // Requests arriving from now on find the result in the result cache,
+  // which tasks fill before they publish it.
+  if (operation.done()) {
+    for (const std::string &name : operation_names) {
+      in_flight_operation_keys_.erase(name);
+    }
+    in_flight_tasks_.erase(request_key);
+    in_flight_task_keys_.erase(key_it);
+  }
+}
+
+void OperationsServiceImpl::PublishOperation(const std::string &operation_name,
+                                             const Operation &operation) {
+  std::shared_ptr<OperationState> state;
+  {
+    OperationTable::accessor a;
+    // The operation does not yet exist if this inserts it.
+    if (operation_progress_.insert(a, operation_name)) {
+      a->second = std::make_shared<OperationState>();
+    }
+    state = a->second;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
     // Make sure that we are not undoing an operation status due to ordering.
     // Once an operation is finished it can never be unfinished.
-    Operation existing = (Operation)a->second;
-    if (existing.done() && !operation.done()) {
+    if (state->operation.done() && !operation.done()) {
       return;
     }
-    a->second = operation;
-  } else {
-    // The operation does not yet exist. Insert it.
-    operation_progress_.insert(std::make_pair(operation_name, operation));
+    state->operation = operation;
+    state->version++;
+    for (const auto &subscriber : state->subscribers) {
+      subscriber.second();
+    }
+  }
+  state->updated.notify_all();
+}
+
+std::shared_ptr<const CancellationToken>
+OperationsServiceImpl::GetCancellationToken(const std::string &operation_name) {
+  OperationTable::accessor a;
+  if (operation_progress_.insert(a, operation_name)) {
+    a->second = std::make_shared<OperationState>();
+  }
+  return a->second->cancellation_token;
+}
+
+void OperationsServiceImpl::DiscardOperation(
+    const std::string &operation_name, const grpc::Status &status) {
+  std::vector<std::string> attached_names;
+  {
+    std::lock_guard<std::mutex> lock(in_flight_mutex_);
+    auto key_it = in_flight_task_keys_.find(operation_name);
+    if (key_it != in_flight_task_keys_.end()) {
+      attached_names = in_flight_tasks_[key_it->second].operation_names;
+      for (const std::string &name : attached_names) {
+        in_flight_operation_keys_.erase(name);
+      }
+      in_flight_tasks_.erase(key_it->second);
+      in_flight_task_keys_.erase(key_it);
+    }
+  }
+  operation_progress_.erase(operation_name);
+
+  for (const std::string &name : attached_names) {
+    if (name != operation_name) {
+      FinishWithError(name, status.error_code(), status.error_message());
+    }
+  }
+}
+
+bool OperationsServiceImpl::AttachToRunningTask(const std::string &name,
+                                                const std::string &request_key,
+                                                Operation *operation) {
+  static Counter *attached_counter = MetricsRegistry::Global().GetCounter(
+      "operations_attached_total",
+      "Operations attached to the running task of an identical request "
+      "instead of starting one.");
+
+  std::lock_guard<std::mutex> lock(in_flight_mutex_);
+  auto task_it = in_flight_tasks_.find(request_key);
+  if (task_it == in_flight_tasks_.end()) {
+    InFlightTask &task = in_flight_tasks_[request_key];
+    task.task_name = name;
+    task.operation_names.push_back(name);
+    {
+      OperationTable::accessor a;
+      if (operation_progress_.insert(a, name)) {
+        a->second = std::make_shared<OperationState>();
+      }
+      task.cancellation_token = a->second->cancellation_token;
+    }
+    in_flight_task_keys_[name] = request_key;
+    in_flight_operation_keys_[name] = request_key;
+    return false;
+  }
+
+  InFlightTask &task = task_it->second;
+  LOG(INFO) << "Attaching " << name << " to " << task.task_name;
+  attached_counter->Increment();
+  task.operation_names.push_back(name);
+  in_flight_operation_keys_[name] = request_key;
+
+  // Start from the task's latest state. Updates published after the lock is
+  // released reach the new operation as well.
+  Operation current;
+  {
+    OperationTable::const_accessor a;
+    if (operation_progress_.find(a, task.task_name)) {
+      std::lock_guard<std::mutex> state_lock(a->second->mutex);
+      current.CopyFrom(a->second->operation);
+    }
+  }
+  current.set_name(name);
+  PublishOperation(name, current);
+  operation->CopyFrom(current);
+
+  return true;
+}
+
+void OperationsServiceImpl::FinishWithError(const std::string &operation_name,
+                                            grpc::StatusCode code,
+                                            const std::string &message) {
+  Operation operation;
+  operation.set_name(operation_name);
+  operation.set_done(1);
+  operation.mutable_error()->set_code(code);
+  operation.mutable_error()->set_message(message);
+  PublishOperation(operation_name, operation);
+}
+
+bool OperationsServiceImpl::FinishFromResultCache(
+    const std::string &operation_name, const std::string &result_key,
+    Operation *operation,
+    const std::function<bool(const Operation &)> &is_valid) {
+  Operation cached_operation;
+  if (!result_cache_ || !result_cache_->Lookup(result_key, &cached_operation)) {
+    return false;
+  }
+  if (is_valid && !is_valid(cached_operation)) {
+    LOG(INFO) << "Memoized result for " << operation_name << " is stale.";
+    return false;
+  }
+  LOG(INFO) << "Reusing memoized result for " << operation_name;
+
+  // Clients still watch or poll the operation, so it is published under its
+  // new name like any other finished operation.
+  cached_operation.set_name(operation_name);
+  UpdateOperation(operation_name, cached_operation);
+  operation->CopyFrom(cached_operation);
+
+  return true;
+}
+
+// One WatchOperation call of the asynchronous server. Rather than waiting
+// for updates on a thread, it subscribes to the state of the operation:
+// every update sets an alarm that brings the call back on a polling thread,
+// which writes the latest state unless a write is still in flight. Like the
+// synchronous watch, it may skip intermediate states but always writes the
+// final one, and then finishes. The call deletes itself once every tag it
+// issued has come back.
+class WatchOperationCall final : public AsyncTag {
+ public:
+  // Waits for the next call on `queue`.
+  static void Start(OperationsServiceImpl *service, AsyncServer *server,
+                    OperationsService::AsyncService *async_service,
+                    grpc::ServerCompletionQueue *queue) {
+    new WatchOperationCall(service, server, async_service, queue);
+  }
+
+  void Proceed(bool ok) override {
+    if (!ok) {
+      // The call never started, so done_ will not come back either.
+      AsyncServer *server = server_;
+      delete this;
+      server->EndCall();
+      return;
+    }
+
+    // Wait for the next call while this one is being served.
+    Start(service_, server_, async_service_, queue_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    {
+      OperationTable::const_accessor a;
+      if (!service_->operation_progress_.find(a, request_.name())) {
+        FinishLocked(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                  "Operation name not found."));
+        return;
+      }
+      state_ = a->second;
+    }
+
+    // The state keeps the operation alive even if a GetOperation call
+    // removes it from the table in the meantime.
+    {
+      std::lock_guard<std::mutex> state_lock(state_->mutex);
+      subscriber_id_ = state_->next_subscriber_id++;
+      state_->subscribers[subscriber_id_] = [this] { Wake(); };
+    }
+    WriteLocked();
+  }
+
+ private:
+  WatchOperationCall(OperationsServiceImpl *service, AsyncServer *server,
+                     OperationsService::AsyncService *async_service,
+                     grpc::ServerCompletionQueue *queue)
+      : service_(service),
+        server_(server),
+        async_service_(async_service),
+        queue_(queue),
+        writer_(&context_),
+        written_([this](bool ok) { OnWritten(ok); }),
+        woken_([this](bool) { OnWoken(); }),
+        finished_([this](bool) { Release(); }),
+        done_([this](bool) { OnDone(); }) {
+    server_->BeginCall();
+    context_.AsyncNotifyWhenDone(AsTag(&done_));
+    async_service_->RequestWatchOperation(&context_, &request_, &writer_,
+                                          queue_, queue_, AsTag(this));
+  }
+
+  // Called by the state of the operation, with its mutex held, after every
+  // update.
+  void Wake() {
+    // One alarm at a time: the state is read once it goes off, so it covers
+    // the updates published until then.
+    if (!wake_pending_.exchange(true)) {
+      pending_tags_++;
+      alarm_.Set(queue_, std::chrono::system_clock::now(), AsTag(&woken_));
+    }
+  }
+
+  void OnWoken() {
+    wake_pending_ = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!writing_ && !finishing_) {
+        WriteLocked();
+      }
+    }
+    Release();
+  }
+
+  void OnWritten(bool ok) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      writing_ = false;
+      if (!ok || client_gone_) {
+        FinishLocked(grpc::Status(grpc::StatusCode::CANCELLED,
+                                  "Watch cancelled by client."));
+      } else if (wrote_done_) {
+        // Do not cache results, same as GetOperation.
+        service_->EraseOperation(request_.name(), state_);
+        FinishLocked(grpc::Status::OK);
+      } else {
+        WriteLocked();
+      }
+    }
+    Release();
+  }
+
+  void OnDone() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Unless the call finished, the client went away. A write in flight
+      // fails and finishes the call instead.
+      client_gone_ = true;
+      if (!writing_ && !finishing_) {
+        FinishLocked(grpc::Status(grpc::StatusCode::CANCELLED,
+                                  "Watch cancelled by client."));
+      }
+    }
+    Release();
+  }
+
+  // Writes the state of the operation if it changed since the last write.
+  // Must be called with mutex_ held and no write in flight.
+  void WriteLocked() {
+    Operation operation;
+    {
+      std::lock_guard<std::mutex> state_lock(state_->mutex);
+      if (wrote_any_ && state_->version == written_version_) {
+        return;
+      }
+      operation.CopyFrom(state_->operation);
+      written_version_ = state_->version;
+      wrote_any_ = true;
+    }
+    wrote_done_ = operation.done();
+    writing_ = true;
+    pending_tags_++;
+    writer_.Write(operation, AsTag(&written_));
+  }
+
+  // Stops following the operation and finishes the call with `status`.
+  // Must be called with mutex_ held and no write in flight.
+  void FinishLocked(const grpc::Status &status) {
+    finishing_ = true;
+    if (state_) {
+      std::lock_guard<std::mutex> state_lock(state_->mutex);
+      state_->subscribers.erase(subscriber_id_);
+    }
+    pending_tags_++;
+    writer_.Finish(status, AsTag(&finished_));
+  }
+
+  // Deletes the call once the last of its tags has come back. done_ is
+  // pending from the start of the call, and every other tag is issued while
+  // another one is still pending, so the count only drops to zero once.
+  void Release() {
+    if (--pending_tags_ == 0) {
+      AsyncServer *server = server_;
+      delete this;
+      server->EndCall();
+    }
+  }
+
+  OperationsServiceImpl *const service_;
+  AsyncServer *const server_;
+  OperationsService::AsyncService *const async_service_;
+  grpc::ServerCompletionQueue *const queue_;
+  grpc::ServerContext context_;
+  WatchOperationRequest request_;
+  grpc::ServerAsyncWriter<Operation> writer_;
+  grpc::Alarm alarm_;
+  CallbackTag written_;
+  CallbackTag woken_;
+  CallbackTag finished_;
+  CallbackTag done_;
+  std::atomic<int> pending_tags_{1};
+  // Set by Wake until its alarm goes off.
+  std::atomic<bool> wake_pending_{false};
+
+  // Guards the members below.
+  std::mutex mutex_;
+  std::shared_ptr<OperationState> state_;
+  uint64_t subscriber_id_ = 0;
+  uint64_t written_version_ = 0;
+  bool wrote_any_ = false;
+  bool wrote_done_ = false;
+  bool writing_ = false;
+  bool finishing_ = false;
+  bool client_gone_ = false;
+};
+
+void OperationsServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<OperationsService::AsyncService>();
+  server->AddUnary(async_service,
+                   &OperationsService::AsyncService::RequestGetOperation, this,
+                   &OperationsService::Service::GetOperation);
+  server->AddMethod(
+      [this, server, async_service](grpc::ServerCompletionQueue *queue) {
+        WatchOperationCall::Start(this, server, async_service, queue);
+      });
+  server->AddUnary(async_service,
+                   &OperationsService::AsyncService::RequestDeleteOperation,
+                   this, &OperationsService::Service::DeleteOperation);
+  server->AddUnary(async_service,
+                   &OperationsService::AsyncService::RequestCancelOperation,
+                   this, &OperationsService::Service::CancelOperation);
+  server->AddUnary(
+      async_service, &OperationsService::AsyncService::RequestInvalidateResults,
+      this, &OperationsService::Service::InvalidateResults,
+      /*blocking=*/true);
+}
+
+void OperationsServiceImpl::EraseOperation(
+    const std::string &operation_name,
+    const std::shared_ptr<OperationState> &state) {
+  OperationTable::accessor a;
+  if (operation_progress_.find(a, operation_name) && a->second == state) {
+    operation_progress_.erase(a);
   }
 }
 
@@ -28,7 +417,10 @@ grpc::Status OperationsServiceImpl::GetOperation(
                         "Operation name not found.");
   }
 
-  operation->CopyFrom((Operation)a->second);
+  {
+    std::lock_guard<std::mutex> lock(a->second->mutex);
+    operation->CopyFrom(a->second->operation);
+  }
 
   // If the operation is done, remove the key, i.e. do not cache results.
   if (operation->done()) {
@@ -38,6 +430,54 @@ grpc::Status OperationsServiceImpl::GetOperation(
   return grpc::Status::OK;
 }
 
+grpc::Status OperationsServiceImpl::WatchOperation(
+    grpc::ServerContext *context, const WatchOperationRequest *request,
+    grpc::ServerWriter<Operation> *writer) {
+  std::shared_ptr<OperationState> state;
+  {
+    OperationTable::const_accessor a;
+    if (!operation_progress_.find(a, request->name())) {
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                          "Operation name not found.");
+    }
+    state = a->second;
+  }
+
+  // The state keeps the operation alive even if a GetOperation call removes
+  // it from the table in the meantime.
+  uint64_t sent_version = 0;
+  bool sent_any = false;
+  while (true) {
+    Operation operation;
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      while (sent_any && state->version == sent_version) {
+        if (context->IsCancelled()) {
+          return grpc::Status(grpc::StatusCode::CANCELLED,
+                              "Watch cancelled by client.");
+        }
+        state->updated.wait_for(lock, kWatchCancelCheckInterval);
+      }
+      operation.CopyFrom(state->operation);
+      sent_version = state->version;
+      sent_any = true;
+    }
+
+    // Intermediate states may be skipped if updates arrive faster than they
+    // can be written, but the final state is always sent.
+    if (!writer->Write(operation)) {
+      return grpc::Status(grpc::StatusCode::CANCELLED,
+                          "Watch cancelled by client.");
+    }
+
+    if (operation.done()) {
+      // Do not cache results, same as GetOperation.
+      EraseOperation(request->name(), state);
+      return grpc::Status::OK;
+    }
+  }
+}
+
 grpc::Status OperationsServiceImpl::DeleteOperation(
     grpc::ServerContext *context, const DeleteOperationRequest *request,
     Operation *operation) {
@@ -47,6 +487,54 @@ grpc::Status OperationsServiceImpl::DeleteOperation(
 grpc::Status OperationsServiceImpl::CancelOperation(
     grpc::ServerContext *context, const CancelOperationRequest *request,
     ::google::protobuf::Empty *response) {
-  return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "");
+  bool detached = false;
+  {
+    std::lock_guard<std::mutex> lock(in_flight_mutex_);
+    auto key_it = in_flight_operation_keys_.find(request->name());
+    if (key_it != in_flight_operation_keys_.end()) {
+      InFlightTask &task = in_flight_tasks_[key_it->second];
+      if (task.operation_names.size() == 1) {
+        // The last operation waiting for the task cancels it, like one that
+        // never shared its task.
+        task.cancellation_token->Cancel();
+        return grpc::Status::OK;
+      }
+      // The others still wait for the result, so only this operation ends.
+      task.operation_names.erase(std::find(task.operation_names.begin(),
+                                           task.operation_names.end(),
+                                           request->name()));
+      in_flight_operation_keys_.erase(key_it);
+      detached = true;
+    }
+  }
+  if (detached) {
+    FinishWithError(request->name(), grpc::StatusCode::CANCELLED,
+                    "Operation cancelled.");
+    return grpc::Status::OK;
+  }
+
+  OperationTable::const_accessor a;
+  if (!operation_progress_.find(a, request->name())) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "Operation name not found.");
+  }
+
+  // The task notices the token at its next check and records a CANCELLED
+  // error as its result. Cancelling a finished operation has no effect.
+  a->second->cancellation_token->Cancel();
+
+  return grpc::Status::OK;
+}
+
+grpc::Status OperationsServiceImpl::InvalidateResults(
+    grpc::ServerContext *context, const InvalidateResultsRequest *request,
+    InvalidateResultsResponse *response) {
+  // Services that do not memoize anything have nothing to drop.
+  if (result_cache_) {
+    response->set_results_removed(
+        result_cache_->Invalidate(request->bitcode_id().id()));
+  }
+
+  return grpc::Status::OK;
 }
 }  // namespace error_specifications
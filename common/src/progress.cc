@@ -0,0 +1,76 @@
+#include "progress.h"
+
+#include <sys/resource.h>
+
+namespace error_specifications {
+
+// CPU time of the process so far.
+static double ProcessCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Largest resident set size of the process so far.
+static uint64_t PeakRssBytes() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // Linux reports kilobytes.
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+StepTimer::StepTimer(ProgressReporter *progress, Kind kind,
+                     const std::string &name)
+    : progress_(progress),
+      kind_(kind),
+      name_(name),
+      start_time_(std::chrono::steady_clock::now()),
+      start_cpu_seconds_(ProcessCpuSeconds()),
+      start_peak_rss_bytes_(PeakRssBytes()) {}
+
+void StepTimer::Stop() {
+  if (stopped_ || !progress_) {
+    return;
+  }
+  stopped_ = true;
+
+  StepUsage step;
+  step.set_name(name_);
+  step.set_start_seconds(
+      std::chrono::duration<double>(start_time_ - progress_->StartTime())
+          .count());
+  step.set_wall_seconds(std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start_time_)
+                            .count());
+  step.set_cpu_seconds(ProcessCpuSeconds() - start_cpu_seconds_);
+  step.set_peak_rss_delta_bytes(PeakRssBytes() - start_peak_rss_bytes_);
+  if (kind_ == Kind::kPhase) {
+    progress_->AddPhase(step);
+  } else {
+    progress_->AddPass(step);
+  }
+}
+
+// The reporter of the operation `pass` runs for, if any.
+static ProgressReporter *GetProgressReporter(const llvm::Pass *pass) {
+  auto *progress_pass = pass->getAnalysisIfAvailable<ProgressReporterPass>();
+  return progress_pass ? progress_pass->GetProgressReporter() : nullptr;
+}
+
+PassTimer::PassTimer(const llvm::Pass *pass, const std::string &pass_name)
+    : duration_timer_(PassDurationHistogram(pass_name)),
+      step_timer_(GetProgressReporter(pass), StepTimer::Kind::kPass,
+                  pass_name) {}
+
+char ProgressReporterPass::ID = 0;
+static llvm::RegisterPass<ProgressReporterPass> X(
+    "progress-reporter", "Makes operation progress reporting available", false,
+    true);
+
+char CancellationTokenPass::ID = 0;
+static llvm::RegisterPass<CancellationTokenPass> Y(
+    "cancellation-token", "Makes operation cancellation available", false,
+    true);
+
+}  // namespace error_specifications
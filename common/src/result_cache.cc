@@ -0,0 +1,287 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "servers.h"
+
+namespace error_specifications {
+
+// Suffix of the files holding cached operations.
+constexpr char kResultFileSuffix[] = ".op";
+
+ResultCache::ResultCache(const ResultCacheOptions &options)
+    : directory_(options.disk_bytes > 0 ? options.directory : "") {
+  memory_.max_bytes = options.memory_bytes;
+  disk_.max_bytes = options.disk_bytes;
+  if (directory_.empty()) {
+    return;
+  }
+  std::error_code error_code = llvm::sys::fs::create_directories(directory_);
+  if (error_code) {
+    LOG(ERROR) << "Unable to create result cache directory " << directory_
+               << ": " << error_code.message()
+               << ". Results will only be cached in memory.";
+    directory_.clear();
+    return;
+  }
+  LoadDiskEntries();
+}
+
+std::string ResultCache::MakeKey(const std::string &rpc_name,
+                                 const std::string &bitcode_id,
+                                 const google::protobuf::Message &request) {
+  // Map fields are otherwise serialized in an unspecified order.
+  std::string serialized_request;
+  {
+    google::protobuf::io::StringOutputStream string_stream(
+        &serialized_request);
+    google::protobuf::io::CodedOutputStream coded_stream(&string_stream);
+    coded_stream.SetSerializationDeterministic(true);
+    request.SerializeToCodedStream(&coded_stream);
+  }
+
+  // The bitcode part comes first so that Invalidate can match on it, and
+  // both parts are hashed so that the key is safe to use as a file name.
+  std::string bitcode_hash;
+  HashString(bitcode_id, bitcode_hash);
+  std::string request_hash;
+  HashString(rpc_name + '\0' + serialized_request, request_hash);
+
+  return bitcode_hash + "-" + request_hash;
+}
+
+bool ResultCache::Lookup(const std::string &key, Operation *out_operation) {
+  {
+    tbb::mutex::scoped_lock lock(mutex_);
+    auto entry_it = memory_.entries.find(key);
+    if (entry_it != memory_.entries.end() &&
+        out_operation->ParseFromString(entry_it->second.serialized_operation)) {
+      memory_.lru.splice(memory_.lru.begin(), memory_.lru,
+                         entry_it->second.lru_position);
+      hits_++;
+      return true;
+    }
+    if (disk_.entries.find(key) == disk_.entries.end()) {
+      misses_++;
+      return false;
+    }
+  }
+
+  // Read from disk without holding the lock. The entry may have been evicted
+  // in the meantime, in which case this is a miss.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(EntryPath(key));
+  if (!buffer || !out_operation->ParseFromArray(
+                     (*buffer)->getBufferStart(), (*buffer)->getBufferSize())) {
+    misses_++;
+    return false;
+  }
+  hits_++;
+
+  tbb::mutex::scoped_lock lock(mutex_);
+  auto entry_it = disk_.entries.find(key);
+  if (entry_it != disk_.entries.end()) {
+    disk_.lru.splice(disk_.lru.begin(), disk_.lru,
+                     entry_it->second.lru_position);
+  }
+  PutLocked(&memory_, key, (*buffer)->getBuffer().str(),
+            (*buffer)->getBufferSize());
+  EvictLocked(&memory_);
+
+  return true;
+}
+
+void ResultCache::Insert(const std::string &key, const Operation &operation) {
+  if (!operation.done() || !operation.has_response()) {
+    return;
+  }
+  std::string serialized_operation;
+  if (!operation.SerializeToString(&serialized_operation)) {
+    LOG(ERROR) << "Unable to serialize operation " << operation.name();
+    return;
+  }
+  const uint64_t size_bytes = serialized_operation.size();
+
+  // Write to a unique temporary file and rename it into place so that
+  // concurrent readers never observe a partially written entry.
+  bool written = false;
+  if (!directory_.empty() && size_bytes <= disk_.max_bytes) {
+    int fd;
+    llvm::SmallString<128> temp_path;
+    std::error_code error_code = llvm::sys::fs::createUniqueFile(
+        directory_ + "/" + key + "-%%%%%%.tmp", fd, temp_path);
+    if (error_code) {
+      LOG(ERROR) << "Unable to create result cache entry: "
+                 << error_code.message();
+    } else {
+      llvm::raw_fd_ostream ostream(fd, /*shouldClose=*/true);
+      ostream << serialized_operation;
+      ostream.close();
+      if (ostream.has_error()) {
+        ostream.clear_error();
+      } else {
+        written = !llvm::sys::fs::rename(temp_path, EntryPath(key));
+      }
+      if (!written) {
+        LOG(ERROR) << "Unable to write result cache entry " << key;
+        llvm::sys::fs::remove(temp_path);
+      }
+    }
+  }
+
+  tbb::mutex::scoped_lock lock(mutex_);
+  if (written) {
+    PutLocked(&disk_, key, "", size_bytes);
+    EvictLocked(&disk_);
+  }
+  PutLocked(&memory_, key, std::move(serialized_operation), size_bytes);
+  EvictLocked(&memory_);
+}
+
+uint64_t ResultCache::Invalidate(const std::string &bitcode_id) {
+  std::string prefix;
+  if (!bitcode_id.empty()) {
+    HashString(bitcode_id, prefix);
+    prefix += "-";
+  }
+
+  uint64_t removed = 0;
+  tbb::mutex::scoped_lock lock(mutex_);
+  for (Tier *tier : {&memory_, &disk_}) {
+    std::vector<std::string> keys;
+    for (const auto &entry : tier->entries) {
+      if (entry.first.compare(0, prefix.size(), prefix) == 0) {
+        keys.push_back(entry.first);
+      }
+    }
+    for (const std::string &key : keys) {
+      EraseLocked(tier, key);
+    }
+    removed += keys.size();
+  }
+  LOG(INFO) << "Invalidated " << removed << " cached results";
+
+  return removed;
+}
+
+ResultCacheStats ResultCache::GetStats() const {
+  ResultCacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = evictions_;
+
+  tbb::mutex::scoped_lock lock(mutex_);
+  stats.memory_entries = memory_.entries.size();
+  stats.memory_bytes = memory_.size_bytes;
+  stats.disk_entries = disk_.entries.size();
+  stats.disk_bytes = disk_.size_bytes;
+
+  return stats;
+}
+
+void ResultCache::PutLocked(Tier *tier, const std::string &key,
+                            std::string serialized_operation,
+                            uint64_t size_bytes) {
+  if (size_bytes > tier->max_bytes) {
+    return;
+  }
+  auto entry_it = tier->entries.find(key);
+  if (entry_it != tier->entries.end()) {
+    tier->size_bytes -= entry_it->second.size_bytes;
+    tier->lru.erase(entry_it->second.lru_position);
+    tier->entries.erase(entry_it);
+  }
+
+  Tier::Entry entry;
+  entry.serialized_operation = std::move(serialized_operation);
+  entry.size_bytes = size_bytes;
+  tier->lru.push_front(key);
+  entry.lru_position = tier->lru.begin();
+  tier->size_bytes += size_bytes;
+  tier->entries[key] = std::move(entry);
+}
+
+void ResultCache::EraseLocked(Tier *tier, const std::string &key) {
+  auto entry_it = tier->entries.find(key);
+  if (entry_it == tier->entries.end()) {
+    return;
+  }
+  if (tier == &disk_) {
+    llvm::sys::fs::remove(EntryPath(key));
+  }
+  tier->size_bytes -= entry_it->second.size_bytes;
+  tier->lru.erase(entry_it->second.lru_position);
+  tier->entries.erase(entry_it);
+}
+
+void ResultCache::EvictLocked(Tier *tier) {
+  while (tier->size_bytes > tier->max_bytes && !tier->lru.empty()) {
+    const std::string key = tier->lru.back();
+    EraseLocked(tier, key);
+    evictions_++;
+  }
+}
+
+void ResultCache::LoadDiskEntries() {
+  struct DiskEntry {
+    std::string key;
+    uint64_t size_bytes;
+    llvm::sys::TimePoint<> modification_time;
+  };
+  std::vector<DiskEntry> disk_entries;
+
+  std::error_code error_code;
+  for (llvm::sys::fs::directory_iterator it(directory_, error_code), end;
+       it != end && !error_code; it.increment(error_code)) {
+    llvm::StringRef file_name = llvm::sys::path::filename(it->path());
+    if (!file_name.endswith(kResultFileSuffix)) {
+      // Temporary files of a run that did not finish writing them.
+      if (file_name.endswith(".tmp")) {
+        llvm::sys::fs::remove(it->path());
+      }
+      continue;
+    }
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(it->path(), status)) {
+      continue;
+    }
+    disk_entries.push_back(
+        {file_name.drop_back(strlen(kResultFileSuffix)).str(),
+         status.getSize(), status.getLastModificationTime()});
+  }
+
+  std::sort(disk_entries.begin(), disk_entries.end(),
+            [](const DiskEntry &lhs, const DiskEntry &rhs) {
+              return lhs.modification_time < rhs.modification_time;
+            });
+
+  tbb::mutex::scoped_lock lock(mutex_);
+  for (const DiskEntry &disk_entry : disk_entries) {
+    if (disk_entry.size_bytes > disk_.max_bytes) {
+      llvm::sys::fs::remove(EntryPath(disk_entry.key));
+      continue;
+    }
+    PutLocked(&disk_, disk_entry.key, "", disk_entry.size_bytes);
+  }
+  EvictLocked(&disk_);
+  LOG(INFO) << "Loaded " << disk_.entries.size() << " cached results from "
+            << directory_;
+}
+
+std::string ResultCache::EntryPath(const std::string &key) const {
+  return directory_ + "/" + key + kResultFileSuffix;
+}
+
+}  // namespace error_specifications
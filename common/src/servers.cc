@@ -1,14 +1,20 @@
 #include "servers.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <ctime>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <vector>
 
 #include "glog/logging.h"
 #include "google/cloud/storage/client.h"
 #include "include/grpcpp/grpcpp.h"
 #include "openssl/evp.h"
+#include "tbb/blocked_range.h"
+#include "tbb/concurrent_vector.h"
+#include "tbb/parallel_for.h"
 
 #include "proto/operations.grpc.pb.h"
 
@@ -50,62 +56,207 @@ Uri FilePathToUri(const std::string &file_path) {
   return uri;
 }
 
+// Wraps an OpenSSL sha256 digest context. Every error is logged and returned
+// as an INTERNAL status.
+class Sha256Digest {
+ public:
+  Sha256Digest() : context_(EVP_MD_CTX_new()) {}
+  ~Sha256Digest() {
+    if (context_ != NULL) {
+      EVP_MD_CTX_free(context_);
+    }
+  }
+
+  grpc::Status Init() {
+    if (context_ == NULL) {
+      const std::string &err_msg =
+          "HashBitcodeData: Unable to create OpenSSL EVP context.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    if (EVP_DigestInit_ex(context_, EVP_sha256(), NULL) == 0) {
+      const std::string &err_msg =
+          "HashBitcodeData: Unable to initialize message digest.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    return grpc::Status::OK;
+  }
+
+  grpc::Status Update(const void *data, size_t length) {
+    if (EVP_DigestUpdate(context_, data, length) == 0) {
+      const std::string &err_msg = "HashBitcodeData: Unable to update digest.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    return grpc::Status::OK;
+  }
+
+  // Writes the raw digest to `out_digest`.
+  grpc::Status Final(std::string &out_digest) {
+    // The actual hash.
+    unsigned char hash[EVP_MAX_MD_SIZE];
+
+    // Hash length returned by OpenSSL.
+    unsigned int hash_length = 0;
+
+    if (EVP_DigestFinal_ex(context_, hash, &hash_length) == 0) {
+      const std::string &err_msg =
+          "HashBitcodeData: Unable to finalize digest.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    out_digest.assign(reinterpret_cast<const char *>(hash), hash_length);
+    return grpc::Status::OK;
+  }
+
+ private:
+  EVP_MD_CTX *context_;
+};
+
+// Converts a raw digest into lower case hex.
+static std::string DigestToHex(const std::string &digest) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string hex(digest.size() * 2, '0');
+  for (size_t i = 0; i < digest.size(); ++i) {
+    const unsigned char byte = static_cast<unsigned char>(digest[i]);
+    hex[2 * i] = kHexDigits[byte >> 4];
+    hex[2 * i + 1] = kHexDigits[byte & 0xf];
+  }
+  return hex;
+}
+
+// Computes the raw sha256 digest of `length` bytes at `data`.
+static grpc::Status DigestBytes(const char *data, size_t length,
+                                std::string &out_digest) {
+  Sha256Digest digest;
+  grpc::Status err = digest.Init();
+  if (!err.ok()) {
+    return err;
+  }
+  err = digest.Update(data, length);
+  if (!err.ok()) {
+    return err;
+  }
+  return digest.Final(out_digest);
+}
+
 grpc::Status HashString(const std::string &input_string,
                         std::string &out_hashed_string) {
-  EVP_MD_CTX *context = EVP_MD_CTX_new();
-  if (context == NULL) {
-    const std::string &err_msg =
-        "HashBitcodeData: Unable to create OpenSSL EVP context.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+  return HashBytes(input_string.c_str(), input_string.length(),
+                   out_hashed_string);
+}
+
+grpc::Status HashBytes(const char *data, size_t length,
+                       std::string &out_hashed_string) {
+  std::string digest;
+  grpc::Status err = DigestBytes(data, length, digest);
+  if (!err.ok()) {
+    return err;
   }
 
-  // All paths must call EVP_MD_CTX_free(context) from this point forward.
+  out_hashed_string = DigestToHex(digest);
 
-  int err = EVP_DigestInit_ex(context, EVP_sha256(), NULL);
-  if (err == 0) {
-    EVP_MD_CTX_free(context);
-    const std::string &err_msg =
-        "HashBitcodeData: Unable to initialize message digest.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
-  }
+  return grpc::Status::OK;
+}
 
-  err = EVP_DigestUpdate(context, input_string.c_str(), input_string.length());
-  if (err == 0) {
-    EVP_MD_CTX_free(context);
-    const std::string &err_msg = "HashBitcodeData: Unable to update digest.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+grpc::Status HashFile(const std::string &file_path,
+                      std::string &out_hashed_string) {
+  std::ifstream ifs(file_path, std::ios::binary);
+  if (!ifs) {
+    const std::string &err_msg = "Unable to read file.";
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
 
-  // The actual hash.
-  unsigned char hash[EVP_MAX_MD_SIZE];
+  Sha256Digest digest;
+  grpc::Status err = digest.Init();
+  if (!err.ok()) {
+    return err;
+  }
 
-  // Hash length returned by OpenSSL.
-  unsigned int hash_length = 0;
+  // Only one block of the file is ever held in memory.
+  std::vector<char> block(kHashBlockSize);
+  while (ifs) {
+    ifs.read(block.data(), block.size());
+    err = digest.Update(block.data(), ifs.gcount());
+    if (!err.ok()) {
+      return err;
+    }
+  }
+  if (ifs.bad()) {
+    const std::string &err_msg = "Unable to read file.";
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
 
-  err = EVP_DigestFinal_ex(context, hash, &hash_length);
-  if (err == 0) {
-    EVP_MD_CTX_free(context);
-    const std::string &err_msg = "HashBitcodeData: Unable to finalize digest.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+  std::string raw_digest;
+  err = digest.Final(raw_digest);
+  if (!err.ok()) {
+    return err;
   }
 
-  // Convert hash to string.
-  std::stringstream ss;
-  for (unsigned int i = 0; i < hash_length; ++i) {
-    ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+  out_hashed_string = DigestToHex(raw_digest);
+
+  return grpc::Status::OK;
+}
+
+grpc::Status TreeHashBytes(const char *data, size_t length,
+                           std::string &out_hashed_string) {
+  const size_t num_blocks =
+      std::max<size_t>(1, (length + kTreeHashBlockSize - 1) /
+                              kTreeHashBlockSize);
+
+  // Hash every block independently.
+  std::vector<std::string> block_digests(num_blocks);
+  tbb::concurrent_vector<grpc::Status> errors;
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, num_blocks),
+                    [&](const tbb::blocked_range<size_t> &blocks) {
+                      for (size_t i = blocks.begin(); i != blocks.end(); ++i) {
+                        const size_t offset = i * kTreeHashBlockSize;
+                        const size_t block_length =
+                            std::min(kTreeHashBlockSize, length - offset);
+                        grpc::Status err = DigestBytes(
+                            data + offset, block_length, block_digests[i]);
+                        if (!err.ok()) {
+                          errors.push_back(err);
+                        }
+                      }
+                    });
+  if (!errors.empty()) {
+    return errors[0];
   }
 
-  out_hashed_string = ss.str();
+  // The root is the digest of the concatenated block digests.
+  Sha256Digest root;
+  grpc::Status err = root.Init();
+  if (!err.ok()) {
+    return err;
+  }
+  for (const std::string &block_digest : block_digests) {
+    err = root.Update(block_digest.data(), block_digest.size());
+    if (!err.ok()) {
+      return err;
+    }
+  }
+  std::string root_digest;
+  err = root.Final(root_digest);
+  if (!err.ok()) {
+    return err;
+  }
 
-  EVP_MD_CTX_free(context);
+  out_hashed_string = kTreeHashPrefix + DigestToHex(root_digest);
 
   return grpc::Status::OK;
 }
 
+grpc::Status HashBytesLike(const std::string &hashed_string, const char *data,
+                           size_t length, std::string &out_hashed_string) {
+  if (hashed_string.compare(0, strlen(kTreeHashPrefix), kTreeHashPrefix) ==
+      0) {
+    return TreeHashBytes(data, length, out_hashed_string);
+  }
+  return HashBytes(data, length, out_hashed_string);
+}
+
 std::string StripSuffixAfterDot(const std::string &input_string) {
   auto idx = input_string.find('.');
   if (idx != std::string::npos) {
@@ -165,12 +316,46 @@ grpc::Status ReadUriIntoString(const Uri &uri, std::string &data) {
   return grpc::Status::OK;
 }
 
+grpc::Status ReadUriIntoBuffer(
+    const Uri &uri, std::unique_ptr<llvm::MemoryBuffer> *out_buffer) {
+  if (uri.scheme() != Scheme::SCHEME_FILE) {
+    std::string data;
+    grpc::Status err = ReadUriIntoString(uri, data);
+    if (!err.ok()) {
+      return err;
+    }
+    *out_buffer = llvm::MemoryBuffer::getMemBufferCopy(data, uri.path());
+    return grpc::Status::OK;
+  }
+
+  std::string file_path;
+  grpc::Status err = ConvertUriToFilePath(uri, file_path);
+  if (!err.ok()) {
+    return err;
+  }
+
+  // LLVM decides whether to mmap the file based on its size.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(file_path);
+  if (!buffer) {
+    const std::string &err_msg = "Unable to read file.";
+    LOG(ERROR) << err_msg << " " << buffer.getError().message();
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+  *out_buffer = std::move(buffer.get());
+
+  return grpc::Status::OK;
+}
+
 std::string GetTaskName(const std::string &request_name,
                         const std::string &unique_id) {
+  static std::atomic<uint64_t> next_sequence_number{0};
+  const uint64_t sequence_number = next_sequence_number++;
   std::time_t curr_time = std::time(nullptr);
   std::string time_stamp = std::asctime(std::localtime(&curr_time));
 
-  return request_name + "-" + unique_id + "-" + time_stamp;
+  return request_name + "-" + unique_id + "-" +
+         std::to_string(sequence_number) + "-" + time_stamp;
 }
 
 }  // namespace error_specifications
@@ -0,0 +1,162 @@
+// Tests of the local bitcode cache against a fake bitcode service.
+
+#include "bitcode_client.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/grpcpp/grpcpp.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "proto/bitcode.grpc.pb.h"
+#include "servers.h"
+
+namespace error_specifications {
+
+namespace {
+
+constexpr char kTestBitcodeServerAddress[] = "localhost:60054";
+
+constexpr char kBitcode[] = "Bitcode of a module.";
+
+// Serves `bytes` for every handle and counts the downloads.
+class FakeBitcodeService final : public BitcodeService::Service {
+ public:
+  grpc::Status DownloadBitcode(grpc::ServerContext *context,
+                               const DownloadBitcodeRequest *request,
+                               grpc::ServerWriter<DataChunk> *writer) override {
+    downloads++;
+    DataChunk chunk;
+    chunk.set_content(bytes);
+    chunk.set_total_size(bytes.size());
+    writer->Write(chunk);
+    return grpc::Status::OK;
+  }
+
+  std::string bytes = kBitcode;
+  std::atomic<int> downloads{0};
+};
+
+}  // namespace
+
+class LocalBitcodeCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(kTestBitcodeServerAddress,
+                             grpc::InsecureServerCredentials());
+    builder.RegisterService(&service_);
+    server_ = builder.BuildAndStart();
+    ASSERT_TRUE(server_);
+
+    llvm::SmallString<128> prefix;
+    llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/true, prefix);
+    llvm::sys::path::append(prefix, "bitcode_cache_test");
+    llvm::SmallString<128> cache_directory;
+    ASSERT_FALSE(
+        llvm::sys::fs::createUniqueDirectory(prefix, cache_directory));
+    cache_directory_ = cache_directory.str().str();
+
+    std::string hash;
+    ASSERT_TRUE(HashString(kBitcode, hash).ok());
+    bitcode_id_.set_id(hash);
+  }
+
+  void TearDown() override {
+    server_->Shutdown();
+    llvm::sys::fs::remove_directories(cache_directory_);
+  }
+
+  // Returns the path of the cache entry for the bitcode.
+  std::string EntryPath() const {
+    return cache_directory_ + "/" + bitcode_id_.id() + ".bc";
+  }
+
+  FakeBitcodeService service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::string cache_directory_;
+  Handle bitcode_id_;
+};
+
+// Tests that a miss downloads and stores the bitcode, and that the next
+// lookup is served from disk without downloading it again.
+TEST_F(LocalBitcodeCacheTest, HitsAfterMiss) {
+  LocalBitcodeCache cache(cache_directory_);
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  ASSERT_TRUE(
+      cache.GetBitcode(kTestBitcodeServerAddress, bitcode_id_, &buffer).ok());
+  EXPECT_EQ(buffer->getBuffer(), kBitcode);
+  EXPECT_EQ(cache.GetMisses(), 1);
+  EXPECT_EQ(service_.downloads, 1);
+  EXPECT_TRUE(llvm::sys::fs::exists(EntryPath()));
+
+  buffer.reset();
+  ASSERT_TRUE(
+      cache.GetBitcode(kTestBitcodeServerAddress, bitcode_id_, &buffer).ok());
+  EXPECT_EQ(buffer->getBuffer(), kBitcode);
+  EXPECT_EQ(cache.GetHits(), 1);
+  EXPECT_EQ(service_.downloads, 1);
+}
+
+// Tests that an entry that no longer matches its handle is discarded and
+// downloaded again.
+TEST_F(LocalBitcodeCacheTest, RefetchesCorruptEntry) {
+  LocalBitcodeCache cache(cache_directory_);
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  ASSERT_TRUE(
+      cache.GetBitcode(kTestBitcodeServerAddress, bitcode_id_, &buffer).ok());
+  {
+    std::error_code error_code;
+    llvm::raw_fd_ostream entry(EntryPath(), error_code);
+    ASSERT_FALSE(error_code);
+    entry << "Truncated";
+  }
+
+  ASSERT_TRUE(
+      cache.GetBitcode(kTestBitcodeServerAddress, bitcode_id_, &buffer).ok());
+  EXPECT_EQ(buffer->getBuffer(), kBitcode);
+  EXPECT_EQ(cache.GetHits(), 0);
+  EXPECT_EQ(cache.GetMisses(), 2);
+  EXPECT_EQ(service_.downloads, 2);
+
+  // The entry was replaced by the downloaded bitcode.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> entry =
+      llvm::MemoryBuffer::getFile(EntryPath());
+  ASSERT_TRUE(entry);
+  EXPECT_EQ((*entry)->getBuffer(), kBitcode);
+}
+
+// Tests that downloaded bitcode that does not match its handle is rejected
+// and never stored.
+TEST_F(LocalBitcodeCacheTest, RejectsHashMismatch) {
+  service_.bytes = "Some other bitcode.";
+  LocalBitcodeCache cache(cache_directory_);
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  EXPECT_EQ(cache.GetBitcode(kTestBitcodeServerAddress, bitcode_id_, &buffer)
+                .error_code(),
+            grpc::StatusCode::DATA_LOSS);
+  EXPECT_FALSE(llvm::sys::fs::exists(EntryPath()));
+}
+
+// Tests that an empty cache directory disables the cache.
+TEST_F(LocalBitcodeCacheTest, DisabledWithoutDirectory) {
+  LocalBitcodeCache cache("");
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(
+        cache.GetBitcode(kTestBitcodeServerAddress, bitcode_id_, &buffer).ok());
+    EXPECT_EQ(buffer->getBuffer(), kBitcode);
+  }
+  EXPECT_EQ(cache.GetHits(), 0);
+  EXPECT_EQ(cache.GetMisses(), 2);
+  EXPECT_EQ(service_.downloads, 2);
+  EXPECT_FALSE(llvm::sys::fs::exists(EntryPath()));
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,205 @@
+#include "executor.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Bound on waiting for the executor, so that a regression fails instead of
+// hanging.
+constexpr std::chrono::seconds kWaitDeadline(10);
+
+// Waits until `condition` holds, and returns whether it did before the
+// deadline.
+bool WaitFor(const std::function<bool()> &condition) {
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + kWaitDeadline;
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+// Bitcode whose parsed module takes up `bytes` of the budget.
+uint64_t BitcodeBytes(uint64_t bytes) {
+  return bytes / kParsedModuleBytesPerBitcodeByte;
+}
+
+// Returns a fetch part that fetches bitcode for a module of `bytes`.
+std::function<bool(uint64_t *)> FetchModule(uint64_t bytes) {
+  return [bytes](uint64_t *bitcode_bytes) {
+    *bitcode_bytes = BitcodeBytes(bytes);
+    return true;
+  };
+}
+
+}  // namespace
+
+// Tests that operations beyond the running and queued ones are rejected
+// with RESOURCE_EXHAUSTED, and that the others still run.
+TEST(OperationExecutorTest, RejectsWhenQueueIsFull) {
+  OperationExecutorOptions options;
+  options.max_concurrent_operations = 2;
+  options.max_queued_operations = 3;
+  OperationExecutor executor(options, "executor_test_full");
+
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<int> ran(0);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(executor
+                    .Submit(OperationPriority::kNormal,
+                            [released, &ran] {
+                              released.wait();
+                              ran++;
+                            })
+                    .ok());
+  }
+  EXPECT_EQ(executor.GetStats().running, 2);
+  EXPECT_EQ(executor.GetStats().queued, 3);
+
+  EXPECT_EQ(executor.Submit(OperationPriority::kHigh, [] {}).error_code(),
+            grpc::StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_EQ(executor.GetStats().rejected, 1);
+
+  release.set_value();
+  ASSERT_TRUE(WaitFor([&] { return executor.GetStats().completed == 5; }));
+  EXPECT_EQ(ran, 5);
+}
+
+// Tests that a high priority operation queued after normal ones runs first,
+// and that operations of one priority run in submission order.
+TEST(OperationExecutorTest, RunsHighPriorityFirst) {
+  OperationExecutorOptions options;
+  options.max_concurrent_operations = 1;
+  OperationExecutor executor(options, "executor_test_priority");
+
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  ASSERT_TRUE(executor
+                  .Submit(OperationPriority::kNormal,
+                          [released] { released.wait(); })
+                  .ok());
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+  auto record = [&](const std::string &name) {
+    return [&, name] {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(name);
+    };
+  };
+  ASSERT_TRUE(
+      executor.Submit(OperationPriority::kNormal, record("normal-1")).ok());
+  ASSERT_TRUE(
+      executor.Submit(OperationPriority::kNormal, record("normal-2")).ok());
+  ASSERT_TRUE(executor.Submit(OperationPriority::kHigh, record("high")).ok());
+
+  release.set_value();
+  ASSERT_TRUE(WaitFor([&] { return executor.GetStats().completed == 4; }));
+  EXPECT_EQ(order,
+            std::vector<std::string>({"high", "normal-1", "normal-2"}));
+}
+
+// Tests that an analysis waiting for its module to be admitted does not hold
+// a slot, and that it is started once the memory it waits for is released.
+TEST(OperationExecutorTest, AnalysisWaitingForMemoryDoesNotHoldSlot) {
+  OperationExecutorOptions options;
+  options.max_concurrent_operations = 1;
+  options.memory_budget_bytes = 1000;
+  OperationExecutor executor(options, "executor_test_admission");
+
+  // Kept after the first analysis finished, as if it were still running.
+  std::mutex mutex;
+  std::unique_ptr<MemoryReservation> held;
+  ASSERT_TRUE(executor
+                  .SubmitAnalysis(
+                      OperationPriority::kNormal, nullptr, FetchModule(800),
+                      [&](std::unique_ptr<MemoryReservation> reservation) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        held = std::move(reservation);
+                      })
+                  .ok());
+  ASSERT_TRUE(WaitFor([&] { return executor.GetStats().completed == 1; }));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_TRUE(held);
+  }
+
+  std::atomic<bool> admitted(false);
+  ASSERT_TRUE(executor
+                  .SubmitAnalysis(
+                      OperationPriority::kNormal, nullptr, FetchModule(800),
+                      [&](std::unique_ptr<MemoryReservation> reservation) {
+                        admitted = reservation != nullptr;
+                      })
+                  .ok());
+  ASSERT_TRUE(
+      WaitFor([&] { return executor.GetStats().waiting_for_memory == 1; }));
+  EXPECT_EQ(executor.GetStats().running, 0);
+
+  // The only slot is free for other operations in the meantime.
+  std::atomic<bool> ran(false);
+  ASSERT_TRUE(
+      executor.Submit(OperationPriority::kNormal, [&] { ran = true; }).ok());
+  ASSERT_TRUE(WaitFor([&] { return ran.load(); }));
+  EXPECT_FALSE(admitted);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    held.reset();
+  }
+  ASSERT_TRUE(WaitFor([&] { return executor.GetStats().completed == 3; }));
+  EXPECT_TRUE(admitted);
+  EXPECT_EQ(executor.GetStats().waiting_for_memory, 0);
+}
+
+// Tests that a cancelled analysis stops waiting for memory and runs its
+// second part without a reservation.
+TEST(OperationExecutorTest, CancelledAnalysisStopsWaitingForMemory) {
+  OperationExecutorOptions options;
+  options.max_concurrent_operations = 1;
+  options.memory_budget_bytes = 1000;
+  OperationExecutor executor(options, "executor_test_admission_cancelled");
+  std::unique_ptr<MemoryReservation> held =
+      executor.GetMemoryBudget()->Admit(BitcodeBytes(800), nullptr);
+  ASSERT_TRUE(held);
+
+  auto cancellation_token = std::make_shared<CancellationToken>();
+  std::atomic<bool> analyzed(false);
+  std::atomic<bool> admitted(true);
+  ASSERT_TRUE(executor
+                  .SubmitAnalysis(
+                      OperationPriority::kNormal, cancellation_token,
+                      FetchModule(800),
+                      [&](std::unique_ptr<MemoryReservation> reservation) {
+                        admitted = reservation != nullptr;
+                        analyzed = true;
+                      })
+                  .ok());
+  ASSERT_TRUE(
+      WaitFor([&] { return executor.GetStats().waiting_for_memory == 1; }));
+
+  // The cancellation is noticed once the next operation is submitted.
+  cancellation_token->Cancel();
+  ASSERT_TRUE(executor.Submit(OperationPriority::kNormal, [] {}).ok());
+  ASSERT_TRUE(WaitFor([&] { return analyzed.load(); }));
+  EXPECT_FALSE(admitted);
+  EXPECT_EQ(executor.GetStats().waiting_for_memory, 0);
+}
+
+}  // namespace error_specifications
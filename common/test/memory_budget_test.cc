@@ -0,0 +1,206 @@
+#include "memory_budget.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Long enough for a thread to start waiting for admission.
+constexpr std::chrono::milliseconds kSettleTime(200);
+
+// Bitcode whose parsed module takes up `bytes` of the budget.
+uint64_t BitcodeBytes(uint64_t bytes) {
+  return bytes / kParsedModuleBytesPerBitcodeByte;
+}
+
+}  // namespace
+
+// Tests that tasks are admitted in arrival order, even when a later task
+// would fit before an earlier one.
+TEST(MemoryBudgetTest, AdmitsInArrivalOrder) {
+  MemoryBudget budget(1000, "memory_budget_test_order");
+  std::unique_ptr<MemoryReservation> first =
+      budget.Admit(BitcodeBytes(400), nullptr);
+  ASSERT_TRUE(first);
+  EXPECT_EQ(first->EstimatedBytes(), 400);
+
+  std::mutex mutex;
+  std::vector<std::string> admitted;
+  auto admit = [&](const std::string &name, uint64_t bytes) {
+    std::unique_ptr<MemoryReservation> reservation =
+        budget.Admit(BitcodeBytes(bytes), nullptr);
+    std::lock_guard<std::mutex> lock(mutex);
+    admitted.push_back(name);
+  };
+  // The second task does not fit next to the first one, the third does but
+  // has to wait for the second.
+  std::thread second(admit, "second", 704);
+  std::this_thread::sleep_for(kSettleTime);
+  std::thread third(admit, "third", 400);
+  std::this_thread::sleep_for(kSettleTime);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_TRUE(admitted.empty());
+  }
+
+  first.reset();
+  second.join();
+  third.join();
+  EXPECT_EQ(admitted, std::vector<std::string>({"second", "third"}));
+}
+
+// Tests that a task larger than the whole budget is admitted, and grown,
+// when it runs alone, and only then.
+TEST(MemoryBudgetTest, AdmitsOversizedTaskAlone) {
+  MemoryBudget budget(1000, "memory_budget_test_oversized");
+  std::unique_ptr<MemoryReservation> oversized =
+      budget.Admit(BitcodeBytes(4000), nullptr);
+  ASSERT_TRUE(oversized);
+  EXPECT_TRUE(budget.Grow(oversized.get(), 1, nullptr));
+  EXPECT_GT(oversized->EstimatedBytes(), 4000);
+
+  std::atomic<bool> admitted(false);
+  std::thread small([&] {
+    std::unique_ptr<MemoryReservation> reservation =
+        budget.Admit(BitcodeBytes(8), nullptr);
+    admitted = true;
+  });
+  std::this_thread::sleep_for(kSettleTime);
+  EXPECT_FALSE(admitted);
+  oversized.reset();
+  small.join();
+  EXPECT_TRUE(admitted);
+}
+
+// Tests that an admitted task that cannot grow goes ahead when every other
+// admitted task waits to grow as well, instead of waiting for them forever.
+TEST(MemoryBudgetTest, GrowsWhenAllAdmittedTasksWait) {
+  MemoryBudget budget(1000, "memory_budget_test_grow");
+  std::unique_ptr<MemoryReservation> first =
+      budget.Admit(BitcodeBytes(400), nullptr);
+  std::unique_ptr<MemoryReservation> second =
+      budget.Admit(BitcodeBytes(400), nullptr);
+  ASSERT_TRUE(first);
+  ASSERT_TRUE(second);
+
+  const uint64_t instructions =
+      1000 / static_cast<uint64_t>(kDefaultBytesPerInstruction) + 1;
+  std::thread grow_first([&] {
+    EXPECT_TRUE(budget.Grow(first.get(), instructions, nullptr));
+    first.reset();
+  });
+  std::thread grow_second([&] {
+    EXPECT_TRUE(budget.Grow(second.get(), instructions, nullptr));
+    second.reset();
+  });
+  grow_first.join();
+  grow_second.join();
+}
+
+// Tests that a task stops waiting once it is cancelled, and that the tasks
+// behind it are admitted in its stead.
+TEST(MemoryBudgetTest, GivesUpOnCancellation) {
+  MemoryBudget budget(1000, "memory_budget_test_cancellation");
+  std::unique_ptr<MemoryReservation> first =
+      budget.Admit(BitcodeBytes(800), nullptr);
+  ASSERT_TRUE(first);
+
+  CancellationToken cancellation_token;
+  std::atomic<bool> cancelled_admitted(true);
+  std::thread cancelled([&] {
+    cancelled_admitted =
+        budget.Admit(BitcodeBytes(800), &cancellation_token) != nullptr;
+  });
+  std::this_thread::sleep_for(kSettleTime);
+  std::atomic<bool> small_admitted(false);
+  std::thread small([&] {
+    std::unique_ptr<MemoryReservation> reservation =
+        budget.Admit(BitcodeBytes(200), nullptr);
+    small_admitted = true;
+  });
+  std::this_thread::sleep_for(kSettleTime);
+  EXPECT_FALSE(small_admitted);
+
+  cancellation_token.Cancel();
+  cancelled.join();
+  small.join();
+  EXPECT_FALSE(cancelled_admitted);
+  EXPECT_TRUE(small_admitted);
+
+  // Growing gives up as well, and leaves the reservation as it was.
+  std::unique_ptr<MemoryReservation> second =
+      budget.Admit(BitcodeBytes(200), nullptr);
+  ASSERT_TRUE(second);
+  EXPECT_FALSE(budget.Grow(second.get(), 1, &cancellation_token));
+  EXPECT_EQ(second->EstimatedBytes(), 200);
+}
+
+// Tests that TryAdmit admits a task only if it fits and no task waits
+// ahead of it, and that the changed callback tells when to try again.
+TEST(MemoryBudgetTest, TryAdmitsWithoutWaiting) {
+  MemoryBudget budget(1000, "memory_budget_test_try_admit");
+  std::atomic<int> changes(0);
+  budget.SetChangedCallback([&] { changes++; });
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+
+  std::unique_ptr<MemoryReservation> first =
+      budget.TryAdmit(BitcodeBytes(800), now, false);
+  ASSERT_TRUE(first);
+  EXPECT_FALSE(budget.TryAdmit(BitcodeBytes(400), now, false));
+
+  // A task waiting in Admit goes first, even though the next one fits.
+  std::atomic<bool> admitted(false);
+  std::thread waiting([&] {
+    std::unique_ptr<MemoryReservation> reservation =
+        budget.Admit(BitcodeBytes(400), nullptr);
+    admitted = true;
+  });
+  std::this_thread::sleep_for(kSettleTime);
+  EXPECT_FALSE(budget.TryAdmit(BitcodeBytes(8), now, true));
+
+  first.reset();
+  waiting.join();
+  EXPECT_TRUE(admitted);
+  EXPECT_GE(changes, 2);
+
+  std::unique_ptr<MemoryReservation> second =
+      budget.TryAdmit(BitcodeBytes(400), now, true);
+  ASSERT_TRUE(second);
+  EXPECT_EQ(second->EstimatedBytes(), 400);
+}
+
+// Tests that the bytes per instruction are calibrated from the peak of a
+// task that ran alone.
+TEST(MemoryBudgetTest, CalibratesFromMeasuredPeak) {
+  MemoryBudget budget(0, "memory_budget_test_calibration");
+  const uint64_t instructions = 1000;
+  const uint64_t default_estimate = budget.Estimate(0, instructions);
+  EXPECT_EQ(default_estimate,
+            static_cast<uint64_t>(kDefaultBytesPerInstruction) * instructions);
+
+  {
+    std::unique_ptr<MemoryReservation> reservation =
+        budget.Admit(BitcodeBytes(1000), nullptr);
+    ASSERT_TRUE(reservation);
+    ASSERT_TRUE(budget.Grow(reservation.get(), instructions, nullptr));
+    // A new peak of the process, much larger than the default estimate.
+    const size_t peak_bytes = 256 << 20;
+    std::unique_ptr<char[]> memory(new char[peak_bytes]);
+    memset(memory.get(), 1, peak_bytes);
+    EXPECT_EQ(memory[peak_bytes - 1], 1);
+  }
+  EXPECT_GT(budget.Estimate(0, instructions), 2 * default_estimate);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,113 @@
+#include "metrics.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "metrics_server.h"
+
+namespace error_specifications {
+
+namespace {
+
+constexpr char kTestMetricsAddress[] = "127.0.0.1:60055";
+constexpr int kTestMetricsPort = 60055;
+
+// Sends `request` to the metrics endpoint and returns the whole response.
+std::string Scrape(const std::string &request) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  EXPECT_GE(fd, 0);
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(kTestMetricsPort);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+              sizeof(address)) != 0) {
+    close(fd);
+    return "";
+  }
+  send(fd, request.data(), request.size(), 0);
+
+  std::string response;
+  char buffer[1024];
+  ssize_t received;
+  while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, received);
+  }
+  close(fd);
+  return response;
+}
+
+}  // namespace
+
+// Tests the exact text of a registry with one metric of each type.
+TEST(MetricsRegistryTest, RendersPrometheusText) {
+  MetricsRegistry registry;
+  registry
+      .GetCounter("requests_total", "Requests.", {{"path", "a\"b\\c\nd"}})
+      ->Increment(2);
+  registry.GetGauge("queue_depth", "Queued operations.")->Set(-3);
+  Histogram *histogram = registry.GetHistogram(
+      "latency_seconds", "Latency.", {1, 2.5}, {{"service", "eesi"}});
+  histogram->Observe(0.5);
+  histogram->Observe(2);
+  histogram->Observe(10);
+
+  EXPECT_EQ(registry.RenderPrometheusText(),
+            "# HELP latency_seconds Latency.\n"
+            "# TYPE latency_seconds histogram\n"
+            "latency_seconds_bucket{service=\"eesi\",le=\"1\"} 1\n"
+            "latency_seconds_bucket{service=\"eesi\",le=\"2.5\"} 2\n"
+            "latency_seconds_bucket{service=\"eesi\",le=\"+Inf\"} 3\n"
+            "latency_seconds_sum{service=\"eesi\"} 12.5\n"
+            "latency_seconds_count{service=\"eesi\"} 3\n"
+            "# HELP queue_depth Queued operations.\n"
+            "# TYPE queue_depth gauge\n"
+            "queue_depth -3\n"
+            "# HELP requests_total Requests.\n"
+            "# TYPE requests_total counter\n"
+            "requests_total{path=\"a\\\"b\\\\c\\nd\"} 2\n");
+}
+
+// Tests that a histogram without labels only carries the bucket bound.
+TEST(MetricsRegistryTest, RendersUnlabelledHistogram) {
+  MetricsRegistry registry;
+  registry.GetHistogram("sizes", "Sizes.", {10})->Observe(20);
+
+  EXPECT_EQ(registry.RenderPrometheusText(),
+            "# HELP sizes Sizes.\n"
+            "# TYPE sizes histogram\n"
+            "sizes_bucket{le=\"10\"} 0\n"
+            "sizes_bucket{le=\"+Inf\"} 1\n"
+            "sizes_sum 20\n"
+            "sizes_count 1\n");
+}
+
+// Tests that the endpoint serves the registry at /metrics and nothing else.
+TEST(MetricsEndpointTest, ServesMetricsOnly) {
+  MetricsRegistry::Global()
+      .GetCounter("metrics_test_scrapes_total", "Scrapes.")
+      ->Increment();
+  MetricsEndpoint endpoint;
+  ASSERT_TRUE(endpoint.Start(kTestMetricsAddress).ok());
+
+  const std::string metrics =
+      Scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(metrics.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << metrics;
+  EXPECT_NE(metrics.find("\r\n\r\n# HELP "), std::string::npos) << metrics;
+  EXPECT_NE(metrics.find("\nmetrics_test_scrapes_total 1\n"),
+            std::string::npos)
+      << metrics;
+
+  const std::string not_found =
+      Scrape("GET /other HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(not_found.rfind("HTTP/1.1 404 Not Found\r\n", 0), 0) << not_found;
+  EXPECT_NE(not_found.find("\r\n\r\nMetrics are served at /metrics.\n"),
+            std::string::npos)
+      << not_found;
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,312 @@
+// End-to-end tests of the operations service on the asynchronous server.
+
+#include "operations_service.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/grpcpp/grpcpp.h"
+
+#include "async_server.h"
+#include "proto/operations.grpc.pb.h"
+
+namespace error_specifications {
+
+namespace {
+
+constexpr char kTestAsyncServerAddress[] = "localhost:60059";
+
+// Bound on calls that are expected to complete, so that a regression fails
+// instead of hanging.
+constexpr std::chrono::seconds kCallDeadline(10);
+
+// Creates the running operation `name`, as a service does before it starts
+// the task.
+void StartOperation(OperationsServiceImpl *service, const std::string &name) {
+  Operation operation;
+  operation.set_name(name);
+  service->UpdateOperation(name, operation);
+}
+
+// Creates the operation `name` for a request identified by `request_key`, as
+// a service does, and returns whether it attached to a running task instead
+// of starting one.
+bool StartOrAttachOperation(OperationsServiceImpl *service,
+                            const std::string &name,
+                            const std::string &request_key) {
+  Operation operation;
+  operation.set_name(name);
+  operation.set_done(0);
+  if (service->AttachToRunningTask(name, request_key, &operation)) {
+    return true;
+  }
+  service->UpdateOperation(name, operation);
+  return false;
+}
+
+// Returns the finished result of a task.
+Operation TaskResult(const std::string &task_name) {
+  Operation operation;
+  operation.set_name(task_name);
+  operation.set_done(1);
+  operation.mutable_error()->set_message("Result.");
+  return operation;
+}
+
+}  // namespace
+
+class AsyncOperationsServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    AsyncServerOptions async_server_options;
+    async_server_options.enabled = true;
+    async_server_options.worker_threads = 1;
+    server_ = std::make_unique<AsyncServer>(async_server_options);
+    service_.AddToAsyncServer(server_.get());
+    ASSERT_TRUE(server_->Start(kTestAsyncServerAddress).ok());
+    stub_ = OperationsService::NewStub(grpc::CreateChannel(
+        kTestAsyncServerAddress, grpc::InsecureChannelCredentials()));
+  }
+
+  void TearDown() override { server_->Shutdown(); }
+
+  grpc::Status GetOperation(const std::string &name, Operation *operation) {
+    GetOperationRequest request;
+    request.set_name(name);
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + kCallDeadline);
+    return stub_->GetOperation(&context, request, operation);
+  }
+
+  grpc::Status CancelOperation(const std::string &name) {
+    CancelOperationRequest request;
+    request.set_name(name);
+    google::protobuf::Empty response;
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + kCallDeadline);
+    return stub_->CancelOperation(&context, request, &response);
+  }
+
+  OperationsServiceImpl service_;
+  std::unique_ptr<AsyncServer> server_;
+  std::unique_ptr<OperationsService::Stub> stub_;
+};
+
+// Tests that waiting watches do not hold the worker threads that blocking
+// calls need, and that every watch ends with the final state.
+TEST_F(AsyncOperationsServiceTest, WatchesDoNotHoldWorkers) {
+  constexpr int kWatches = 16;
+  for (int i = 0; i < kWatches; i++) {
+    StartOperation(&service_, "operation-" + std::to_string(i));
+  }
+
+  std::atomic<int> started(0);
+  std::atomic<int> finished(0);
+  std::vector<std::thread> watches;
+  for (int i = 0; i < kWatches; i++) {
+    watches.emplace_back([this, i, &started, &finished] {
+      WatchOperationRequest request;
+      request.set_name("operation-" + std::to_string(i));
+      grpc::ClientContext context;
+      context.set_deadline(std::chrono::system_clock::now() + kCallDeadline);
+      std::unique_ptr<grpc::ClientReader<Operation>> reader(
+          stub_->WatchOperation(&context, request));
+      Operation operation;
+      bool first = true;
+      while (reader->Read(&operation)) {
+        if (first) {
+          first = false;
+          started++;
+        }
+      }
+      if (reader->Finish().ok() && operation.done() &&
+          operation.error().message() == "Result.") {
+        finished++;
+      }
+    });
+  }
+  const auto deadline = std::chrono::steady_clock::now() + kCallDeadline;
+  while (started < kWatches && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(started, kWatches);
+
+  // InvalidateResults needs the only worker thread.
+  InvalidateResultsRequest invalidate_request;
+  InvalidateResultsResponse invalidate_response;
+  grpc::ClientContext invalidate_context;
+  invalidate_context.set_deadline(std::chrono::system_clock::now() +
+                                  kCallDeadline);
+  EXPECT_TRUE(stub_
+                  ->InvalidateResults(&invalidate_context, invalidate_request,
+                                      &invalidate_response)
+                  .ok());
+
+  for (int update = 1; update <= 100; update++) {
+    for (int i = 0; i < kWatches; i++) {
+      Operation operation;
+      operation.set_name("operation-" + std::to_string(i));
+      operation.set_done(update == 100);
+      operation.mutable_error()->set_message(update == 100 ? "Result." : "");
+      service_.UpdateOperation(operation.name(), operation);
+    }
+  }
+  for (std::thread &watch : watches) {
+    watch.join();
+  }
+  EXPECT_EQ(finished, kWatches);
+
+  // Finished operations are not kept, same as with GetOperation.
+  GetOperationRequest get_request;
+  get_request.set_name("operation-0");
+  Operation operation;
+  grpc::ClientContext get_context;
+  EXPECT_EQ(stub_->GetOperation(&get_context, get_request, &operation)
+                .error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+// Tests that watching an unknown operation fails right away.
+TEST_F(AsyncOperationsServiceTest, WatchUnknownOperation) {
+  WatchOperationRequest request;
+  request.set_name("unknown");
+  grpc::ClientContext context;
+  context.set_deadline(std::chrono::system_clock::now() + kCallDeadline);
+  std::unique_ptr<grpc::ClientReader<Operation>> reader(
+      stub_->WatchOperation(&context, request));
+  Operation operation;
+  EXPECT_FALSE(reader->Read(&operation));
+  EXPECT_EQ(reader->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+// Tests that watches that went away, and watches still waiting when the
+// server shuts down, are finished while updates keep arriving.
+TEST_F(AsyncOperationsServiceTest, FinishesAbandonedWatches) {
+  StartOperation(&service_, "operation");
+
+  WatchOperationRequest request;
+  request.set_name("operation");
+  grpc::ClientContext cancelled_context;
+  std::unique_ptr<grpc::ClientReader<Operation>> cancelled_reader(
+      stub_->WatchOperation(&cancelled_context, request));
+  Operation operation;
+  ASSERT_TRUE(cancelled_reader->Read(&operation));
+  cancelled_context.TryCancel();
+  while (cancelled_reader->Read(&operation)) {
+  }
+  EXPECT_EQ(cancelled_reader->Finish().error_code(),
+            grpc::StatusCode::CANCELLED);
+
+  grpc::ClientContext waiting_context;
+  std::unique_ptr<grpc::ClientReader<Operation>> waiting_reader(
+      stub_->WatchOperation(&waiting_context, request));
+  ASSERT_TRUE(waiting_reader->Read(&operation));
+
+  std::atomic<bool> stop(false);
+  std::thread updates([this, &stop] {
+    Operation update;
+    update.set_name("operation");
+    while (!stop) {
+      service_.UpdateOperation("operation", update);
+    }
+  });
+  server_->Shutdown();
+  stop = true;
+  updates.join();
+  while (waiting_reader->Read(&operation)) {
+  }
+  EXPECT_FALSE(waiting_reader->Finish().ok());
+}
+
+// Tests that identical requests share one task, and that each gets its own
+// operation with the task's result.
+TEST_F(AsyncOperationsServiceTest, AttachesIdenticalRequests) {
+  EXPECT_FALSE(StartOrAttachOperation(&service_, "first", "request"));
+  EXPECT_TRUE(StartOrAttachOperation(&service_, "second", "request"));
+  // A different request starts a task of its own.
+  EXPECT_FALSE(StartOrAttachOperation(&service_, "other", "other-request"));
+
+  Operation operation;
+  ASSERT_TRUE(GetOperation("second", &operation).ok());
+  EXPECT_EQ(operation.name(), "second");
+  EXPECT_FALSE(operation.done());
+
+  service_.UpdateOperation("first", TaskResult("first"));
+  for (const std::string name : {"first", "second"}) {
+    Operation result;
+    ASSERT_TRUE(GetOperation(name, &result).ok());
+    EXPECT_EQ(result.name(), name);
+    EXPECT_TRUE(result.done());
+    EXPECT_EQ(result.error().message(), "Result.");
+  }
+  EXPECT_FALSE(service_.GetCancellationToken("other")->IsCancelled());
+
+  // Once the task is over, the next identical request starts a new one.
+  EXPECT_FALSE(StartOrAttachOperation(&service_, "third", "request"));
+}
+
+// Tests that cancelling one of the operations attached to a task only
+// finishes that operation, and the task goes on for the others.
+TEST_F(AsyncOperationsServiceTest, CancelDetachesSharedOperation) {
+  ASSERT_FALSE(StartOrAttachOperation(&service_, "first", "request"));
+  ASSERT_TRUE(StartOrAttachOperation(&service_, "second", "request"));
+  std::shared_ptr<const CancellationToken> cancellation_token =
+      service_.GetCancellationToken("first");
+
+  // The operation the task was started for can leave it as well.
+  ASSERT_TRUE(CancelOperation("first").ok());
+  EXPECT_FALSE(cancellation_token->IsCancelled());
+  Operation cancelled;
+  ASSERT_TRUE(GetOperation("first", &cancelled).ok());
+  EXPECT_TRUE(cancelled.done());
+  EXPECT_EQ(cancelled.error().code(), grpc::StatusCode::CANCELLED);
+
+  service_.UpdateOperation("first", TaskResult("first"));
+  Operation result;
+  ASSERT_TRUE(GetOperation("second", &result).ok());
+  EXPECT_TRUE(result.done());
+  EXPECT_EQ(result.error().message(), "Result.");
+}
+
+// Tests that cancelling the last operation attached to a task cancels the
+// task.
+TEST_F(AsyncOperationsServiceTest, CancelLastSharedOperationCancelsTask) {
+  ASSERT_FALSE(StartOrAttachOperation(&service_, "first", "request"));
+  ASSERT_TRUE(StartOrAttachOperation(&service_, "second", "request"));
+  std::shared_ptr<const CancellationToken> cancellation_token =
+      service_.GetCancellationToken("first");
+
+  ASSERT_TRUE(CancelOperation("second").ok());
+  EXPECT_FALSE(cancellation_token->IsCancelled());
+  ASSERT_TRUE(CancelOperation("first").ok());
+  EXPECT_TRUE(cancellation_token->IsCancelled());
+}
+
+// Tests that the operations attached to a task that could not be started
+// finish with the error of the submission.
+TEST_F(AsyncOperationsServiceTest, DiscardFinishesAttachedOperations) {
+  ASSERT_FALSE(StartOrAttachOperation(&service_, "first", "request"));
+  ASSERT_TRUE(StartOrAttachOperation(&service_, "second", "request"));
+
+  service_.DiscardOperation(
+      "first",
+      grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Queue is full."));
+  Operation operation;
+  EXPECT_EQ(GetOperation("first", &operation).error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+  ASSERT_TRUE(GetOperation("second", &operation).ok());
+  EXPECT_TRUE(operation.done());
+  EXPECT_EQ(operation.error().code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_EQ(operation.error().message(), "Queue is full.");
+
+  // The request is no longer running.
+  EXPECT_FALSE(StartOrAttachOperation(&service_, "third", "request"));
+}
+
+}  // namespace error_specifications
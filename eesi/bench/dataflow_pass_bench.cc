@@ -0,0 +1,202 @@
+// Macrobenchmarks of the dataflow passes and of ErrorBlocksPass on whole
+// modules.
+//
+// Usage: dataflow_pass_bench [benchmark flags] [--synthetic_functions=N,...]
+//            MODULE...
+//
+// Every module is parsed, or generated, once before any benchmark runs. Each
+// benchmark runs one pass, together with the passes it requires, in a fresh
+// legacy pass manager, so that e.g. ReturnConstraintsPass includes
+// ReturnPropagationPass.
+// Throughput is reported as instructions per second. The dataflow passes
+// also report the blocks of the module and how many times their solver
+// visited blocks.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "benchmark/benchmark.h"
+#include "dataflow_solver.h"
+#include "eesi/bench/synthetic_module.h"
+#include "error_blocks_pass.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "return_constraints_pass.h"
+#include "return_propagation_pass.h"
+#include "return_range_pass.h"
+#include "returned_values_pass.h"
+
+ABSL_FLAG(std::vector<std::string>, synthetic_functions, {},
+          "Sizes, in functions, of synthetic modules to benchmark besides the "
+          "given modules.");
+ABSL_FLAG(int, synthetic_scc_size, 1,
+          "Functions per call-graph strongly connected component of the "
+          "synthetic modules.");
+
+namespace error_specifications {
+namespace {
+
+// A module parsed once and shared by every benchmark on it. The passes only
+// read the module.
+struct ParsedModule {
+  std::string name;
+  llvm::LLVMContext llvm_context;
+  std::unique_ptr<llvm::Module> module;
+  int64_t num_instructions = 0;
+};
+
+void CountInstructions(ParsedModule *parsed) {
+  for (const llvm::Function &function : *parsed->module) {
+    for (const llvm::BasicBlock &block : function) {
+      parsed->num_instructions += block.size();
+    }
+  }
+}
+
+std::unique_ptr<ParsedModule> ParseModule(const std::string &path) {
+  auto parsed = std::make_unique<ParsedModule>();
+  parsed->name = llvm::sys::path::filename(path).str();
+  llvm::SMDiagnostic err;
+  parsed->module = llvm::parseIRFile(path, err, parsed->llvm_context);
+  if (!parsed->module) {
+    err.print("dataflow-pass-bench", llvm::errs());
+    return nullptr;
+  }
+  CountInstructions(parsed.get());
+
+  return parsed;
+}
+
+std::unique_ptr<ParsedModule> GenerateModule(int num_functions,
+                                             int scc_size) {
+  auto parsed = std::make_unique<ParsedModule>();
+  parsed->name = "synthetic-" + std::to_string(num_functions);
+  SyntheticModuleOptions options;
+  options.num_functions = num_functions;
+  options.scc_size = scc_size;
+  parsed->module = GenerateSyntheticModule(options, &parsed->llvm_context);
+  CountInstructions(parsed.get());
+
+  return parsed;
+}
+
+// Runs the pass returned by `make_pass` over `parsed` on every iteration.
+template <typename MakePass>
+void RunPass(benchmark::State &state, const ParsedModule *parsed,
+             MakePass make_pass) {
+  for (auto _ : state) {
+    llvm::legacy::PassManager pass_manager;
+    pass_manager.add(make_pass());
+    pass_manager.run(*parsed->module);
+  }
+  state.SetItemsProcessed(state.iterations() * parsed->num_instructions);
+  state.counters["instructions"] = parsed->num_instructions;
+}
+
+// Like RunPass, for a dataflow pass of type Pass whose solver stats
+// `get_solver_stats` returns.
+template <typename Pass, typename GetSolverStats>
+void RunDataflowPass(benchmark::State &state, const ParsedModule *parsed,
+                     GetSolverStats get_solver_stats) {
+  DataflowSolverStats stats;
+  for (auto _ : state) {
+    llvm::legacy::PassManager pass_manager;
+    Pass *pass = new Pass();
+    pass_manager.add(pass);
+    pass_manager.run(*parsed->module);
+    stats = get_solver_stats(*pass);
+  }
+  state.SetItemsProcessed(state.iterations() * parsed->num_instructions);
+  state.counters["instructions"] = parsed->num_instructions;
+  state.counters["blocks"] = stats.blocks;
+  state.counters["block_visits"] = stats.block_visits;
+}
+
+void RegisterBenchmarks(const ParsedModule *parsed) {
+  benchmark::RegisterBenchmark(
+      ("ReturnPropagationPass/" + parsed->name).c_str(),
+      [parsed](benchmark::State &state) {
+        RunDataflowPass<ReturnPropagationPass>(
+            state, parsed, [](const ReturnPropagationPass &pass) {
+              return pass.GetResult().GetSolverStats();
+            });
+      });
+  benchmark::RegisterBenchmark(
+      ("ReturnConstraintsPass/" + parsed->name).c_str(),
+      [parsed](benchmark::State &state) {
+        RunDataflowPass<ReturnConstraintsPass>(
+            state, parsed, [](const ReturnConstraintsPass &pass) {
+              return pass.GetResult().GetSolverStats();
+            });
+      });
+  benchmark::RegisterBenchmark(
+      ("ReturnedValuesPass/" + parsed->name).c_str(),
+      [parsed](benchmark::State &state) {
+        RunDataflowPass<ReturnedValuesPass>(
+            state, parsed, [](const ReturnedValuesPass &pass) {
+              return pass.GetSolverStats();
+            });
+      });
+  benchmark::RegisterBenchmark(
+      ("ReturnRangePass/" + parsed->name).c_str(),
+      [parsed](benchmark::State &state) {
+        RunDataflowPass<ReturnRangePass>(
+            state, parsed, [](const ReturnRangePass &pass) {
+              return pass.GetSolverStats();
+            });
+      });
+  benchmark::RegisterBenchmark(
+      ("ErrorBlocksPass/" + parsed->name).c_str(),
+      [parsed](benchmark::State &state) {
+        RunPass(state, parsed, [] {
+          ErrorBlocksPass *error_blocks_pass = new ErrorBlocksPass();
+          error_blocks_pass->SetSpecificationsRequest(
+              GetSpecificationsRequest(), nullptr);
+          return error_blocks_pass;
+        });
+      });
+}
+
+}  // namespace
+}  // namespace error_specifications
+
+int main(int argc, char **argv) {
+  // The benchmark flags are removed before the remaining ones are parsed.
+  benchmark::Initialize(&argc, argv);
+  std::vector<char *> paths = absl::ParseCommandLine(argc, argv);
+  const std::vector<std::string> synthetic_functions =
+      absl::GetFlag(FLAGS_synthetic_functions);
+  if (paths.size() < 2 && synthetic_functions.empty()) {
+    llvm::errs() << "Usage: " << argv[0]
+                 << " [benchmark flags] [--synthetic_functions=N,...] "
+                    "MODULE...\n";
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<error_specifications::ParsedModule>> modules;
+  for (size_t i = 1; i < paths.size(); i++) {
+    auto parsed = error_specifications::ParseModule(paths[i]);
+    if (!parsed) {
+      return 1;
+    }
+    modules.push_back(std::move(parsed));
+  }
+  for (const std::string &num_functions : synthetic_functions) {
+    modules.push_back(error_specifications::GenerateModule(
+        std::stoi(num_functions), absl::GetFlag(FLAGS_synthetic_scc_size)));
+  }
+  for (const auto &parsed : modules) {
+    error_specifications::RegisterBenchmarks(parsed.get());
+  }
+  benchmark::RunSpecifiedBenchmarks();
+
+  return 0;
+}
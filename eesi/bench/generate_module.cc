@@ -0,0 +1,78 @@
+// Writes a synthetic module for stress benchmarks, e.g.
+//
+//   bazel run //eesi/bench:generate_module -- --functions=100000 \
+//       --scc_size=8 --output=/tmp/synthetic-100k.bc
+//
+// The module is written as text if the output ends in .ll and as bitcode
+// otherwise. See synthetic_module.h for the shape of the module.
+
+#include <string>
+#include <system_error>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "eesi/bench/synthetic_module.h"
+#include "glog/logging.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+ABSL_FLAG(int, functions, 1000, "Number of defined functions.");
+ABSL_FLAG(int, call_sites_per_function, 4,
+          "Checked call sites, each with an error block, per function.");
+ABSL_FLAG(int, scc_size, 1,
+          "Functions per call-graph strongly connected component.");
+ABSL_FLAG(int, error_code_percent, 50,
+          "Percent of error blocks that return an error code rather than the "
+          "result of the failed call.");
+ABSL_FLAG(int, error_only_functions, 4,
+          "Number of functions only called in error blocks.");
+ABSL_FLAG(int, external_functions, 16,
+          "Number of declared functions whose results are checked.");
+ABSL_FLAG(int, error_code, -5, "Error code returned by error blocks.");
+ABSL_FLAG(uint64_t, seed, 1, "Seed of the choices made by the generator.");
+ABSL_FLAG(std::string, output, "synthetic.bc", "The file to write.");
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging("generate-module");
+  absl::ParseCommandLine(argc, argv);
+
+  error_specifications::SyntheticModuleOptions options;
+  options.num_functions = absl::GetFlag(FLAGS_functions);
+  options.call_sites_per_function =
+      absl::GetFlag(FLAGS_call_sites_per_function);
+  options.scc_size = absl::GetFlag(FLAGS_scc_size);
+  options.error_code_percent = absl::GetFlag(FLAGS_error_code_percent);
+  options.num_error_only_functions = absl::GetFlag(FLAGS_error_only_functions);
+  options.num_external_functions = absl::GetFlag(FLAGS_external_functions);
+  options.error_code = absl::GetFlag(FLAGS_error_code);
+  options.seed = absl::GetFlag(FLAGS_seed);
+
+  llvm::LLVMContext llvm_context;
+  std::unique_ptr<llvm::Module> module =
+      error_specifications::GenerateSyntheticModule(options, &llvm_context);
+
+  const std::string output_path = absl::GetFlag(FLAGS_output);
+  std::error_code error_code;
+  llvm::raw_fd_ostream ostream(output_path, error_code,
+                               llvm::sys::fs::F_None);
+  if (error_code) {
+    LOG(ERROR) << "Unable to open " << output_path << ": "
+               << error_code.message();
+    return 1;
+  }
+  if (llvm::StringRef(output_path).endswith(".ll")) {
+    module->print(ostream, nullptr);
+  } else {
+    llvm::WriteBitcodeToFile(*module, ostream);
+  }
+  ostream.close();
+  if (ostream.has_error()) {
+    LOG(ERROR) << "Unable to write " << output_path;
+    ostream.clear_error();
+    return 1;
+  }
+
+  return 0;
+}
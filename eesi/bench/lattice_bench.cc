@@ -0,0 +1,123 @@
+// Microbenchmarks of the sign and confidence lattice operations that the
+// dataflow passes and ErrorBlocksPass apply at every program point.
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "confidence_lattice.h"
+#include "constraint.h"
+
+namespace error_specifications {
+namespace {
+
+// Every element of the sign lattice.
+const std::vector<SignLatticeElement> &SignLatticeElements() {
+  static const std::vector<SignLatticeElement> elements = {
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP,
+  };
+
+  return elements;
+}
+
+// Returns `count` confidence elements that cover different combinations of
+// confidences, the same ones on every call.
+std::vector<LatticeElementConfidence> ConfidenceElements(int count) {
+  std::vector<LatticeElementConfidence> elements;
+  for (int i = 0; i < count; i++) {
+    elements.emplace_back(/* ==0 */ (i * 37) % (kMaxConfidence + 1),
+                          /* <0 */ (i * 53) % (kMaxConfidence + 1),
+                          /* >0 */ (i * 71) % (kMaxConfidence + 1),
+                          /* emptyset */ (i * 13) % (kMaxConfidence + 1));
+  }
+
+  return elements;
+}
+
+void BM_SignLatticeMeet(benchmark::State &state) {
+  const std::vector<SignLatticeElement> &elements = SignLatticeElements();
+  for (auto _ : state) {
+    for (SignLatticeElement x : elements) {
+      for (SignLatticeElement y : elements) {
+        benchmark::DoNotOptimize(SignLattice::Meet(x, y));
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * elements.size() *
+                          elements.size());
+}
+BENCHMARK(BM_SignLatticeMeet);
+
+void BM_SignLatticeJoin(benchmark::State &state) {
+  const std::vector<SignLatticeElement> &elements = SignLatticeElements();
+  for (auto _ : state) {
+    for (SignLatticeElement x : elements) {
+      for (SignLatticeElement y : elements) {
+        benchmark::DoNotOptimize(SignLattice::Join(x, y));
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * elements.size() *
+                          elements.size());
+}
+BENCHMARK(BM_SignLatticeJoin);
+
+void BM_SignLatticeComplement(benchmark::State &state) {
+  const std::vector<SignLatticeElement> &elements = SignLatticeElements();
+  for (auto _ : state) {
+    for (SignLatticeElement x : elements) {
+      benchmark::DoNotOptimize(SignLattice::Complement(x));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * elements.size());
+}
+BENCHMARK(BM_SignLatticeComplement);
+
+void BM_ConfidenceLatticeJoin(benchmark::State &state) {
+  const std::vector<LatticeElementConfidence> elements = ConfidenceElements(8);
+  for (auto _ : state) {
+    for (const LatticeElementConfidence &x : elements) {
+      for (const LatticeElementConfidence &y : elements) {
+        benchmark::DoNotOptimize(ConfidenceLattice::Join(x, y));
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * elements.size() *
+                          elements.size());
+}
+BENCHMARK(BM_ConfidenceLatticeJoin);
+
+// The argument is the number of elements met, e.g. the number of
+// predecessors of a block.
+void BM_ConfidenceLatticeMeetOnVector(benchmark::State &state) {
+  const std::vector<LatticeElementConfidence> elements =
+      ConfidenceElements(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ConfidenceLattice::MeetOnVector(elements));
+  }
+  state.SetItemsProcessed(state.iterations() * elements.size());
+}
+BENCHMARK(BM_ConfidenceLatticeMeetOnVector)->RangeMultiplier(4)->Range(2, 512);
+
+// The argument is the number of elements compared, e.g. the number of
+// specifications of a function's synonyms.
+void BM_ConfidenceLatticeKeepHighest(benchmark::State &state) {
+  const std::vector<LatticeElementConfidence> elements =
+      ConfidenceElements(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ConfidenceLattice::KeepHighest(elements));
+  }
+  state.SetItemsProcessed(state.iterations() * elements.size());
+}
+BENCHMARK(BM_ConfidenceLatticeKeepHighest)->RangeMultiplier(4)->Range(2, 512);
+
+}  // namespace
+}  // namespace error_specifications
+
+BENCHMARK_MAIN();
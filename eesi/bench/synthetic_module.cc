@@ -0,0 +1,197 @@
+#include "eesi/bench/synthetic_module.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace error_specifications {
+
+namespace {
+
+// How a call site checks the result of its call.
+enum class CheckKind {
+  // result < 0 is an error.
+  kLessThanZero,
+  // result != 0 is an error.
+  kNotZero,
+  // result == 0 is an error, e.g. a null pointer.
+  kZero,
+  // A switch with a case for the error code.
+  kSwitch,
+  kNumCheckKinds,
+};
+
+class SyntheticModuleBuilder {
+ public:
+  SyntheticModuleBuilder(const SyntheticModuleOptions &options,
+                         llvm::LLVMContext *llvm_context)
+      : options_(options),
+        llvm_context_(*llvm_context),
+        builder_(*llvm_context),
+        random_(options.seed) {}
+
+  std::unique_ptr<llvm::Module> Build() {
+    module_ = std::make_unique<llvm::Module>("synthetic", llvm_context_);
+    llvm::Type *int_type = llvm::Type::getInt32Ty(llvm_context_);
+    llvm::FunctionType *int_function_type =
+        llvm::FunctionType::get(int_type, /*isVarArg=*/false);
+    llvm::FunctionType *void_function_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(llvm_context_), /*isVarArg=*/false);
+
+    for (int i = 0; i < std::max(options_.num_external_functions, 1); i++) {
+      external_functions_.push_back(llvm::Function::Create(
+          int_function_type, llvm::GlobalValue::ExternalLinkage,
+          "external_" + std::to_string(i), module_.get()));
+    }
+    for (int i = 0; i < options_.num_error_only_functions; i++) {
+      error_only_functions_.push_back(llvm::Function::Create(
+          void_function_type, llvm::GlobalValue::ExternalLinkage,
+          "error_only_" + std::to_string(i), module_.get()));
+    }
+    // Declared up front so that calls can refer to any of them.
+    for (int i = 0; i < options_.num_functions; i++) {
+      functions_.push_back(llvm::Function::Create(
+          int_function_type, llvm::GlobalValue::ExternalLinkage,
+          "function_" + std::to_string(i), module_.get()));
+    }
+    for (int i = 0; i < options_.num_functions; i++) {
+      BuildFunction(i);
+    }
+
+    std::string errors;
+    llvm::raw_string_ostream error_stream(errors);
+    CHECK(!llvm::verifyModule(*module_, &error_stream))
+        << "Generated an invalid module: " << error_stream.str();
+
+    return std::move(module_);
+  }
+
+ private:
+  void BuildFunction(int index) {
+    const int scc_size = std::max(options_.scc_size, 1);
+    const int scc_begin = index - index % scc_size;
+    const int scc_end = std::min(scc_begin + scc_size, options_.num_functions);
+    llvm::Function *function = functions_[index];
+    llvm::Type *int_type = llvm::Type::getInt32Ty(llvm_context_);
+
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(llvm_context_, "entry", function);
+    const int num_call_sites = std::max(options_.call_sites_per_function, 1);
+    std::vector<llvm::BasicBlock *> checks;
+    for (int k = 0; k < num_call_sites; k++) {
+      checks.push_back(llvm::BasicBlock::Create(
+          llvm_context_, "check_" + std::to_string(k), function));
+    }
+    llvm::BasicBlock *success =
+        llvm::BasicBlock::Create(llvm_context_, "success", function);
+    llvm::BasicBlock *exit =
+        llvm::BasicBlock::Create(llvm_context_, "exit", function);
+
+    builder_.SetInsertPoint(entry);
+    llvm::Value *retval = builder_.CreateAlloca(int_type, nullptr, "retval");
+    builder_.CreateBr(checks[0]);
+
+    for (int k = 0; k < num_call_sites; k++) {
+      llvm::Function *callee = nullptr;
+      if (k == 0 && scc_end - scc_begin > 1) {
+        // Closes the cycle through the component.
+        callee = functions_[scc_begin + (index - scc_begin + 1) %
+                                            (scc_end - scc_begin)];
+      } else {
+        callee = PickCallee(scc_begin);
+      }
+      llvm::BasicBlock *next =
+          k + 1 < num_call_sites ? checks[k + 1] : success;
+      llvm::BasicBlock *error = llvm::BasicBlock::Create(
+          llvm_context_, "error_" + std::to_string(k), function, next);
+
+      builder_.SetInsertPoint(checks[k]);
+      llvm::Value *result =
+          builder_.CreateCall(callee, {}, "result_" + std::to_string(k));
+      llvm::Value *zero = llvm::ConstantInt::get(int_type, 0);
+      switch (static_cast<CheckKind>(k % static_cast<int>(
+                                             CheckKind::kNumCheckKinds))) {
+        case CheckKind::kLessThanZero:
+          builder_.CreateCondBr(builder_.CreateICmpSLT(result, zero), error,
+                                next);
+          break;
+        case CheckKind::kNotZero:
+          builder_.CreateCondBr(builder_.CreateICmpNE(result, zero), error,
+                                next);
+          break;
+        case CheckKind::kZero:
+          builder_.CreateCondBr(builder_.CreateICmpEQ(result, zero), error,
+                                next);
+          break;
+        default:
+          builder_.CreateSwitch(result, next, 1)
+              ->addCase(llvm::ConstantInt::get(
+                            llvm::cast<llvm::IntegerType>(int_type),
+                            options_.error_code, /*isSigned=*/true),
+                        error);
+          break;
+      }
+
+      builder_.SetInsertPoint(error);
+      if (!error_only_functions_.empty()) {
+        builder_.CreateCall(
+            error_only_functions_[random_() % error_only_functions_.size()]);
+      }
+      if (static_cast<int>(random_() % 100) < options_.error_code_percent) {
+        builder_.CreateStore(
+            llvm::ConstantInt::get(int_type, options_.error_code,
+                                   /*isSigned=*/true),
+            retval);
+      } else {
+        builder_.CreateStore(result, retval);
+      }
+      builder_.CreateBr(exit);
+    }
+
+    builder_.SetInsertPoint(success);
+    builder_.CreateStore(llvm::ConstantInt::get(int_type, 0), retval);
+    builder_.CreateBr(exit);
+
+    builder_.SetInsertPoint(exit);
+    builder_.CreateRet(builder_.CreateLoad(int_type, retval, "return_value"));
+  }
+
+  // Returns a function of an earlier component or an external function.
+  llvm::Function *PickCallee(int scc_begin) {
+    const uint64_t choice =
+        random_() % (scc_begin + external_functions_.size());
+    if (choice < static_cast<uint64_t>(scc_begin)) {
+      return functions_[choice];
+    }
+
+    return external_functions_[choice - scc_begin];
+  }
+
+  const SyntheticModuleOptions &options_;
+  llvm::LLVMContext &llvm_context_;
+  llvm::IRBuilder<> builder_;
+  std::mt19937_64 random_;
+
+  std::unique_ptr<llvm::Module> module_;
+  std::vector<llvm::Function *> functions_;
+  std::vector<llvm::Function *> external_functions_;
+  std::vector<llvm::Function *> error_only_functions_;
+};
+
+}  // namespace
+
+std::unique_ptr<llvm::Module> GenerateSyntheticModule(
+    const SyntheticModuleOptions &options, llvm::LLVMContext *llvm_context) {
+  return SyntheticModuleBuilder(options, llvm_context).Build();
+}
+
+}  // namespace error_specifications
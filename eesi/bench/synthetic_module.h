@@ -0,0 +1,63 @@
+// Generates LLVM modules of arbitrary size with the shapes the EESI, checker,
+// and getgraph passes analyse, so that their scaling can be measured on
+// modules far larger than the ones in testdata.
+//
+// Every generated function is laid out like reg2mem output: its return
+// value lives in an alloca that is stored on every path and loaded in a
+// single exit block. The body is a chain of checked call sites:
+//
+//   check_k:
+//     %result = call i32 @callee()
+//     %failed = icmp slt i32 %result, 0    ; or ne, eq, or a switch
+//     br i1 %failed, label %error_k, label %check_k+1
+//   error_k:
+//     call void @error_only_m()            ; e.g. a logging function
+//     store i32 -5, i32* %retval           ; or the callee's result
+//     br label %exit
+//
+// Functions are grouped into strongly connected components: the first call
+// site of each function calls the next function of its component, and the
+// other call sites call functions of earlier components or external
+// functions. The module is the same for the same options.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_BENCH_SYNTHETIC_MODULE_H_
+#define ERROR_SPECIFICATIONS_EESI_BENCH_SYNTHETIC_MODULE_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+namespace error_specifications {
+
+struct SyntheticModuleOptions {
+  // Number of defined functions.
+  int num_functions = 1000;
+  // Checked call sites per function. Each adds an error block and a check
+  // block to the function.
+  int call_sites_per_function = 4;
+  // Functions per call-graph strongly connected component. 1 gives an
+  // acyclic call graph.
+  int scc_size = 1;
+  // Percent of error blocks that return an error code rather than
+  // propagating the result of the failed call.
+  int error_code_percent = 50;
+  // Number of declared functions that are only called in error blocks. 0
+  // generates no error-only calls.
+  int num_error_only_functions = 4;
+  // Number of declared external functions that are called and checked, like
+  // library calls.
+  int num_external_functions = 16;
+  // The error code returned by error blocks.
+  int error_code = -5;
+  uint64_t seed = 1;
+};
+
+// Returns a verified module built in `llvm_context` according to `options`.
+std::unique_ptr<llvm::Module> GenerateSyntheticModule(
+    const SyntheticModuleOptions &options, llvm::LLVMContext *llvm_context);
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_BENCH_SYNTHETIC_MODULE_H_
@@ -30,4 +30,8 @@ class CallGraphUnderapproximation: public llvm::CallGraph {
 
 };
 
+// Returns the number of strongly connected components in the call graph, i.e.
+// the number of steps of a bottom-up scc_iterator traversal.
+uint64_t CountSccs(llvm::CallGraph &call_graph);
+
 }  // namespace error_specifications
@@ -14,11 +14,13 @@
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_CONSTRAINT_H_
 
 #include <bitset>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <string>
 #include <unordered_map>
 
+#include "function_ids.h"
 #include "proto/eesi.grpc.pb.h"
 
 namespace error_specifications {
@@ -124,49 +126,42 @@ class SignLattice {
   static const std::map<SignLatticeElement, int> offset;
 };
 
-// Wraps a lattice element with other data
-// - The function name of the return value being constrained.
-// - Source location of branch that generated this constraint.
+// Wraps a lattice element with the function whose return value it
+// constrains.
 class Constraint {
  public:
   Constraint() {}
-  explicit Constraint(const std::string &fname) : fname(fname) {}
+  explicit Constraint(FunctionId function_id) : function_id(function_id) {}
 
-  Constraint(const std::string &fname, const std::string &value)
-      : fname(fname) {
+  Constraint(FunctionId function_id, const std::string &value)
+      : function_id(function_id) {
     std::unordered_map<std::string, SignLatticeElement>::const_iterator it =
         SignLattice::string_to_lattice_element.find(value);
     assert(it != SignLattice::string_to_lattice_element.end());
     lattice_element = it->second;
   }
 
-  Constraint(const std::string &fname,
-             const SignLatticeElement &lattice_element)
-      : fname(fname), lattice_element(lattice_element) {}
+  Constraint(FunctionId function_id, const SignLatticeElement &lattice_element)
+      : function_id(function_id), lattice_element(lattice_element) {}
 
-  // The name of the function to be constrained.
-  std::string fname;
+  // The function to be constrained, see FunctionIds.
+  FunctionId function_id = kUnresolvedFunctionId;
 
   // The lattice value.
   SignLatticeElement lattice_element =
       SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
 
-  // Debug info if we have it (not guaranteed) of icmp that generated this
-  // constraint.
-  std::string file;
-  unsigned line = 0;
-
   bool operator==(const Constraint &other) const {
-    return (fname == other.fname && lattice_element == other.lattice_element &&
-            file == other.file && line == other.line);
+    return function_id == other.function_id &&
+           lattice_element == other.lattice_element;
   }
   bool operator!=(const Constraint &other) const { return !(*this == other); }
 
-  // Meet two constraints (function names must match).
-  Constraint Meet(const Constraint &other);
+  // Meet two constraints (functions must match).
+  Constraint Meet(const Constraint &other) const;
 
-  // Join two constraints (function names must match).
-  Constraint Join(const Constraint &other);
+  // Join two constraints (functions must match).
+  Constraint Join(const Constraint &other) const;
 
   bool Intersects(const Constraint &other) const;
 
@@ -176,6 +171,12 @@ class Constraint {
   bool IsBottom() const { return SignLattice::IsBottom(lattice_element); }
 };
 
+// The hash of a constraint in a FunctionIdMap.
+inline uint64_t PersistentHash(const Constraint &constraint) {
+  return MixHash(static_cast<uint64_t>(constraint.function_id) << 32 |
+                 static_cast<uint64_t>(constraint.lattice_element));
+}
+
 inline std::ostream &operator<<(std::ostream &os,
                                 const SignLatticeElement &lattice_element) {
   os << SignLattice::lattice_element_to_string.at(lattice_element);
@@ -184,7 +185,7 @@ inline std::ostream &operator<<(std::ostream &os,
 
 inline std::ostream &operator<<(std::ostream &os,
                                 const Constraint &constraint) {
-  os << constraint.fname << " " << constraint.lattice_element;
+  os << constraint.function_id << " " << constraint.lattice_element;
   return os;
 }
 
@@ -0,0 +1,51 @@
+// The dataflow analyses of this directory as new pass manager analyses.
+//
+// ReturnPropagationAnalysis and ReturnConstraintsAnalysis are computed once
+// per module by a llvm::ModuleAnalysisManager and cached there until they are
+// invalidated. The legacy wrapper passes, e.g. ReturnPropagationPass, take
+// their results from the manager of an AnalysisManagerPass when one is added
+// to the legacy pass manager, so that EESI, the checkers, and getgraph share
+// one computation of the facts over a module.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_ANALYSES_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_ANALYSES_H_
+
+#include <string>
+
+#include "cancellation.h"
+#include "fact_cache.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+namespace error_specifications {
+
+// Registers the dataflow analyses with `analysis_manager`. The analyses stop
+// early once `cancellation_token` is cancelled. If `fact_cache` is given, the
+// facts of the module parsed from `bitcode_id` are loaded from, and stored
+// in, it. Both pointers may be null and must outlive the manager otherwise.
+void RegisterDataflowAnalyses(llvm::ModuleAnalysisManager *analysis_manager,
+                              const CancellationToken *cancellation_token,
+                              FactCache *fact_cache = nullptr,
+                              const std::string &bitcode_id = "");
+
+// Makes a module analysis manager available to every pass run by a legacy
+// pass manager. The pass does not own the manager.
+class AnalysisManagerPass : public llvm::ImmutablePass {
+ public:
+  static char ID;
+
+  AnalysisManagerPass() : AnalysisManagerPass(nullptr) {}
+  explicit AnalysisManagerPass(llvm::ModuleAnalysisManager *analysis_manager)
+      : llvm::ImmutablePass(ID), analysis_manager_(analysis_manager) {}
+
+  llvm::ModuleAnalysisManager *GetAnalysisManager() const {
+    return analysis_manager_;
+  }
+
+ private:
+  llvm::ModuleAnalysisManager *analysis_manager_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_ANALYSES_H_
@@ -0,0 +1,177 @@
+// A worklist solver for the dataflow analyses of this directory.
+//
+// An analysis keeps a fact at the boundaries of every basic block and, as
+// the Transfer of the solver, says how facts flow into, through and out of a
+// block. The solver first visits every block of a function in reverse
+// post-order for forward analyses, or in post-order for backward ones, so
+// that most blocks are visited after the blocks their facts come from. After
+// that, it only visits again the neighbours of blocks whose facts changed:
+// their successors for forward analyses, their predecessors for backward
+// ones. Blocks waiting to be visited are taken in the same order.
+//
+// A Transfer is a class with the following members. The solver calls them
+// directly, so that they are resolved, and can be inlined, at compile time.
+//
+//   // The fact that `block` passes on to its neighbours: the one at its exit
+//   // for forward analyses, at its entry for backward ones.
+//   Fact &GetOutgoingFact(const llvm::BasicBlock &block);
+//
+//   // Joins the outgoing facts of the neighbours that `block` gets facts
+//   // from into the fact at its other boundary.
+//   void JoinIncomingFacts(const llvm::BasicBlock &block);
+//
+//   // Applies the transfer functions of the instructions of `block`.
+//   // Returns whether they also changed the facts of its neighbours
+//   // directly, e.g. by joining facts into the entry of the successors of a
+//   // branch.
+//   bool VisitBlock(const llvm::BasicBlock &block);
+//
+// Facts must be copyable and comparable with !=.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_SOLVER_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_SOLVER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+
+namespace error_specifications {
+
+enum class DataflowDirection { kForward, kBackward };
+
+// How much work solving some functions took.
+struct DataflowSolverStats {
+  uint64_t blocks = 0;
+  // Visits of blocks, at least one per block. The visits beyond that are
+  // the iterations the facts needed to reach a fixpoint.
+  uint64_t block_visits = 0;
+};
+
+// Adds up the stats of functions that may be solved in parallel.
+class DataflowSolverCounters {
+ public:
+  void Add(const DataflowSolverStats &stats) {
+    blocks_ += stats.blocks;
+    block_visits_ += stats.block_visits;
+  }
+
+  DataflowSolverStats Get() const {
+    DataflowSolverStats stats;
+    stats.blocks = blocks_;
+    stats.block_visits = block_visits_;
+    return stats;
+  }
+
+ private:
+  std::atomic<uint64_t> blocks_{0};
+  std::atomic<uint64_t> block_visits_{0};
+};
+
+template <typename Fact, DataflowDirection Direction, typename Transfer>
+class DataflowSolver {
+ public:
+  // `transfer` must outlive the solver.
+  explicit DataflowSolver(Transfer *transfer) : transfer_(transfer) {}
+
+  // Visits the blocks of `function` until none of their outgoing facts
+  // changes.
+  DataflowSolverStats Solve(const llvm::Function &function) {
+    DataflowSolverStats stats;
+    if (function.empty()) {
+      return stats;
+    }
+
+    const std::vector<const llvm::BasicBlock *> order = GetOrder(function);
+    llvm::DenseMap<const llvm::BasicBlock *, unsigned> positions;
+    for (unsigned i = 0; i < order.size(); i++) {
+      positions[order[i]] = i;
+    }
+
+    // The positions in `order` of the blocks to visit, smallest first.
+    std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>>
+        worklist;
+    std::vector<bool> queued(order.size(), true);
+    for (unsigned i = 0; i < order.size(); i++) {
+      worklist.push(i);
+    }
+    auto enqueue = [&](const llvm::BasicBlock *block) {
+      const unsigned position = positions.lookup(block);
+      if (!queued[position]) {
+        queued[position] = true;
+        worklist.push(position);
+      }
+    };
+
+    stats.blocks = order.size();
+    while (!worklist.empty()) {
+      const unsigned position = worklist.top();
+      worklist.pop();
+      queued[position] = false;
+      const llvm::BasicBlock &block = *order[position];
+
+      transfer_->JoinIncomingFacts(block);
+      Fact &outgoing_fact = transfer_->GetOutgoingFact(block);
+      Fact previous_fact = outgoing_fact;
+      const bool changed_neighbours = transfer_->VisitBlock(block);
+      stats.block_visits++;
+      if (!changed_neighbours && !(previous_fact != outgoing_fact)) {
+        continue;
+      }
+
+      if (Direction == DataflowDirection::kForward) {
+        for (const llvm::BasicBlock *successor : llvm::successors(&block)) {
+          enqueue(successor);
+        }
+      } else {
+        for (const llvm::BasicBlock *predecessor :
+             llvm::predecessors(&block)) {
+          enqueue(predecessor);
+        }
+      }
+    }
+
+    return stats;
+  }
+
+ private:
+  // Returns every block of `function` in reverse post-order, followed by
+  // the unreachable ones in layout order, or that order reversed for
+  // backward analyses.
+  static std::vector<const llvm::BasicBlock *> GetOrder(
+      const llvm::Function &function) {
+    std::vector<const llvm::BasicBlock *> order;
+    order.reserve(function.size());
+    llvm::ReversePostOrderTraversal<const llvm::Function *> traversal(
+        &function);
+    order.insert(order.end(), traversal.begin(), traversal.end());
+    if (order.size() < function.size()) {
+      const llvm::SmallPtrSet<const llvm::BasicBlock *, 32> reachable(
+          order.begin(), order.end());
+      for (const llvm::BasicBlock &block : function) {
+        if (!reachable.count(&block)) {
+          order.push_back(&block);
+        }
+      }
+    }
+    if (Direction == DataflowDirection::kBackward) {
+      std::reverse(order.begin(), order.end());
+    }
+
+    return order;
+  }
+
+  Transfer *transfer_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_SOLVER_H_
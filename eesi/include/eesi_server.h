@@ -4,13 +4,22 @@
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_EESI_SERVER_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_EESI_SERVER_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
-#include "tbb/task.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include "async_server.h"
+#include "bitcode_client.h"
+#include "executor.h"
+#include "fact_cache.h"
+#include "memory_budget.h"
+#include "operation_progress.h"
 #include "operations_service.h"
 #include "proto/eesi.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
+#include "result_cache.h"
 
 namespace error_specifications {
 
@@ -25,27 +34,94 @@ class EesiServiceImpl final : public EesiService::Service {
                                 Operation *operation) override;
 
  public:
+  explicit EesiServiceImpl(
+      const std::string &bitcode_cache_directory = "",
+      const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+      const OperationExecutorOptions &executor_options =
+          OperationExecutorOptions(),
+      const std::string &trace_directory = "",
+      const std::string &fact_cache_directory = "")
+      : bitcode_cache(bitcode_cache_directory),
+        result_cache(result_cache_options),
+        fact_cache(fact_cache_directory),
+        trace_directory(trace_directory),
+        executor(executor_options, "eesi") {
+    operations_service.SetResultCache(&result_cache);
+  }
+
   // Because TBB can throw exceptions.
   ~EesiServiceImpl() throw() {}
 
+  // Serves the EesiService and operations RPCs on `server`, which must not
+  // outlive this service.
+  void AddToAsyncServer(AsyncServer *server);
+
   // The operations service for this EESI service.
   OperationsServiceImpl operations_service;
+
+  // Local copies of bitcode previously downloaded from the bitcode service.
+  LocalBitcodeCache bitcode_cache;
+
+  // Memoized results of finished GetSpecifications operations.
+  ResultCache result_cache;
+
+  // Dataflow facts of previously analysed bitcode.
+  FactCache fact_cache;
+
+  // Directory the performance traces of finished operations are written
+  // to. No traces are written if it is empty.
+  const std::string trace_directory;
+
+  // Runs the GetSpecifications tasks. Declared last so that it is destroyed
+  // first, waiting for the tasks that still use the members above.
+  OperationExecutor executor;
 };
 
-// This is a TBB task that runs EESI specification inference on bitcode
-// id. The Bitcode file is retrieved from the bitcode service and
+// Runs EESI specification inference on bitcode id, on the service's
+// executor. The Bitcode file is retrieved from the bitcode service and
 // the operations service is updated when the task is complete.
-class GetSpecificationsTask : public tbb::task {
+class GetSpecificationsTask {
  public:
-  tbb::task *execute(void);
+  // Fetches the bitcode and sets its size. Returns false if the operation
+  // is over.
+  bool Fetch(uint64_t *bitcode_bytes);
+
+  // Analyses the fetched bitcode once the memory budget admitted it, or
+  // reports that the operation was cancelled if `memory_reservation` is
+  // null.
+  void Analyze(std::unique_ptr<MemoryReservation> memory_reservation);
 
   std::string task_name;
   GetSpecificationsRequest request;
   OperationsServiceImpl *operations_service;
+  LocalBitcodeCache *bitcode_cache;
   std::string bitcode_server_address;
+  std::shared_ptr<const CancellationToken> cancellation_token;
+  ResultCache *result_cache;
+  std::string result_key;
+  FactCache *fact_cache;
+  std::string trace_directory;
+  OperationExecutor *executor;
+
+  // Kept from Fetch to Analyze.
+  std::unique_ptr<OperationProgressReporter> progress;
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::unique_ptr<StepTimer> admission_timer;
 };
 
-void RunEesiServer(const std::string &eesi_server_address);
+// Start the EESI service. Downloaded bitcode is cached in
+// `bitcode_cache_directory` and its dataflow facts in `fact_cache_directory`
+// unless they are empty. The performance traces of finished operations are
+// written to `trace_directory` unless it is empty.
+void RunEesiServer(
+    const std::string &eesi_server_address,
+    const std::string &bitcode_cache_directory = "",
+    const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+    const OperationExecutorOptions &executor_options =
+        OperationExecutorOptions(),
+    const AsyncServerOptions &async_server_options = AsyncServerOptions(),
+    const std::string &trace_directory = "",
+    const std::string &fact_cache_directory = "");
 
 }  // namespace error_specifications
 
@@ -5,11 +5,13 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "call_graph_underapproximation.h"
 #include "checker.h"
 #include "confidence_lattice.h"
 #include "constraint.h"
+#include "function_ids.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InstIterator.h"
@@ -48,7 +50,29 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   using ErrorOnlyFuncToArgMap =
       std::unordered_multimap<std::string,
                               std::unordered_map<int, ConstantValue>>;
-  using ReturnTypeMap = std::unordered_map<std::string, FunctionReturnType>;
+
+  // What the analysis knows of the functions with a source name.
+  struct FunctionState {
+    // Unknown until one is inferred or given as domain knowledge.
+    LatticeElementConfidence error_specification;
+    // Whether error_specification is domain knowledge, which never changes.
+    bool has_initial_specification = false;
+    FunctionReturnType return_type =
+        FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER;
+    // Whether domain knowledge reaches the function through the call graph,
+    // see GetNonDoomedFunctions. The function may have no error
+    // specification, e.g. if its body could not be analyzed.
+    bool non_doomed = false;
+    // Whether the function returns domain knowledge codes.
+    bool returns_domain_knowledge_codes = false;
+    // The first LLVM function with the name that was analyzed. The others
+    // are skipped.
+    llvm::Function *function = nullptr;
+  };
+
+  // Interns `source_name`, which may not be the name of a function of the
+  // module, and makes room for its state.
+  FunctionId InternFunction(const std::string &source_name);
 
   // Performs static analysis to infer the error specification of the
   // function. Returns true if the error specification for the function has been
@@ -69,7 +93,7 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   LatticeElementConfidence VisitBlock(const llvm::BasicBlock &BB);
 
   std::set<SignLatticeElement> CollectConstraints(
-      const llvm::Function &parent_function, const std::string &fn_name);
+      const llvm::Function &parent_function, FunctionId fn_id);
 
   // Returns true if any new error values were added.
   // Called for each call instruction.
@@ -78,13 +102,13 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // Helper function for adding values to error_return_values_ map.
   LatticeElementConfidence AddErrorValue(const llvm::Function *, int64_t);
 
-  // Adds a function name to the non-doomed functions set. Returns true if we
-  // update the set.
+  // Adds a function to the non-doomed functions. Returns true if it was
+  // doomed.
   bool AddNonDoomedFunction(const llvm::Function &f);
-  bool AddNonDoomedFunction(const std::string &function_name);
+  bool AddNonDoomedFunction(FunctionId function_id);
 
   bool IsDoomedFunction(const llvm::Function &f);
-  bool IsDoomedFunction(const std::string &function_name);
+  bool IsDoomedFunction(FunctionId function_id);
 
   // Returns the abstraction of a concrete integer.
   SignLatticeElement AbstractInteger(int64_t concrete) const;
@@ -99,6 +123,7 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // Requires the given function to be non-null.
   LatticeElementConfidence GetErrorSpecification(
       const llvm::Function *node) const;
+  LatticeElementConfidence GetErrorSpecification(FunctionId function_id) const;
   LatticeElementConfidence GetErrorSpecification(
       const std::string &source_name) const;
 
@@ -110,7 +135,7 @@ struct ErrorBlocksPass : public llvm::ModulePass {
 
   // Remove a sign lattice element from an error specification.
   // Returns true if the error specification was updated.
-  bool RemoveFromErrorSpecification(const std::string &function_name,
+  bool RemoveFromErrorSpecification(FunctionId function_id,
                                     LatticeElementConfidence to_remove);
 
   // Checks whether an llvm::Value and a ConstantValue contain the same value.
@@ -132,24 +157,23 @@ struct ErrorBlocksPass : public llvm::ModulePass {
 
   // Returns true if the given value is a success code for the given function.
   // This IsSuccessCode variant considers the smart-success-code-zero heuristic.
-  bool IsSuccessCode(const std::string &function_name, const int64_t value,
+  bool IsSuccessCode(FunctionId function_id, const int64_t value,
                      const std::string &filename) const;
 
   // Returns true if the smart-success-code-zero heuristic is enabled and if the
   // heuristic determines that the given function has 0 as a success code.
-  bool ShouldSmartDropZero(const std::string &function_name,
+  bool ShouldSmartDropZero(FunctionId function_id,
                            const std::string &filename) const;
 
   // Adds a function to the set of functions that return domain knowledge codes.
   // This should be called whenever a function returns a domain knowledge
   // success/error code, or when a function propagates the return of a callee
   // that returns domain knowledge codes.
-  void AddFunctionReturningDomainKnowledgeCodes(
-      const std::string &function_name);
+  void AddFunctionReturningDomainKnowledgeCodes(FunctionId function_id);
 
   // Returns true if the given function returns global codes
   // represented by the domain knowledge.
-  bool ReturnsDomainKnowledgeCodes(const std::string &function_name) const;
+  bool ReturnsDomainKnowledgeCodes(FunctionId function_id) const;
 
   // Returns true if the ErrorBlocksPass should ignore the given
   // function.
@@ -192,8 +216,13 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   std::unordered_map<const llvm::Function *, std::unordered_set<int64_t>>
       error_return_values_;
 
-  // A map from function _source_ names to its error specification.
-  ErrorSpecificationMap error_specifications_;
+  // The source names of the functions of the module, of the domain knowledge
+  // and of the embedding vocabulary, starting with the IDs that
+  // ReturnConstraintsPass gives the functions of the module.
+  FunctionIds function_ids_;
+
+  // The state of every function, indexed by ID.
+  std::vector<FunctionState> functions_;
 
   // Domain knowledge: Multimap of function names to sets of arguments required
   // to consider a call error-only.  If a function has multiple entries, then
@@ -213,29 +242,14 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // knowledge error codes.
   std::unordered_map<int64_t, std::unordered_set<std::string>> success_codes_;
 
-  std::unordered_map<std::string, llvm::Function *> name_to_function_;
-
   // Whether to apply a heuristic to determine if 0 is a success code in certain
   // contexts, instead of every time.
   bool smart_success_code_zero_;
 
-  // The set of functions that return domain knowledge codes.
-  std::unordered_set<std::string> functions_returning_domain_knowledge_codes_;
-
   // Map of function source names that correspond to initial error
-  // specifications. These should never change.
+  // specifications. These should never change. Copied to the state of the
+  // functions once the module is known.
   ErrorSpecificationMap initial_error_specifications_;
-
-  // Map of function source names that correspond to their return type.
-  ReturnTypeMap function_return_types_;
-
-  // The set of functions that domain knowledge reaches. In other words, these
-  // functions are connected to domain knowledge via the call graph in some
-  // manner. These functions may not necessarily have associated error
-  // specifications. These functions may also not have functions whose
-  // specifications would be inferred by EESIER, as these can potentially
-  // be external functions that we could not analyze the body for.
-  std::unordered_set<std::string> non_doomed_function_names_;
 };
 
 }  // namespace error_specifications
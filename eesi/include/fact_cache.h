@@ -0,0 +1,81 @@
+// A local disk cache of the dataflow facts of a module.
+//
+// The return propagation and return constraints facts depend only on the
+// module, and bitcode handles are digests of its bytes, so the facts computed
+// for one handle hold for every later request on it. FactCache stores them
+// in a compact binary form under the handle, and the analyses registered by
+// RegisterDataflowAnalyses load them instead of solving the dataflow
+// equations again.
+//
+// Values are identified by their position in a fixed traversal of the
+// module, which is the same every time the same bitcode is parsed. An entry
+// whose value count does not match the module, or that cannot be decoded, is
+// removed and treated as a miss.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_CACHE_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "llvm/IR/Module.h"
+#include "return_constraints_pass.h"
+#include "return_propagation_pass.h"
+
+namespace error_specifications {
+
+class FactCache {
+ public:
+  // An empty `cache_directory` disables the cache: every lookup misses and
+  // nothing is stored.
+  explicit FactCache(const std::string &cache_directory);
+
+  // Fills `out_facts` with the facts stored for `module`, parsed from
+  // `bitcode_id`, and returns true on a hit.
+  bool LoadReturnPropagation(const std::string &bitcode_id,
+                             const llvm::Module &module,
+                             ReturnPropagation *out_facts);
+  bool LoadReturnConstraints(const std::string &bitcode_id,
+                             const llvm::Module &module,
+                             ReturnConstraints *out_facts);
+
+  // Stores the complete `facts` of `module`. Failures are logged and
+  // otherwise ignored.
+  void StoreReturnPropagation(const std::string &bitcode_id,
+                              const llvm::Module &module,
+                              const ReturnPropagation &facts) const;
+  void StoreReturnConstraints(const std::string &bitcode_id,
+                              const llvm::Module &module,
+                              const ReturnConstraints &facts) const;
+
+  uint64_t GetHits() const { return hits_; }
+  uint64_t GetMisses() const { return misses_; }
+
+ private:
+  // Returns the path of the `analysis` facts of `bitcode_id`, or an empty
+  // string if they are not cacheable.
+  std::string EntryPath(const std::string &bitcode_id,
+                        const std::string &analysis) const;
+
+  // Returns the payload of the entry at `path` if it exists and was written
+  // for a module of `num_values` values.
+  bool ReadEntry(const std::string &path, uint64_t num_values,
+                 std::string *out_payload) const;
+
+  // Writes `payload` to `path`, replacing the entry atomically.
+  void WriteEntry(const std::string &path, uint64_t num_values,
+                  const std::string &payload) const;
+
+  // Counts a hit or a miss and returns `hit`.
+  bool Record(bool hit);
+
+  std::string cache_directory_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_CACHE_H_
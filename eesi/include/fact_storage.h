@@ -0,0 +1,68 @@
+// How the dataflow analyses of this directory store their facts.
+//
+// By default an analysis keeps the fact before and after every instruction,
+// so its memory grows with the number of instructions times the size of a
+// fact. With FactStorage::kBlockBoundaries it only keeps the facts at the
+// entry and exit of every basic block, which is all that solving the
+// dataflow equations over the control-flow graph needs. GetInFact and
+// GetOutFact then recompute the facts inside a block from its boundary fact
+// with the transfer functions, which costs a walk over part of the block on
+// every query. The analyses also answer for a whole block at once, with a
+// single walk, for callers that visit every instruction.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_STORAGE_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_STORAGE_H_
+
+#include <cstdint>
+#include <string>
+
+namespace error_specifications {
+
+enum class FactStorage {
+  // The facts before and after every instruction.
+  kEveryInstruction,
+  // The facts at the entry and exit of every basic block.
+  kBlockBoundaries,
+};
+
+// Sets the storage of the analyses that are not given one, e.g. the legacy
+// passes created by a pass manager. Meant to be called once, at startup.
+void SetDefaultFactStorage(FactStorage storage);
+FactStorage GetDefaultFactStorage();
+
+// Parses "every_instruction" or "block_boundaries". Returns false otherwise.
+bool ParseFactStorage(const std::string &name, FactStorage *out_storage);
+
+// What the facts of an analysis of one module take up. Bytes are
+// approximations: they count the containers of a fact and their entries,
+// but not memory the entries point to. Containers that facts share are
+// divided among them.
+struct FactStorageStats {
+  uint64_t stored_facts = 0;
+  uint64_t stored_bytes = 0;
+  // The facts inside blocks that kBlockBoundaries did not keep, and the
+  // memory they would have taken up, assuming they are as large as the
+  // stored ones.
+  uint64_t elided_facts = 0;
+  uint64_t elided_bytes = 0;
+};
+
+// Returns the approximate bytes of `fact`, whose value is an unordered
+// container, allocated with std::make_shared.
+template <typename Fact>
+uint64_t ApproximateFactBytes(const Fact &fact) {
+  using Value = decltype(fact.value);
+  return sizeof(Fact) + 2 * sizeof(long) +
+         fact.value.bucket_count() * sizeof(void *) +
+         fact.value.size() *
+             (sizeof(typename Value::value_type) + 2 * sizeof(void *));
+}
+
+// Adds the `stats` of one computation of `analysis` to the dataflow fact
+// metrics and logs them.
+void ReportFactStorage(const std::string &analysis,
+                       const FactStorageStats &stats);
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_STORAGE_H_
@@ -0,0 +1,312 @@
+// Dense storage for the facts of the dataflow analyses of this directory.
+//
+// An analysis keeps a fact at some program points of a module: before and
+// after every instruction, or only at the boundaries of every block (see
+// fact_storage.h). InstructionNumbering numbers the blocks and instructions
+// of a module once, so that a FactTable keeps the facts in a vector indexed
+// by those numbers instead of in a hash map keyed by instruction. Functions
+// are numbered one after the other, and the blocks and instructions of a
+// function in layout order, so the facts of a function, and of a block, are
+// contiguous: workers that analyse different functions write to disjoint
+// slices of the table, and the transfer functions walk the facts of a block
+// by index.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_TABLE_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_TABLE_H_
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "fact_storage.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Module.h"
+#include "tbb/tbb.h"
+
+namespace error_specifications {
+
+// Numbers the blocks of a module and, optionally, its instructions.
+class InstructionNumbering {
+ public:
+  InstructionNumbering(const llvm::Module &module, bool number_instructions);
+
+  unsigned NumBlocks() const { return block_first_instructions_.size() - 1; }
+  unsigned NumInstructions() const { return block_first_instructions_.back(); }
+
+  // Returns false if `block` is not part of the module.
+  bool GetBlockNumber(const llvm::BasicBlock *block,
+                      unsigned *out_number) const;
+
+  // Returns false if `inst` is not part of the module, or instructions are
+  // not numbered.
+  bool GetInstructionNumber(const llvm::Instruction *inst,
+                            unsigned *out_number) const;
+
+  // The number of the first instruction of block `block_number`. The other
+  // instructions of the block follow it.
+  unsigned GetFirstInstructionNumber(unsigned block_number) const {
+    return block_first_instructions_[block_number];
+  }
+
+ private:
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> block_numbers_;
+  llvm::DenseMap<const llvm::Instruction *, unsigned> instruction_numbers_;
+  // Indexed by block number, with the number of instructions at the end.
+  std::vector<unsigned> block_first_instructions_;
+};
+
+// The program points of a FactTable.
+enum class FactPoints {
+  // Every instruction.
+  kEveryInstruction,
+  // The first instruction of every block.
+  kBlockEntries,
+  // The last instruction of every block.
+  kBlockExits,
+};
+
+// Bytes of the slot of a fact in a FactTable.
+constexpr uint64_t kFactSlotBytes = sizeof(std::shared_ptr<void>);
+
+// The facts of an analysis either before or after some instructions of a
+// module. Facts are shared so that a point can reuse the fact of another,
+// e.g. the input fact of an instruction is the output fact of the previous
+// one.
+template <typename Fact>
+class FactTable {
+ public:
+  // Makes room for a null fact at each of the `points` of `numbering`, which
+  // must number instructions for FactPoints::kEveryInstruction.
+  void Reset(std::shared_ptr<const InstructionNumbering> numbering,
+             FactPoints points) {
+    numbering_ = std::move(numbering);
+    points_ = points;
+    facts_.assign(points_ == FactPoints::kEveryInstruction
+                      ? numbering_->NumInstructions()
+                      : numbering_->NumBlocks(),
+                  nullptr);
+  }
+
+  // Removes every point.
+  void Clear() {
+    numbering_.reset();
+    std::vector<std::shared_ptr<Fact>>().swap(facts_);
+  }
+
+  size_t NumPoints() const { return facts_.size(); }
+
+  // Whether `inst` is a point of the table and has a fact.
+  bool Has(const llvm::Instruction *inst) const {
+    const size_t index = GetIndex(inst);
+    return index != kNoIndex && facts_[index];
+  }
+
+  // The fact at `inst`, or null if it has none.
+  const std::shared_ptr<Fact> &Get(const llvm::Instruction *inst) const {
+    static const std::shared_ptr<Fact> no_fact;
+    const size_t index = GetIndex(inst);
+    return index != kNoIndex ? facts_[index] : no_fact;
+  }
+
+  // Sets the fact at `inst`, which must be a point of the table.
+  void Set(const llvm::Instruction *inst, std::shared_ptr<Fact> fact) {
+    const size_t index = GetIndex(inst);
+    assert(index != kNoIndex);
+    facts_[index] = std::move(fact);
+  }
+
+  // The facts at the points of `block`, which must be part of the module, in
+  // order: one per instruction for FactPoints::kEveryInstruction, a single
+  // one otherwise.
+  std::shared_ptr<Fact> *GetBlockFacts(const llvm::BasicBlock &block) {
+    return &facts_[GetBlockIndex(block)];
+  }
+  const std::shared_ptr<Fact> *GetBlockFacts(
+      const llvm::BasicBlock &block) const {
+    return &facts_[GetBlockIndex(block)];
+  }
+
+  // The fact before the first instruction of `block`, for tables of every
+  // instruction or of block entries.
+  const std::shared_ptr<Fact> &GetEntry(const llvm::BasicBlock &block) const {
+    return facts_[GetBlockIndex(block)];
+  }
+
+  // The fact after the last instruction of `block`, for tables of every
+  // instruction or of block exits.
+  const std::shared_ptr<Fact> &GetExit(const llvm::BasicBlock &block) const {
+    if (points_ != FactPoints::kEveryInstruction) {
+      return facts_[GetBlockIndex(block)];
+    }
+    unsigned block_number = 0;
+    numbering_->GetBlockNumber(&block, &block_number);
+    return facts_[numbering_->GetFirstInstructionNumber(block_number + 1) -
+                  1];
+  }
+
+ private:
+  static constexpr size_t kNoIndex = ~static_cast<size_t>(0);
+
+  size_t GetIndex(const llvm::Instruction *inst) const {
+    if (!numbering_) {
+      return kNoIndex;
+    }
+    const llvm::BasicBlock *block = inst->getParent();
+    unsigned number;
+    switch (points_) {
+      case FactPoints::kEveryInstruction:
+        if (!numbering_->GetInstructionNumber(inst, &number)) {
+          return kNoIndex;
+        }
+        return number;
+      case FactPoints::kBlockEntries:
+        if (inst != &block->front() ||
+            !numbering_->GetBlockNumber(block, &number)) {
+          return kNoIndex;
+        }
+        return number;
+      case FactPoints::kBlockExits:
+        if (inst != &block->back() ||
+            !numbering_->GetBlockNumber(block, &number)) {
+          return kNoIndex;
+        }
+        return number;
+    }
+
+    return kNoIndex;
+  }
+
+  size_t GetBlockIndex(const llvm::BasicBlock &block) const {
+    unsigned block_number = 0;
+    numbering_->GetBlockNumber(&block, &block_number);
+    if (points_ != FactPoints::kEveryInstruction) {
+      return block_number;
+    }
+
+    return numbering_->GetFirstInstructionNumber(block_number);
+  }
+
+  std::shared_ptr<const InstructionNumbering> numbering_;
+  FactPoints points_ = FactPoints::kEveryInstruction;
+  std::vector<std::shared_ptr<Fact>> facts_;
+};
+
+// Makes room in `input_facts` and `output_facts` for the facts that
+// `storage` keeps of `module`: before and after every instruction, or before
+// the first and after the last instruction of every block.
+template <typename Fact>
+void ResetFactTables(const llvm::Module &module, FactStorage storage,
+                     FactTable<Fact> *input_facts,
+                     FactTable<Fact> *output_facts) {
+  const bool every_instruction = storage == FactStorage::kEveryInstruction;
+  auto numbering =
+      std::make_shared<const InstructionNumbering>(module, every_instruction);
+  input_facts->Reset(numbering, every_instruction
+                                    ? FactPoints::kEveryInstruction
+                                    : FactPoints::kBlockEntries);
+  output_facts->Reset(numbering, every_instruction
+                                     ? FactPoints::kEveryInstruction
+                                     : FactPoints::kBlockExits);
+}
+
+// Resets the fact tables as ResetFactTables does and puts an empty fact at
+// their points in the functions that `should_analyze` accepts, in parallel.
+// With every instruction, the input fact of an instruction is the output
+// fact of the previous one in its block.
+template <typename Fact, typename ShouldAnalyze>
+void InitializeFactTables(const llvm::Module &module, FactStorage storage,
+                          ShouldAnalyze should_analyze,
+                          FactTable<Fact> *input_facts,
+                          FactTable<Fact> *output_facts) {
+  ResetFactTables(module, storage, input_facts, output_facts);
+
+  std::vector<const llvm::Function *> module_functions;
+  for (const llvm::Function &function : module) {
+    if (should_analyze(function)) {
+      module_functions.push_back(&function);
+    }
+  }
+  tbb::parallel_for(
+      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
+          module_functions.begin(), module_functions.end()),
+      [&](auto thread_functions) {
+        for (const auto *function : thread_functions) {
+          for (const auto &basic_block : *function) {
+            std::shared_ptr<Fact> *inputs =
+                input_facts->GetBlockFacts(basic_block);
+            std::shared_ptr<Fact> *outputs =
+                output_facts->GetBlockFacts(basic_block);
+            if (storage == FactStorage::kBlockBoundaries) {
+              *inputs = std::make_shared<Fact>();
+              *outputs = std::make_shared<Fact>();
+              continue;
+            }
+            std::shared_ptr<Fact> prev = std::make_shared<Fact>();
+            for (size_t i = 0, e = basic_block.size(); i != e; i++) {
+              inputs[i] = prev;
+              outputs[i] = std::make_shared<Fact>();
+              prev = outputs[i];
+            }
+          }
+        }
+      });
+}
+
+// Initializes the fact tables of every function of `module`.
+template <typename Fact>
+void InitializeFactTables(const llvm::Module &module, FactStorage storage,
+                          FactTable<Fact> *input_facts,
+                          FactTable<Fact> *output_facts) {
+  InitializeFactTables(
+      module, storage, [](const llvm::Function &) { return true; },
+      input_facts, output_facts);
+}
+
+// Counts the facts that `input_facts` and `output_facts` hold for the
+// instructions of `module`. Blocks without facts are skipped.
+template <typename Fact>
+FactStorageStats CountFacts(const llvm::Module &module,
+                            const FactTable<Fact> &input_facts,
+                            const FactTable<Fact> &output_facts) {
+  FactStorageStats stats;
+  uint64_t instructions = 0;
+  uint64_t blocks = 0;
+  for (const llvm::Function &function : module) {
+    for (const llvm::BasicBlock &block : function) {
+      if (!input_facts.Has(&block.front())) {
+        continue;
+      }
+      blocks++;
+      stats.stored_facts++;
+      stats.stored_bytes +=
+          ApproximateFactBytes(*input_facts.Get(&block.front()));
+      for (const llvm::Instruction &inst : block) {
+        instructions++;
+        if (output_facts.Has(&inst)) {
+          stats.stored_facts++;
+          stats.stored_bytes += ApproximateFactBytes(*output_facts.Get(&inst));
+        }
+      }
+    }
+  }
+
+  // Every instruction has an output fact, and the first one of a block an
+  // input fact, when all are kept. Each elided fact also saves its slots in
+  // both tables.
+  stats.elided_facts = instructions + blocks - stats.stored_facts;
+  if (stats.stored_facts > 0) {
+    stats.elided_bytes =
+        stats.elided_facts *
+        (stats.stored_bytes / stats.stored_facts + 2 * kFactSlotBytes);
+  }
+  stats.stored_bytes +=
+      (input_facts.NumPoints() + output_facts.NumPoints()) * kFactSlotBytes;
+
+  return stats;
+}
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_FACT_TABLE_H_
@@ -0,0 +1,72 @@
+// Dense IDs for the functions that the analyses of this directory refer to.
+//
+// The analyses identify a function by its source name (see GetSourceName),
+// which several LLVM functions may share. FunctionIds interns the source
+// names of the functions of a module once, so that facts and per-function
+// state are keyed by a small integer instead of by a string that is hashed
+// and copied on every block visit. Names are only looked up again when
+// results leave the analyses.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_FUNCTION_IDS_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_FUNCTION_IDS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "persistent_map.h"
+
+namespace error_specifications {
+
+using FunctionId = uint32_t;
+
+// The ID of the empty name, which callees that cannot be resolved have.
+constexpr FunctionId kUnresolvedFunctionId = 0;
+
+// Interns the source names of functions.
+class FunctionIds {
+ public:
+  // Only has the empty name.
+  FunctionIds();
+
+  // Also has the source name of every function of `module`, numbered in
+  // module order.
+  explicit FunctionIds(const llvm::Module &module);
+
+  size_t size() const { return names_.size(); }
+
+  // Returns the ID of `source_name`, which is added if it is new.
+  FunctionId Intern(const std::string &source_name);
+
+  // Returns false if `source_name` has no ID.
+  bool Find(const std::string &source_name, FunctionId *out_id) const;
+
+  // The ID of the source name of `function`, which must be part of the
+  // module.
+  FunctionId GetId(const llvm::Function &function) const;
+
+  // The ID of the source name of the function that `call` calls, or
+  // kUnresolvedFunctionId if GetCalleeFunction cannot resolve it.
+  FunctionId GetCalleeId(const llvm::CallInst &call) const;
+
+  const std::string &GetName(FunctionId id) const { return names_[id]; }
+
+ private:
+  // Indexed by ID.
+  std::vector<std::string> names_;
+  llvm::StringMap<FunctionId> ids_;
+  llvm::DenseMap<const llvm::Function *, FunctionId> function_ids_;
+};
+
+// A map from function IDs. Maps of facts hold few functions each, so a
+// lookup is a short binary search.
+template <typename T>
+using FunctionIdMap = PersistentMap<FunctionId, T>;
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_FUNCTION_IDS_H_
@@ -0,0 +1,277 @@
+// Persistent containers for the facts of the dataflow analyses of this
+// directory.
+//
+// Most transfer functions pass the fact before an instruction on unchanged,
+// or with a single entry changed, and the solver keeps a copy of the
+// outgoing fact of a block to find out whether visiting the block changed
+// it. With node-based containers, each of those copies the whole fact.
+// PersistentSet and PersistentMap instead keep their entries sorted in one
+// vector that copies share: a copy only takes a reference, and a change
+// copies the vector only if another container still refers to it. Changes
+// that leave a container equal, e.g. inserting an element it already has,
+// keep it shared. Each vector also carries a hash of its entries, updated
+// with every change, so that containers that share their entries, or whose
+// hashes differ, compare in constant time.
+//
+// Entries are only read through const iterators. They change through
+// Insert and Set, which keep the hash up to date.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_PERSISTENT_MAP_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_PERSISTENT_MAP_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace error_specifications {
+
+// Spreads the bits of `hash`, so that sums of the hashes of entries that
+// are e.g. pointers rarely collide. The finalizer of MurmurHash3.
+inline uint64_t MixHash(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb93e53ca88d3ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// The hash of an entry of a persistent container. Overloaded for entries
+// without a std::hash.
+template <typename T>
+uint64_t PersistentHash(const T &value) {
+  return MixHash(std::hash<T>()(value));
+}
+
+// The approximate bytes that an entry of a persistent container points to,
+// e.g. when it is itself a persistent container.
+template <typename T>
+uint64_t PersistentBytes(const T &) {
+  return 0;
+}
+
+// The entries that persistent containers share, sorted by key. Traits gets
+// the key, the hash and the bytes pointed to of an entry.
+template <typename Key, typename Entry, typename Traits>
+class PersistentEntries {
+ public:
+  using value_type = Entry;
+  using iterator = typename std::vector<Entry>::const_iterator;
+  using const_iterator = iterator;
+
+  iterator begin() const { return GetEntries().begin(); }
+  iterator end() const { return GetEntries().end(); }
+
+  bool empty() const { return GetEntries().empty(); }
+  size_t size() const { return GetEntries().size(); }
+
+  iterator find(const Key &key) const {
+    iterator it = LowerBound(key);
+    return it != end() && !Less(key, Traits::GetKey(*it)) ? it : end();
+  }
+  size_t count(const Key &key) const { return find(key) != end(); }
+
+  // The sum of the hashes of the entries.
+  uint64_t Hash() const { return node_ ? node_->hash : 0; }
+
+  bool operator==(const PersistentEntries &other) const {
+    if (node_ == other.node_) {
+      return true;
+    }
+    if (size() != other.size() || Hash() != other.Hash()) {
+      return false;
+    }
+    return GetEntries() == other.GetEntries();
+  }
+  bool operator!=(const PersistentEntries &other) const {
+    return !(*this == other);
+  }
+
+  // The approximate bytes of the entries and of what they point to,
+  // divided among the containers that share them, so that the bytes of
+  // every container add up to the memory they take up together.
+  uint64_t ApproximateBytes() const {
+    if (!node_) {
+      return 0;
+    }
+    uint64_t bytes = sizeof(Node) + 2 * sizeof(long) +
+                     node_->entries.capacity() * sizeof(Entry);
+    for (const Entry &entry : node_->entries) {
+      bytes += Traits::GetBytes(entry);
+    }
+
+    return bytes / node_.use_count();
+  }
+
+ protected:
+  // Adds `entry`, or replaces the entry with the same key if `replace`.
+  // Returns whether the container changed.
+  bool Put(Entry entry, bool replace) {
+    iterator it = LowerBound(Traits::GetKey(entry));
+    const size_t index = it - begin();
+    const bool found =
+        it != end() && !Less(Traits::GetKey(entry), Traits::GetKey(*it));
+    if (found && (!replace || *it == entry)) {
+      return false;
+    }
+
+    Node *node = GetMutableNode(size() + (found ? 0 : 1));
+    if (found) {
+      node->hash -= Traits::GetHash(node->entries[index]);
+      node->entries[index] = std::move(entry);
+    } else {
+      node->entries.insert(node->entries.begin() + index, std::move(entry));
+    }
+    node->hash += Traits::GetHash(node->entries[index]);
+
+    return true;
+  }
+
+  // Adds the entries of `other` whose keys are missing. Returns whether the
+  // container changed.
+  bool PutAll(const PersistentEntries &other) {
+    if (other.empty() || node_ == other.node_) {
+      return false;
+    }
+    if (empty()) {
+      node_ = other.node_;
+      return true;
+    }
+    auto compare = [](const Entry &a, const Entry &b) {
+      return Less(Traits::GetKey(a), Traits::GetKey(b));
+    };
+    if (std::includes(begin(), end(), other.begin(), other.end(), compare)) {
+      return false;
+    }
+
+    auto node = std::make_shared<Node>();
+    node->entries.reserve(size() + other.size());
+    std::set_union(begin(), end(), other.begin(), other.end(),
+                   std::back_inserter(node->entries), compare);
+    for (const Entry &entry : node->entries) {
+      node->hash += Traits::GetHash(entry);
+    }
+    node_ = std::move(node);
+
+    return true;
+  }
+
+ private:
+  struct Node {
+    std::vector<Entry> entries;
+    uint64_t hash = 0;
+  };
+
+  static bool Less(const Key &a, const Key &b) {
+    return std::less<Key>()(a, b);
+  }
+
+  const std::vector<Entry> &GetEntries() const {
+    static const std::vector<Entry> no_entries;
+    return node_ ? node_->entries : no_entries;
+  }
+
+  iterator LowerBound(const Key &key) const {
+    return std::lower_bound(begin(), end(), key,
+                            [](const Entry &entry, const Key &key) {
+                              return Less(Traits::GetKey(entry), key);
+                            });
+  }
+
+  // Returns the node to change, copied first, with room for `capacity`
+  // entries, if other containers share it.
+  Node *GetMutableNode(size_t capacity) {
+    if (!node_ || node_.use_count() > 1) {
+      auto node = std::make_shared<Node>();
+      node->entries.reserve(capacity);
+      if (node_) {
+        node->entries.assign(node_->entries.begin(), node_->entries.end());
+        node->hash = node_->hash;
+      }
+      node_ = std::move(node);
+    }
+
+    return node_.get();
+  }
+
+  // Null while the container is empty.
+  std::shared_ptr<Node> node_;
+};
+
+template <typename T>
+struct PersistentSetTraits {
+  static const T &GetKey(const T &entry) { return entry; }
+  static uint64_t GetHash(const T &entry) { return PersistentHash(entry); }
+  static uint64_t GetBytes(const T &entry) { return PersistentBytes(entry); }
+};
+
+// A set of elements ordered by std::less.
+template <typename T>
+class PersistentSet : public PersistentEntries<T, T, PersistentSetTraits<T>> {
+ public:
+  // Returns whether `element` is new.
+  bool Insert(T element) { return this->Put(std::move(element), false); }
+
+  // Adds the elements of `other`. Returns whether any was new.
+  bool InsertAll(const PersistentSet &other) { return this->PutAll(other); }
+};
+
+template <typename Key, typename T>
+struct PersistentMapTraits {
+  static const Key &GetKey(const std::pair<Key, T> &entry) {
+    return entry.first;
+  }
+  static uint64_t GetHash(const std::pair<Key, T> &entry) {
+    return MixHash(PersistentHash(entry.first) + PersistentHash(entry.second));
+  }
+  static uint64_t GetBytes(const std::pair<Key, T> &entry) {
+    return PersistentBytes(entry.first) + PersistentBytes(entry.second);
+  }
+};
+
+// A map from keys ordered by std::less.
+template <typename Key, typename T>
+class PersistentMap : public PersistentEntries<Key, std::pair<Key, T>,
+                                               PersistentMapTraits<Key, T>> {
+ public:
+  // The value of `key`, which must be in the map.
+  const T &at(const Key &key) const {
+    auto it = this->find(key);
+    assert(it != this->end());
+    return it->second;
+  }
+
+  // Sets the value of `key`. Returns whether the map changed.
+  bool Set(const Key &key, T value) {
+    return this->Put(std::pair<Key, T>(key, std::move(value)), true);
+  }
+};
+
+template <typename T>
+uint64_t PersistentHash(const PersistentSet<T> &set) {
+  return set.Hash();
+}
+
+template <typename T>
+uint64_t PersistentBytes(const PersistentSet<T> &set) {
+  return set.ApproximateBytes();
+}
+
+template <typename Key, typename T>
+uint64_t PersistentHash(const PersistentMap<Key, T> &map) {
+  return map.Hash();
+}
+
+template <typename Key, typename T>
+uint64_t PersistentBytes(const PersistentMap<Key, T> &map) {
+  return map.ApproximateBytes();
+}
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_PERSISTENT_MAP_H_
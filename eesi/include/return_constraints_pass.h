@@ -1,24 +1,35 @@
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_RETURN_CONSTRAINTS_PASS_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_RETURN_CONSTRAINTS_PASS_H_
 
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
+#include "cancellation.h"
 #include "constraint.h"
+#include "dataflow_solver.h"
+#include "fact_storage.h"
+#include "fact_table.h"
+#include "function_ids.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include "return_propagation_pass.h"
 #include "tbb/tbb.h"
 
 namespace error_specifications {
 
+class FactCache;
+
 class ReturnConstraintsFact {
  public:
-  std::unordered_map<std::string, Constraint> value;
+  FunctionIdMap<Constraint> value;
 
   ReturnConstraintsFact() {}
 
@@ -39,28 +50,32 @@ class ReturnConstraintsFact {
   // of one fact but not the other, the result to copy the value from the fact
   // where the function exists.
 
-  void Join(const ReturnConstraintsFact &other) {
+  // Returns whether this fact changed.
+  bool Join(const ReturnConstraintsFact &other) {
+    bool changed = false;
     // For each function key, join the constraints.
     for (const auto &kv : other.value) {
-      const std::string &function_name = kv.first;
-      auto value_it = value.find(function_name);
+      const FunctionId function_id = kv.first;
+      auto value_it = value.find(function_id);
       if (value_it != value.end()) {
-        value_it->second = value_it->second.Join(kv.second);
+        changed |= value.Set(function_id, value_it->second.Join(kv.second));
       } else {
-        value[function_name] = kv.second;
+        value.Set(function_id, kv.second);
+        changed = true;
       }
     }
+    return changed;
   }
 
   void Meet(const ReturnConstraintsFact &other) {
     // For each function key, meet the constraints.
     for (const auto &kv : other.value) {
-      const std::string &function_name = kv.first;
-      auto value_it = value.find(function_name);
+      const FunctionId function_id = kv.first;
+      auto value_it = value.find(function_id);
       if (value_it != value.end()) {
-        value_it->second = value_it->second.Meet(kv.second);
+        value.Set(function_id, value_it->second.Meet(kv.second));
       } else {
-        value[function_name] = kv.second;
+        value.Set(function_id, kv.second);
       }
     }
   }
@@ -72,21 +87,46 @@ class ReturnConstraintsFact {
   }
 };
 
-class ReturnConstraintsPass : public llvm::ModulePass {
+// The approximate bytes of `fact`, allocated with std::make_shared, and its
+// share of the persistent map it holds.
+inline uint64_t ApproximateFactBytes(const ReturnConstraintsFact &fact) {
+  return sizeof(ReturnConstraintsFact) + 2 * sizeof(long) +
+         fact.value.ApproximateBytes();
+}
+
+// The return constraints facts of every instruction of a module.
+class ReturnConstraints {
  public:
-  static char ID;
+  explicit ReturnConstraints(FactStorage storage = GetDefaultFactStorage())
+      : storage_(storage) {}
 
-  ReturnConstraintsPass() : llvm::ModulePass(ID) {}
+  // Computes the facts of every function in `module` from its
+  // `return_propagation`, which must outlive this object. Stops early,
+  // leaving the facts incomplete, once `cancellation_token` is cancelled.
+  void Compute(const llvm::Module &module,
+               const ReturnPropagation *return_propagation,
+               const CancellationToken *cancellation_token);
 
-  // Entry point.
-  bool runOnModule(llvm::Module &M) override;
+  FactStorage GetFactStorage() const { return storage_; }
 
-  // Called for each function.
-  void RunOnFunction(const llvm::Function &F);
+  // The facts kept by the last Compute.
+  const FactStorageStats &GetStorageStats() const { return storage_stats_; }
+
+  // The blocks visited to compute the facts.
+  DataflowSolverStats GetSolverStats() const { return solver_counters_.Get(); }
+
+  // The IDs of the functions that the facts constrain.
+  const FunctionIds &GetFunctionIds() const { return *function_ids_; }
 
   ReturnConstraintsFact GetInFact(const llvm::Value *) const;
   ReturnConstraintsFact GetOutFact(const llvm::Value *) const;
 
+  // The facts before, or after, every instruction of `block`, in order.
+  std::vector<ReturnConstraintsFact> GetBlockInFacts(
+      const llvm::BasicBlock &block) const;
+  std::vector<ReturnConstraintsFact> GetBlockOutFacts(
+      const llvm::BasicBlock &block) const;
+
   static std::pair<SignLatticeElement, SignLatticeElement> AbstractICmp(
       const llvm::ICmpInst &I);
 
@@ -95,37 +135,70 @@ class ReturnConstraintsPass : public llvm::ModulePass {
   // sites.
   std::set<SignLatticeElement> GetConstraints(
       llvm::Module &module, const std::string &parent_function,
-      const Function &called_function);
+      const Function &called_function) const;
 
  private:
-  // Called for each basic block.
+  // Reads and writes the facts.
+  friend class FactCache;
+
+  friend class DataflowSolver<ReturnConstraintsFact,
+                              DataflowDirection::kForward, ReturnConstraints>;
+
+  // Called for each function.
+  void RunOnFunction(const llvm::Function &F);
+
+  // The Transfer of the DataflowSolver. VisitBlock returns whether a branch
+  // or switch changed the entry fact of a successor.
+  ReturnConstraintsFact &GetOutgoingFact(const llvm::BasicBlock &BB);
+  void JoinIncomingFacts(const llvm::BasicBlock &BB);
   bool VisitBlock(const llvm::BasicBlock &BB);
 
-  // Transfer functions.
+  // Recomputes the output facts of the instructions of `block`, up to and
+  // including `last`, which must not be its terminator, from the fact at its
+  // entry.
+  std::vector<std::shared_ptr<ReturnConstraintsFact>> ReplayBlock(
+      const llvm::BasicBlock &block, const llvm::Instruction *last) const;
+
+  // Transfer functions. Those of branches and switches also join facts into
+  // the entry of their successors, and return whether any changed;
+  // TransferInstruction handles every other instruction, which only writes
+  // `out`.
+  bool VisitInstruction(const llvm::Instruction &I,
+                        std::shared_ptr<const ReturnConstraintsFact> input,
+                        std::shared_ptr<ReturnConstraintsFact> out);
+  void TransferInstruction(const llvm::Instruction &I,
+                           std::shared_ptr<const ReturnConstraintsFact> input,
+                           std::shared_ptr<ReturnConstraintsFact> out) const;
   void VisitCallInst(const llvm::CallInst &I,
                      std::shared_ptr<const ReturnConstraintsFact> input,
-                     std::shared_ptr<ReturnConstraintsFact> out);
-  void VisitBranchInst(const llvm::BranchInst &I,
+                     std::shared_ptr<ReturnConstraintsFact> out) const;
+  bool VisitBranchInst(const llvm::BranchInst &I,
                        std::shared_ptr<const ReturnConstraintsFact> input,
                        std::shared_ptr<ReturnConstraintsFact> out);
-  void VisitSwitchInst(const llvm::SwitchInst &I,
+  bool VisitSwitchInst(const llvm::SwitchInst &I,
                        std::shared_ptr<const ReturnConstraintsFact> input,
                        std::shared_ptr<ReturnConstraintsFact> out);
   void VisitPHINode(const llvm::PHINode &I,
                     std::shared_ptr<const ReturnConstraintsFact> input,
-                    std::shared_ptr<ReturnConstraintsFact> out);
+                    std::shared_ptr<ReturnConstraintsFact> out) const;
 
-  virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+  FactStorage storage_;
+  FactStorageStats storage_stats_;
+  DataflowSolverCounters solver_counters_;
+
+  // The values that hold return values. Only set during Compute.
+  const ReturnPropagation *return_propagation_ = nullptr;
 
-  // A map from values (instructions) to dataflow facts
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnConstraintsFact>>
-      input_facts_;
+  // Interns the callees of the module. Shared with the facts loaded from a
+  // FactCache.
+  std::shared_ptr<const FunctionIds> function_ids_ =
+      std::make_shared<const FunctionIds>();
 
-  // A map from values (instructions) to dataflow facts
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnConstraintsFact>>
-      output_facts_;
+  // The dataflow facts of instructions. With FactStorage::kBlockBoundaries,
+  // only those of the first instruction of every block in input_facts_ and
+  // of the last one in output_facts_.
+  FactTable<ReturnConstraintsFact> input_facts_;
+  FactTable<ReturnConstraintsFact> output_facts_;
 
   static const std::map<
       std::pair<llvm::ICmpInst::Predicate, SignLatticeElement>,
@@ -136,6 +209,79 @@ class ReturnConstraintsPass : public llvm::ModulePass {
       unsigned_replacement;
 };
 
+// Computes the ReturnConstraints of a module for the new pass manager from
+// its ReturnPropagationAnalysis. The module analysis manager caches the
+// result until it is invalidated. The facts do not refer to the return
+// propagation, so they stay valid if only it is invalidated. If a FactCache
+// is given, the facts of `bitcode_id` are loaded from it when present, without
+// computing the return propagation, and stored in it once computed.
+class ReturnConstraintsAnalysis
+    : public llvm::AnalysisInfoMixin<ReturnConstraintsAnalysis> {
+ public:
+  using Result = std::unique_ptr<const ReturnConstraints>;
+
+  explicit ReturnConstraintsAnalysis(
+      const CancellationToken *cancellation_token = nullptr,
+      FactCache *fact_cache = nullptr, const std::string &bitcode_id = "")
+      : cancellation_token_(cancellation_token),
+        fact_cache_(fact_cache),
+        bitcode_id_(bitcode_id) {}
+
+  Result run(llvm::Module &module,
+             llvm::ModuleAnalysisManager &analysis_manager);
+
+ private:
+  friend llvm::AnalysisInfoMixin<ReturnConstraintsAnalysis>;
+  static llvm::AnalysisKey Key;
+
+  // Not owned, may be null.
+  const CancellationToken *cancellation_token_;
+  FactCache *fact_cache_;
+
+  std::string bitcode_id_;
+};
+
+// Makes the ReturnConstraints of a module available to legacy passes, from
+// the module analysis manager of an AnalysisManagerPass if there is one. See
+// ReturnPropagationPass.
+class ReturnConstraintsPass : public llvm::ModulePass {
+ public:
+  static char ID;
+
+  ReturnConstraintsPass() : llvm::ModulePass(ID) {}
+
+  // Entry point.
+  bool runOnModule(llvm::Module &M) override;
+
+  // The facts of the module the pass last ran on.
+  const ReturnConstraints &GetResult() const { return *result_; }
+
+  ReturnConstraintsFact GetInFact(const llvm::Value *value) const {
+    return result_->GetInFact(value);
+  }
+  ReturnConstraintsFact GetOutFact(const llvm::Value *value) const {
+    return result_->GetOutFact(value);
+  }
+
+  static std::pair<SignLatticeElement, SignLatticeElement> AbstractICmp(
+      const llvm::ICmpInst &I) {
+    return ReturnConstraints::AbstractICmp(I);
+  }
+
+  std::set<SignLatticeElement> GetConstraints(
+      llvm::Module &module, const std::string &parent_function,
+      const Function &called_function) const {
+    return result_->GetConstraints(module, parent_function, called_function);
+  }
+
+ private:
+  virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+
+  // Set if the facts were not taken from a module analysis manager.
+  std::unique_ptr<const ReturnConstraints> owned_result_;
+  const ReturnConstraints *result_ = nullptr;
+};
+
 }  //  namespace error_specifications
 
 #endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_RETURN_CONSTRAINTS_PASS_H_
@@ -1,25 +1,38 @@
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_RETURN_PROPAGATION_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_RETURN_PROPAGATION_H_
 
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "cancellation.h"
+#include "dataflow_solver.h"
+#include "fact_storage.h"
+#include "fact_table.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include "persistent_map.h"
 #include "tbb/tbb.h"
 
 namespace error_specifications {
 
+class FactCache;
+
 // A dataflow fact is a map from LLVM values to the functions they hold return
-// values for.
+// values for. Facts share their maps, see persistent_map.h.
 class ReturnPropagationFact {
  public:
-  std::unordered_map<const llvm::Value *,
-                     std::unordered_set<const llvm::Value *>>
-      value;
+  using ValueSet = PersistentSet<const llvm::Value *>;
+
+  PersistentMap<const llvm::Value *, ValueSet> value;
 
   ReturnPropagationFact() {}
 
@@ -37,54 +50,173 @@ class ReturnPropagationFact {
 
   void Join(const ReturnPropagationFact &other) {
     // Union each set in map
-    for (auto kv : other.value) {
-      value[kv.first].insert(kv.second.begin(), kv.second.end());
+    for (const auto &kv : other.value) {
+      auto value_it = value.find(kv.first);
+      if (value_it == value.end()) {
+        value.Set(kv.first, kv.second);
+        continue;
+      }
+      ValueSet values = value_it->second;
+      if (values.InsertAll(kv.second)) {
+        value.Set(kv.first, std::move(values));
+      }
+    }
+  }
+
+  // Adds `held` to the values that `holder` may hold.
+  void Add(const llvm::Value *holder, const llvm::Value *held) {
+    auto value_it = value.find(holder);
+    ValueSet values = value_it != value.end() ? value_it->second : ValueSet();
+    if (values.Insert(held)) {
+      value.Set(holder, std::move(values));
     }
   }
 };
 
-struct ReturnPropagationPass : public llvm::ModulePass {
-  static char ID;
+// The approximate bytes of `fact`, allocated with std::make_shared, and its
+// share of the persistent map it holds.
+inline uint64_t ApproximateFactBytes(const ReturnPropagationFact &fact) {
+  return sizeof(ReturnPropagationFact) + 2 * sizeof(long) +
+         fact.value.ApproximateBytes();
+}
 
-  ReturnPropagationPass() : llvm::ModulePass(ID) {}
+// The return propagation facts of every instruction of a module.
+class ReturnPropagation {
+ public:
+  explicit ReturnPropagation(FactStorage storage = GetDefaultFactStorage())
+      : storage_(storage) {}
 
-  // Dataflow facts at the program point immediately following instruction.
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnPropagationFact>>
-      input_facts_;
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnPropagationFact>>
-      output_facts_;
+  // Computes the facts of every function in `module`. Stops early, leaving
+  // the facts incomplete, once `cancellation_token` is cancelled.
+  void Compute(const llvm::Module &module,
+               const CancellationToken *cancellation_token);
 
-  bool finished = false;
+  FactStorage GetFactStorage() const { return storage_; }
 
-  bool runOnModule(llvm::Module &M) override;
-  bool RunOnFunction(const llvm::Function &F);
+  // The facts kept by the last Compute.
+  const FactStorageStats &GetStorageStats() const { return storage_stats_; }
+
+  // The blocks visited to compute the facts.
+  DataflowSolverStats GetSolverStats() const { return solver_counters_.Get(); }
+
+  // Whether `value` is an instruction that has facts.
+  bool HasFacts(const llvm::Value *value) const;
+
+  // The facts before and after `value`, an instruction that has facts.
+  ReturnPropagationFact GetInFact(const llvm::Value *value) const;
+  ReturnPropagationFact GetOutFact(const llvm::Value *value) const;
+
+  // The facts before, or after, every instruction of `block`, in order.
+  std::vector<ReturnPropagationFact> GetBlockInFacts(
+      const llvm::BasicBlock &block) const;
+  std::vector<ReturnPropagationFact> GetBlockOutFacts(
+      const llvm::BasicBlock &block) const;
+
+  // Dataflow facts at the program points immediately before and following
+  // instructions. With FactStorage::kBlockBoundaries, only before the first
+  // and after the last instruction of every block; use the accessors above.
+  FactTable<ReturnPropagationFact> input_facts_;
+  FactTable<ReturnPropagationFact> output_facts_;
+
+ private:
+  friend class DataflowSolver<ReturnPropagationFact,
+                              DataflowDirection::kForward, ReturnPropagation>;
+
+  void RunOnFunction(const llvm::Function &F);
+
+  // The Transfer of the DataflowSolver. Blocks only change the facts of
+  // other blocks through their exit facts.
+  ReturnPropagationFact &GetOutgoingFact(const llvm::BasicBlock &BB);
+  void JoinIncomingFacts(const llvm::BasicBlock &BB);
   bool VisitBlock(const llvm::BasicBlock &BB);
 
+  // Recomputes the output facts of the instructions of `block`, up to and
+  // including `last`, from the fact at its entry.
+  std::vector<std::shared_ptr<ReturnPropagationFact>> ReplayBlock(
+      const llvm::BasicBlock &block, const llvm::Instruction *last) const;
+
+  // Transfer functions.
+  void VisitInstruction(const llvm::Instruction &I,
+                        std::shared_ptr<const ReturnPropagationFact> input,
+                        std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitCallInst(const llvm::CallInst &I,
                      std::shared_ptr<const ReturnPropagationFact> input,
-                     std::shared_ptr<ReturnPropagationFact> out);
+                     std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitLoadInst(const llvm::LoadInst &I,
                      std::shared_ptr<const ReturnPropagationFact> input,
-                     std::shared_ptr<ReturnPropagationFact> out);
+                     std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitStoreInst(const llvm::StoreInst &I,
                       std::shared_ptr<const ReturnPropagationFact> input,
-                      std::shared_ptr<ReturnPropagationFact> out);
+                      std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitBitCastInst(const llvm::BitCastInst &I,
                         std::shared_ptr<const ReturnPropagationFact> input,
-                        std::shared_ptr<ReturnPropagationFact> out);
+                        std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitPtrToIntInst(const llvm::PtrToIntInst &I,
                          std::shared_ptr<const ReturnPropagationFact> input,
-                         std::shared_ptr<ReturnPropagationFact> out);
+                         std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitBinaryOperator(const llvm::BinaryOperator &I,
                            std::shared_ptr<const ReturnPropagationFact> input,
-                           std::shared_ptr<ReturnPropagationFact> out);
+                           std::shared_ptr<ReturnPropagationFact> out) const;
   void VisitPHINode(const llvm::PHINode &I,
                     std::shared_ptr<const ReturnPropagationFact> input,
-                    std::shared_ptr<ReturnPropagationFact> out);
+                    std::shared_ptr<ReturnPropagationFact> out) const;
+
+  FactStorage storage_;
+  FactStorageStats storage_stats_;
+  DataflowSolverCounters solver_counters_;
+};
+
+// Computes the ReturnPropagation of a module for the new pass manager. The
+// module analysis manager caches the result until it is invalidated. If a
+// FactCache is given, the facts of `bitcode_id` are loaded from it when
+// present and stored in it once computed.
+class ReturnPropagationAnalysis
+    : public llvm::AnalysisInfoMixin<ReturnPropagationAnalysis> {
+ public:
+  using Result = std::unique_ptr<const ReturnPropagation>;
+
+  explicit ReturnPropagationAnalysis(
+      const CancellationToken *cancellation_token = nullptr,
+      FactCache *fact_cache = nullptr, const std::string &bitcode_id = "")
+      : cancellation_token_(cancellation_token),
+        fact_cache_(fact_cache),
+        bitcode_id_(bitcode_id) {}
+
+  Result run(llvm::Module &module,
+             llvm::ModuleAnalysisManager &analysis_manager);
+
+ private:
+  friend llvm::AnalysisInfoMixin<ReturnPropagationAnalysis>;
+  static llvm::AnalysisKey Key;
+
+  // Not owned, may be null.
+  const CancellationToken *cancellation_token_;
+  FactCache *fact_cache_;
+
+  std::string bitcode_id_;
+};
+
+// Makes the ReturnPropagation of a module available to legacy passes. If the
+// pass manager has an AnalysisManagerPass, the result is taken from, and
+// cached in, its module analysis manager so that every pass manager sharing
+// it computes the facts only once. Otherwise the pass computes them itself.
+class ReturnPropagationPass : public llvm::ModulePass {
+ public:
+  static char ID;
+
+  ReturnPropagationPass() : llvm::ModulePass(ID) {}
+
+  bool runOnModule(llvm::Module &M) override;
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+
+  // The facts of the module the pass last ran on.
+  const ReturnPropagation &GetResult() const { return *result_; }
+
+ private:
+  // Set if the facts were not taken from a module analysis manager.
+  std::unique_ptr<const ReturnPropagation> owned_result_;
+  const ReturnPropagation *result_ = nullptr;
 };
 
 }  // namespace error_specifications
@@ -2,7 +2,11 @@
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_RETURN_RANGE_PASS_H_
 
 #include <unordered_map>
+#include <vector>
 
+#include "dataflow_solver.h"
+#include "fact_storage.h"
+#include "fact_table.h"
 #include "llvm.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
@@ -34,8 +38,8 @@ class ReturnRangeFact {
 
   // Join this fact with another one.  The other fact's entries are copied to
   // this fact, and if there are duplicate entries, their ranges are
-  // combined with SignLattice::Join.
-  void Join(const ReturnRangeFact &other);
+  // combined with SignLattice::Join.  Returns whether this fact changed.
+  bool Join(const ReturnRangeFact &other);
 
   // Meet this fact with another one.  The other fact's entries are copied to
   // this fact, and if there are duplicate entries, their ranges are
@@ -64,7 +68,8 @@ class ReturnRangePass : public llvm::ModulePass {
  public:
   static char ID;
 
-  ReturnRangePass() : llvm::ModulePass(ID) {}
+  explicit ReturnRangePass(FactStorage storage = GetDefaultFactStorage())
+      : llvm::ModulePass(ID), storage_(storage) {}
 
   // Entry point.
   bool runOnModule(llvm::Module &M) override;
@@ -85,29 +90,66 @@ class ReturnRangePass : public llvm::ModulePass {
   const std::unordered_map<const llvm::Function *, SignLatticeElement>
       &GetReturnRanges() const;
 
+  FactStorage GetFactStorage() const { return storage_; }
+
+  // The facts kept by the last run.
+  const FactStorageStats &GetStorageStats() const { return storage_stats_; }
+
+  // The blocks visited to compute the facts.
+  DataflowSolverStats GetSolverStats() const { return solver_counters_.Get(); }
+
   ReturnRangeFact GetInFact(const llvm::Instruction *inst) const;
   ReturnRangeFact GetOutFact(const llvm::Instruction *inst) const;
 
+  // The facts before, or after, every instruction of `block`, in order.
+  std::vector<ReturnRangeFact> GetBlockInFacts(
+      const llvm::BasicBlock &block) const;
+  std::vector<ReturnRangeFact> GetBlockOutFacts(
+      const llvm::BasicBlock &block) const;
+
  private:
   // Map from llvm functions to their return ranges.
   std::unordered_map<const llvm::Function *, SignLatticeElement> return_ranges_;
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
-  // Called for each basic block.
+  friend class DataflowSolver<ReturnRangeFact, DataflowDirection::kForward,
+                              ReturnRangePass>;
+
+  // The Transfer of the DataflowSolver. VisitBlock returns whether a branch
+  // or switch changed the entry fact of a successor.
+  ReturnRangeFact &GetOutgoingFact(const llvm::BasicBlock &BB);
+  void JoinIncomingFacts(const llvm::BasicBlock &BB);
   bool VisitBlock(const llvm::BasicBlock &BB);
 
-  // Transfer functions
+  // Recomputes the output facts of the instructions of `block`, up to and
+  // including `last`, which must not be its terminator, from the fact at its
+  // entry.
+  std::vector<std::shared_ptr<ReturnRangeFact>> ReplayBlock(
+      const llvm::BasicBlock &block, const llvm::Instruction *last) const;
+
+  // Transfer functions. Those of branches and switches also join facts into
+  // the entry of their successors and return whether any changed. That of
+  // returns joins into the return range of the function. TransferInstruction
+  // handles every other instruction, which only writes `out`.
+  bool VisitInstruction(const llvm::Instruction &I, const ReturnRangeFact &in,
+                        ReturnRangeFact &out,
+                        const ReturnedValuesFact &out_rvf);
+  void TransferInstruction(const llvm::Instruction &I,
+                           const ReturnRangeFact &in, ReturnRangeFact &out,
+                           const ReturnedValuesFact &out_rvf) const;
   void VisitStoreInst(const llvm::StoreInst &I, const ReturnRangeFact &in,
-                      ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
+                      ReturnRangeFact &out,
+                      const ReturnedValuesFact &out_rvf) const;
   void VisitLoadLikeInst(const llvm::Instruction &I, const ReturnRangeFact &in,
                          ReturnRangeFact &out,
-                         const ReturnedValuesFact &out_rvf);
+                         const ReturnedValuesFact &out_rvf) const;
   void VisitPHINode(const llvm::PHINode &I, const ReturnRangeFact &in,
-                    ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
-  void VisitBranchInst(const llvm::BranchInst &I, const ReturnRangeFact &in,
+                    ReturnRangeFact &out,
+                    const ReturnedValuesFact &out_rvf) const;
+  bool VisitBranchInst(const llvm::BranchInst &I, const ReturnRangeFact &in,
                        ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
-  void VisitSwitchInst(const llvm::SwitchInst &I, const ReturnRangeFact &in,
+  bool VisitSwitchInst(const llvm::SwitchInst &I, const ReturnRangeFact &in,
                        ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
   void VisitReturnInst(const llvm::ReturnInst &I, const ReturnRangeFact &in);
 
@@ -132,15 +174,15 @@ class ReturnRangePass : public llvm::ModulePass {
   // 3. It does not return an integer or a pointer.
   bool ShouldIgnore(const llvm::Function *func) const;
 
-  // A map from instructions to dataflow facts.
-  std::unordered_map<const llvm::Instruction *,
-                     std::shared_ptr<ReturnRangeFact>>
-      input_facts_;
+  FactStorage storage_;
+  FactStorageStats storage_stats_;
+  DataflowSolverCounters solver_counters_;
 
-  // A map from instructions to dataflow facts.
-  std::unordered_map<const llvm::Instruction *,
-                     std::shared_ptr<ReturnRangeFact>>
-      output_facts_;
+  // The dataflow facts of instructions. With FactStorage::kBlockBoundaries,
+  // only those of the first instruction of every block in input_facts_ and
+  // of the last one in output_facts_.
+  FactTable<ReturnRangeFact> input_facts_;
+  FactTable<ReturnRangeFact> output_facts_;
 };
 
 }  //  namespace error_specifications
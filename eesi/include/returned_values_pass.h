@@ -11,6 +11,8 @@
 //              holds at the program point before the instruction.
 // output_facts: a map from LLVM instruction values to the dataflow fact that
 //               holds at the program point after the instruction.
+// With FactStorage::kBlockBoundaries, both only hold the facts at the entry
+// and exit of basic blocks; GetInFact and GetOutFact recompute the others.
 
 // Implementation
 // ---------------
@@ -48,6 +50,7 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
@@ -57,6 +60,9 @@
 #include "tbb/tbb.h"
 
 #include "constraint.h"
+#include "dataflow_solver.h"
+#include "fact_storage.h"
+#include "fact_table.h"
 
 namespace error_specifications {
 
@@ -75,8 +81,11 @@ class ReturnedValuesFact {
     return value != other.value;
   }
 
-  void Join(const ReturnedValuesFact &other) {
+  // Returns whether this fact changed.
+  bool Join(const ReturnedValuesFact &other) {
+    const size_t size = value.size();
     value.insert(other.value.begin(), other.value.end());
+    return value.size() != size;
   }
 
   void Meet(const ReturnedValuesFact &other) {
@@ -96,7 +105,8 @@ class ReturnedValuesPass : public llvm::ModulePass {
  public:
   static char ID;
 
-  ReturnedValuesPass() : llvm::ModulePass(ID) {}
+  explicit ReturnedValuesPass(FactStorage storage = GetDefaultFactStorage())
+      : llvm::ModulePass(ID), storage_(storage) {}
 
   // Entry point.
   bool runOnModule(llvm::Module &M) override;
@@ -104,56 +114,100 @@ class ReturnedValuesPass : public llvm::ModulePass {
   // Called for each function.
   void RunOnFunction(const llvm::Function &F);
 
+  FactStorage GetFactStorage() const { return storage_; }
+
+  // The facts kept by the last run.
+  const FactStorageStats &GetStorageStats() const { return storage_stats_; }
+
+  // The blocks visited to compute the facts.
+  DataflowSolverStats GetSolverStats() const { return solver_counters_.Get(); }
+
   ReturnedValuesFact GetInFact(const llvm::Value *) const;
   ReturnedValuesFact GetOutFact(const llvm::Value *) const;
 
- private:
-  // Called for each basic block.
-  bool visitBlock(const llvm::BasicBlock &BB);
+  // The facts before, or after, every instruction of `block`, in order.
+  std::vector<ReturnedValuesFact> GetBlockInFacts(
+      const llvm::BasicBlock &block) const;
+  std::vector<ReturnedValuesFact> GetBlockOutFacts(
+      const llvm::BasicBlock &block) const;
 
-  // Transfer functions.
+ private:
+  friend class DataflowSolver<ReturnedValuesFact, DataflowDirection::kBackward,
+                              ReturnedValuesPass>;
+
+  // The Transfer of the DataflowSolver. VisitBlock returns whether a PHI
+  // node changed the exit fact of a predecessor.
+  ReturnedValuesFact &GetOutgoingFact(const llvm::BasicBlock &BB);
+  void JoinIncomingFacts(const llvm::BasicBlock &BB);
+  bool VisitBlock(const llvm::BasicBlock &BB);
+
+  // Recomputes the input facts of the instructions of `block`, from `first`
+  // to the end of the block in order, from the fact at its exit.
+  std::vector<std::shared_ptr<ReturnedValuesFact>> ReplayBlock(
+      const llvm::BasicBlock &block, const llvm::Instruction *first) const;
+
+  // Transfer functions. VisitInstruction also records the returned calls and
+  // adds the incoming values of returned PHI nodes to the exit of their
+  // blocks, and returns whether any of those changed; TransferInstruction
+  // only writes `input`.
+  bool VisitInstruction(const llvm::Instruction &I,
+                        std::shared_ptr<ReturnedValuesFact> input,
+                        std::shared_ptr<const ReturnedValuesFact> out);
+  void TransferInstruction(const llvm::Instruction &I,
+                           std::shared_ptr<ReturnedValuesFact> input,
+                           std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitReturnInst(const llvm::ReturnInst &I,
                        std::shared_ptr<ReturnedValuesFact> input,
-                       std::shared_ptr<const ReturnedValuesFact> out);
+                       std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitCallInst(const llvm::CallInst &I,
                      std::shared_ptr<ReturnedValuesFact> input,
-                     std::shared_ptr<const ReturnedValuesFact> out);
+                     std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitLoadInst(const llvm::LoadInst &I,
                      std::shared_ptr<ReturnedValuesFact> input,
-                     std::shared_ptr<const ReturnedValuesFact> out);
+                     std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitStoreInst(const llvm::StoreInst &I,
                       std::shared_ptr<ReturnedValuesFact> input,
-                      std::shared_ptr<const ReturnedValuesFact> out);
+                      std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitBitCastInst(const llvm::BitCastInst &I,
                         std::shared_ptr<ReturnedValuesFact> input,
-                        std::shared_ptr<const ReturnedValuesFact> out);
+                        std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitPtrToIntInst(const llvm::PtrToIntInst &I,
                          std::shared_ptr<ReturnedValuesFact> input,
-                         std::shared_ptr<const ReturnedValuesFact> out);
+                         std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitTruncInst(const llvm::TruncInst &I,
                       std::shared_ptr<ReturnedValuesFact> input,
-                      std::shared_ptr<const ReturnedValuesFact> out);
+                      std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitSExtInst(const llvm::SExtInst &I,
                      std::shared_ptr<ReturnedValuesFact> input,
-                     std::shared_ptr<const ReturnedValuesFact> out);
+                     std::shared_ptr<const ReturnedValuesFact> out) const;
   void VisitPHINode(const llvm::PHINode &I,
                     std::shared_ptr<ReturnedValuesFact> input,
-                    std::shared_ptr<const ReturnedValuesFact> out);
+                    std::shared_ptr<const ReturnedValuesFact> out) const;
+
+  // If the result of call `I` can be returned, adds its callee to the
+  // propagated functions of its caller.
+  void RecordReturnPropagated(const llvm::CallInst &I,
+                              const ReturnedValuesFact &out);
+
+  // If the PHI result can be returned, then add incoming values to the exit
+  // of each incoming basic block. Returns whether any was new.
+  bool AddIncomingValuesToPredecessors(const llvm::PHINode &I,
+                                       const ReturnedValuesFact &out);
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
   // Helper function for adding values to return_propagated map.
   void AddReturnPropagated(const llvm::Function *, const std::string &);
 
-  // A map from values (instructions) to dataflow facts.
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnedValuesFact>>
-      input_facts_;
+  FactStorage storage_;
+  FactStorageStats storage_stats_;
+  DataflowSolverCounters solver_counters_;
 
-  // A map from values (instructions) to dataflow facts.
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnedValuesFact>>
-      output_facts_;
+  // The dataflow facts of instructions. With FactStorage::kBlockBoundaries,
+  // only those of the first instruction of every block in input_facts_ and
+  // of the last one in output_facts_.
+  FactTable<ReturnedValuesFact> input_facts_;
+  FactTable<ReturnedValuesFact> output_facts_;
 
   // A map from functions to propagated functions.
   tbb::concurrent_unordered_map<const llvm::Function *,
@@ -1,5 +1,7 @@
 #include "call_graph_underapproximation.h"
 
+#include "llvm/ADT/SCCIterator.h"
+
 namespace error_specifications {
 
 CallGraphUnderapproximation::CallGraphUnderapproximation(llvm::Module &module)
@@ -39,4 +41,13 @@ void CallGraphUnderapproximation::AddCallees(llvm::Function *function) {
   }
 }
 
+uint64_t CountSccs(llvm::CallGraph &call_graph) {
+  uint64_t sccs = 0;
+  for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
+       ++scc_it) {
+    sccs++;
+  }
+  return sccs;
+}
+
 }  // namespace error_specifications
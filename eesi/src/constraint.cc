@@ -224,25 +224,25 @@ bool SignLattice::Intersects(const SignLatticeElement &x,
   return !SignLattice::IsBottom(SignLattice::Meet(x, y));
 }
 
-Constraint Constraint::Meet(const Constraint &other) {
-  assert(fname == other.fname);
+Constraint Constraint::Meet(const Constraint &other) const {
+  assert(function_id == other.function_id);
   Constraint c;
-  c.fname = fname;
+  c.function_id = function_id;
   c.lattice_element = SignLattice::Meet(lattice_element, other.lattice_element);
 
   return c;
 }
 
-Constraint Constraint::Join(const Constraint &other) {
-  assert(fname == other.fname);
+Constraint Constraint::Join(const Constraint &other) const {
+  assert(function_id == other.function_id);
   Constraint c;
-  c.fname = fname;
+  c.function_id = function_id;
   c.lattice_element = SignLattice::Join(lattice_element, other.lattice_element);
   return c;
 }
 
 bool Constraint::Intersects(const Constraint &other) const {
-  assert(fname == other.fname);
+  assert(function_id == other.function_id);
   return SignLattice::Intersects(lattice_element, other.lattice_element);
 }
 
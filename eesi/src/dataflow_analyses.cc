@@ -0,0 +1,31 @@
+#include "dataflow_analyses.h"
+
+#include "llvm/IR/PassInstrumentation.h"
+#include "return_constraints_pass.h"
+#include "return_propagation_pass.h"
+
+namespace error_specifications {
+
+void RegisterDataflowAnalyses(llvm::ModuleAnalysisManager *analysis_manager,
+                              const CancellationToken *cancellation_token,
+                              FactCache *fact_cache,
+                              const std::string &bitcode_id) {
+  // getResult asks every analysis for its instrumentation.
+  analysis_manager->registerPass(
+      [] { return llvm::PassInstrumentationAnalysis(); });
+  analysis_manager->registerPass([cancellation_token, fact_cache, bitcode_id] {
+    return ReturnPropagationAnalysis(cancellation_token, fact_cache,
+                                     bitcode_id);
+  });
+  analysis_manager->registerPass([cancellation_token, fact_cache, bitcode_id] {
+    return ReturnConstraintsAnalysis(cancellation_token, fact_cache,
+                                     bitcode_id);
+  });
+}
+
+char AnalysisManagerPass::ID = 0;
+static llvm::RegisterPass<AnalysisManagerPass> X(
+    "analysis-manager", "Makes a module analysis manager available", false,
+    true);
+
+}  // namespace error_specifications
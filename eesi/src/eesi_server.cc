@@ -4,10 +4,11 @@
 
 #include <ctime>
 #include <iostream>
-#include <numeric>
 #include <string>
 #include <vector>
 
+#include "bitcode_client.h"
+#include "dataflow_analyses.h"
 #include "error_blocks_pass.h"
 #include "glog/logging.h"
 #include "include/grpcpp/grpcpp.h"
@@ -17,7 +18,11 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/SourceMgr.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "metrics_server.h"
 #include "operations_service.h"
+#include "progress.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
 #include "return_constraints_pass.h"
@@ -26,53 +31,74 @@
 #include "returned_values_pass.h"
 #include "servers.h"
 #include "synonym_finder.h"
-#include "tbb/task.h"
 
 namespace error_specifications {
 
-tbb::task *GetSpecificationsTask::execute(void) {
+bool GetSpecificationsTask::Fetch(uint64_t *bitcode_bytes) {
   LOG(INFO) << task_name;
 
-  Operation result;
-  result.set_name(task_name);
+  // Every pass run by the pass manager can publish its progress.
+  progress = std::make_unique<OperationProgressReporter>(operations_service,
+                                                         task_name);
 
-  // Connect to the bitcode service
-  std::shared_ptr<grpc::Channel> channel;
-  std::unique_ptr<BitcodeService::Stub> stub;
-  channel = grpc::CreateChannel(bitcode_server_address,
-                                grpc::InsecureChannelCredentials());
-  stub = BitcodeService::NewStub(channel);
-
-  grpc::ClientContext download_context;
-  DownloadBitcodeRequest download_req;
-  download_req.mutable_bitcode_id()->CopyFrom(request.bitcode_id());
-  std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
-      stub->DownloadBitcode(&download_context, download_req));
-  std::vector<std::string> chunks;
-  DataChunk chunk;
-  while (reader->Read(&chunk)) {
-    chunks.push_back(chunk.content());
+  // Fetch the bitcode, from the local cache if possible, and parse it in
+  // place.
+  StepTimer download_timer(progress.get(), StepTimer::Kind::kPhase,
+                           "download");
+  grpc::Status download_status = bitcode_cache->GetBitcode(
+      bitcode_server_address, request.bitcode_id(), &buffer);
+  download_timer.Stop();
+  if (!download_status.ok()) {
+    LOG(ERROR) << "Unable to download bitcode.";
+    Operation result;
+    result.set_name(task_name);
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(download_status.error_code());
+    error_pb_message->set_message(download_status.error_message());
+    result.set_done(1);
+    operations_service->UpdateOperation(task_name, result);
+    return false;
   }
 
-  std::string bitcode_bytes =
-      std::accumulate(chunks.begin(), chunks.end(), std::string(""));
+  admission_timer = std::make_unique<StepTimer>(
+      progress.get(), StepTimer::Kind::kPhase, "admission");
+  *bitcode_bytes = buffer->getBufferSize();
+  return true;
+}
 
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+void GetSpecificationsTask::Analyze(
+    std::unique_ptr<MemoryReservation> memory_reservation) {
+  admission_timer->Stop();
+  OperationProgressReporter &progress = *this->progress;
+  MemoryBudget *memory_budget = executor->GetMemoryBudget();
+
+  Operation result;
+  result.set_name(task_name);
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic err;
   llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), err, llvm_context));
-
-  if (!module) {
-    err.print("eesi-server", llvm::errs());
-    abort();
+  std::unique_ptr<llvm::Module> module;
+  if (memory_reservation) {
+    StepTimer parse_timer(&progress, StepTimer::Kind::kPhase, "parse");
+    module = llvm::parseIR(buffer->getMemBufferRef(), err, llvm_context);
+    if (!module) {
+      err.print("eesi-server", llvm::errs());
+      abort();
+    }
+    RecordParsedModuleMetrics(*module, buffer->getBufferSize());
+    parse_timer.Stop();
   }
 
+  // Caches the dataflow analyses that several passes share.
+  llvm::ModuleAnalysisManager analysis_manager;
+  RegisterDataflowAnalyses(&analysis_manager, cancellation_token.get(),
+                           fact_cache, request.bitcode_id().id());
+
   llvm::legacy::PassManager pass_manager;
+  pass_manager.add(new ProgressReporterPass(&progress));
+  pass_manager.add(new CancellationTokenPass(cancellation_token.get()));
+  pass_manager.add(new AnalysisManagerPass(&analysis_manager));
   ReturnPropagationPass *return_propagation = new ReturnPropagationPass();
   ReturnConstraintsPass *return_constraints = new ReturnConstraintsPass();
   ReturnedValuesPass *returned_values = new ReturnedValuesPass();
@@ -92,8 +118,36 @@ tbb::task *GetSpecificationsTask::execute(void) {
   pass_manager.add(returned_values);
   pass_manager.add(return_range);
 
-  pass_manager.run(*module);
+  // Grow the reservation by the facts of the passes.
+  if (memory_reservation) {
+    StepTimer growth_timer(&progress, StepTimer::Kind::kPhase, "growth");
+    const bool grown = memory_budget->Grow(memory_reservation.get(),
+                                           CountInstructions(*module),
+                                           cancellation_token.get());
+    growth_timer.Stop();
+    if (grown) {
+      pass_manager.run(*module);
+    }
+  }
+
+  // The passes stop early once the operation is cancelled, so their partial
+  // results are dropped along with the module.
+  if (cancellation_token->IsCancelled()) {
+    LOG(INFO) << "Operation cancelled: " << task_name;
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(grpc::StatusCode::CANCELLED);
+    error_pb_message->set_message("Operation cancelled.");
+    result.set_done(1);
+    progress.FillMetadata(&result);
+    if (!trace_directory.empty()) {
+      progress.WriteTrace(trace_directory);
+    }
+    operations_service->UpdateOperation(task_name, result);
+    delete synonym_finder;
+    return;
+  }
 
+  StepTimer pack_timer(&progress, StepTimer::Kind::kPhase, "pack");
   GetSpecificationsResponse get_specifications_response =
       error_blocks->GetSpecifications();
 
@@ -101,10 +155,15 @@ tbb::task *GetSpecificationsTask::execute(void) {
 
   // Packing into google.protobuf.Any
   result.mutable_response()->PackFrom(get_specifications_response);
+  pack_timer.Stop();
+  progress.FillMetadata(&result);
+  if (!trace_directory.empty()) {
+    progress.WriteTrace(trace_directory);
+  }
 
+  result_cache->Insert(result_key, result);
   operations_service->UpdateOperation(task_name, result);
   delete synonym_finder;  // TODO: we might want to use smart pointers here.
-  return NULL;
 }
 
 grpc::Status EesiServiceImpl::GetSpecifications(
@@ -122,17 +181,47 @@ grpc::Status EesiServiceImpl::GetSpecifications(
   // Return the name of the operation so client can check on progress.
   std::string task_name =
       GetTaskName("GetSpecifications", request->bitcode_id().id());
+  const std::string result_key = ResultCache::MakeKey(
+      "GetSpecifications", request->bitcode_id().id(), *request);
+  if (operations_service.FinishFromResultCache(task_name, result_key,
+                                               operation)) {
+    return grpc::Status::OK;
+  }
   operation->set_name(task_name);
   operation->set_done(0);
+  // Identical requests made while this one runs share its task.
+  if (operations_service.AttachToRunningTask(task_name, result_key,
+                                             operation)) {
+    return grpc::Status::OK;
+  }
   operations_service.UpdateOperation(task_name, *operation);
 
-  GetSpecificationsTask *task =
-      new (tbb::task::allocate_root()) GetSpecificationsTask();
+  auto task = std::make_shared<GetSpecificationsTask>();
   task->operations_service = &operations_service;
+  task->bitcode_cache = &bitcode_cache;
   task->request = *request;
   task->task_name = task_name;
   task->bitcode_server_address = bitcode_server_address;
-  tbb::task::enqueue(*task);
+  task->cancellation_token = operations_service.GetCancellationToken(task_name);
+  task->result_cache = &result_cache;
+  task->result_key = result_key;
+  task->fact_cache = &fact_cache;
+  task->trace_directory = trace_directory;
+  task->executor = &executor;
+  // Wait, without holding a slot of the executor, until the analysis fits
+  // next to the running ones: first the parsed module, then the facts of the
+  // passes over its instructions. Admission only fails once the operation
+  // is cancelled, which the task handles.
+  grpc::Status submit_status = executor.SubmitAnalysis(
+      OperationPriority::kNormal, task->cancellation_token,
+      [task](uint64_t *bitcode_bytes) { return task->Fetch(bitcode_bytes); },
+      [task](std::unique_ptr<MemoryReservation> memory_reservation) {
+        task->Analyze(std::move(memory_reservation));
+      });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name, submit_status);
+    return submit_status;
+  }
 
   return grpc::Status::OK;
 }
@@ -143,12 +232,43 @@ grpc::Status EesiServiceImpl::GetErrorHandlers(
   return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "");
 }
 
-void RunEesiServer(const std::string &server_address) {
-  EesiServiceImpl service;
+void EesiServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<EesiService::AsyncService>();
+  // May read a memoized result from disk.
+  server->AddUnary(async_service,
+                   &EesiService::AsyncService::RequestGetSpecifications, this,
+                   &EesiService::Service::GetSpecifications,
+                   /*blocking=*/true);
+  server->AddUnary(async_service,
+                   &EesiService::AsyncService::RequestGetErrorHandlers, this,
+                   &EesiService::Service::GetErrorHandlers);
+  operations_service.AddToAsyncServer(server);
+}
+
+void RunEesiServer(const std::string &server_address,
+                   const std::string &bitcode_cache_directory,
+                   const ResultCacheOptions &result_cache_options,
+                   const OperationExecutorOptions &executor_options,
+                   const AsyncServerOptions &async_server_options,
+                   const std::string &trace_directory,
+                   const std::string &fact_cache_directory) {
+  EesiServiceImpl service(bitcode_cache_directory, result_cache_options,
+                          executor_options, trace_directory,
+                          fact_cache_directory);
+  if (async_server_options.enabled) {
+    AsyncServer server(async_server_options);
+    service.AddToAsyncServer(&server);
+    if (server.Start(server_address).ok()) {
+      server.Wait();
+    }
+    return;
+  }
 
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder);
   // Register "service" as the instance through which we'll communicate with
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
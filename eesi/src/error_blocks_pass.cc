@@ -12,6 +12,7 @@
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Module.h"
+#include "progress.h"
 #include "return_constraints_pass.h"
 #include "return_propagation_pass.h"
 #include "return_range_pass.h"
@@ -46,7 +47,6 @@ void ErrorBlocksPass::SetSpecificationsRequest(
     }
 
     error_only_functions_.insert({source_name, required_arg_map});
-    AddNonDoomedFunction(source_name);
   }
 
   // Store error codes.
@@ -97,23 +97,38 @@ void ErrorBlocksPass::SetSpecificationsRequest(
     // Save a copy of the initial specification so that we can assert
     // that it has not been modified.
     initial_error_specifications_[specification_function_name] = c;
+  }
+}
 
-    // Bootstrap the analysis with the initial specification.
-    error_specifications_[specification_function_name] = c;
-    AddNonDoomedFunction(specification_function_name);
+FunctionId ErrorBlocksPass::InternFunction(const std::string &source_name) {
+  const FunctionId function_id = function_ids_.Intern(source_name);
+  if (function_id >= functions_.size()) {
+    functions_.resize(function_id + 1);
   }
+
+  return function_id;
 }
 
 bool ErrorBlocksPass::IgnoreFunction(const llvm::Function *function) const {
   return function == nullptr || function->isIntrinsic() ||
-         initial_error_specifications_.find(GetSourceName(*function)) !=
-             initial_error_specifications_.end() ||
+         functions_[function_ids_.GetId(*function)]
+             .has_initial_specification ||
          IsVoidFunction(*function);
 }
 
 bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
+  PassTimer pass_timer(this, "ErrorBlocksPass");
   LOG(INFO) << "ErrorBlocksPass running on module...";
 
+  // Numbering the functions as ReturnConstraintsPass does lets the
+  // constraints of its facts be looked up by ID.
+  function_ids_ =
+      getAnalysis<ReturnConstraintsPass>().GetResult().GetFunctionIds();
+  functions_.assign(function_ids_.size(), FunctionState());
+  for (const auto &kv : error_only_functions_) {
+    AddNonDoomedFunction(InternFunction(kv.first));
+  }
+
   // Generating the call graph and traversing the SCCs bottom-up.
   llvm::CallGraph call_graph = CallGraphUnderapproximation(module);
   // The set of functions whose error specifications have converged
@@ -128,7 +143,13 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
     FunctionReturnType typ =
         f == nullptr ? FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER
                      : GetReturnType(*f);
-    function_return_types_.insert(std::make_pair(kv.first, typ));
+    // Bootstrap the analysis with the initial specification.
+    const FunctionId function_id = InternFunction(kv.first);
+    FunctionState &state = functions_[function_id];
+    state.error_specification = kv.second;
+    state.has_initial_specification = true;
+    state.return_type = typ;
+    state.non_doomed = true;
     converged_functions.insert(std::make_pair(kv.first, typ));
   }
 
@@ -142,12 +163,30 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
       // We are only interested in adding integer/pointer functions.
       if (IgnoreFunction(f)) continue;
 
-      AddNonDoomedFunction(function_label);
+      AddNonDoomedFunction(InternFunction(function_label));
     }
   }
 
+  ProgressReporter *progress = nullptr;
+  if (auto *progress_pass = getAnalysisIfAvailable<ProgressReporterPass>()) {
+    progress = progress_pass->GetProgressReporter();
+  }
+  const CancellationToken *cancellation_token = nullptr;
+  if (auto *cancellation_pass =
+          getAnalysisIfAvailable<CancellationTokenPass>()) {
+    cancellation_token = cancellation_pass->GetCancellationToken();
+  }
+  if (progress) {
+    progress->StartPass("ErrorBlocksPass", CountSccs(call_graph),
+                        CountDefinedFunctions(module));
+  }
+
   for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
        ++scc_it) {
+    if (IsCancelled(cancellation_token)) {
+      LOG(INFO) << "ErrorBlocksPass cancelled.";
+      return false;
+    }
     std::vector<llvm::Function *> scc_funcs;
     for (auto node : *scc_it) {
       auto f = node->getFunction();
@@ -160,9 +199,10 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
       for (auto func : scc_funcs) {
         // Analyzing the function, attempting to infer a specification.
         changed = RunOnFunction(func) || changed;
+        if (progress) progress->FunctionAnalyzed();
       }
       // Perform fixpoint only if SCC has a loop.
-    } while (has_loop && changed);
+    } while (has_loop && changed && !IsCancelled(cancellation_token));
 
     // Only expand using the embedding if the appropriate SynonymFinder
     //    has
@@ -196,12 +236,12 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
             const auto return_range = return_range_pass.GetReturnRange(
                 *func,
                 /*default=*/SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP);
-            std::string func_name = GetSourceName(*func);
-            return ReturnsDomainKnowledgeCodes(func_name) ||
+            const FunctionId func_id = function_ids_.GetId(*func);
+            return ReturnsDomainKnowledgeCodes(func_id) ||
                    ConfidenceLattice::IsEmptyset(
-                       GetErrorSpecification(func_name)) ||
+                       GetErrorSpecification(func_id)) ||
                    !ConfidenceLattice::IsUnknown(
-                       GetErrorSpecification(func_name));
+                       GetErrorSpecification(func_id));
             // ConfidenceLattice::Equals(GetErrorSpecification(func_name),
             //                          return_range);
           });
@@ -295,30 +335,42 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
 
       CheckViolations(*f);
     }
+
+    if (progress) progress->SccDone();
   }
 
   // Just printing off the reachable functions and the total count, as well as
   // the total count of specifications.
   LOG(INFO) << "Functions that are non-doomed:";
-  for (auto non_doomed_function_name : non_doomed_function_names_) {
-    LOG(INFO) << non_doomed_function_name;
+  for (FunctionId id = 0; id < functions_.size(); id++) {
+    if (functions_[id].non_doomed) {
+      LOG(INFO) << function_ids_.GetName(id);
+    }
   }
 
   // We can ignore checking for LLVM intrinsics here as IgnoreFunction() is
-  // called on every function before it gets added to function_return_types_.
+  // called on every function before its return type is set.
   auto total_non_void_functions = std::count_if(
-      function_return_types_.begin(), function_return_types_.end(),
-      [this](std::pair<std::string, FunctionReturnType> f) {
-        return f.second == FunctionReturnType::FUNCTION_RETURN_TYPE_INTEGER ||
-               f.second == FunctionReturnType::FUNCTION_RETURN_TYPE_POINTER;
+      functions_.begin(), functions_.end(), [](const FunctionState &f) {
+        return f.return_type ==
+                   FunctionReturnType::FUNCTION_RETURN_TYPE_INTEGER ||
+               f.return_type ==
+                   FunctionReturnType::FUNCTION_RETURN_TYPE_POINTER;
+      });
+  auto total_non_doomed_functions =
+      std::count_if(functions_.begin(), functions_.end(),
+                    [](const FunctionState &f) { return f.non_doomed; });
+  auto total_specifications = std::count_if(
+      functions_.begin(), functions_.end(), [](const FunctionState &f) {
+        return !ConfidenceLattice::IsUnknown(f.error_specification);
       });
 
   LOG(INFO) << "Total number of Integer/Pointer functions: "
             << total_non_void_functions;
   LOG(INFO) << "Total number of non-doomed functions: "
-            << non_doomed_function_names_.size();
+            << total_non_doomed_functions;
   LOG(INFO) << "Total number of specifications inferred: "
-            << error_specifications_.size();
+            << total_specifications;
 
   LOG(INFO) << "ErrorBlocks Finished";
   google::FlushLogFiles(google::INFO);
@@ -447,25 +499,25 @@ bool ErrorBlocksPass::ExpandErrorSpecification(
 }
 
 bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
-  const auto fn_name = GetSourceName(*fn);
+  const FunctionId fn_id = function_ids_.GetId(*fn);
   // Ideally we want to incorporate the LLVM names back into this, but the
   // entire pipeline would have to account for this, which it doesn't.... Just
   // take the first instance. This is very hacky and poorly written, but this
   // just needs to work for now.
-  if (name_to_function_.find(fn_name) != name_to_function_.end()) {
-    llvm::Function *found_func = (*(name_to_function_.find(fn_name))).second;
-    if (found_func != fn) {
+  FunctionState &state = functions_[fn_id];
+  if (state.function != nullptr) {
+    if (state.function != fn) {
       return false;
     }
   } else {
-    name_to_function_[fn_name] = fn;
+    state.function = fn;
   }
 
-  LOG(INFO) << "Analyze " << fn_name;
-  // Add every function to return type map.
-  function_return_types_[fn_name] =
-      fn == nullptr ? FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER
-                    : GetReturnType(*fn);
+  LOG(INFO) << "Analyze " << function_ids_.GetName(fn_id);
+  // Record the return type of every function.
+  state.return_type = fn == nullptr
+                          ? FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER
+                          : GetReturnType(*fn);
 
   // Initialize the join result to emptyset.
   std::vector<LatticeElementConfidence> block_confidences;
@@ -504,7 +556,6 @@ bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
   }
 
   // We need these names to check for SmartSuccessCodeZero.
-  std::string parent_fname = GetSourceName(*fn);
   std::string function_fname;
   if (fn && fn->begin() != fn->end()) {
     const llvm::Instruction *first_bb =
@@ -514,7 +565,7 @@ bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
 
   // If 0 is the first processed error return statement, the heuristic will
   // incorrectly count it towards the error specification.
-  if (ShouldSmartDropZero(parent_fname, function_fname)) {
+  if (ShouldSmartDropZero(fn_id, function_fname)) {
     LatticeElementConfidence zero_confidence(kMaxConfidence, kMinConfidence,
                                              kMinConfidence);
     auto downgraded_lattice_confidence = ConfidenceLattice::Difference(
@@ -522,7 +573,7 @@ bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
     if (downgraded_lattice_confidence != blocks_join_result) {
       blocks_join_result = downgraded_lattice_confidence;
       LOG(INFO) << "Retroactively dropped 0 from error specification for "
-                << parent_fname;
+                << function_ids_.GetName(fn_id);
     }
   }
 
@@ -530,7 +581,7 @@ bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
 }
 
 std::set<SignLatticeElement> ErrorBlocksPass::CollectConstraints(
-    const llvm::Function &parent_function, const std::string &fn_name) {
+    const llvm::Function &parent_function, FunctionId fn_id) {
   std::set<SignLatticeElement> ret;
 
   ReturnConstraintsPass &return_constraints_pass =
@@ -538,12 +589,11 @@ std::set<SignLatticeElement> ErrorBlocksPass::CollectConstraints(
 
   // Go over every instruction in parent_function.
   for (auto &basic_block : parent_function) {
-    for (auto &inst : basic_block) {
-      ReturnConstraintsFact return_constraints_fact =
-          return_constraints_pass.GetInFact(&inst);
-      const auto &fn_constraint = return_constraints_fact.value.find(fn_name);
+    for (const ReturnConstraintsFact &return_constraints_fact :
+         return_constraints_pass.GetResult().GetBlockInFacts(basic_block)) {
+      const auto &fn_constraint = return_constraints_fact.value.find(fn_id);
       // If there there is constraint on the instruction associated with
-      // fn_name.
+      // fn_id.
       if (fn_constraint != return_constraints_fact.value.end()) {
         // Then add that constraint to ret.
         ret.insert(fn_constraint->second.lattice_element);
@@ -565,18 +615,15 @@ void ErrorBlocksPass::CheckViolations(const llvm::Function &func) {
 }
 
 void ErrorBlocksPass::CheckViolations(const llvm::CallInst &call_inst) {
-  const Function callee_function = GetCallee(call_inst);
-
-  const std::string &callee_function_name = callee_function.source_name();
-  auto confidence_it = error_specifications_.find(callee_function_name);
-  if (confidence_it == error_specifications_.end()) {
+  const FunctionId callee_id = function_ids_.GetCalleeId(call_inst);
+  const LatticeElementConfidence &lattice_confidence =
+      functions_[callee_id].error_specification;
+  if (ConfidenceLattice::IsUnknown(lattice_confidence)) {
     return;
   }
 
-  const LatticeElementConfidence &lattice_confidence = confidence_it->second;
-
   auto callee_constraints =
-      CollectConstraints(*(call_inst.getFunction()), callee_function_name);
+      CollectConstraints(*(call_inst.getFunction()), callee_id);
 
   SignLatticeElement lattice_element =
       ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
@@ -599,7 +646,8 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       join_result = ConfidenceLattice::Join(VisitCallInst(*inst), join_result);
     }
   }
-  std::string parent_fname = GetSourceName(*BB.getParent());
+  const FunctionId parent_id = function_ids_.GetId(*BB.getParent());
+  const std::string &parent_fname = function_ids_.GetName(parent_id);
   const llvm::Instruction *bb_first = GetFirstInstructionOfBB(&BB);
   ReturnedValuesPass &returned_values_pass = getAnalysis<ReturnedValuesPass>();
   ReturnedValuesFact rtf = returned_values_pass.GetInFact(bb_first);
@@ -621,17 +669,17 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       int64_t return_value = int_return->getSExtValue();
 
       if (IsErrorCode(return_value, function_fname)) {
-        AddNonDoomedFunction(parent_fname);
-        AddFunctionReturningDomainKnowledgeCodes(parent_fname);
+        AddNonDoomedFunction(parent_id);
+        AddFunctionReturningDomainKnowledgeCodes(parent_id);
         join_result = ConfidenceLattice::Join(
             AddErrorValue(BB.getParent(), return_value), join_result);
         LOG(INFO) << "ErrorCode"
                   << " c=" << return_value << *bb_first;
-      } else if (IsSuccessCode(parent_fname, return_value, function_fname)) {
+      } else if (IsSuccessCode(parent_id, return_value, function_fname)) {
         // This check is different from the IsErrorCode check, since 0 might
         // not be considered a success code if the corresponding heuristic is
         // enabled.
-        AddFunctionReturningDomainKnowledgeCodes(parent_fname);
+        AddFunctionReturningDomainKnowledgeCodes(parent_id);
         LOG(INFO) << "SuccessCode"
                   << " c=" << return_value << *bb_first;
         return join_result;
@@ -644,23 +692,23 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       getAnalysis<ReturnConstraintsPass>();
   const llvm::Instruction *bb_last = GetLastInstructionOfBB(&BB);
   ReturnConstraintsFact rcf = return_constraints_pass.GetOutFact(bb_last);
-  // string constraint_fname is the function whose return value is
+  // constraint_id is the function whose return value is
   // constraining this block. Constraint block_constraint is the abstract
   // value of the constraint on block execution. Constraint constraint_aerv is
   // the abstract error return value of constraint_f.
-  for (auto kv : rcf.value) {
-    std::string constraint_fname = kv.first;
+  for (const auto &kv : rcf.value) {
+    const FunctionId constraint_id = kv.first;
     // Empty name constraints should never affect the analysis, since we
     // cannot determine which function's error specifications are constraining
-    // the block. Relying on string empty is not the cleanest way to handle
-    // this, but it's straightforward for now.
-    if (constraint_fname.empty()) continue;
+    // the block.
+    if (constraint_id == kUnresolvedFunctionId) continue;
+    const std::string &constraint_fname = function_ids_.GetName(constraint_id);
     Constraint block_constraint = kv.second;
 
     // Get the error specification (AERV) for function constraining this
     // block.
     LatticeElementConfidence constraining_function_confidence =
-        GetErrorSpecification(constraint_fname);
+        GetErrorSpecification(constraint_id);
 
     LatticeElementConfidence block_intersection_confidence =
         ConfidenceLattice::Intersection(constraining_function_confidence,
@@ -681,7 +729,7 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
     // Transform values that can be returned into
     // a constraint on a function return value.
 
-    std::string propagate_callee;
+    FunctionId propagate_callee = kUnresolvedFunctionId;
     if (block_constraint.lattice_element !=
         SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP) {
       if (const auto maybe_bool = ExtractBoolean(*returned_value)) {
@@ -707,7 +755,7 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                   << " abstracted=\"" << return_lattice_confidence << "\""
                   << " fprime=" << constraint_fname << " l=\""
                   << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname)
+                  << " E(fprime)=\"" << GetErrorSpecification(constraint_id)
                   << "\"";
       } else if (const llvm::ConstantInt *int_return =
                      llvm::dyn_cast<llvm::ConstantInt>(returned_value)) {
@@ -743,10 +791,10 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                   << " abstracted=\"" << return_lattice_confidence << "\""
                   << " fprime=" << constraint_fname << " l=\""
                   << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname)
+                  << " E(fprime)=\"" << GetErrorSpecification(constraint_id)
                   << "\"";
       } else if (llvm::isa<llvm::ConstantPointerNull>(returned_value)) {
-        propagate_callee = constraint_fname;
+        propagate_callee = constraint_id;
         // The confidence_zero should be the max of the constraining
         // function's error specification confidences.
         auto return_confidence_zero =
@@ -760,7 +808,7 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                   << " abstracted=\"" << return_lattice_confidence << "\""
                   << " fprime=" << constraint_fname << " l=\""
                   << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname)
+                  << " E(fprime)=\"" << GetErrorSpecification(constraint_id)
                   << "\"";
       } else if (const auto maybe_string_literal =
                      ExtractStringLiteral(*returned_value)) {
@@ -775,14 +823,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             /* ==0 */ kMinConfidence, return_confidence_less_than_zero,
             return_confidence_greater_than_zero,
             block_intersection_confidence.GetConfidenceEmptyset());
-        propagate_callee = constraint_fname;
+        propagate_callee = constraint_id;
         LOG(INFO) << "ErrorStringLiteral"
                   << " f=" << parent_fname << *bb_last << " c=\""
                   << maybe_string_literal->str() << "\""
                   << " abstracted=\"" << return_lattice_confidence << "\""
                   << " fprime=" << constraint_fname << " l=\""
                   << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname);
+                  << " E(fprime)=\"" << GetErrorSpecification(constraint_id);
       }
     }
 
@@ -790,7 +838,7 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
     if (call) {
       // DIRECT PROPAGATION
       // The function is returning a call instruction.
-      std::string callee_name = GetCallee(*call).source_name();
+      const FunctionId callee_id = function_ids_.GetCalleeId(*call);
       LatticeElementConfidence callee_confidence = GetErrorSpecification(*call);
 
       // If any confidence values are greater-than kMinConfidence, we want
@@ -800,13 +848,13 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       if (!ConfidenceLattice::IsUnknown(callee_confidence)) {
         // If we return a call instruction, we take the callee function's
         // confidence.
-        propagate_callee = callee_name;
+        propagate_callee = callee_id;
         return_lattice_confidence = callee_confidence;
         // There is a small chance that the constraining function on the
         // block is the same as the function value returned. If this is
         // the case, we have to make sure that the actual error value can
         // be returned.
-        if (callee_name.compare(constraint_fname) == 0) {
+        if (callee_id == constraint_id) {
           return_lattice_confidence = ConfidenceLattice::Meet(
               callee_confidence, block_intersection_confidence);
           LOG(INFO) << "Returned function same as constraining function, "
@@ -817,13 +865,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                   << " fprime=" << constraint_fname << " constraint=\""
                   << block_constraint.lattice_element << "\""
                   << " E(fprime)=\"" << constraining_function_confidence << "\""
-                  << " g=\"" << propagate_callee << "\""
+                  << " g=\"" << function_ids_.GetName(propagate_callee)
+                  << "\""
                   << " E(g)=\"" << callee_confidence;
 
         if (ReturnsDomainKnowledgeCodes(propagate_callee)) {
-          AddFunctionReturningDomainKnowledgeCodes(parent_fname);
+          AddFunctionReturningDomainKnowledgeCodes(parent_id);
         }
-        if (ShouldSmartDropZero(parent_fname, function_fname)) {
+        if (ShouldSmartDropZero(parent_id, function_fname)) {
           auto downgraded_lattice_confidence = ConfidenceLattice::Difference(
               return_lattice_confidence,
               SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
@@ -842,7 +891,7 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       // at this program point. Check to see if the returned value can hold
       // the return value of a function.
       ReturnPropagationFact rpf =
-          *(return_propagation_pass.output_facts_.at(bb_last));
+          return_propagation_pass.GetResult().GetOutFact(bb_last);
 
       if (rpf.value.find(returned_value) != rpf.value.end()) {
         if (rpf.value.at(returned_value).size() > 1) {
@@ -901,10 +950,10 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                       << " fprime=" << constraint_fname << " l=\""
                       << block_constraint.lattice_element << "\""
                       << " E(fprime)=\""
-                      << GetErrorSpecification(constraint_fname) << "\"";
+                      << GetErrorSpecification(constraint_id) << "\"";
           } else if (const llvm::CallInst *call =
                          llvm::dyn_cast<llvm::CallInst>(v)) {
-            std::string callee_name = GetCallee(*call).source_name();
+            const FunctionId callee_id = function_ids_.GetCalleeId(*call);
             LatticeElementConfidence callee_confidence =
                 GetErrorSpecification(*call);
             // If any confidence values are greater-than kMinConfidence, we
@@ -917,14 +966,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             // block is the same as the function value returned. If this is
             // the case, we have to make sure that the actual error value can
             // be returned.
-            if (callee_name.compare(constraint_fname) == 0) {
+            if (callee_id == constraint_id) {
               return_lattice_confidence = ConfidenceLattice::Meet(
                   callee_confidence, block_intersection_confidence);
               LOG(INFO) << "Returned function same as constraining function, "
                         << "performing meet: " << return_lattice_confidence;
             }
 
-            propagate_callee = callee_name;
+            propagate_callee = callee_id;
             // If we return a call instruction (in this case indirectly), we
             // take the callee function's confidence.
             LOG(INFO) << "PropagationIndirect"
@@ -933,14 +982,15 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                       << block_constraint.lattice_element << "\""
                       << " E(fprime)=\"" << constraining_function_confidence
                       << "\""
-                      << " g=\"" << propagate_callee << "\""
+                      << " g=\"" << function_ids_.GetName(propagate_callee)
+                      << "\""
                       << " E(g)=\"" << callee_confidence;
 
             if (ReturnsDomainKnowledgeCodes(propagate_callee)) {
-              AddFunctionReturningDomainKnowledgeCodes(parent_fname);
+              AddFunctionReturningDomainKnowledgeCodes(parent_id);
             }
           }
-          if (ShouldSmartDropZero(parent_fname, function_fname)) {
+          if (ShouldSmartDropZero(parent_id, function_fname)) {
             auto downgraded_lattice_confidence = ConfidenceLattice::Difference(
                 return_lattice_confidence,
                 SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
@@ -968,12 +1018,12 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
 
 LatticeElementConfidence ErrorBlocksPass::VisitCallInst(
     const llvm::CallInst &call_inst) {
-  const std::string callee_name = GetCalleeSourceName(call_inst);
+  const FunctionId callee_id = function_ids_.GetCalleeId(call_inst);
   const llvm::Function *parent = call_inst.getFunction();
   const std::string &function_fname = GetSourceFileName(call_inst);
   // If the callee is in our list of reachable functions, then add the caller
   // as well.
-  if (!IsDoomedFunction(callee_name)) {
+  if (!IsDoomedFunction(callee_id)) {
     AddNonDoomedFunction(*parent);
   }
 
@@ -987,14 +1037,16 @@ LatticeElementConfidence ErrorBlocksPass::VisitCallInst(
     const auto val = llvm::dyn_cast<llvm::Value>(&call_inst);
     // If the callee name is empty, then there is a possibility that the
     // callee is coming from a function pointer stored in a struct.
-    if (callee_name.empty() && val && val->getType()->isIntOrPtrTy()) {
+    if (callee_id == kUnresolvedFunctionId && val &&
+        val->getType()->isIntOrPtrTy()) {
       emptyset_confidence = kMinConfidence;
       // If the function name is the empty string, then it is likely a LLVM
       // intrinsic. We should return emptyset in this case. If the call is
       // just related to an emptyset specification, then we should also return
       // emptyset here as well.
-    } else if (callee_name.empty() || ConfidenceLattice::IsEmptyset(
-                                          GetErrorSpecification(call_inst))) {
+    } else if (callee_id == kUnresolvedFunctionId ||
+               ConfidenceLattice::IsEmptyset(
+                   GetErrorSpecification(call_inst))) {
       emptyset_confidence = kMaxConfidence;
     }
     return LatticeElementConfidence(kMinConfidence, kMinConfidence,
@@ -1026,7 +1078,7 @@ LatticeElementConfidence ErrorBlocksPass::VisitCallInst(
     } else if (const llvm::ConstantInt *int_return =
                    llvm::dyn_cast<llvm::ConstantInt>(v)) {
       const int64_t return_value = int_return->getSExtValue();
-      if (!IsSuccessCode(GetSourceName(*parent), return_value,
+      if (!IsSuccessCode(function_ids_.GetId(*parent), return_value,
                          function_fname)) {
         join_result = ConfidenceLattice::Join(
             AddErrorValue(parent, return_value), join_result);
@@ -1082,64 +1134,64 @@ LatticeElementConfidence ErrorBlocksPass::AddErrorValue(const llvm::Function *f,
 }
 
 bool ErrorBlocksPass::AddNonDoomedFunction(const llvm::Function &f) {
-  return AddNonDoomedFunction(GetSourceName(f));
+  return AddNonDoomedFunction(function_ids_.GetId(f));
 }
 
-bool ErrorBlocksPass::AddNonDoomedFunction(const std::string &function_name) {
-  return non_doomed_function_names_.insert(function_name).second;
+bool ErrorBlocksPass::AddNonDoomedFunction(FunctionId function_id) {
+  const bool doomed = !functions_[function_id].non_doomed;
+  functions_[function_id].non_doomed = true;
+  return doomed;
 }
 
 bool ErrorBlocksPass::IsDoomedFunction(const llvm::Function &f) {
-  return IsDoomedFunction(GetSourceName(f));
+  return IsDoomedFunction(function_ids_.GetId(f));
 }
 
-bool ErrorBlocksPass::IsDoomedFunction(const std::string &function_name) {
-  return non_doomed_function_names_.find(function_name) ==
-         non_doomed_function_names_.end();
+bool ErrorBlocksPass::IsDoomedFunction(FunctionId function_id) {
+  return !functions_[function_id].non_doomed;
 }
 
 GetSpecificationsResponse ErrorBlocksPass::GetSpecifications() const {
   GetSpecificationsResponse response;
-  for (const auto &function_lattice_confidence : error_specifications_) {
+  for (FunctionId id = 0; id < functions_.size(); id++) {
+    const FunctionState &state = functions_[id];
+    const LatticeElementConfidence &lattice_confidence =
+        state.error_specification;
     // Skip "unknown" error specifications since the default assumption is
     // that function specifications are unknown when not reported by the
     // analysis.
-    if (ConfidenceLattice::IsUnknown(function_lattice_confidence.second)) {
+    if (ConfidenceLattice::IsUnknown(lattice_confidence)) {
       continue;
     }
 
     // Copying the inferred specifications to the response.
-    const std::string &llvm_name = function_lattice_confidence.first;
+    const std::string &llvm_name = function_ids_.GetName(id);
     const std::string &source_name = LlvmToSourceName(llvm_name);
-    const FunctionReturnType return_type =
-        function_return_types_.find(source_name)->second;
 
     LOG(INFO) << "Function: " << source_name
-              << " spec: " << function_lattice_confidence.second;
+              << " spec: " << lattice_confidence;
     // Enforce invariant initial specifications from domain knowledge.
-    auto initial_spec_it = initial_error_specifications_.find(source_name);
-    if (initial_spec_it != initial_error_specifications_.end()) {
-      assert(initial_spec_it->second == function_lattice_confidence.second);
+    if (state.has_initial_specification) {
+      assert(initial_error_specifications_.at(llvm_name) ==
+             lattice_confidence);
     }
 
     SignLatticeElement lattice_element =
         ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
-            function_lattice_confidence.second);
+            lattice_confidence);
     Function f;
     f.set_llvm_name(llvm_name);
     f.set_source_name(source_name);
-    f.set_return_type(return_type);
+    f.set_return_type(state.return_type);
     Specification *s = response.add_specifications();
     s->mutable_function()->CopyFrom(f);
     s->set_lattice_element(lattice_element);
-    s->set_confidence_zero(
-        function_lattice_confidence.second.GetConfidenceZero());
+    s->set_confidence_zero(lattice_confidence.GetConfidenceZero());
     s->set_confidence_less_than_zero(
-        function_lattice_confidence.second.GetConfidenceLessThanZero());
+        lattice_confidence.GetConfidenceLessThanZero());
     s->set_confidence_greater_than_zero(
-        function_lattice_confidence.second.GetConfidenceGreaterThanZero());
-    s->set_confidence_emptyset(
-        function_lattice_confidence.second.GetConfidenceEmptyset());
+        lattice_confidence.GetConfidenceGreaterThanZero());
+    s->set_confidence_emptyset(lattice_confidence.GetConfidenceEmptyset());
   }
 
   std::vector<Violation> violations = checker_->GetViolations();
@@ -1162,34 +1214,46 @@ SignLatticeElement ErrorBlocksPass::AbstractInteger(int64_t v) const {
 }
 
 std::unordered_set<std::string> ErrorBlocksPass::GetNonDoomedFunctions() const {
-  return non_doomed_function_names_;
+  std::unordered_set<std::string> non_doomed_function_names;
+  for (FunctionId id = 0; id < functions_.size(); id++) {
+    if (functions_[id].non_doomed) {
+      non_doomed_function_names.insert(function_ids_.GetName(id));
+    }
+  }
+
+  return non_doomed_function_names;
 }
 
 LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
     const llvm::CallInst &call_inst) const {
-  std::string function_name = GetCalleeSourceName(call_inst);
-  if (function_name.empty()) {
+  const FunctionId function_id = function_ids_.GetCalleeId(call_inst);
+  if (function_id == kUnresolvedFunctionId) {
     // All confidence values are 0 by default.
     return LatticeElementConfidence();
   }
-  return GetErrorSpecification(function_name);
+  return GetErrorSpecification(function_id);
 }
 
 LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
     const llvm::Function *fn) const {
   assert(fn != nullptr);
-  return GetErrorSpecification(GetSourceName(*fn));
+  return GetErrorSpecification(function_ids_.GetId(*fn));
+}
+
+LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
+    FunctionId function_id) const {
+  // All confidence values are 0 by default.
+  return functions_[function_id].error_specification;
 }
 
 LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
     const std::string &function_name) const {
-  ErrorSpecificationMap::const_iterator it =
-      error_specifications_.find(function_name);
-  if (it != error_specifications_.end()) {
-    return it->second;
+  FunctionId function_id;
+  if (!function_ids_.Find(function_name, &function_id)) {
+    // All confidence values are 0 by default.
+    return LatticeElementConfidence();
   }
-  // All confidence values are 0 by default.
-  return LatticeElementConfidence();
+  return GetErrorSpecification(function_id);
 }
 
 bool ErrorBlocksPass::UpdateErrorSpecification(const llvm::Function *func,
@@ -1213,8 +1277,8 @@ bool ErrorBlocksPass::UpdateErrorSpecification(const llvm::Function *func,
   // the way that the expansion is currently performed. However, if we decide
   // to do something like expanding on all return values, then this is
   // necessary. Explained here: https://github.com/95616ARG/indra/issues/785
-  std::string function_name = GetSourceName(*func);
-  const auto &current = GetErrorSpecification(function_name);
+  const FunctionId function_id = function_ids_.GetId(*func);
+  const auto current = GetErrorSpecification(function_id);
   // Check if current is currently bottom. If delta is emptyset, then joining
   // with bottom/unknown would cause the delta to become bottom/unknown as
   // well.
@@ -1252,27 +1316,28 @@ bool ErrorBlocksPass::UpdateErrorSpecification(const llvm::Function *func,
   // Set error specification to delta, which should now be the old
   // specification joined with the delta with any of confidence values
   // modified from KeepIfMax and RemoveLowestNonMin.
-  error_specifications_[function_name] = delta;
-  LOG(INFO) << "Updated: " << function_name << " spec: " << delta;
+  functions_[function_id].error_specification = delta;
+  LOG(INFO) << "Updated: " << function_ids_.GetName(function_id)
+            << " spec: " << delta;
   return current != delta;
 }
 
 bool ErrorBlocksPass::RemoveFromErrorSpecification(
-    const std::string &function_name, LatticeElementConfidence to_remove) {
-  auto it = error_specifications_.find(function_name);
-  if (it != error_specifications_.end()) {
-    auto current = it->second;
-    auto updated = ConfidenceLattice::Difference(current, to_remove);
-
-    if (ConfidenceLattice::IsUnknown(updated)) {
-      error_specifications_.erase(function_name);
-    } else {
-      it->second = updated;
-    }
-
-    return current != updated;
+    FunctionId function_id, LatticeElementConfidence to_remove) {
+  LatticeElementConfidence &specification =
+      functions_[function_id].error_specification;
+  if (ConfidenceLattice::IsUnknown(specification)) {
+    return false;
   }
-  return false;
+  auto current = specification;
+  auto updated = ConfidenceLattice::Difference(current, to_remove);
+
+  // An unknown specification is the same as none.
+  specification = ConfidenceLattice::IsUnknown(updated)
+                      ? LatticeElementConfidence()
+                      : updated;
+
+  return current != updated;
 }
 
 bool ErrorBlocksPass::ValuesAreEqual(
@@ -1378,26 +1443,26 @@ bool ErrorBlocksPass::IsSuccessCode(int64_t value,
 }
 
 void ErrorBlocksPass::AddFunctionReturningDomainKnowledgeCodes(
-    const std::string &function_name) {
-  functions_returning_domain_knowledge_codes_.insert(function_name);
+    FunctionId function_id) {
+  functions_[function_id].returns_domain_knowledge_codes = true;
 }
 
 bool ErrorBlocksPass::ReturnsDomainKnowledgeCodes(
-    const std::string &function_name) const {
-  return functions_returning_domain_knowledge_codes_.count(function_name) > 0;
+    FunctionId function_id) const {
+  return functions_[function_id].returns_domain_knowledge_codes;
 }
 
-bool ErrorBlocksPass::IsSuccessCode(const std::string &function_name,
+bool ErrorBlocksPass::IsSuccessCode(FunctionId function_id,
                                     const int64_t value,
                                     const std::string &filename) const {
   if (smart_success_code_zero_ && value == 0) {
-    return ShouldSmartDropZero(function_name, filename);
+    return ShouldSmartDropZero(function_id, filename);
   } else {
     return IsSuccessCode(value, filename);
   }
 }
 
-bool ErrorBlocksPass::ShouldSmartDropZero(const std::string &function_name,
+bool ErrorBlocksPass::ShouldSmartDropZero(FunctionId function_id,
                                           const std::string &filename) const {
   // Here, we apply a heuristic, since returning 0 is a bit complicated due to
   // ambiguity.  It might be a domain knowledge success code, or the current
@@ -1406,7 +1471,7 @@ bool ErrorBlocksPass::ShouldSmartDropZero(const std::string &function_name,
   // knowledge success and error codes form a collective set of return codes,
   // we know 0 must be a success return.
   return smart_success_code_zero_ && IsSuccessCode(0, filename) &&
-         ReturnsDomainKnowledgeCodes(function_name);
+         ReturnsDomainKnowledgeCodes(function_id);
 }
 
 void ErrorBlocksPass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
@@ -0,0 +1,559 @@
+#include "fact_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Starts every entry. The digit is bumped whenever the encoding changes.
+constexpr char kEntryMagic[] = "EESIFCT2";
+constexpr size_t kEntryMagicSize = sizeof(kEntryMagic) - 1;
+
+// How the fact at a program point is encoded.
+enum FactTag : uint64_t {
+  // The input fact of an instruction is the output fact of the previous
+  // instruction in its block, or the output fact equals the input fact.
+  kSameAsPrevious = 0,
+  // The fact follows.
+  kExplicit = 1,
+};
+
+// Numbers every value of a module that a fact can refer to, and the source
+// names of its functions, in an order that only depends on the module.
+class ValueNumbering {
+ public:
+  explicit ValueNumbering(const llvm::Module &module)
+      : function_ids_(std::make_shared<const FunctionIds>(module)) {
+    for (const llvm::GlobalVariable &global : module.globals()) {
+      Add(&global);
+    }
+    for (const llvm::Function &function : module) {
+      Add(&function);
+    }
+    for (const llvm::Function &function : module) {
+      for (const llvm::Argument &argument : function.args()) {
+        Add(&argument);
+      }
+      for (const llvm::BasicBlock &block : function) {
+        Add(&block);
+        for (const llvm::Instruction &inst : block) {
+          Add(&inst);
+          // Constants only appear as operands.
+          for (const llvm::Use &operand : inst.operands()) {
+            Add(operand.get());
+          }
+        }
+      }
+    }
+  }
+
+  uint64_t size() const { return values_.size(); }
+
+  // Returns false if `value` is not part of the module.
+  bool GetId(const llvm::Value *value, uint64_t *out_id) const {
+    auto it = ids_.find(value);
+    if (it == ids_.end()) {
+      return false;
+    }
+    *out_id = it->second;
+
+    return true;
+  }
+
+  // Returns null if `id` is out of range.
+  const llvm::Value *GetValue(uint64_t id) const {
+    return id < values_.size() ? values_[id] : nullptr;
+  }
+
+  // The IDs of the source names of the functions, as ReturnConstraints
+  // numbers them.
+  const std::shared_ptr<const FunctionIds> &function_ids() const {
+    return function_ids_;
+  }
+
+ private:
+  void Add(const llvm::Value *value) {
+    if (ids_.emplace(value, values_.size()).second) {
+      values_.push_back(value);
+    }
+  }
+
+  std::vector<const llvm::Value *> values_;
+  std::unordered_map<const llvm::Value *, uint64_t> ids_;
+  std::shared_ptr<const FunctionIds> function_ids_;
+};
+
+class FactWriter {
+ public:
+  void WriteVarint(uint64_t value) {
+    while (value >= 0x80) {
+      bytes_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    bytes_.push_back(static_cast<char>(value));
+  }
+
+  void WriteString(const std::string &value) {
+    WriteVarint(value.size());
+    bytes_.append(value);
+  }
+
+  const std::string &bytes() const { return bytes_; }
+
+ private:
+  std::string bytes_;
+};
+
+class FactReader {
+ public:
+  explicit FactReader(const std::string &bytes) : bytes_(bytes) {}
+
+  bool ReadVarint(uint64_t *out_value) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (position_ >= bytes_.size()) {
+        return false;
+      }
+      const uint8_t byte = static_cast<uint8_t>(bytes_[position_++]);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        *out_value = value;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool ReadString(std::string *out_value) {
+    uint64_t size;
+    if (!ReadVarint(&size) || size > bytes_.size() - position_) {
+      return false;
+    }
+    out_value->assign(bytes_, position_, size);
+    position_ += size;
+
+    return true;
+  }
+
+  bool AtEnd() const { return position_ == bytes_.size(); }
+
+  size_t position() const { return position_; }
+
+ private:
+  const std::string &bytes_;
+  size_t position_ = 0;
+};
+
+bool WriteFact(const ReturnPropagationFact &fact,
+               const ValueNumbering &numbering, FactWriter *writer) {
+  // Sorted so that equal facts are always encoded the same way.
+  std::vector<std::pair<uint64_t, std::vector<uint64_t>>> entries;
+  for (const auto &kv : fact.value) {
+    std::pair<uint64_t, std::vector<uint64_t>> entry;
+    if (!numbering.GetId(kv.first, &entry.first)) {
+      return false;
+    }
+    for (const llvm::Value *value : kv.second) {
+      uint64_t id;
+      if (!numbering.GetId(value, &id)) {
+        return false;
+      }
+      entry.second.push_back(id);
+    }
+    std::sort(entry.second.begin(), entry.second.end());
+    entries.push_back(std::move(entry));
+  }
+  std::sort(entries.begin(), entries.end());
+
+  writer->WriteVarint(entries.size());
+  for (const auto &entry : entries) {
+    writer->WriteVarint(entry.first);
+    writer->WriteVarint(entry.second.size());
+    for (uint64_t id : entry.second) {
+      writer->WriteVarint(id);
+    }
+  }
+
+  return true;
+}
+
+bool ReadFact(FactReader *reader, const ValueNumbering &numbering,
+              ReturnPropagationFact *out_fact) {
+  uint64_t num_entries;
+  if (!reader->ReadVarint(&num_entries)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < num_entries; i++) {
+    uint64_t key_id;
+    uint64_t num_values;
+    if (!reader->ReadVarint(&key_id) || !reader->ReadVarint(&num_values)) {
+      return false;
+    }
+    const llvm::Value *key = numbering.GetValue(key_id);
+    if (!key) {
+      return false;
+    }
+    ReturnPropagationFact::ValueSet values;
+    for (uint64_t j = 0; j < num_values; j++) {
+      uint64_t id;
+      if (!reader->ReadVarint(&id) || !numbering.GetValue(id)) {
+        return false;
+      }
+      values.Insert(numbering.GetValue(id));
+    }
+    out_fact->value.Set(key, std::move(values));
+  }
+
+  return true;
+}
+
+bool WriteFact(const ReturnConstraintsFact &fact, const ValueNumbering &,
+               FactWriter *writer) {
+  // Entries are sorted by function, so equal facts are always encoded the
+  // same way.
+  writer->WriteVarint(fact.value.size());
+  for (const auto &kv : fact.value) {
+    writer->WriteVarint(kv.first);
+    writer->WriteVarint(kv.second.lattice_element);
+  }
+
+  return true;
+}
+
+bool ReadFact(FactReader *reader, const ValueNumbering &numbering,
+              ReturnConstraintsFact *out_fact) {
+  uint64_t num_entries;
+  if (!reader->ReadVarint(&num_entries)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < num_entries; i++) {
+    uint64_t function_id;
+    uint64_t lattice_element;
+    if (!reader->ReadVarint(&function_id) ||
+        function_id >= numbering.function_ids()->size() ||
+        !reader->ReadVarint(&lattice_element) ||
+        !SignLatticeElement_IsValid(static_cast<int>(lattice_element))) {
+      return false;
+    }
+    out_fact->value.Set(
+        function_id,
+        Constraint(static_cast<FunctionId>(function_id),
+                   static_cast<SignLatticeElement>(lattice_element)));
+  }
+
+  return true;
+}
+
+// Encodes the input and output fact of every instruction of `module`.
+// Returns false if a fact refers to a value outside of it.
+template <typename Facts>
+bool WriteFacts(const llvm::Module &module, const ValueNumbering &numbering,
+                const Facts &facts, FactWriter *writer) {
+  for (const llvm::Function &function : module) {
+    for (const llvm::BasicBlock &block : function) {
+      // A whole block at a time, so that facts stored only at the block
+      // boundaries are recomputed once per block.
+      const auto input_facts = facts.GetBlockInFacts(block);
+      const auto output_facts = facts.GetBlockOutFacts(block);
+      for (size_t i = 0; i < input_facts.size(); i++) {
+        if (i > 0 && input_facts[i].value == output_facts[i - 1].value) {
+          writer->WriteVarint(kSameAsPrevious);
+        } else {
+          writer->WriteVarint(kExplicit);
+          if (!WriteFact(input_facts[i], numbering, writer)) {
+            return false;
+          }
+        }
+
+        if (output_facts[i].value == input_facts[i].value) {
+          writer->WriteVarint(kSameAsPrevious);
+        } else {
+          writer->WriteVarint(kExplicit);
+          if (!WriteFact(output_facts[i], numbering, writer)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Decodes the facts written by WriteFacts. Facts that were equal when they
+// were written are shared between program points; the analyses never
+// modify them once they are complete. With FactStorage::kBlockBoundaries,
+// only the facts at the entry and exit of blocks are kept.
+template <typename Fact>
+bool ReadFacts(const llvm::Module &module, const ValueNumbering &numbering,
+               FactStorage storage, FactReader *reader,
+               FactTable<Fact> *input_facts, FactTable<Fact> *output_facts) {
+  ResetFactTables(module, storage, input_facts, output_facts);
+  for (const llvm::Function &function : module) {
+    for (const llvm::BasicBlock &block : function) {
+      std::shared_ptr<Fact> previous;
+      for (const llvm::Instruction &inst : block) {
+        uint64_t tag;
+        if (!reader->ReadVarint(&tag)) {
+          return false;
+        }
+        std::shared_ptr<Fact> input = previous;
+        if (tag == kExplicit) {
+          input = std::make_shared<Fact>();
+          if (!ReadFact(reader, numbering, input.get())) {
+            return false;
+          }
+        } else if (tag != kSameAsPrevious || !input) {
+          return false;
+        }
+
+        if (!reader->ReadVarint(&tag)) {
+          return false;
+        }
+        std::shared_ptr<Fact> output = input;
+        if (tag == kExplicit) {
+          output = std::make_shared<Fact>();
+          if (!ReadFact(reader, numbering, output.get())) {
+            return false;
+          }
+        } else if (tag != kSameAsPrevious) {
+          return false;
+        }
+
+        if (storage == FactStorage::kEveryInstruction ||
+            &inst == &block.front()) {
+          input_facts->Set(&inst, input);
+        }
+        if (storage == FactStorage::kEveryInstruction ||
+            &inst == &block.back()) {
+          output_facts->Set(&inst, output);
+        }
+        previous = output;
+      }
+    }
+  }
+
+  return reader->AtEnd();
+}
+
+// Handles are used as file names, so only hex digests, possibly with a
+// "tree-" prefix, are cached.
+bool IsCacheableHandle(const std::string &bitcode_id) {
+  if (bitcode_id.empty()) {
+    return false;
+  }
+  for (char c : bitcode_id) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+FactCache::FactCache(const std::string &cache_directory)
+    : cache_directory_(cache_directory) {
+  if (cache_directory_.empty()) {
+    return;
+  }
+  std::error_code error_code =
+      llvm::sys::fs::create_directories(cache_directory_);
+  if (error_code) {
+    LOG(ERROR) << "Unable to create fact cache directory " << cache_directory_
+               << ": " << error_code.message()
+               << ". Dataflow facts will not be cached.";
+    cache_directory_.clear();
+  }
+}
+
+bool FactCache::LoadReturnPropagation(const std::string &bitcode_id,
+                                      const llvm::Module &module,
+                                      ReturnPropagation *out_facts) {
+  const std::string path = EntryPath(bitcode_id, "return_propagation");
+  if (path.empty()) {
+    return Record(false);
+  }
+  const ValueNumbering numbering(module);
+  std::string payload;
+  if (!ReadEntry(path, numbering.size(), &payload)) {
+    return Record(false);
+  }
+
+  FactReader reader(payload);
+  if (!ReadFacts<ReturnPropagationFact>(module, numbering,
+                                        out_facts->GetFactStorage(), &reader,
+                                        &out_facts->input_facts_,
+                                        &out_facts->output_facts_)) {
+    LOG(WARNING) << "Discarding corrupt fact cache entry " << path;
+    llvm::sys::fs::remove(path);
+    out_facts->input_facts_.Clear();
+    out_facts->output_facts_.Clear();
+    return Record(false);
+  }
+
+  return Record(true);
+}
+
+bool FactCache::LoadReturnConstraints(const std::string &bitcode_id,
+                                      const llvm::Module &module,
+                                      ReturnConstraints *out_facts) {
+  const std::string path = EntryPath(bitcode_id, "return_constraints");
+  if (path.empty()) {
+    return Record(false);
+  }
+  const ValueNumbering numbering(module);
+  std::string payload;
+  if (!ReadEntry(path, numbering.size(), &payload)) {
+    return Record(false);
+  }
+
+  FactReader reader(payload);
+  if (!ReadFacts<ReturnConstraintsFact>(module, numbering,
+                                        out_facts->GetFactStorage(), &reader,
+                                        &out_facts->input_facts_,
+                                        &out_facts->output_facts_)) {
+    LOG(WARNING) << "Discarding corrupt fact cache entry " << path;
+    llvm::sys::fs::remove(path);
+    out_facts->input_facts_.Clear();
+    out_facts->output_facts_.Clear();
+    return Record(false);
+  }
+  out_facts->function_ids_ = numbering.function_ids();
+
+  return Record(true);
+}
+
+void FactCache::StoreReturnPropagation(const std::string &bitcode_id,
+                                       const llvm::Module &module,
+                                       const ReturnPropagation &facts) const {
+  const std::string path = EntryPath(bitcode_id, "return_propagation");
+  if (path.empty()) {
+    return;
+  }
+  const ValueNumbering numbering(module);
+  FactWriter writer;
+  if (!WriteFacts(module, numbering, facts, &writer)) {
+    LOG(WARNING) << "Unable to encode return propagation facts of "
+                 << bitcode_id;
+    return;
+  }
+  WriteEntry(path, numbering.size(), writer.bytes());
+}
+
+void FactCache::StoreReturnConstraints(const std::string &bitcode_id,
+                                       const llvm::Module &module,
+                                       const ReturnConstraints &facts) const {
+  const std::string path = EntryPath(bitcode_id, "return_constraints");
+  if (path.empty()) {
+    return;
+  }
+  const ValueNumbering numbering(module);
+  FactWriter writer;
+  if (!WriteFacts(module, numbering, facts, &writer)) {
+    LOG(WARNING) << "Unable to encode return constraints facts of "
+                 << bitcode_id;
+    return;
+  }
+  WriteEntry(path, numbering.size(), writer.bytes());
+}
+
+std::string FactCache::EntryPath(const std::string &bitcode_id,
+                                 const std::string &analysis) const {
+  if (cache_directory_.empty() || !IsCacheableHandle(bitcode_id)) {
+    return "";
+  }
+
+  return cache_directory_ + "/" + bitcode_id + "." + analysis + ".facts";
+}
+
+bool FactCache::ReadEntry(const std::string &path, uint64_t num_values,
+                          std::string *out_payload) const {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return false;
+  }
+
+  const llvm::StringRef bytes = (*buffer)->getBuffer();
+  if (!bytes.startswith(llvm::StringRef(kEntryMagic, kEntryMagicSize))) {
+    LOG(WARNING) << "Discarding fact cache entry of another format " << path;
+    llvm::sys::fs::remove(path);
+    return false;
+  }
+  *out_payload = bytes.substr(kEntryMagicSize).str();
+  FactReader reader(*out_payload);
+  uint64_t entry_num_values;
+  if (!reader.ReadVarint(&entry_num_values) ||
+      entry_num_values != num_values) {
+    LOG(WARNING) << "Discarding fact cache entry of another module " << path;
+    llvm::sys::fs::remove(path);
+    return false;
+  }
+  out_payload->erase(0, reader.position());
+
+  return true;
+}
+
+void FactCache::WriteEntry(const std::string &path, uint64_t num_values,
+                           const std::string &payload) const {
+  // Write to a unique temporary file and rename it into place so that
+  // concurrent readers never observe a partially written entry.
+  int fd;
+  llvm::SmallString<128> temp_path;
+  std::error_code error_code =
+      llvm::sys::fs::createUniqueFile(path + "-%%%%%%.tmp", fd, temp_path);
+  if (error_code) {
+    LOG(ERROR) << "Unable to create fact cache entry: "
+               << error_code.message();
+    return;
+  }
+
+  {
+    FactWriter header;
+    header.WriteVarint(num_values);
+    llvm::raw_fd_ostream ostream(fd, /*shouldClose=*/true);
+    ostream.write(kEntryMagic, kEntryMagicSize);
+    ostream << header.bytes() << payload;
+    ostream.close();
+    if (ostream.has_error()) {
+      LOG(ERROR) << "Unable to write fact cache entry " << temp_path.c_str();
+      ostream.clear_error();
+      llvm::sys::fs::remove(temp_path);
+      return;
+    }
+  }
+
+  error_code = llvm::sys::fs::rename(temp_path, path);
+  if (error_code) {
+    LOG(ERROR) << "Unable to commit fact cache entry: "
+               << error_code.message();
+    llvm::sys::fs::remove(temp_path);
+  }
+}
+
+bool FactCache::Record(bool hit) {
+  if (hit) {
+    hits_++;
+  } else {
+    misses_++;
+  }
+
+  return hit;
+}
+
+}  // namespace error_specifications
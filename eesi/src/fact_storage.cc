@@ -0,0 +1,64 @@
+#include "fact_storage.h"
+
+#include <atomic>
+
+#include "glog/logging.h"
+#include "metrics.h"
+
+namespace error_specifications {
+
+static std::atomic<FactStorage> default_fact_storage{
+    FactStorage::kEveryInstruction};
+
+void SetDefaultFactStorage(FactStorage storage) {
+  default_fact_storage = storage;
+}
+
+FactStorage GetDefaultFactStorage() { return default_fact_storage; }
+
+bool ParseFactStorage(const std::string &name, FactStorage *out_storage) {
+  if (name == "every_instruction") {
+    *out_storage = FactStorage::kEveryInstruction;
+  } else if (name == "block_boundaries") {
+    *out_storage = FactStorage::kBlockBoundaries;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+void ReportFactStorage(const std::string &analysis,
+                       const FactStorageStats &stats) {
+  MetricsRegistry &registry = MetricsRegistry::Global();
+  const MetricLabels labels = {{"analysis", analysis}};
+  registry
+      .GetCounter("dataflow_facts_stored_total",
+                  "Dataflow facts kept by the analyses of modules.", labels)
+      ->Increment(stats.stored_facts);
+  registry
+      .GetCounter("dataflow_fact_bytes_stored_total",
+                  "Approximate memory of the dataflow facts kept by the "
+                  "analyses of modules.",
+                  labels)
+      ->Increment(stats.stored_bytes);
+  registry
+      .GetCounter("dataflow_facts_elided_total",
+                  "Dataflow facts inside basic blocks that were recomputed on "
+                  "demand instead of kept.",
+                  labels)
+      ->Increment(stats.elided_facts);
+  registry
+      .GetCounter("dataflow_fact_bytes_saved_total",
+                  "Approximate memory saved by recomputing the dataflow facts "
+                  "inside basic blocks on demand.",
+                  labels)
+      ->Increment(stats.elided_bytes);
+
+  LOG(INFO) << analysis << " kept " << stats.stored_facts
+            << " facts of about " << stats.stored_bytes << " bytes and elided "
+            << stats.elided_facts << " of about " << stats.elided_bytes
+            << " bytes";
+}
+
+}  // namespace error_specifications
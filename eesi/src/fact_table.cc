@@ -0,0 +1,45 @@
+#include "fact_table.h"
+
+namespace error_specifications {
+
+InstructionNumbering::InstructionNumbering(const llvm::Module &module,
+                                           bool number_instructions) {
+  unsigned num_instructions = 0;
+  for (const llvm::Function &function : module) {
+    for (const llvm::BasicBlock &block : function) {
+      block_numbers_[&block] = block_first_instructions_.size();
+      block_first_instructions_.push_back(num_instructions);
+      for (const llvm::Instruction &inst : block) {
+        if (number_instructions) {
+          instruction_numbers_[&inst] = num_instructions;
+        }
+        num_instructions++;
+      }
+    }
+  }
+  block_first_instructions_.push_back(num_instructions);
+}
+
+bool InstructionNumbering::GetBlockNumber(const llvm::BasicBlock *block,
+                                          unsigned *out_number) const {
+  auto it = block_numbers_.find(block);
+  if (it == block_numbers_.end()) {
+    return false;
+  }
+  *out_number = it->second;
+
+  return true;
+}
+
+bool InstructionNumbering::GetInstructionNumber(const llvm::Instruction *inst,
+                                                unsigned *out_number) const {
+  auto it = instruction_numbers_.find(inst);
+  if (it == instruction_numbers_.end()) {
+    return false;
+  }
+  *out_number = it->second;
+
+  return true;
+}
+
+}  // namespace error_specifications
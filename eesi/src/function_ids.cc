@@ -0,0 +1,52 @@
+#include "function_ids.h"
+
+#include <cassert>
+
+#include "llvm.h"
+
+namespace error_specifications {
+
+FunctionIds::FunctionIds() { Intern(""); }
+
+FunctionIds::FunctionIds(const llvm::Module &module) : FunctionIds() {
+  for (const llvm::Function &function : module) {
+    function_ids_[&function] = Intern(GetSourceName(function));
+  }
+}
+
+FunctionId FunctionIds::Intern(const std::string &source_name) {
+  auto inserted = ids_.try_emplace(source_name, names_.size());
+  if (inserted.second) {
+    names_.push_back(source_name);
+  }
+
+  return inserted.first->second;
+}
+
+bool FunctionIds::Find(const std::string &source_name,
+                       FunctionId *out_id) const {
+  auto it = ids_.find(source_name);
+  if (it == ids_.end()) {
+    return false;
+  }
+  *out_id = it->second;
+
+  return true;
+}
+
+FunctionId FunctionIds::GetId(const llvm::Function &function) const {
+  auto it = function_ids_.find(&function);
+  assert(it != function_ids_.end());
+  return it == function_ids_.end() ? kUnresolvedFunctionId : it->second;
+}
+
+FunctionId FunctionIds::GetCalleeId(const llvm::CallInst &call) const {
+  const llvm::Function *callee = GetCalleeFunction(call);
+  if (!callee) {
+    return kUnresolvedFunctionId;
+  }
+
+  return GetId(*callee);
+}
+
+}  // namespace error_specifications
@@ -2,123 +2,192 @@
 
 #include <string>
 
+#include "dataflow_analyses.h"
 #include "eesi_common.h"
+#include "fact_cache.h"
 #include "llvm.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "progress.h"
 #include "return_propagation_pass.h"
 #include "tbb/tbb.h"
 
 namespace error_specifications {
 
+llvm::AnalysisKey ReturnConstraintsAnalysis::Key;
+
+ReturnConstraintsAnalysis::Result ReturnConstraintsAnalysis::run(
+    llvm::Module &module, llvm::ModuleAnalysisManager &analysis_manager) {
+  auto constraints = std::make_unique<ReturnConstraints>();
+  if (fact_cache_ &&
+      fact_cache_->LoadReturnConstraints(bitcode_id_, module,
+                                         constraints.get())) {
+    return constraints;
+  }
+
+  const ReturnPropagation *return_propagation =
+      analysis_manager.getResult<ReturnPropagationAnalysis>(module).get();
+  constraints->Compute(module, return_propagation, cancellation_token_);
+  if (fact_cache_ && !IsCancelled(cancellation_token_)) {
+    fact_cache_->StoreReturnConstraints(bitcode_id_, module, *constraints);
+  }
+
+  return constraints;
+}
+
 bool ReturnConstraintsPass::runOnModule(llvm::Module &module) {
+  PassTimer pass_timer(this, "ReturnConstraintsPass");
+
+  if (auto *analysis_manager_pass =
+          getAnalysisIfAvailable<AnalysisManagerPass>()) {
+    result_ = analysis_manager_pass->GetAnalysisManager()
+                  ->getResult<ReturnConstraintsAnalysis>(module)
+                  .get();
+    return false;
+  }
+
+  const CancellationToken *cancellation_token = nullptr;
+  if (auto *cancellation_pass =
+          getAnalysisIfAvailable<CancellationTokenPass>()) {
+    cancellation_token = cancellation_pass->GetCancellationToken();
+  }
+  auto constraints = std::make_unique<ReturnConstraints>();
+  constraints->Compute(module,
+                       &getAnalysis<ReturnPropagationPass>().GetResult(),
+                       cancellation_token);
+  result_ = constraints.get();
+  owned_result_ = std::move(constraints);
+
+  return false;
+}
+
+void ReturnConstraints::Compute(const llvm::Module &module,
+                                const ReturnPropagation *return_propagation,
+                                const CancellationToken *cancellation_token) {
+  return_propagation_ = return_propagation;
+  function_ids_ = std::make_shared<const FunctionIds>(module);
+
   std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &fn : module) {
     module_functions.push_back(&fn);
   }
 
-  // Initialize program points to empty ReturnConstraintsFact.
-  // Creates a new fact at every program point.
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          for (const auto &basic_block : *function) {
-            std::shared_ptr<ReturnConstraintsFact> prev =
-                std::make_shared<ReturnConstraintsFact>();
-            for (auto &inst : basic_block) {
-              input_facts_[&inst] = prev;
-              output_facts_[&inst] = std::make_shared<ReturnConstraintsFact>();
-              prev = output_facts_[&inst];
-            }
-          }
-        }
-      });
+  // Creates a new fact at every program point, or at the block boundaries.
+  InitializeFactTables(module, storage_, &input_facts_, &output_facts_);
 
   tbb::parallel_for(
       tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
           module_functions.begin(), module_functions.end()),
       [&](auto thread_functions) {
         for (const auto *function : thread_functions) {
+          if (IsCancelled(cancellation_token)) return;
           this->RunOnFunction(*function);
         }
       });
-
-  return false;
+  return_propagation_ = nullptr;
+  if (!IsCancelled(cancellation_token)) {
+    storage_stats_ = CountFacts(module, input_facts_, output_facts_);
+    ReportFactStorage("ReturnConstraints", storage_stats_);
+  }
 }
 
-void ReturnConstraintsPass::RunOnFunction(const llvm::Function &F) {
-  std::string fname = F.getName().str();
+void ReturnConstraints::RunOnFunction(const llvm::Function &F) {
+  DataflowSolver<ReturnConstraintsFact, DataflowDirection::kForward,
+                 ReturnConstraints>
+      solver(this);
+  solver_counters_.Add(solver.Solve(F));
+}
 
-  bool changed = true;
-  while (changed) {
-    changed = false;
+ReturnConstraintsFact &ReturnConstraints::GetOutgoingFact(
+    const llvm::BasicBlock &BB) {
+  return *output_facts_.GetExit(BB);
+}
 
-    for (auto bi = F.begin(), be = F.end(); bi != be; ++bi) {
-      const llvm::BasicBlock *BB = &*bi;
-      const llvm::Instruction *succ_begin = &*(BB->begin());
-      auto succ_fact = input_facts_.at(succ_begin);
+void ReturnConstraints::JoinIncomingFacts(const llvm::BasicBlock &BB) {
+  ReturnConstraintsFact &succ_fact = *input_facts_.GetEntry(BB);
 
-      // Go over predecessor blocks and apply join
-      for (auto pi = llvm::pred_begin(BB), pe = llvm::pred_end(BB); pi != pe;
-           ++pi) {
-        const llvm::Instruction *pred_term = (*pi)->getTerminator();
-        auto pred_fact = output_facts_.at(pred_term);
-        succ_fact->Join(*pred_fact);
-      }
+  // Go over predecessor blocks and apply join
+  for (auto pi = llvm::pred_begin(&BB), pe = llvm::pred_end(&BB); pi != pe;
+       ++pi) {
+    succ_fact.Join(*output_facts_.GetExit(**pi));
+  }
+}
 
-      changed = VisitBlock(*BB) || changed;
+bool ReturnConstraints::VisitBlock(const llvm::BasicBlock &BB) {
+  bool changed_successors = false;
+  if (storage_ == FactStorage::kBlockBoundaries) {
+    // Only the fact at the exit of the block is kept.
+    std::shared_ptr<ReturnConstraintsFact> exit_fact =
+        output_facts_.GetExit(BB);
+    std::shared_ptr<const ReturnConstraintsFact> input_fact =
+        input_facts_.GetEntry(BB);
+    for (const llvm::Instruction &I : BB) {
+      std::shared_ptr<ReturnConstraintsFact> output_fact =
+          &I == &BB.back() ? exit_fact
+                           : std::make_shared<ReturnConstraintsFact>();
+      changed_successors |= VisitInstruction(I, input_fact, output_fact);
+      input_fact = output_fact;
     }
+
+    return changed_successors;
   }
-  return;
+
+  const std::shared_ptr<ReturnConstraintsFact> *input_facts =
+      input_facts_.GetBlockFacts(BB);
+  const std::shared_ptr<ReturnConstraintsFact> *output_facts =
+      output_facts_.GetBlockFacts(BB);
+  size_t index = 0;
+  for (const llvm::Instruction &I : BB) {
+    changed_successors |=
+        VisitInstruction(I, input_facts[index], output_facts[index]);
+    index++;
+  }
+
+  return changed_successors;
 }
 
-bool ReturnConstraintsPass::VisitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
-  for (auto ii = BB.begin(), ie = BB.end(); ii != ie; ++ii) {
-    const llvm::Instruction &I = *ii;
-
-    std::shared_ptr<ReturnConstraintsFact> input_fact = input_facts_.at(&I);
-    std::shared_ptr<ReturnConstraintsFact> output_fact = output_facts_.at(&I);
-
-    ReturnConstraintsFact prev_fact = *output_fact;
-    if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
-      VisitCallInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BranchInst *inst =
-                   llvm::dyn_cast<llvm::BranchInst>(&I)) {
-      VisitBranchInst(*inst, input_fact, output_fact);
-    } else if (const llvm::SwitchInst *inst =
-                   llvm::dyn_cast<llvm::SwitchInst>(&I)) {
-      VisitSwitchInst(*inst, input_fact, output_fact);
-    } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
-      VisitPHINode(*inst, input_fact, output_fact);
-    } else {
-      // Default is to just copy facts from previous instruction unchanged.
-      output_fact->value = input_fact->value;
-    }
-    changed = changed || (*(output_fact) != prev_fact);
+bool ReturnConstraints::VisitInstruction(
+    const llvm::Instruction &I, std::shared_ptr<const ReturnConstraintsFact> in,
+    std::shared_ptr<ReturnConstraintsFact> out) {
+  if (const llvm::BranchInst *inst = llvm::dyn_cast<llvm::BranchInst>(&I)) {
+    return VisitBranchInst(*inst, in, out);
+  } else if (const llvm::SwitchInst *inst =
+                 llvm::dyn_cast<llvm::SwitchInst>(&I)) {
+    return VisitSwitchInst(*inst, in, out);
   }
 
-  return changed;
+  TransferInstruction(I, in, out);
+  return false;
 }
 
-void ReturnConstraintsPass::VisitCallInst(
+void ReturnConstraints::TransferInstruction(
+    const llvm::Instruction &I, std::shared_ptr<const ReturnConstraintsFact> in,
+    std::shared_ptr<ReturnConstraintsFact> out) const {
+  if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
+    VisitCallInst(*inst, in, out);
+  } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
+    VisitPHINode(*inst, in, out);
+  } else {
+    // Default is to just copy facts from previous instruction unchanged.
+    out->value = in->value;
+  }
+}
+
+void ReturnConstraints::VisitCallInst(
     const llvm::CallInst &I, std::shared_ptr<const ReturnConstraintsFact> in,
-    std::shared_ptr<ReturnConstraintsFact> out) {
+    std::shared_ptr<ReturnConstraintsFact> out) const {
   out->value = in->value;
-  std::unordered_set<const llvm::Value *> gen_value({&I});
 
-  std::string callee_name = GetCallee(I).source_name();
+  const FunctionId callee_id = function_ids_->GetCalleeId(I);
 
-  Constraint c(callee_name);
+  Constraint c(callee_id);
   c.lattice_element = SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
 
-  out->value[callee_name] = c;
+  out->value.Set(callee_id, c);
 }
 
 const std::map<SignLatticeElement, SignLatticeElement>
-    ReturnConstraintsPass::unsigned_replacement({
+    ReturnConstraints::unsigned_replacement({
         {SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO,
          SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM},
         {SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO,
@@ -137,7 +206,7 @@ const std::map<SignLatticeElement, SignLatticeElement>
 
 const std::map<std::pair<llvm::ICmpInst::Predicate, SignLatticeElement>,
                std::pair<SignLatticeElement, SignLatticeElement>>
-    ReturnConstraintsPass::predicate_complement({
+    ReturnConstraints::predicate_complement({
         // (<, 0)  -->  (<0, >=0)
         {std::make_pair(llvm::ICmpInst::Predicate::ICMP_SLT,
                         SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO),
@@ -256,7 +325,7 @@ const std::map<std::pair<llvm::ICmpInst::Predicate, SignLatticeElement>,
     });
 
 std::pair<SignLatticeElement, SignLatticeElement>
-ReturnConstraintsPass::AbstractICmp(const llvm::ICmpInst &I) {
+ReturnConstraints::AbstractICmp(const llvm::ICmpInst &I) {
   SignLatticeElement true_element =
       SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
   SignLatticeElement false_element =
@@ -314,13 +383,14 @@ ReturnConstraintsPass::AbstractICmp(const llvm::ICmpInst &I) {
   return result;
 }
 
-void ReturnConstraintsPass::VisitSwitchInst(
+bool ReturnConstraints::VisitSwitchInst(
     const llvm::SwitchInst &I, std::shared_ptr<const ReturnConstraintsFact> in,
     std::shared_ptr<ReturnConstraintsFact> out) {
   out->value = in->value;
 
+  bool changed_successors = false;
   llvm::Value *condition = I.getCondition();
-  if (!condition) return;
+  if (!condition) return changed_successors;
 
   // Go through the non-default cases. Everything else is handled similarily
   // to VisitBranchInst, except we do not deal with true/false successors,
@@ -340,32 +410,29 @@ void ReturnConstraintsPass::VisitSwitchInst(
             SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO;
       }
     } else {
-      return;
+      return changed_successors;
     }
 
     // Get the set of function whose values reach either the condition or the
     // case from return-propagation.
-    ReturnPropagationPass *return_propagation =
-        &getAnalysis<ReturnPropagationPass>();
+    const ReturnPropagation *return_propagation = return_propagation_;
     const llvm::Value *value_reaching_case;
-    if (return_propagation->output_facts_.find(case_value) !=
-        return_propagation->output_facts_.end()) {
+    if (return_propagation->HasFacts(case_value)) {
       value_reaching_case = case_value;
-    } else if (return_propagation->output_facts_.find(condition) !=
-               return_propagation->output_facts_.end()) {
+    } else if (return_propagation->HasFacts(condition)) {
       value_reaching_case = condition;
     } else {
-      return;
+      return changed_successors;
     }
 
     // The first element of this pair is the llvm value being tested
     // The second element is the set of functions which the key value may hold.
-    auto fact = return_propagation->output_facts_.at(value_reaching_case);
-    std::unordered_set<const llvm::Value *> test_ret_values;
-    for (auto element : fact->value) {
-      if (element.first == value_reaching_case) {
-        test_ret_values = element.second;
-      }
+    const ReturnPropagationFact fact =
+        return_propagation->GetOutFact(value_reaching_case);
+    ReturnPropagationFact::ValueSet test_ret_values;
+    auto fact_it = fact.value.find(value_reaching_case);
+    if (fact_it != fact.value.end()) {
+      test_ret_values = fact_it->second;
     }
 
     const llvm::BasicBlock *case_bb = case_entry.getCaseSuccessor();
@@ -373,61 +440,63 @@ void ReturnConstraintsPass::VisitSwitchInst(
     for (const llvm::Value *v : test_ret_values) {
       if (!llvm::isa<llvm::CallInst>(v)) continue;
 
-      // Get the function name associated with v.
+      // Get the function associated with v.
       const llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(v);
-      std::string fname = GetCallee(*call).source_name();
+      const FunctionId function_id = function_ids_->GetCalleeId(*call);
 
       // Kill the constraints for functions being tested.
       // This prevents predecessor join from setting everything to top,
       // splitting constraint lattice_element at branches. This allows different
       // constraints to be associated with different successor blocks (different
       // edges).
-      Constraint kill_constraint(fname);
+      Constraint kill_constraint(function_id);
       kill_constraint.lattice_element =
           SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-      out->value[fname] = kill_constraint;
+      out->value.Set(function_id, kill_constraint);
 
-      Constraint case_c(fname);
+      Constraint case_c(function_id);
       case_c.lattice_element = case_abstract_value;
 
-      // Insert fname's constraint into the temporary case fact. We use
-      // the input fact because we killed fname's entry in the output fact.
+      // Insert the function's constraint into the temporary case fact. We
+      // use the input fact because we killed the function's entry in the
+      // output fact.
       ReturnConstraintsFact case_fact;
-      auto it = in->value.find(fname);
+      auto it = in->value.find(function_id);
       if (it != in->value.end()) {
-        // fname has a pre-existing constraint
-        case_fact.value[fname] = case_c.Meet(it->second);
+        // The function has a pre-existing constraint
+        case_fact.value.Set(function_id, case_c.Meet(it->second));
       } else {
-        case_fact.value[fname] = case_c;
+        case_fact.value.Set(function_id, case_c);
       }
 
-      // We perform a join here to simulate predecessor join for fname.  The
-      // original predecessor join in RunOnFunction won't work on fname because
-      // we killed fname's entry in the out fact.
-      auto existing_case_fact = input_facts_.at(case_bb_first);
-      existing_case_fact->Join(case_fact);
+      // We perform a join here to simulate predecessor join for the
+      // function.  The original predecessor join in RunOnFunction won't work
+      // on it because we killed the function's entry in the out fact.
+      auto existing_case_fact = input_facts_.Get(case_bb_first);
+      changed_successors |= existing_case_fact->Join(case_fact);
     }
   }
+
+  return changed_successors;
 }
 
-void ReturnConstraintsPass::VisitBranchInst(
+bool ReturnConstraints::VisitBranchInst(
     const llvm::BranchInst &I, std::shared_ptr<const ReturnConstraintsFact> in,
     std::shared_ptr<ReturnConstraintsFact> out) {
   out->value = in->value;
 
   if (I.isUnconditional()) {
-    return;
+    return false;
   }
   llvm::Value *condition = I.getOperand(0);
   assert(condition);
 
   llvm::ICmpInst *icmp = llvm::dyn_cast<llvm::ICmpInst>(condition);
   if (!icmp) {
-    return;
+    return false;
   }
 
-  ReturnPropagationPass *return_propagation =
-      &getAnalysis<ReturnPropagationPass>();
+  const ReturnPropagation *return_propagation = return_propagation_;
 
   llvm::BasicBlock *true_bb = llvm::dyn_cast<llvm::BasicBlock>(I.getOperand(2));
   assert(true_bb);
@@ -440,99 +509,176 @@ void ReturnConstraintsPass::VisitBranchInst(
   // Get the set of function whose values reach icmp operand from
   // return-propagation.
   llvm::Value *icmp_value = nullptr;
-  if (return_propagation->output_facts_.find(icmp->getOperand(0)) !=
-      return_propagation->output_facts_.end()) {
+  if (return_propagation->HasFacts(icmp->getOperand(0))) {
     icmp_value = icmp->getOperand(0);
-  } else if (return_propagation->output_facts_.find(icmp->getOperand(1)) !=
-             return_propagation->output_facts_.end()) {
+  } else if (return_propagation->HasFacts(icmp->getOperand(1))) {
     icmp_value = icmp->getOperand(1);
   } else {
-    return;
+    return false;
   }
 
-  auto fact = return_propagation->output_facts_.at(icmp_value);
+  const ReturnPropagationFact fact =
+      return_propagation->GetOutFact(icmp_value);
 
   // The first element of this pair is the llvm value being tested
   // The second element is the set of functions which the key value may hold.
-  std::unordered_set<const llvm::Value *> test_ret_values;
-  for (auto element : fact->value) {
-    if (element.first == icmp_value) {
-      test_ret_values = element.second;
-    }
+  ReturnPropagationFact::ValueSet test_ret_values;
+  auto fact_it = fact.value.find(icmp_value);
+  if (fact_it != fact.value.end()) {
+    test_ret_values = fact_it->second;
   }
 
+  bool changed_successors = false;
   for (const llvm::Value *v : test_ret_values) {
     ReturnConstraintsFact true_fact;
     ReturnConstraintsFact false_fact;
 
     if (!llvm::isa<llvm::CallInst>(v)) continue;
 
-    // Get the function name associated with v.
+    // Get the function associated with v.
     const llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(v);
-    std::string fname = GetCallee(*call).source_name();
+    const FunctionId function_id = function_ids_->GetCalleeId(*call);
 
     // Kill the constraints for functions being tested.
     // This prevents predecessor join from setting everything to top,
     // splitting constraint lattice_element at branches. This allows different
     // constraints to be associated with different successor blocks (different
     // edges).
-    Constraint kill_constraint(fname);
+    Constraint kill_constraint(function_id);
     kill_constraint.lattice_element =
         SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-    out->value[fname] = kill_constraint;
+    out->value.Set(function_id, kill_constraint);
 
-    Constraint true_c(fname);
+    Constraint true_c(function_id);
     true_c.lattice_element = true_abstract_value;
-    Constraint false_c(fname);
+    Constraint false_c(function_id);
     false_c.lattice_element = false_abstract_value;
 
-    // Insert fname's constraint into the temporary true/false facts.  We use
-    // the input fact because we killed fname's entry in the output fact.
-    auto it = in->value.find(fname);
+    // Insert the function's constraint into the temporary true/false facts.
+    // We use the input fact because we killed the function's entry in the
+    // output fact.
+    auto it = in->value.find(function_id);
     if (it != in->value.end()) {
-      // fname has a pre-existing constraint
-      true_fact.value[fname] = true_c.Meet(it->second);
-      false_fact.value[fname] = false_c.Meet(it->second);
+      // The function has a pre-existing constraint
+      true_fact.value.Set(function_id, true_c.Meet(it->second));
+      false_fact.value.Set(function_id, false_c.Meet(it->second));
     } else {
-      true_fact.value[fname] = true_c;
-      false_fact.value[fname] = false_c;
+      true_fact.value.Set(function_id, true_c);
+      false_fact.value.Set(function_id, false_c);
     }
 
-    // We perform a join here to simulate predecessor join for fname.  The
-    // original predecessor join in RunOnFunction won't work on fname because we
-    // killed fname's entry in the out fact.
+    // We perform a join here to simulate predecessor join for the function.
+    // The original predecessor join in RunOnFunction won't work on it because
+    // we killed the function's entry in the out fact.
     const llvm::Instruction *true_first = GetFirstInstructionOfBB(true_bb);
-    auto existing_true_fact = input_facts_.at(true_first);
-    existing_true_fact->Join(true_fact);
+    auto existing_true_fact = input_facts_.Get(true_first);
+    changed_successors |= existing_true_fact->Join(true_fact);
 
     const llvm::Instruction *false_first = GetFirstInstructionOfBB(false_bb);
-    auto existing_false_fact = input_facts_.at(false_first);
-    existing_false_fact->Join(false_fact);
+    auto existing_false_fact = input_facts_.Get(false_first);
+    changed_successors |= existing_false_fact->Join(false_fact);
   }
+
+  return changed_successors;
 }
 
 // If the PHI result can be returned, then add incoming values
 // to the exit of each incoming basic block.
-void ReturnConstraintsPass::VisitPHINode(
+void ReturnConstraints::VisitPHINode(
     const llvm::PHINode &I, std::shared_ptr<const ReturnConstraintsFact> in,
-    std::shared_ptr<ReturnConstraintsFact> out) {
+    std::shared_ptr<ReturnConstraintsFact> out) const {
   out->value = in->value;
 }
 
-ReturnConstraintsFact ReturnConstraintsPass::GetInFact(
+ReturnConstraintsFact ReturnConstraints::GetInFact(
     const llvm::Value *v) const {
-  return *(input_facts_.at(v));
+  const auto *inst = llvm::cast<llvm::Instruction>(v);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.front()) {
+    return *(input_facts_.Get(inst));
+  }
+
+  return std::move(*ReplayBlock(block, inst->getPrevNode()).back());
 }
 
-ReturnConstraintsFact ReturnConstraintsPass::GetOutFact(
+ReturnConstraintsFact ReturnConstraints::GetOutFact(
     const llvm::Value *v) const {
-  return *(output_facts_.at(v));
+  const auto *inst = llvm::cast<llvm::Instruction>(v);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.back()) {
+    return *(output_facts_.Get(inst));
+  }
+
+  return std::move(*ReplayBlock(block, inst).back());
 }
 
-std::set<SignLatticeElement> ReturnConstraintsPass::GetConstraints(
+std::vector<ReturnConstraintsFact> ReturnConstraints::GetBlockInFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnConstraintsFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*input_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  facts.push_back(*input_facts_.GetEntry(block));
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.back().getPrevNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+
+  return facts;
+}
+
+std::vector<ReturnConstraintsFact> ReturnConstraints::GetBlockOutFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnConstraintsFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*output_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.back().getPrevNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+  facts.push_back(*output_facts_.GetExit(block));
+
+  return facts;
+}
+
+std::vector<std::shared_ptr<ReturnConstraintsFact>>
+ReturnConstraints::ReplayBlock(const llvm::BasicBlock &block,
+                               const llvm::Instruction *last) const {
+  std::vector<std::shared_ptr<ReturnConstraintsFact>> facts;
+  std::shared_ptr<const ReturnConstraintsFact> input_fact =
+      input_facts_.GetEntry(block);
+  for (const llvm::Instruction &I : block) {
+    facts.push_back(std::make_shared<ReturnConstraintsFact>());
+    TransferInstruction(I, input_fact, facts.back());
+    if (&I == last) {
+      break;
+    }
+    input_fact = facts.back();
+  }
+
+  return facts;
+}
+
+std::set<SignLatticeElement> ReturnConstraints::GetConstraints(
     llvm::Module &module, const std::string &parent_function,
-    const Function &called_function) {
+    const Function &called_function) const {
   std::set<SignLatticeElement> ret;
+  FunctionId called_function_id;
+  if (!function_ids_->Find(called_function.source_name(),
+                           &called_function_id)) {
+    return ret;
+  }
 
   for (auto &function : module) {
     if (function.getName() != parent_function) {
@@ -541,11 +687,10 @@ std::set<SignLatticeElement> ReturnConstraintsPass::GetConstraints(
 
     for (auto &basic_block : function) {
       const llvm::Instruction *inst = GetFirstInstructionOfBB(&basic_block);
-      auto return_constraints_fact = input_facts_.at(inst);
-      for (const auto &kv : return_constraints_fact->value) {
-        if (kv.first == called_function.source_name()) {
-          ret.insert(kv.second.lattice_element);
-        }
+      auto return_constraints_fact = input_facts_.Get(inst);
+      auto it = return_constraints_fact->value.find(called_function_id);
+      if (it != return_constraints_fact->value.end()) {
+        ret.insert(it->second.lattice_element);
       }
     }
   }
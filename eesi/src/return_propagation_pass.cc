@@ -4,6 +4,8 @@
 #include <memory>
 #include <string>
 
+#include "dataflow_analyses.h"
+#include "fact_cache.h"
 #include "glog/logging.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/AliasSetTracker.h"
@@ -14,208 +16,333 @@
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include "progress.h"
 
 namespace error_specifications {
 
+llvm::AnalysisKey ReturnPropagationAnalysis::Key;
+
+ReturnPropagationAnalysis::Result ReturnPropagationAnalysis::run(
+    llvm::Module &module, llvm::ModuleAnalysisManager &analysis_manager) {
+  auto result = std::make_unique<ReturnPropagation>();
+  if (fact_cache_ &&
+      fact_cache_->LoadReturnPropagation(bitcode_id_, module, result.get())) {
+    return result;
+  }
+
+  result->Compute(module, cancellation_token_);
+  if (fact_cache_ && !IsCancelled(cancellation_token_)) {
+    fact_cache_->StoreReturnPropagation(bitcode_id_, module, *result);
+  }
+
+  return result;
+}
+
 bool ReturnPropagationPass::runOnModule(llvm::Module &module) {
-  if (finished) return false;
+  PassTimer pass_timer(this, "ReturnPropagationPass");
+
+  if (auto *analysis_manager_pass =
+          getAnalysisIfAvailable<AnalysisManagerPass>()) {
+    result_ = analysis_manager_pass->GetAnalysisManager()
+                  ->getResult<ReturnPropagationAnalysis>(module)
+                  .get();
+    return false;
+  }
+
+  const CancellationToken *cancellation_token = nullptr;
+  if (auto *cancellation_pass =
+          getAnalysisIfAvailable<CancellationTokenPass>()) {
+    cancellation_token = cancellation_pass->GetCancellationToken();
+  }
+  auto result = std::make_unique<ReturnPropagation>();
+  result->Compute(module, cancellation_token);
+  result_ = result.get();
+  owned_result_ = std::move(result);
+
+  return false;
+}
+
+void ReturnPropagation::Compute(const llvm::Module &module,
+                                const CancellationToken *cancellation_token) {
+  // Creates a new fact at every program point, or at the block boundaries.
+  InitializeFactTables(module, storage_, &input_facts_, &output_facts_);
 
   std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &fn : module) {
     module_functions.push_back(&fn);
   }
 
-  // Initialize program points to empty ReturnConstraintsFact.
-  // Creates a new fact at every program point.
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          for (const auto &basic_block : *function) {
-            std::shared_ptr<ReturnPropagationFact> prev =
-                std::make_shared<ReturnPropagationFact>();
-            for (auto &inst : basic_block) {
-              input_facts_[&inst] = prev;
-              output_facts_[&inst] = std::make_shared<ReturnPropagationFact>();
-              prev = output_facts_[&inst];
-            }
-          }
-        }
-      });
-
   tbb::parallel_for(
       tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
           module_functions.begin(), module_functions.end()),
       [&](auto thread_functions) {
         for (const auto *function : thread_functions) {
+          if (IsCancelled(cancellation_token)) return;
           this->RunOnFunction(*function);
         }
       });
+  if (!IsCancelled(cancellation_token)) {
+    storage_stats_ = CountFacts(module, input_facts_, output_facts_);
+    ReportFactStorage("ReturnPropagation", storage_stats_);
+  }
+}
 
-  finished = true;
+void ReturnPropagation::RunOnFunction(const llvm::Function &F) {
+  DataflowSolver<ReturnPropagationFact, DataflowDirection::kForward,
+                 ReturnPropagation>
+      solver(this);
+  solver_counters_.Add(solver.Solve(F));
+}
 
-  return false;
+ReturnPropagationFact &ReturnPropagation::GetOutgoingFact(
+    const llvm::BasicBlock &BB) {
+  return *output_facts_.GetExit(BB);
 }
 
-bool ReturnPropagationPass::RunOnFunction(const llvm::Function &F) {
-  std::string fname = F.getName().str();
+void ReturnPropagation::JoinIncomingFacts(const llvm::BasicBlock &BB) {
+  ReturnPropagationFact &succ_fact = *input_facts_.GetEntry(BB);
 
-  bool changed = true;
-  while (changed) {
-    changed = false;
+  // Go over predecessor blocks and apply join.
+  for (auto pi = pred_begin(&BB), pe = pred_end(&BB); pi != pe; ++pi) {
+    succ_fact.Join(*output_facts_.GetExit(**pi));
+  }
+}
 
-    for (auto bi = F.begin(), be = F.end(); bi != be; ++bi) {
-      const llvm::BasicBlock *BB = &*bi;
-      const llvm::Instruction *succ_begin = &*(BB->begin());
-      auto succ_fact = input_facts_.at(succ_begin);
+bool ReturnPropagation::VisitBlock(const llvm::BasicBlock &BB) {
+  if (storage_ == FactStorage::kBlockBoundaries) {
+    // Only the fact at the exit of the block is kept.
+    std::shared_ptr<ReturnPropagationFact> exit_fact =
+        output_facts_.GetExit(BB);
+    std::shared_ptr<const ReturnPropagationFact> input_fact =
+        input_facts_.GetEntry(BB);
+    for (const llvm::Instruction &I : BB) {
+      std::shared_ptr<ReturnPropagationFact> output_fact =
+          &I == &BB.back() ? exit_fact
+                           : std::make_shared<ReturnPropagationFact>();
+      VisitInstruction(I, input_fact, output_fact);
+      input_fact = output_fact;
+    }
 
-      // Go over predecessor blocks and apply join.
-      for (auto pi = pred_begin(BB), pe = pred_end(BB); pi != pe; ++pi) {
-        const llvm::Instruction *pred_term = (*pi)->getTerminator();
-        auto pred_fact = output_facts_.at(pred_term);
-        succ_fact->Join(*pred_fact);
-      }
+    return false;
+  }
 
-      changed = VisitBlock(*BB) || changed;
-    }
+  const std::shared_ptr<ReturnPropagationFact> *input_facts =
+      input_facts_.GetBlockFacts(BB);
+  const std::shared_ptr<ReturnPropagationFact> *output_facts =
+      output_facts_.GetBlockFacts(BB);
+  size_t index = 0;
+  for (const llvm::Instruction &I : BB) {
+    VisitInstruction(I, input_facts[index], output_facts[index]);
+    index++;
   }
 
   return false;
 }
 
-bool ReturnPropagationPass::VisitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
-  for (auto ii = BB.begin(), ie = BB.end(); ii != ie; ++ii) {
-    const llvm::Instruction &I = *ii;
-
-    std::shared_ptr<ReturnPropagationFact> input_fact = input_facts_.at(&I);
-    std::shared_ptr<ReturnPropagationFact> output_fact = output_facts_.at(&I);
-    ReturnPropagationFact prev_fact = *output_fact;
-
-    if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
-      VisitCallInst(*inst, input_fact, output_fact);
-    } else if (const llvm::LoadInst *inst =
-                   llvm::dyn_cast<llvm::LoadInst>(&I)) {
-      VisitLoadInst(*inst, input_fact, output_fact);
-    } else if (const llvm::StoreInst *inst =
-                   llvm::dyn_cast<llvm::StoreInst>(&I)) {
-      VisitStoreInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BitCastInst *inst =
-                   llvm::dyn_cast<llvm::BitCastInst>(&I)) {
-      VisitBitCastInst(*inst, input_fact, output_fact);
-    } else if (const llvm::PtrToIntInst *inst =
-                   llvm::dyn_cast<llvm::PtrToIntInst>(&I)) {
-      VisitPtrToIntInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BinaryOperator *inst =
-                   llvm::dyn_cast<llvm::BinaryOperator>(&I)) {
-      VisitBinaryOperator(*inst, input_fact, output_fact);
-    } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
-      VisitPHINode(*inst, input_fact, output_fact);
-    } else {
-      // Default is to just copy facts from previous instruction unchanged.
-      output_fact->value = input_fact->value;
-    }
-
-    changed = changed || (*output_fact != prev_fact);
+void ReturnPropagation::VisitInstruction(
+    const llvm::Instruction &I, std::shared_ptr<const ReturnPropagationFact> in,
+    std::shared_ptr<ReturnPropagationFact> out) const {
+  if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
+    VisitCallInst(*inst, in, out);
+  } else if (const llvm::LoadInst *inst = llvm::dyn_cast<llvm::LoadInst>(&I)) {
+    VisitLoadInst(*inst, in, out);
+  } else if (const llvm::StoreInst *inst =
+                 llvm::dyn_cast<llvm::StoreInst>(&I)) {
+    VisitStoreInst(*inst, in, out);
+  } else if (const llvm::BitCastInst *inst =
+                 llvm::dyn_cast<llvm::BitCastInst>(&I)) {
+    VisitBitCastInst(*inst, in, out);
+  } else if (const llvm::PtrToIntInst *inst =
+                 llvm::dyn_cast<llvm::PtrToIntInst>(&I)) {
+    VisitPtrToIntInst(*inst, in, out);
+  } else if (const llvm::BinaryOperator *inst =
+                 llvm::dyn_cast<llvm::BinaryOperator>(&I)) {
+    VisitBinaryOperator(*inst, in, out);
+  } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
+    VisitPHINode(*inst, in, out);
+  } else {
+    // Default is to just copy facts from previous instruction unchanged.
+    out->value = in->value;
   }
-
-  return changed;
 }
 
-void ReturnPropagationPass::VisitCallInst(
+void ReturnPropagation::VisitCallInst(
     const llvm::CallInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   out->value = in->value;
-
-  if (out->value.find(&I) == out->value.end()) {
-    out->value[&I] = std::unordered_set<const llvm::Value *>();
-  }
-  out->value.at(&I).insert(&I);
+  out->Add(&I, &I);
 }
 
 // Copy the return facts into a new value.
-void ReturnPropagationPass::VisitLoadInst(
+void ReturnPropagation::VisitLoadInst(
     const llvm::LoadInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   out->value = in->value;
   llvm::Value *load_from = I.getOperand(0);
 
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  auto load_it = in->value.find(load_from);
+  if (load_it != in->value.end()) {
+    out->value.Set(&I, load_it->second);
   }
 }
 
 // Copy the return facts into a new value.
-void ReturnPropagationPass::VisitStoreInst(
+void ReturnPropagation::VisitStoreInst(
     const llvm::StoreInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   llvm::Value *sender = I.getOperand(0);
   llvm::Value *receiver = I.getOperand(1);
 
   out->value = in->value;
 
   if (llvm::isa<llvm::ConstantInt>(sender)) {
-    if (out->value.find(receiver) == out->value.end()) {
-      out->value[receiver] = std::unordered_set<const llvm::Value *>();
-    }
-    out->value.at(receiver).insert(sender);
+    out->Add(receiver, sender);
   }
 
-  if (in->value.find(sender) != in->value.end()) {
-    out->value[receiver] = in->value.at(sender);
+  auto sender_it = in->value.find(sender);
+  if (sender_it != in->value.end()) {
+    out->value.Set(receiver, sender_it->second);
   }
 }
 
-void ReturnPropagationPass::VisitBitCastInst(
+void ReturnPropagation::VisitBitCastInst(
     const llvm::BitCastInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   // Identical to load.
   out->value = in->value;
   llvm::Value *load_from = I.getOperand(0);
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  auto load_it = in->value.find(load_from);
+  if (load_it != in->value.end()) {
+    out->value.Set(&I, load_it->second);
   }
 }
 
-void ReturnPropagationPass::VisitPtrToIntInst(
+void ReturnPropagation::VisitPtrToIntInst(
     const llvm::PtrToIntInst &I,
     std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   // Identical to load.
   out->value = in->value;
   llvm::Value *load_from = I.getOperand(0);
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  auto load_it = in->value.find(load_from);
+  if (load_it != in->value.end()) {
+    out->value.Set(&I, load_it->second);
   }
 }
 
-void ReturnPropagationPass::VisitBinaryOperator(
+void ReturnPropagation::VisitBinaryOperator(
     const llvm::BinaryOperator &I,
     std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   // Identical to load.
   out->value = in->value;
   llvm::Value *load_from = I.getOperand(0);
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  auto load_it = in->value.find(load_from);
+  if (load_it != in->value.end()) {
+    out->value.Set(&I, load_it->second);
   }
 }
 
-void ReturnPropagationPass::VisitPHINode(
+void ReturnPropagation::VisitPHINode(
     const llvm::PHINode &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+    std::shared_ptr<ReturnPropagationFact> out) const {
   // Union all of the sets together for phi incoming values.
   for (unsigned i = 0, e = I.getNumIncomingValues(); i != e; ++i) {
     llvm::Value *v = I.getIncomingValue(i);
-    if (in->value.find(v) != in->value.end()) {
-      for (const llvm::Value *from : in->value.at(v)) {
-        out->value[&I].insert(from);
+    auto incoming_it = in->value.find(v);
+    if (incoming_it != in->value.end()) {
+      for (const llvm::Value *from : incoming_it->second) {
+        out->Add(&I, from);
       }
     }
   }
 }
 
+bool ReturnPropagation::HasFacts(const llvm::Value *value) const {
+  const auto *inst = llvm::dyn_cast<llvm::Instruction>(value);
+  return inst && input_facts_.Has(&inst->getParent()->front());
+}
+
+ReturnPropagationFact ReturnPropagation::GetInFact(
+    const llvm::Value *value) const {
+  const auto *inst = llvm::cast<llvm::Instruction>(value);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.front()) {
+    return *input_facts_.Get(inst);
+  }
+
+  return std::move(*ReplayBlock(block, inst->getPrevNode()).back());
+}
+
+ReturnPropagationFact ReturnPropagation::GetOutFact(
+    const llvm::Value *value) const {
+  const auto *inst = llvm::cast<llvm::Instruction>(value);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.back()) {
+    return *output_facts_.Get(inst);
+  }
+
+  return std::move(*ReplayBlock(block, inst).back());
+}
+
+std::vector<ReturnPropagationFact> ReturnPropagation::GetBlockInFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnPropagationFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*input_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  facts.push_back(*input_facts_.GetEntry(block));
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.back().getPrevNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+
+  return facts;
+}
+
+std::vector<ReturnPropagationFact> ReturnPropagation::GetBlockOutFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnPropagationFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*output_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.back().getPrevNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+  facts.push_back(*output_facts_.GetExit(block));
+
+  return facts;
+}
+
+std::vector<std::shared_ptr<ReturnPropagationFact>>
+ReturnPropagation::ReplayBlock(const llvm::BasicBlock &block,
+                               const llvm::Instruction *last) const {
+  std::vector<std::shared_ptr<ReturnPropagationFact>> facts;
+  std::shared_ptr<const ReturnPropagationFact> input_fact =
+      input_facts_.GetEntry(block);
+  for (const llvm::Instruction &I : block) {
+    facts.push_back(std::make_shared<ReturnPropagationFact>());
+    VisitInstruction(I, input_fact, facts.back());
+    if (&I == last) {
+      break;
+    }
+    input_fact = facts.back();
+  }
+
+  return facts;
+}
+
 void ReturnPropagationPass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
   au.setPreservesAll();
 }
@@ -2,8 +2,10 @@
 
 #include "call_graph_underapproximation.h"
 #include "eesi_common.h"
+#include "glog/logging.h"
 #include "llvm/ADT/SCCIterator.h"
 #include "llvm/IR/CFG.h"
+#include "progress.h"
 #include "return_constraints_pass.h"
 #include "returned_values_pass.h"
 
@@ -26,16 +28,22 @@ bool ReturnRangeFact::operator!=(const ReturnRangeFact &other) const {
   return !(*this == other);
 }
 
-void ReturnRangeFact::Join(const ReturnRangeFact &other) {
+bool ReturnRangeFact::Join(const ReturnRangeFact &other) {
+  bool changed = false;
   for (const auto &kv : other.value) {
     auto it = this->value.find(kv.first);
 
     if (it != this->value.end()) {
-      it->second = SignLattice::Join(it->second, kv.second);
+      const SignLatticeElement joined =
+          SignLattice::Join(it->second, kv.second);
+      changed = changed || joined != it->second;
+      it->second = joined;
     } else {
       this->value[kv.first] = kv.second;
+      changed = true;
     }
   }
+  return changed;
 }
 
 void ReturnRangeFact::Meet(const ReturnRangeFact &other) {
@@ -76,26 +84,36 @@ bool ReturnRangeFact::Contains(const llvm::Value *v) const {
 }
 
 bool ReturnRangePass::runOnModule(llvm::Module &module) {
-  // Initialize program points to empty ReturnRangeFact.
-  // Creates a new fact at every relevant program point.
-  for (const llvm::Function &func : module) {
-    if (!ShouldIgnore(&func)) {
-      for (const llvm::BasicBlock &basic_block : func) {
-        std::shared_ptr<ReturnRangeFact> prev =
-            std::make_shared<ReturnRangeFact>();
-        for (const llvm::Instruction &inst : basic_block) {
-          input_facts_[&inst] = prev;
-          output_facts_[&inst] = std::make_shared<ReturnRangeFact>();
-          prev = output_facts_[&inst];
-        }
-      }
-    }
-  }
+  PassTimer pass_timer(this, "ReturnRangePass");
+  // Creates a new fact at every relevant program point, or at the block
+  // boundaries.
+  InitializeFactTables(
+      module, storage_,
+      [this](const llvm::Function &func) { return !ShouldIgnore(&func); },
+      &input_facts_, &output_facts_);
 
   llvm::CallGraph call_graph = CallGraphUnderapproximation(module);
 
+  ProgressReporter *progress = nullptr;
+  if (auto *progress_pass = getAnalysisIfAvailable<ProgressReporterPass>()) {
+    progress = progress_pass->GetProgressReporter();
+  }
+  const CancellationToken *cancellation_token = nullptr;
+  if (auto *cancellation_pass =
+          getAnalysisIfAvailable<CancellationTokenPass>()) {
+    cancellation_token = cancellation_pass->GetCancellationToken();
+  }
+  if (progress) {
+    progress->StartPass("ReturnRangePass", CountSccs(call_graph),
+                        CountDefinedFunctions(module));
+  }
+
   for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
        ++scc_it) {
+    if (IsCancelled(cancellation_token)) {
+      LOG(INFO) << "ReturnRangePass cancelled.";
+      return false;
+    }
     const bool has_loop = scc_it.hasLoop();
     bool changed;
 
@@ -109,42 +127,45 @@ bool ReturnRangePass::runOnModule(llvm::Module &module) {
               *func, SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
 
           RunOnFunction(*func);
+          if (progress) progress->FunctionAnalyzed();
 
           auto new_range = GetReturnRange(
               *func, SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
           changed = changed || orig_range != new_range;
         }
       }
-    } while (has_loop && changed);
+    } while (has_loop && changed && !IsCancelled(cancellation_token));
+
+    if (progress) progress->SccDone();
   }
+  storage_stats_ = CountFacts(module, input_facts_, output_facts_);
+  ReportFactStorage("ReturnRange", storage_stats_);
 
   return false;
 }
 
 void ReturnRangePass::RunOnFunction(const llvm::Function &func) {
-  bool changed;
-
-  do {
-    changed = false;
+  DataflowSolver<ReturnRangeFact, DataflowDirection::kForward, ReturnRangePass>
+      solver(this);
+  solver_counters_.Add(solver.Solve(func));
+}
 
-    for (const llvm::BasicBlock &BB : func) {
-      const llvm::Instruction *bb_first = GetFirstInstructionOfBB(&BB);
-      auto bb_first_fact = input_facts_.at(bb_first);
+ReturnRangeFact &ReturnRangePass::GetOutgoingFact(const llvm::BasicBlock &BB) {
+  return *output_facts_.GetExit(BB);
+}
 
-      const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-      const auto bb_first_rvf = returned_values_pass.GetInFact(bb_first);
+void ReturnRangePass::JoinIncomingFacts(const llvm::BasicBlock &BB) {
+  const llvm::Instruction *bb_first = GetFirstInstructionOfBB(&BB);
+  ReturnRangeFact &bb_first_fact = *input_facts_.GetEntry(BB);
 
-      // Predecessor join
-      for (auto pi = llvm::pred_begin(&BB), pe = llvm::pred_end(&BB); pi != pe;
-           ++pi) {
-        const llvm::Instruction *pred_last = GetLastInstructionOfBB(*pi);
-        auto &pred_last_fact = output_facts_.at(pred_last);
-        bb_first_fact->FilteredJoin(*pred_last_fact, bb_first_rvf);
-      }
+  const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
+  const auto bb_first_rvf = returned_values_pass.GetInFact(bb_first);
 
-      changed = VisitBlock(BB) || changed;
-    }
-  } while (changed);
+  // Predecessor join
+  for (auto pi = llvm::pred_begin(&BB), pe = llvm::pred_end(&BB); pi != pe;
+       ++pi) {
+    bb_first_fact.FilteredJoin(*output_facts_.GetExit(**pi), bb_first_rvf);
+  }
 }
 
 SignLatticeElement ReturnRangePass::GetReturnRange(
@@ -165,12 +186,83 @@ const std::unordered_map<const llvm::Function *, SignLatticeElement>
 
 ReturnRangeFact ReturnRangePass::GetInFact(
     const llvm::Instruction *inst) const {
-  return *input_facts_.at(inst);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.front()) {
+    return *input_facts_.Get(inst);
+  }
+
+  return std::move(*ReplayBlock(block, inst->getPrevNode()).back());
 }
 
 ReturnRangeFact ReturnRangePass::GetOutFact(
     const llvm::Instruction *inst) const {
-  return *output_facts_.at(inst);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.back()) {
+    return *output_facts_.Get(inst);
+  }
+
+  return std::move(*ReplayBlock(block, inst).back());
+}
+
+std::vector<ReturnRangeFact> ReturnRangePass::GetBlockInFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnRangeFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*input_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  facts.push_back(*input_facts_.GetEntry(block));
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.back().getPrevNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+
+  return facts;
+}
+
+std::vector<ReturnRangeFact> ReturnRangePass::GetBlockOutFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnRangeFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*output_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.back().getPrevNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+  facts.push_back(*output_facts_.GetExit(block));
+
+  return facts;
+}
+
+std::vector<std::shared_ptr<ReturnRangeFact>> ReturnRangePass::ReplayBlock(
+    const llvm::BasicBlock &block, const llvm::Instruction *last) const {
+  const std::vector<ReturnedValuesFact> out_rvfs =
+      getAnalysis<ReturnedValuesPass>().GetBlockOutFacts(block);
+
+  std::vector<std::shared_ptr<ReturnRangeFact>> facts;
+  std::shared_ptr<const ReturnRangeFact> in_fact =
+      input_facts_.GetEntry(block);
+  size_t index = 0;
+  for (const llvm::Instruction &inst : block) {
+    facts.push_back(std::make_shared<ReturnRangeFact>());
+    TransferInstruction(inst, *in_fact, *facts.back(), out_rvfs[index++]);
+    if (&inst == last) {
+      break;
+    }
+    in_fact = facts.back();
+  }
+
+  return facts;
 }
 
 void ReturnRangePass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
@@ -180,47 +272,82 @@ void ReturnRangePass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
 
 // Called for each basic block.
 bool ReturnRangePass::VisitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
+  const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
+  const std::vector<ReturnedValuesFact> out_rvfs =
+      returned_values_pass.GetBlockOutFacts(BB);
+
+  bool changed_successors = false;
+  if (storage_ == FactStorage::kBlockBoundaries) {
+    // Only the fact at the exit of the block is kept.
+    const auto &exit_fact = output_facts_.GetExit(BB);
+    std::shared_ptr<const ReturnRangeFact> in_fact = input_facts_.GetEntry(BB);
+    size_t index = 0;
+    for (const llvm::Instruction &inst : BB) {
+      std::shared_ptr<ReturnRangeFact> out_fact =
+          &inst == &BB.back() ? exit_fact : std::make_shared<ReturnRangeFact>();
+      changed_successors |=
+          VisitInstruction(inst, *in_fact, *out_fact, out_rvfs[index++]);
+      in_fact = out_fact;
+    }
 
+    return changed_successors;
+  }
+
+  const std::shared_ptr<ReturnRangeFact> *input_facts =
+      input_facts_.GetBlockFacts(BB);
+  const std::shared_ptr<ReturnRangeFact> *output_facts =
+      output_facts_.GetBlockFacts(BB);
+  size_t index = 0;
   for (const llvm::Instruction &inst : BB) {
-    const auto &in_fact = input_facts_.at(&inst);
-    const auto &out_fact = output_facts_.at(&inst);
-    const auto orig_out_fact = *out_fact;
-
-    const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-    const auto out_rvf = returned_values_pass.GetOutFact(&inst);
-
-    // Resolve final values
-    if (const auto *store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
-      VisitStoreInst(*store_inst, *in_fact, *out_fact, out_rvf);
-    } else if (llvm::isa<llvm::LoadInst>(&inst) ||
-               llvm::isa<llvm::BitCastInst>(&inst) ||
-               llvm::isa<llvm::PtrToIntInst>(&inst) ||
-               llvm::isa<llvm::TruncInst>(&inst) ||
-               llvm::isa<llvm::SExtInst>(&inst)) {
-      VisitLoadLikeInst(inst, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-      VisitPHINode(*phi, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *branch = llvm::dyn_cast<llvm::BranchInst>(&inst)) {
-      VisitBranchInst(*branch, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *sw = llvm::dyn_cast<llvm::SwitchInst>(&inst)) {
-      VisitSwitchInst(*sw, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *ret = llvm::dyn_cast<llvm::ReturnInst>(&inst)) {
-      VisitReturnInst(*ret, *in_fact);
-    } else {
-      out_fact->FilteredCopy(*in_fact, out_rvf);
-    }
+    changed_successors |=
+        VisitInstruction(inst, *input_facts[index], *output_facts[index],
+                         out_rvfs[index]);
+    index++;
+  }
+
+  return changed_successors;
+}
 
-    changed = changed || *out_fact != orig_out_fact;
+bool ReturnRangePass::VisitInstruction(const llvm::Instruction &inst,
+                                       const ReturnRangeFact &in,
+                                       ReturnRangeFact &out,
+                                       const ReturnedValuesFact &out_rvf) {
+  if (const auto *branch = llvm::dyn_cast<llvm::BranchInst>(&inst)) {
+    return VisitBranchInst(*branch, in, out, out_rvf);
+  } else if (const auto *sw = llvm::dyn_cast<llvm::SwitchInst>(&inst)) {
+    return VisitSwitchInst(*sw, in, out, out_rvf);
+  } else if (const auto *ret = llvm::dyn_cast<llvm::ReturnInst>(&inst)) {
+    VisitReturnInst(*ret, in);
+  } else {
+    TransferInstruction(inst, in, out, out_rvf);
   }
 
-  return changed;
+  return false;
+}
+
+void ReturnRangePass::TransferInstruction(
+    const llvm::Instruction &inst, const ReturnRangeFact &in,
+    ReturnRangeFact &out, const ReturnedValuesFact &out_rvf) const {
+  // Resolve final values
+  if (const auto *store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+    VisitStoreInst(*store_inst, in, out, out_rvf);
+  } else if (llvm::isa<llvm::LoadInst>(&inst) ||
+             llvm::isa<llvm::BitCastInst>(&inst) ||
+             llvm::isa<llvm::PtrToIntInst>(&inst) ||
+             llvm::isa<llvm::TruncInst>(&inst) ||
+             llvm::isa<llvm::SExtInst>(&inst)) {
+    VisitLoadLikeInst(inst, in, out, out_rvf);
+  } else if (const auto *phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+    VisitPHINode(*phi, in, out, out_rvf);
+  } else {
+    out.FilteredCopy(in, out_rvf);
+  }
 }
 
 void ReturnRangePass::VisitStoreInst(const llvm::StoreInst &I,
                                      const ReturnRangeFact &in,
                                      ReturnRangeFact &out,
-                                     const ReturnedValuesFact &out_rvf) {
+                                     const ReturnedValuesFact &out_rvf) const {
   const llvm::Value *stored = I.getOperand(0);
   const llvm::Value *target = I.getOperand(1);
 
@@ -237,10 +364,9 @@ void ReturnRangePass::VisitStoreInst(const llvm::StoreInst &I,
   }
 }
 
-void ReturnRangePass::VisitLoadLikeInst(const llvm::Instruction &I,
-                                        const ReturnRangeFact &in,
-                                        ReturnRangeFact &out,
-                                        const ReturnedValuesFact &out_rvf) {
+void ReturnRangePass::VisitLoadLikeInst(
+    const llvm::Instruction &I, const ReturnRangeFact &in,
+    ReturnRangeFact &out, const ReturnedValuesFact &out_rvf) const {
   const llvm::Value *loaded = I.getOperand(0);
 
   out.FilteredCopy(in, out_rvf);
@@ -259,7 +385,7 @@ void ReturnRangePass::VisitLoadLikeInst(const llvm::Instruction &I,
 void ReturnRangePass::VisitPHINode(const llvm::PHINode &I,
                                    const ReturnRangeFact &in,
                                    ReturnRangeFact &out,
-                                   const ReturnedValuesFact &out_rvf) {
+                                   const ReturnedValuesFact &out_rvf) const {
   out.FilteredCopy(in, out_rvf);
 
   if (!out_rvf.Contains(&I)) {  // result isn't returnable
@@ -278,20 +404,20 @@ void ReturnRangePass::VisitPHINode(const llvm::PHINode &I,
   }
 }
 
-void ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
+bool ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
                                       const ReturnRangeFact &in,
                                       ReturnRangeFact &out,
                                       const ReturnedValuesFact &out_rvf) {
   out.FilteredCopy(in, out_rvf);
 
   if (I.isUnconditional()) {
-    return;
+    return false;
   }
 
   const auto *cond = llvm::dyn_cast<llvm::ICmpInst>(I.getOperand(0));
 
   if (!cond) {
-    return;
+    return false;
   }
 
   const llvm::Value *checked_value;
@@ -300,7 +426,7 @@ void ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
             GetCheckedReturnValue(*cond, cond->getOperand(0), out_rvf)) &&
       !(checked_value =
             GetCheckedReturnValue(*cond, cond->getOperand(1), out_rvf))) {
-    return;
+    return false;
   }
 
   // Similar to ReturnConstraintsPass: A returned value is being checked, so we
@@ -310,40 +436,44 @@ void ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
 
   const auto *false_bb = llvm::dyn_cast<llvm::BasicBlock>(I.getOperand(1));
   const auto *false_bb_first = GetFirstInstructionOfBB(false_bb);
-  auto false_in_fact = input_facts_[false_bb_first];
+  auto false_in_fact = input_facts_.Get(false_bb_first);
   const auto false_rvf = returned_values_pass.GetInFact(false_bb_first);
 
   const auto *true_bb = llvm::dyn_cast<llvm::BasicBlock>(I.getOperand(2));
   const auto *true_bb_first = GetFirstInstructionOfBB(true_bb);
-  auto true_in_fact = input_facts_[true_bb_first];
+  auto true_in_fact = input_facts_.Get(true_bb_first);
   const auto true_rvf = returned_values_pass.GetInFact(true_bb_first);
 
   const auto abstracted_icmp = ReturnConstraintsPass::AbstractICmp(*cond);
 
   out.value.erase(checked_value);
 
+  bool changed_successors = false;
   if (true_rvf.Contains(checked_value)) {
     if (in.Contains(checked_value)) {
-      true_in_fact->Join(ReturnRangeFact(
+      changed_successors |= true_in_fact->Join(ReturnRangeFact(
           checked_value, SignLattice::Meet(in.value.at(checked_value),
                                            abstracted_icmp.first)));
     } else {
-      true_in_fact->Join(ReturnRangeFact(checked_value, abstracted_icmp.first));
+      changed_successors |= true_in_fact->Join(
+          ReturnRangeFact(checked_value, abstracted_icmp.first));
     }
   }
   if (false_rvf.Contains(checked_value)) {
     if (in.Contains(checked_value)) {
-      false_in_fact->Join(ReturnRangeFact(
+      changed_successors |= false_in_fact->Join(ReturnRangeFact(
           checked_value, SignLattice::Meet(in.value.at(checked_value),
                                            abstracted_icmp.second)));
     } else {
-      false_in_fact->Join(
+      changed_successors |= false_in_fact->Join(
           ReturnRangeFact(checked_value, abstracted_icmp.second));
     }
   }
+
+  return changed_successors;
 }
 
-void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
+bool ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
                                       const ReturnRangeFact &in,
                                       ReturnRangeFact &out,
                                       const ReturnedValuesFact &out_rvf) {
@@ -352,7 +482,7 @@ void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
   const llvm::Value *test_value = nullptr;
 
   if (!(test_value = GetCheckedReturnValue(I, I.getCondition(), out_rvf))) {
-    return;
+    return false;
   }
 
   // Like ReturnConstraintsPass, we kill the entry in the out fact and pass on
@@ -361,21 +491,22 @@ void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
 
   out.value.erase(test_value);
 
+  bool changed_successors = false;
   // Go through the non-default cases
   for (const auto &case_entry : I.cases()) {
     const llvm::ConstantInt *case_value = case_entry.getCaseValue();
     const llvm::BasicBlock *case_bb = case_entry.getCaseSuccessor();
     const llvm::Instruction *case_bb_first = GetFirstInstructionOfBB(case_bb);
     const auto case_rvf = returned_values_pass.GetInFact(case_bb_first);
-    auto &case_in_fact = input_facts_.at(case_bb_first);
+    auto &case_in_fact = input_facts_.Get(case_bb_first);
 
     if (case_rvf.Contains(test_value)) {
       if (in.Contains(test_value)) {
-        case_in_fact->Join(ReturnRangeFact(
+        changed_successors |= case_in_fact->Join(ReturnRangeFact(
             test_value, SignLattice::Meet(in.value.at(test_value),
                                           AbstractInteger(*case_value))));
       } else {
-        case_in_fact->Join(
+        changed_successors |= case_in_fact->Join(
             ReturnRangeFact(test_value, AbstractInteger(*case_value)));
       }
     }
@@ -387,9 +518,12 @@ void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
       GetFirstInstructionOfBB(default_bb);
   const auto default_rvf = returned_values_pass.GetInFact(default_bb_first);
   if (default_rvf.Contains(test_value) && in.Contains(test_value)) {
-    auto &default_in_fact = input_facts_.at(default_bb_first);
-    default_in_fact->Join(ReturnRangeFact(test_value, in.value.at(test_value)));
+    auto &default_in_fact = input_facts_.Get(default_bb_first);
+    changed_successors |= default_in_fact->Join(
+        ReturnRangeFact(test_value, in.value.at(test_value)));
   }
+
+  return changed_successors;
 }
 
 void ReturnRangePass::VisitReturnInst(const llvm::ReturnInst &I,
@@ -1,119 +1,147 @@
 #include "returned_values_pass.h"
 
+#include <algorithm>
 #include <string>
 
 #include "llvm/IR/CFG.h"
 
 #include "eesi_common.h"
 #include "llvm.h"
+#include "progress.h"
 
 namespace error_specifications {
 
 bool ReturnedValuesPass::runOnModule(llvm::Module &module) {
+  PassTimer pass_timer(this, "ReturnedValuesPass");
+  const CancellationToken *cancellation_token = nullptr;
+  if (auto *cancellation_pass =
+          getAnalysisIfAvailable<CancellationTokenPass>()) {
+    cancellation_token = cancellation_pass->GetCancellationToken();
+  }
+
   std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &fn : module) {
     module_functions.push_back(&fn);
   }
 
-  // Initialize program points to empty ReturnConstraintsFact.
-  // Creates a new fact at every program point.
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          for (const auto &basic_block : *function) {
-            std::shared_ptr<ReturnedValuesFact> prev =
-                std::make_shared<ReturnedValuesFact>();
-            for (auto &inst : basic_block) {
-              input_facts_[&inst] = prev;
-              output_facts_[&inst] = std::make_shared<ReturnedValuesFact>();
-              prev = output_facts_[&inst];
-            }
-          }
-        }
-      });
+  // Creates a new fact at every program point, or at the block boundaries.
+  InitializeFactTables(module, storage_, &input_facts_, &output_facts_);
 
   tbb::parallel_for(
       tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
           module_functions.begin(), module_functions.end()),
       [&](auto thread_functions) {
         for (const auto *function : thread_functions) {
+          if (IsCancelled(cancellation_token)) return;
           this->RunOnFunction(*function);
         }
       });
+  if (!IsCancelled(cancellation_token)) {
+    storage_stats_ = CountFacts(module, input_facts_, output_facts_);
+    ReportFactStorage("ReturnedValues", storage_stats_);
+  }
 
   return false;
 }
 
 void ReturnedValuesPass::RunOnFunction(const llvm::Function &F) {
-  std::string fname = F.getName().str();
+  DataflowSolver<ReturnedValuesFact, DataflowDirection::kBackward,
+                 ReturnedValuesPass>
+      solver(this);
+  solver_counters_.Add(solver.Solve(F));
+}
 
-  bool changed = true;
-  while (changed) {
-    changed = false;
-    for (auto bi = F.begin(), be = F.end(); bi != be; ++bi) {
-      const llvm::BasicBlock *BB = &*bi;
+ReturnedValuesFact &ReturnedValuesPass::GetOutgoingFact(
+    const llvm::BasicBlock &BB) {
+  return *input_facts_.GetEntry(BB);
+}
 
-      const llvm::Instruction *bb_last = GetLastInstructionOfBB(BB);
-      auto bb_out_fact = output_facts_.at(bb_last);
+void ReturnedValuesPass::JoinIncomingFacts(const llvm::BasicBlock &BB) {
+  ReturnedValuesFact &bb_out_fact = *output_facts_.GetExit(BB);
 
-      // Go over successor blocks and apply join.
-      for (auto si = succ_begin(BB), se = succ_end(BB); si != se; ++si) {
-        const llvm::Instruction *succ_first = &(*(si->begin()));
-        auto succ_fact = input_facts_.at(succ_first);
-        bb_out_fact->Join(*succ_fact);
-      }
+  // Go over successor blocks and apply join.
+  for (auto si = succ_begin(&BB), se = succ_end(&BB); si != se; ++si) {
+    bb_out_fact.Join(*input_facts_.GetEntry(**si));
+  }
+}
 
-      changed = visitBlock(*BB) || changed;
+bool ReturnedValuesPass::VisitBlock(const llvm::BasicBlock &BB) {
+  bool changed_predecessors = false;
+  if (storage_ == FactStorage::kBlockBoundaries) {
+    // Only the fact at the entry of the block is kept.
+    std::shared_ptr<ReturnedValuesFact> entry_fact =
+        input_facts_.GetEntry(BB);
+    std::shared_ptr<const ReturnedValuesFact> output_fact =
+        output_facts_.GetExit(BB);
+    for (auto ii = BB.rbegin(), ie = BB.rend(); ii != ie; ++ii) {
+      const llvm::Instruction &I = *ii;
+      std::shared_ptr<ReturnedValuesFact> input_fact =
+          &I == &BB.front() ? entry_fact
+                            : std::make_shared<ReturnedValuesFact>();
+      changed_predecessors |= VisitInstruction(I, input_fact, output_fact);
+      output_fact = input_fact;
     }
-  }
 
-  return;
-}
+    return changed_predecessors;
+  }
 
-bool ReturnedValuesPass::visitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
+  const std::shared_ptr<ReturnedValuesFact> *input_facts =
+      input_facts_.GetBlockFacts(BB);
+  const std::shared_ptr<ReturnedValuesFact> *output_facts =
+      output_facts_.GetBlockFacts(BB);
+  size_t index = BB.size();
   for (auto ii = BB.rbegin(), ie = BB.rend(); ii != ie; ++ii) {
     const llvm::Instruction &I = *ii;
+    index--;
+    changed_predecessors |=
+        VisitInstruction(I, input_facts[index], output_facts[index]);
+  }
 
-    std::shared_ptr<ReturnedValuesFact> input_fact = input_facts_.at(&I);
-    std::shared_ptr<ReturnedValuesFact> output_fact = output_facts_.at(&I);
-
-    ReturnedValuesFact prev_fact = *input_fact;
-    if (const llvm::ReturnInst *inst = llvm::dyn_cast<llvm::ReturnInst>(&I)) {
-      VisitReturnInst(*inst, input_fact, output_fact);
-    } else if (const llvm::CallInst *inst =
-                   llvm::dyn_cast<llvm::CallInst>(&I)) {
-      VisitCallInst(*inst, input_fact, output_fact);
-    } else if (const llvm::LoadInst *inst =
-                   llvm::dyn_cast<llvm::LoadInst>(&I)) {
-      VisitLoadInst(*inst, input_fact, output_fact);
-    } else if (const llvm::StoreInst *inst =
-                   llvm::dyn_cast<llvm::StoreInst>(&I)) {
-      VisitStoreInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BitCastInst *inst =
-                   llvm::dyn_cast<llvm::BitCastInst>(&I)) {
-      VisitBitCastInst(*inst, input_fact, output_fact);
-    } else if (const llvm::PtrToIntInst *inst =
-                   llvm::dyn_cast<llvm::PtrToIntInst>(&I)) {
-      VisitPtrToIntInst(*inst, input_fact, output_fact);
-    } else if (const llvm::TruncInst *inst =
-                   llvm::dyn_cast<llvm::TruncInst>(&I)) {
-      VisitTruncInst(*inst, input_fact, output_fact);
-    } else if (const llvm::SExtInst *inst =
-                   llvm::dyn_cast<llvm::SExtInst>(&I)) {
-      VisitSExtInst(*inst, input_fact, output_fact);
-    } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
-      VisitPHINode(*inst, input_fact, output_fact);
-    } else {
-      // Default is to just copy facts from previous instruction unchanged.
-      input_fact->value = output_fact->value;
-    }
-    changed = changed || (*(input_fact) != prev_fact);
+  return changed_predecessors;
+}
+
+bool ReturnedValuesPass::VisitInstruction(
+    const llvm::Instruction &I, std::shared_ptr<ReturnedValuesFact> in,
+    std::shared_ptr<const ReturnedValuesFact> out) {
+  TransferInstruction(I, in, out);
+  if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
+    RecordReturnPropagated(*inst, *out);
+  } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
+    return AddIncomingValuesToPredecessors(*inst, *out);
   }
 
-  return changed;
+  return false;
+}
+
+void ReturnedValuesPass::TransferInstruction(
+    const llvm::Instruction &I, std::shared_ptr<ReturnedValuesFact> in,
+    std::shared_ptr<const ReturnedValuesFact> out) const {
+  if (const llvm::ReturnInst *inst = llvm::dyn_cast<llvm::ReturnInst>(&I)) {
+    VisitReturnInst(*inst, in, out);
+  } else if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
+    VisitCallInst(*inst, in, out);
+  } else if (const llvm::LoadInst *inst = llvm::dyn_cast<llvm::LoadInst>(&I)) {
+    VisitLoadInst(*inst, in, out);
+  } else if (const llvm::StoreInst *inst =
+                 llvm::dyn_cast<llvm::StoreInst>(&I)) {
+    VisitStoreInst(*inst, in, out);
+  } else if (const llvm::BitCastInst *inst =
+                 llvm::dyn_cast<llvm::BitCastInst>(&I)) {
+    VisitBitCastInst(*inst, in, out);
+  } else if (const llvm::PtrToIntInst *inst =
+                 llvm::dyn_cast<llvm::PtrToIntInst>(&I)) {
+    VisitPtrToIntInst(*inst, in, out);
+  } else if (const llvm::TruncInst *inst =
+                 llvm::dyn_cast<llvm::TruncInst>(&I)) {
+    VisitTruncInst(*inst, in, out);
+  } else if (const llvm::SExtInst *inst = llvm::dyn_cast<llvm::SExtInst>(&I)) {
+    VisitSExtInst(*inst, in, out);
+  } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
+    VisitPHINode(*inst, in, out);
+  } else {
+    // Default is to just copy facts from previous instruction unchanged.
+    in->value = out->value;
+  }
 }
 
 void ReturnedValuesPass::AddReturnPropagated(const llvm::Function *f,
@@ -125,20 +153,25 @@ void ReturnedValuesPass::AddReturnPropagated(const llvm::Function *f,
   }
 }
 
+// Add every call instruction that can be returned to return propagated map.
+void ReturnedValuesPass::RecordReturnPropagated(const llvm::CallInst &I,
+                                                const ReturnedValuesFact &out) {
+  if (!out.Contains(&I)) return;
+
+  std::string fname = GetCalleeSourceName(I);
+  if (fname.empty()) return;
+
+  AddReturnPropagated(I.getFunction(), fname);
+}
+
 void ReturnedValuesPass::VisitCallInst(
     const llvm::CallInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
 
   std::string fname = GetCalleeSourceName(I);
   if (fname.empty()) return;
 
-  // Add every call instruction that can be returned to return propagated map.
-  if (out->value.find(&I) != out->value.end()) {
-    const llvm::Function *parent = I.getFunction();
-    AddReturnPropagated(parent, fname);
-  }
-
   // LLVM creates multiple copies with numbers at end, e.g. ERR_PTR116.
   const std::vector<std::string> err_functions{"ERR_PTR", "IS_ERR", "PTR_ERR",
                                                "ERR_CAST"};
@@ -154,7 +187,7 @@ void ReturnedValuesPass::VisitCallInst(
 // Insert the value being returned.
 void ReturnedValuesPass::VisitReturnInst(
     const llvm::ReturnInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   // check for void return.
   if (I.getNumOperands() == 0) return;
   llvm::Value *returned = I.getOperand(0);
@@ -165,7 +198,7 @@ void ReturnedValuesPass::VisitReturnInst(
 // Add sender if receiver element of out fact, remove receiver from in fact.
 void ReturnedValuesPass::VisitStoreInst(
     const llvm::StoreInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   llvm::Value *sender = I.getOperand(0);
   llvm::Value *receiver = I.getOperand(1);
@@ -178,7 +211,7 @@ void ReturnedValuesPass::VisitStoreInst(
 // Add operand to in fact if load element of out fact.
 void ReturnedValuesPass::VisitLoadInst(
     const llvm::LoadInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   llvm::Value *load_from = I.getOperand(0);
   in->value.erase(&I);
@@ -190,7 +223,7 @@ void ReturnedValuesPass::VisitLoadInst(
 // Same as load.
 void ReturnedValuesPass::VisitBitCastInst(
     const llvm::BitCastInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   llvm::Value *load_from = I.getOperand(0);
   in->value.erase(&I);
@@ -202,7 +235,7 @@ void ReturnedValuesPass::VisitBitCastInst(
 // Same as load.
 void ReturnedValuesPass::VisitPtrToIntInst(
     const llvm::PtrToIntInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   llvm::Value *load_from = I.getOperand(0);
   in->value.erase(&I);
@@ -214,7 +247,7 @@ void ReturnedValuesPass::VisitPtrToIntInst(
 // Same as load.
 void ReturnedValuesPass::VisitTruncInst(
     const llvm::TruncInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   in->value.erase(&I);
   llvm::Value *load_from = I.getOperand(0);
@@ -226,7 +259,7 @@ void ReturnedValuesPass::VisitTruncInst(
 // Same as load.
 void ReturnedValuesPass::VisitSExtInst(
     const llvm::SExtInst &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   in->value.erase(&I);
   llvm::Value *load_from = I.getOperand(0);
@@ -235,34 +268,117 @@ void ReturnedValuesPass::VisitSExtInst(
   }
 }
 
-// If the PHI result can be returned, then add incoming values
-// to the exit of each incoming basic block.
+// The PHI result is replaced by its incoming values at the exit of the
+// incoming blocks, see AddIncomingValuesToPredecessors.
 void ReturnedValuesPass::VisitPHINode(
     const llvm::PHINode &I, std::shared_ptr<ReturnedValuesFact> in,
-    std::shared_ptr<const ReturnedValuesFact> out) {
+    std::shared_ptr<const ReturnedValuesFact> out) const {
   in->value = out->value;
   if (out->value.find(&I) == out->value.end()) {
     return;
   }
   in->value.erase(&I);
+}
 
+// If the PHI result can be returned, then add incoming values
+// to the exit of each incoming basic block.
+bool ReturnedValuesPass::AddIncomingValuesToPredecessors(
+    const llvm::PHINode &I, const ReturnedValuesFact &out) {
+  if (!out.Contains(&I)) {
+    return false;
+  }
+
+  bool changed = false;
   for (unsigned i = 0, e = I.getNumIncomingValues(); i != e; ++i) {
     const llvm::Value *v = I.getIncomingValue(i);
     const llvm::BasicBlock *BB = I.getIncomingBlock(i);
-    const llvm::Instruction *bb_last = GetLastInstructionOfBB(BB);
 
     // insert value into the output fact of the last instruction.
-    auto bb_out_fact = output_facts_.at(bb_last);
-    bb_out_fact->value.insert(v);
+    const auto &bb_out_fact = output_facts_.GetExit(*BB);
+    changed = bb_out_fact->value.insert(v).second || changed;
   }
+
+  return changed;
 }
 
 ReturnedValuesFact ReturnedValuesPass::GetInFact(const llvm::Value *v) const {
-  return *(input_facts_.at(v));
+  const auto *inst = llvm::cast<llvm::Instruction>(v);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.front()) {
+    return *(input_facts_.Get(inst));
+  }
+
+  return std::move(*ReplayBlock(block, inst).front());
 }
 
 ReturnedValuesFact ReturnedValuesPass::GetOutFact(const llvm::Value *v) const {
-  return *(output_facts_.at(v));
+  const auto *inst = llvm::cast<llvm::Instruction>(v);
+  const llvm::BasicBlock &block = *inst->getParent();
+  if (storage_ == FactStorage::kEveryInstruction || inst == &block.back()) {
+    return *(output_facts_.Get(inst));
+  }
+
+  return std::move(*ReplayBlock(block, inst->getNextNode()).front());
+}
+
+std::vector<ReturnedValuesFact> ReturnedValuesPass::GetBlockInFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnedValuesFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*input_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  facts.push_back(*input_facts_.GetEntry(block));
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.front().getNextNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+
+  return facts;
+}
+
+std::vector<ReturnedValuesFact> ReturnedValuesPass::GetBlockOutFacts(
+    const llvm::BasicBlock &block) const {
+  std::vector<ReturnedValuesFact> facts;
+  if (storage_ == FactStorage::kEveryInstruction) {
+    for (const llvm::Instruction &inst : block) {
+      facts.push_back(*output_facts_.Get(&inst));
+    }
+    return facts;
+  }
+
+  if (&block.front() != &block.back()) {
+    for (auto &fact : ReplayBlock(block, block.front().getNextNode())) {
+      facts.push_back(std::move(*fact));
+    }
+  }
+  facts.push_back(*output_facts_.GetExit(block));
+
+  return facts;
+}
+
+std::vector<std::shared_ptr<ReturnedValuesFact>>
+ReturnedValuesPass::ReplayBlock(const llvm::BasicBlock &block,
+                                const llvm::Instruction *first) const {
+  std::vector<std::shared_ptr<ReturnedValuesFact>> facts;
+  std::shared_ptr<const ReturnedValuesFact> output_fact =
+      output_facts_.GetExit(block);
+  for (auto ii = block.rbegin(), ie = block.rend(); ii != ie; ++ii) {
+    const llvm::Instruction &I = *ii;
+    facts.push_back(std::make_shared<ReturnedValuesFact>());
+    TransferInstruction(I, facts.back(), output_fact);
+    if (&I == first) {
+      break;
+    }
+    output_fact = facts.back();
+  }
+  std::reverse(facts.begin(), facts.end());
+
+  return facts;
 }
 
 void ReturnedValuesPass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
@@ -0,0 +1,209 @@
+#include "dataflow_solver.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+const char *const kModule = R"(
+define void @diamond(i1 %c) {
+entry:
+  br i1 %c, label %left, label %right
+left:
+  br label %exit
+right:
+  br label %exit
+exit:
+  ret void
+unreachable:
+  ret void
+}
+
+define void @loop(i1 %c) {
+entry:
+  br label %header
+header:
+  br i1 %c, label %body, label %exit
+body:
+  br label %header
+exit:
+  ret void
+}
+)";
+
+// Collects the names of the blocks on some path to every block, for forward
+// analyses, or from every block, for backward ones.
+template <DataflowDirection Direction>
+class BlockNamesTransfer {
+ public:
+  using Fact = std::set<std::string>;
+  using Solver = DataflowSolver<Fact, Direction, BlockNamesTransfer>;
+
+  Fact &GetOutgoingFact(const llvm::BasicBlock &block) {
+    return outgoing_facts_[&block];
+  }
+
+  void JoinIncomingFacts(const llvm::BasicBlock &block) {
+    Fact &incoming_fact = incoming_facts_[&block];
+    if (Direction == DataflowDirection::kForward) {
+      for (const llvm::BasicBlock *predecessor : llvm::predecessors(&block)) {
+        const Fact &fact = outgoing_facts_[predecessor];
+        incoming_fact.insert(fact.begin(), fact.end());
+      }
+    } else {
+      for (const llvm::BasicBlock *successor : llvm::successors(&block)) {
+        const Fact &fact = outgoing_facts_[successor];
+        incoming_fact.insert(fact.begin(), fact.end());
+      }
+    }
+  }
+
+  bool VisitBlock(const llvm::BasicBlock &block) {
+    visits_.push_back(block.getName().str());
+    Fact &outgoing_fact = outgoing_facts_[&block];
+    outgoing_fact = incoming_facts_[&block];
+    outgoing_fact.insert(block.getName().str());
+    return false;
+  }
+
+  std::map<const llvm::BasicBlock *, Fact> incoming_facts_;
+  std::map<const llvm::BasicBlock *, Fact> outgoing_facts_;
+  std::vector<std::string> visits_;
+};
+
+// Never changes its facts, but reports that visiting `changing_block` changed
+// its neighbours the first `changes` times.
+class SideEffectTransfer {
+ public:
+  using Solver =
+      DataflowSolver<int, DataflowDirection::kForward, SideEffectTransfer>;
+
+  SideEffectTransfer(const std::string &changing_block, int changes)
+      : changing_block_(changing_block), changes_(changes) {}
+
+  int &GetOutgoingFact(const llvm::BasicBlock &block) { return fact_; }
+
+  void JoinIncomingFacts(const llvm::BasicBlock &block) {}
+
+  bool VisitBlock(const llvm::BasicBlock &block) {
+    visits_.push_back(block.getName().str());
+    if (block.getName() != changing_block_ || changes_ == 0) {
+      return false;
+    }
+    changes_--;
+    return true;
+  }
+
+  const std::string changing_block_;
+  int changes_;
+  int fact_ = 0;
+  std::vector<std::string> visits_;
+};
+
+}  // namespace
+
+class DataflowSolverTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseAssemblyString(kModule, err, llvm_context_);
+    if (!module_) {
+      err.print("dataflow-solver-test", llvm::errs());
+    }
+    ASSERT_TRUE(module_);
+  }
+
+  const llvm::BasicBlock &GetBlock(const llvm::Function &function,
+                                   const std::string &name) {
+    for (const llvm::BasicBlock &block : function) {
+      if (block.getName() == name) {
+        return block;
+      }
+    }
+    ADD_FAILURE() << "No block " << name;
+    return function.front();
+  }
+
+  llvm::LLVMContext llvm_context_;
+  std::unique_ptr<llvm::Module> module_;
+};
+
+// Tests that a forward analysis of an acyclic function visits every block
+// once, each after its predecessors, and the unreachable ones last.
+TEST_F(DataflowSolverTest, ForwardAcyclicVisitsBlocksOnce) {
+  const llvm::Function &function = *module_->getFunction("diamond");
+  BlockNamesTransfer<DataflowDirection::kForward> transfer;
+  BlockNamesTransfer<DataflowDirection::kForward>::Solver solver(&transfer);
+  const DataflowSolverStats stats = solver.Solve(function);
+
+  EXPECT_EQ(stats.blocks, 5);
+  EXPECT_EQ(stats.block_visits, 5);
+  ASSERT_EQ(transfer.visits_.size(), 5);
+  EXPECT_EQ(transfer.visits_[0], "entry");
+  EXPECT_EQ(transfer.visits_[3], "exit");
+  EXPECT_EQ(transfer.visits_[4], "unreachable");
+  EXPECT_EQ(transfer.outgoing_facts_[&GetBlock(function, "exit")],
+            std::set<std::string>({"entry", "left", "right", "exit"}));
+}
+
+// Tests that a backward analysis of an acyclic function visits every block
+// once, each after its successors.
+TEST_F(DataflowSolverTest, BackwardAcyclicVisitsBlocksOnce) {
+  const llvm::Function &function = *module_->getFunction("diamond");
+  BlockNamesTransfer<DataflowDirection::kBackward> transfer;
+  BlockNamesTransfer<DataflowDirection::kBackward>::Solver solver(&transfer);
+  const DataflowSolverStats stats = solver.Solve(function);
+
+  EXPECT_EQ(stats.blocks, 5);
+  EXPECT_EQ(stats.block_visits, 5);
+  ASSERT_EQ(transfer.visits_.size(), 5);
+  EXPECT_EQ(transfer.visits_[0], "unreachable");
+  EXPECT_EQ(transfer.visits_[1], "exit");
+  EXPECT_EQ(transfer.visits_[4], "entry");
+  EXPECT_EQ(transfer.outgoing_facts_[&GetBlock(function, "entry")],
+            std::set<std::string>({"entry", "left", "right", "exit"}));
+}
+
+// Tests that the facts of a loop reach a fixpoint, which takes visiting some
+// blocks again.
+TEST_F(DataflowSolverTest, LoopRevisitsBlocks) {
+  const llvm::Function &function = *module_->getFunction("loop");
+  BlockNamesTransfer<DataflowDirection::kForward> transfer;
+  BlockNamesTransfer<DataflowDirection::kForward>::Solver solver(&transfer);
+  const DataflowSolverStats stats = solver.Solve(function);
+
+  EXPECT_EQ(stats.blocks, 4);
+  EXPECT_GT(stats.block_visits, 4);
+  EXPECT_EQ(transfer.outgoing_facts_[&GetBlock(function, "exit")],
+            std::set<std::string>({"entry", "header", "body", "exit"}));
+  EXPECT_EQ(transfer.outgoing_facts_[&GetBlock(function, "header")],
+            std::set<std::string>({"entry", "header", "body"}));
+}
+
+// Tests that blocks whose facts were changed by the visit of a neighbour,
+// rather than through their outgoing facts, are visited again.
+TEST_F(DataflowSolverTest, RevisitsBlocksChangedByNeighbours) {
+  const llvm::Function &function = *module_->getFunction("loop");
+  SideEffectTransfer unchanged_transfer("body", 0);
+  SideEffectTransfer::Solver unchanged_solver(&unchanged_transfer);
+  EXPECT_EQ(unchanged_solver.Solve(function).block_visits, 4);
+
+  SideEffectTransfer changed_transfer("body", 1);
+  SideEffectTransfer::Solver changed_solver(&changed_transfer);
+  EXPECT_EQ(changed_solver.Solve(function).block_visits, 5);
+  EXPECT_EQ(changed_transfer.visits_.back(), "header");
+}
+
+}  // namespace error_specifications
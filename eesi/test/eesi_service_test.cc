@@ -5,6 +5,11 @@
 
 #include <unistd.h>
 
+#include <future>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "include/grpcpp/grpcpp.h"
 #include "llvm/ADT/StringRef.h"
@@ -72,6 +77,24 @@ class EesiServiceTest : public ::testing::Test {
   }
 };
 
+// Keeps every slot of `executor` busy until it goes out of scope, so that
+// operations submitted in the meantime stay queued.
+class BusyExecutor {
+ public:
+  explicit BusyExecutor(OperationExecutor *executor) {
+    std::shared_future<void> released = release_.get_future().share();
+    for (int i = 0; i < kDefaultMaxConcurrentOperations; i++) {
+      executor->Submit(OperationPriority::kNormal,
+                       [released] { released.wait(); });
+    }
+  }
+
+  ~BusyExecutor() { release_.set_value(); }
+
+ private:
+  std::promise<void> release_;
+};
+
 TEST_F(EesiServiceTest, PidginSpecifications) {
   // Register the bitcode file.
   RegisterBitcodeRequest register_bitcode_req;
@@ -169,6 +192,150 @@ TEST_F(EesiServiceTest, PidginSpecifications) {
 
   ASSERT_EQ(GetNonEmptySpecificationsCount(response), 15)
       << response.DebugString();
+
+  // The finished operation keeps the progress of the last pass.
+  ProgressMetadata progress;
+  ASSERT_TRUE(get_specifications_operation.metadata().UnpackTo(&progress));
+  ASSERT_FALSE(progress.current_pass().empty());
+  ASSERT_EQ(progress.sccs_done(), progress.sccs_total());
+  ASSERT_GT(progress.functions_analyzed(), 0);
+
+  // And the report of where its time went.
+  std::vector<std::string> phases;
+  for (const StepUsage &phase : progress.performance().phases()) {
+    phases.push_back(phase.name());
+  }
+  ASSERT_EQ(phases, std::vector<std::string>(
+                        {"download", "admission", "parse", "growth", "pack"}));
+  std::set<std::string> passes;
+  for (const StepUsage &pass : progress.performance().passes()) {
+    passes.insert(pass.name());
+    ASSERT_GE(pass.wall_seconds(), 0);
+  }
+  ASSERT_EQ(passes, std::set<std::string>({"ErrorBlocksPass",
+                                           "ReturnConstraintsPass",
+                                           "ReturnPropagationPass",
+                                           "ReturnRangePass",
+                                           "ReturnedValuesPass"}));
+}
+
+TEST_F(EesiServiceTest, IdenticalRequestsShareOneResult) {
+  RegisterBitcodeRequest register_bitcode_req;
+  RegisterBitcodeResponse register_bitcode_res;
+  grpc::ClientContext register_bitcode_context;
+  register_bitcode_req.mutable_uri()->CopyFrom(
+      FilePathToUri("testdata/programs/pidgin-reg2mem.ll"));
+  grpc::Status status = bitcode_stub_->RegisterBitcode(
+      &register_bitcode_context, register_bitcode_req, &register_bitcode_res);
+  ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+
+  Specification malloc_spec;
+  malloc_spec.mutable_function()->set_source_name("malloc");
+  malloc_spec.mutable_function()->set_llvm_name("malloc");
+  malloc_spec.set_lattice_element(
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
+  GetSpecificationsRequest get_specifications_req;
+  get_specifications_req.mutable_bitcode_id()->set_id(
+      register_bitcode_res.bitcode_id().id());
+  get_specifications_req.mutable_bitcode_id()->set_authority(
+      test_bitcode_server_address_);
+  get_specifications_req.add_initial_specifications()->CopyFrom(malloc_spec);
+
+  // The second request either shares the task of the first or, if that
+  // already finished, reuses its memoized result.
+  std::vector<Operation> operations(2);
+  for (Operation &operation : operations) {
+    grpc::ClientContext get_specifications_context;
+    status = eesi_stub_->GetSpecifications(&get_specifications_context,
+                                           get_specifications_req, &operation);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+  }
+  ASSERT_NE(operations[0].name(), operations[1].name());
+
+  for (Operation &operation : operations) {
+    int number_of_tries = 0;
+    while (!operation.done()) {
+      grpc::ClientContext get_operation_context;
+      GetOperationRequest get_operation_req;
+      get_operation_req.set_name(operation.name());
+      status = operations_stub_->GetOperation(&get_operation_context,
+                                              get_operation_req, &operation);
+      ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+      ASSERT_LE(number_of_tries, 10);
+      number_of_tries++;
+      usleep(1000 * 1000);
+    }
+    ASSERT_FALSE(operation.has_error()) << operation.error().message();
+  }
+
+  // Both are the result of the one task.
+  GetSpecificationsResponse response;
+  ASSERT_TRUE(operations[0].response().UnpackTo(&response));
+  ASSERT_EQ(operations[0].response().value(),
+            operations[1].response().value());
+}
+
+// Tests that cancelling an operation that has not finished yet finishes it
+// with a CANCELLED error.
+TEST_F(EesiServiceTest, CancelGetSpecifications) {
+  RegisterBitcodeRequest register_bitcode_req;
+  RegisterBitcodeResponse register_bitcode_res;
+  grpc::ClientContext register_bitcode_context;
+  register_bitcode_req.mutable_uri()->CopyFrom(
+      FilePathToUri("testdata/programs/pidgin-reg2mem.ll"));
+  grpc::Status status = bitcode_stub_->RegisterBitcode(
+      &register_bitcode_context, register_bitcode_req, &register_bitcode_res);
+  ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+
+  GetSpecificationsRequest get_specifications_req;
+  get_specifications_req.mutable_bitcode_id()->set_id(
+      register_bitcode_res.bitcode_id().id());
+  get_specifications_req.mutable_bitcode_id()->set_authority(
+      test_bitcode_server_address_);
+
+  Operation operation;
+  {
+    // The operation waits for a slot until it has been cancelled.
+    BusyExecutor busy_executor(&eesi_service_.executor);
+    grpc::ClientContext get_specifications_context;
+    status = eesi_stub_->GetSpecifications(&get_specifications_context,
+                                           get_specifications_req, &operation);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+    ASSERT_FALSE(operation.done());
+
+    grpc::ClientContext cancel_context;
+    CancelOperationRequest cancel_req;
+    cancel_req.set_name(operation.name());
+    google::protobuf::Empty cancel_res;
+    status = operations_stub_->CancelOperation(&cancel_context, cancel_req,
+                                               &cancel_res);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+  }
+
+  int number_of_tries = 0;
+  while (!operation.done()) {
+    grpc::ClientContext get_operation_context;
+    GetOperationRequest get_operation_req;
+    get_operation_req.set_name(operation.name());
+    status = operations_stub_->GetOperation(&get_operation_context,
+                                            get_operation_req, &operation);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+    ASSERT_LE(number_of_tries, 10);
+    number_of_tries++;
+    usleep(100 * 1000);
+  }
+  EXPECT_EQ(operation.error().code(), grpc::StatusCode::CANCELLED);
+}
+
+// Tests that cancelling an operation that does not exist fails.
+TEST_F(EesiServiceTest, CancelUnknownOperation) {
+  grpc::ClientContext cancel_context;
+  CancelOperationRequest cancel_req;
+  cancel_req.set_name("unknown");
+  google::protobuf::Empty cancel_res;
+  grpc::Status status = operations_stub_->CancelOperation(
+      &cancel_context, cancel_req, &cancel_res);
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
 }
 
 }  // namespace error_specifications
@@ -0,0 +1,160 @@
+#include "fact_cache.h"
+
+#include <fstream>
+
+#include "dataflow_analyses.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+constexpr char kCacheDirectory[] = "/tmp/FactCacheTest";
+constexpr char kBitcodeId[] =
+    "3f1a6c0e9b2d4f8a7c5e1d0b9a8f7e6d5c4b3a29180716253445566778899aab";
+
+std::unique_ptr<llvm::Module> ParseModule(llvm::LLVMContext *llvm_context) {
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> module(llvm::parseIRFile(
+      "testdata/programs/mustcheck_lez_split-reg2mem.ll", err, *llvm_context));
+  if (!module) {
+    err.print("fact-cache-test", llvm::errs());
+  }
+
+  return module;
+}
+
+class FactCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    llvm::sys::fs::remove_directories(kCacheDirectory);
+    module_ = ParseModule(&llvm_context_);
+    ASSERT_TRUE(module_);
+  }
+
+  void TearDown() override {
+    llvm::sys::fs::remove_directories(kCacheDirectory);
+  }
+
+  llvm::LLVMContext llvm_context_;
+  std::unique_ptr<llvm::Module> module_;
+};
+
+// Tests that facts stored by one analysis manager are loaded by the next one
+// and equal the computed facts at every program point.
+TEST_F(FactCacheTest, LoadsStoredFacts) {
+  FactCache fact_cache(kCacheDirectory);
+
+  llvm::ModuleAnalysisManager computing_manager;
+  RegisterDataflowAnalyses(&computing_manager, nullptr, &fact_cache,
+                           kBitcodeId);
+  const ReturnConstraints &computed_constraints =
+      *computing_manager.getResult<ReturnConstraintsAnalysis>(*module_);
+  const ReturnPropagation &computed_propagation =
+      *computing_manager.getResult<ReturnPropagationAnalysis>(*module_);
+  ASSERT_EQ(fact_cache.GetHits(), 0);
+  ASSERT_EQ(fact_cache.GetMisses(), 2);
+
+  llvm::ModuleAnalysisManager loading_manager;
+  RegisterDataflowAnalyses(&loading_manager, nullptr, &fact_cache,
+                           kBitcodeId);
+  const ReturnConstraints &loaded_constraints =
+      *loading_manager.getResult<ReturnConstraintsAnalysis>(*module_);
+  // Loading the constraints does not compute the return propagation.
+  ASSERT_EQ(fact_cache.GetHits(), 1);
+  const ReturnPropagation &loaded_propagation =
+      *loading_manager.getResult<ReturnPropagationAnalysis>(*module_);
+  ASSERT_EQ(fact_cache.GetHits(), 2);
+  ASSERT_EQ(fact_cache.GetMisses(), 2);
+
+  for (const llvm::Function &function : *module_) {
+    for (const llvm::BasicBlock &block : function) {
+      for (const llvm::Instruction &inst : block) {
+        ASSERT_TRUE(computed_constraints.GetInFact(&inst) ==
+                    loaded_constraints.GetInFact(&inst));
+        ASSERT_TRUE(computed_constraints.GetOutFact(&inst) ==
+                    loaded_constraints.GetOutFact(&inst));
+        ASSERT_EQ(computed_propagation.GetInFact(&inst).value,
+                  loaded_propagation.GetInFact(&inst).value);
+        ASSERT_EQ(computed_propagation.GetOutFact(&inst).value,
+                  loaded_propagation.GetOutFact(&inst).value);
+      }
+    }
+  }
+}
+
+// Tests that facts stored for every instruction are loaded into block
+// boundary storage, and the other way around, with the same facts at every
+// program point.
+TEST_F(FactCacheTest, LoadsFactsIntoEitherStorage) {
+  FactCache fact_cache(kCacheDirectory);
+
+  ReturnPropagation computed_propagation(FactStorage::kEveryInstruction);
+  computed_propagation.Compute(*module_, nullptr);
+  fact_cache.StoreReturnPropagation(kBitcodeId, *module_,
+                                    computed_propagation);
+  ReturnPropagation loaded_propagation(FactStorage::kBlockBoundaries);
+  ASSERT_TRUE(fact_cache.LoadReturnPropagation(kBitcodeId, *module_,
+                                               &loaded_propagation));
+
+  ReturnConstraints computed_constraints(FactStorage::kBlockBoundaries);
+  computed_constraints.Compute(*module_, &computed_propagation, nullptr);
+  fact_cache.StoreReturnConstraints(kBitcodeId, *module_,
+                                    computed_constraints);
+  ReturnConstraints loaded_constraints(FactStorage::kEveryInstruction);
+  ASSERT_TRUE(fact_cache.LoadReturnConstraints(kBitcodeId, *module_,
+                                               &loaded_constraints));
+
+  for (const llvm::Function &function : *module_) {
+    for (const llvm::BasicBlock &block : function) {
+      for (const llvm::Instruction &inst : block) {
+        ASSERT_EQ(computed_propagation.GetInFact(&inst).value,
+                  loaded_propagation.GetInFact(&inst).value);
+        ASSERT_EQ(computed_propagation.GetOutFact(&inst).value,
+                  loaded_propagation.GetOutFact(&inst).value);
+        ASSERT_TRUE(computed_constraints.GetInFact(&inst) ==
+                    loaded_constraints.GetInFact(&inst));
+        ASSERT_TRUE(computed_constraints.GetOutFact(&inst) ==
+                    loaded_constraints.GetOutFact(&inst));
+      }
+    }
+  }
+}
+
+// Tests that an entry that cannot be decoded is removed and recomputed.
+TEST_F(FactCacheTest, DiscardsCorruptEntry) {
+  FactCache fact_cache(kCacheDirectory);
+  const std::string path = std::string(kCacheDirectory) + "/" + kBitcodeId +
+                           ".return_propagation.facts";
+  {
+    std::ofstream entry(path, std::ios::binary);
+    entry << "EESIFCT1garbage";
+  }
+
+  ReturnPropagation facts;
+  ASSERT_FALSE(
+      fact_cache.LoadReturnPropagation(kBitcodeId, *module_, &facts));
+  ASSERT_FALSE(llvm::sys::fs::exists(path));
+  ASSERT_EQ(fact_cache.GetMisses(), 1);
+}
+
+// Tests that handles that are not digests are never used as file names.
+TEST_F(FactCacheTest, IgnoresUnsafeHandles) {
+  FactCache fact_cache(kCacheDirectory);
+
+  llvm::ModuleAnalysisManager analysis_manager;
+  RegisterDataflowAnalyses(&analysis_manager, nullptr, &fact_cache,
+                           "../escape");
+  analysis_manager.getResult<ReturnPropagationAnalysis>(*module_);
+
+  std::error_code error_code;
+  llvm::sys::fs::directory_iterator entries(kCacheDirectory, error_code);
+  ASSERT_FALSE(error_code);
+  ASSERT_EQ(entries, llvm::sys::fs::directory_iterator());
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,163 @@
+#include "fact_storage.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+#include "return_constraints_pass.h"
+#include "return_propagation_pass.h"
+#include "return_range_pass.h"
+#include "returned_values_pass.h"
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+class FactStorageTest : public ::testing::TestWithParam<const char *> {
+ protected:
+  void SetUp() override {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseIRFile(GetParam(), err, llvm_context_);
+    if (!module_) {
+      err.print("fact-storage-test", llvm::errs());
+    }
+    ASSERT_TRUE(module_);
+  }
+
+  // Asserts that the block boundary storage elides every fact that the
+  // other storage keeps beyond the block boundaries, and takes up less
+  // memory.
+  static void ExpectSmallerStats(const FactStorageStats &dense,
+                                 const FactStorageStats &sparse) {
+    EXPECT_EQ(dense.elided_facts, 0);
+    EXPECT_EQ(sparse.stored_facts + sparse.elided_facts, dense.stored_facts);
+    if (sparse.elided_facts > 0) {
+      EXPECT_LT(sparse.stored_bytes, dense.stored_bytes);
+      EXPECT_GT(sparse.elided_bytes, 0);
+    }
+  }
+
+  llvm::LLVMContext llvm_context_;
+  std::unique_ptr<llvm::Module> module_;
+};
+
+// Tests that both storages of the forward analyses have the same facts at
+// every program point, one at a time and a block at a time.
+TEST_P(FactStorageTest, ForwardAnalysesAgree) {
+  ReturnPropagation dense_propagation(FactStorage::kEveryInstruction);
+  dense_propagation.Compute(*module_, nullptr);
+  ReturnPropagation sparse_propagation(FactStorage::kBlockBoundaries);
+  sparse_propagation.Compute(*module_, nullptr);
+  ReturnConstraints dense_constraints(FactStorage::kEveryInstruction);
+  dense_constraints.Compute(*module_, &dense_propagation, nullptr);
+  ReturnConstraints sparse_constraints(FactStorage::kBlockBoundaries);
+  sparse_constraints.Compute(*module_, &sparse_propagation, nullptr);
+
+  for (const llvm::Function &function : *module_) {
+    for (const llvm::BasicBlock &block : function) {
+      if (!dense_propagation.HasFacts(&block.front())) {
+        ASSERT_FALSE(sparse_propagation.HasFacts(&block.front()));
+        continue;
+      }
+      const std::vector<ReturnPropagationFact> propagation_in_facts =
+          sparse_propagation.GetBlockInFacts(block);
+      const std::vector<ReturnPropagationFact> propagation_out_facts =
+          sparse_propagation.GetBlockOutFacts(block);
+      const std::vector<ReturnConstraintsFact> constraints_in_facts =
+          sparse_constraints.GetBlockInFacts(block);
+      const std::vector<ReturnConstraintsFact> constraints_out_facts =
+          sparse_constraints.GetBlockOutFacts(block);
+      ASSERT_EQ(propagation_in_facts.size(), block.size());
+      ASSERT_EQ(propagation_out_facts.size(), block.size());
+      ASSERT_EQ(constraints_in_facts.size(), block.size());
+      ASSERT_EQ(constraints_out_facts.size(), block.size());
+      size_t i = 0;
+      for (const llvm::Instruction &inst : block) {
+        ASSERT_EQ(dense_propagation.GetInFact(&inst).value,
+                  sparse_propagation.GetInFact(&inst).value);
+        ASSERT_EQ(dense_propagation.GetOutFact(&inst).value,
+                  sparse_propagation.GetOutFact(&inst).value);
+        ASSERT_EQ(dense_propagation.GetInFact(&inst).value,
+                  propagation_in_facts[i].value);
+        ASSERT_EQ(dense_propagation.GetOutFact(&inst).value,
+                  propagation_out_facts[i].value);
+        ASSERT_TRUE(dense_constraints.GetInFact(&inst) ==
+                    sparse_constraints.GetInFact(&inst));
+        ASSERT_TRUE(dense_constraints.GetOutFact(&inst) ==
+                    sparse_constraints.GetOutFact(&inst));
+        ASSERT_TRUE(dense_constraints.GetInFact(&inst) ==
+                    constraints_in_facts[i]);
+        ASSERT_TRUE(dense_constraints.GetOutFact(&inst) ==
+                    constraints_out_facts[i]);
+        i++;
+      }
+    }
+  }
+
+  ExpectSmallerStats(dense_propagation.GetStorageStats(),
+                     sparse_propagation.GetStorageStats());
+  ExpectSmallerStats(dense_constraints.GetStorageStats(),
+                     sparse_constraints.GetStorageStats());
+}
+
+// Tests that both storages of the backward analysis, and of the range
+// analysis that reads it, have the same facts at every program point.
+TEST_P(FactStorageTest, LegacyPassesAgree) {
+  ReturnedValuesPass *dense_values =
+      new ReturnedValuesPass(FactStorage::kEveryInstruction);
+  ReturnRangePass *dense_range =
+      new ReturnRangePass(FactStorage::kEveryInstruction);
+  llvm::legacy::PassManager dense_manager;
+  dense_manager.add(dense_values);
+  dense_manager.add(dense_range);
+  dense_manager.run(*module_);
+
+  ReturnedValuesPass *sparse_values =
+      new ReturnedValuesPass(FactStorage::kBlockBoundaries);
+  ReturnRangePass *sparse_range =
+      new ReturnRangePass(FactStorage::kBlockBoundaries);
+  llvm::legacy::PassManager sparse_manager;
+  sparse_manager.add(sparse_values);
+  sparse_manager.add(sparse_range);
+  sparse_manager.run(*module_);
+
+  for (const llvm::Function &function : *module_) {
+    for (const llvm::BasicBlock &block : function) {
+      const std::vector<ReturnedValuesFact> values_in_facts =
+          sparse_values->GetBlockInFacts(block);
+      const std::vector<ReturnRangeFact> range_out_facts =
+          sparse_range->GetBlockOutFacts(block);
+      ASSERT_EQ(values_in_facts.size(), block.size());
+      ASSERT_EQ(range_out_facts.size(), block.size());
+      size_t i = 0;
+      for (const llvm::Instruction &inst : block) {
+        ASSERT_TRUE(dense_values->GetInFact(&inst) ==
+                    sparse_values->GetInFact(&inst));
+        ASSERT_TRUE(dense_values->GetOutFact(&inst) ==
+                    sparse_values->GetOutFact(&inst));
+        ASSERT_TRUE(dense_range->GetInFact(&inst) ==
+                    sparse_range->GetInFact(&inst));
+        ASSERT_TRUE(dense_range->GetOutFact(&inst) ==
+                    sparse_range->GetOutFact(&inst));
+        ASSERT_TRUE(dense_values->GetInFact(&inst) == values_in_facts[i]);
+        ASSERT_TRUE(dense_range->GetOutFact(&inst) == range_out_facts[i]);
+        i++;
+      }
+    }
+  }
+
+  ExpectSmallerStats(dense_values->GetStorageStats(),
+                     sparse_values->GetStorageStats());
+  ExpectSmallerStats(dense_range->GetStorageStats(),
+                     sparse_range->GetStorageStats());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Programs, FactStorageTest,
+    ::testing::Values("testdata/programs/mustcheck_lez_split-reg2mem.ll",
+                      "testdata/programs/propagation_inside_if-reg2mem.ll",
+                      "testdata/programs/saved_return.ll",
+                      "testdata/programs/scc_functions-reg2mem.ll"));
+
+}  // namespace error_specifications
@@ -0,0 +1,168 @@
+#include "fact_table.h"
+
+#include <memory>
+
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+const char *const kModule = R"(
+define i32 @first(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  br label %exit
+exit:
+  ret i32 %y
+}
+
+declare i32 @declared()
+
+define i32 @second() {
+entry:
+  %z = call i32 @declared()
+  %w = add i32 %z, 2
+  ret i32 %w
+}
+)";
+
+struct TestFact {
+  int value = 0;
+};
+
+}  // namespace
+
+class FactTableTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseAssemblyString(kModule, err, llvm_context_);
+    if (!module_) {
+      err.print("fact-table-test", llvm::errs());
+    }
+    ASSERT_TRUE(module_);
+  }
+
+  llvm::LLVMContext llvm_context_;
+  std::unique_ptr<llvm::Module> module_;
+};
+
+// Tests that the blocks and instructions of a module are numbered densely,
+// function by function, in layout order.
+TEST_F(FactTableTest, NumbersBlocksAndInstructionsInOrder) {
+  const InstructionNumbering numbering(*module_, true);
+  EXPECT_EQ(numbering.NumBlocks(), 3);
+  EXPECT_EQ(numbering.NumInstructions(), 6);
+
+  unsigned expected_block = 0;
+  unsigned expected_instruction = 0;
+  for (const llvm::Function &function : *module_) {
+    for (const llvm::BasicBlock &block : function) {
+      unsigned block_number;
+      ASSERT_TRUE(numbering.GetBlockNumber(&block, &block_number));
+      EXPECT_EQ(block_number, expected_block++);
+      EXPECT_EQ(numbering.GetFirstInstructionNumber(block_number),
+                expected_instruction);
+      for (const llvm::Instruction &inst : block) {
+        unsigned instruction_number;
+        ASSERT_TRUE(numbering.GetInstructionNumber(&inst, &instruction_number));
+        EXPECT_EQ(instruction_number, expected_instruction++);
+      }
+    }
+  }
+
+  const InstructionNumbering block_numbering(*module_, false);
+  unsigned instruction_number;
+  EXPECT_FALSE(block_numbering.GetInstructionNumber(
+      &module_->getFunction("first")->front().front(), &instruction_number));
+}
+
+// Tests that a table of every instruction has a point per instruction, and
+// that the facts of a block are contiguous.
+TEST_F(FactTableTest, EveryInstruction) {
+  auto numbering = std::make_shared<const InstructionNumbering>(*module_, true);
+  FactTable<TestFact> table;
+  table.Reset(numbering, FactPoints::kEveryInstruction);
+  EXPECT_EQ(table.NumPoints(), 6);
+
+  const llvm::BasicBlock &block = module_->getFunction("second")->front();
+  int value = 0;
+  for (const llvm::Instruction &inst : block) {
+    EXPECT_FALSE(table.Has(&inst));
+    auto fact = std::make_shared<TestFact>();
+    fact->value = ++value;
+    table.Set(&inst, fact);
+    EXPECT_TRUE(table.Has(&inst));
+  }
+
+  const std::shared_ptr<TestFact> *facts = table.GetBlockFacts(block);
+  EXPECT_EQ(facts[0]->value, 1);
+  EXPECT_EQ(facts[1]->value, 2);
+  EXPECT_EQ(facts[2]->value, 3);
+  EXPECT_EQ(table.GetEntry(block)->value, 1);
+  EXPECT_EQ(table.GetExit(block)->value, 3);
+  EXPECT_EQ(table.Get(&block.back())->value, 3);
+  EXPECT_FALSE(table.Get(&module_->getFunction("first")->front().front()));
+
+  table.Clear();
+  EXPECT_EQ(table.NumPoints(), 0);
+  EXPECT_FALSE(table.Has(&block.front()));
+}
+
+// Tests that tables of block entries, or exits, only have a point at the
+// first, or last, instruction of every block.
+TEST_F(FactTableTest, BlockBoundaries) {
+  FactTable<TestFact> input_facts;
+  FactTable<TestFact> output_facts;
+  InitializeFactTables(*module_, FactStorage::kBlockBoundaries, &input_facts,
+                       &output_facts);
+  EXPECT_EQ(input_facts.NumPoints(), 3);
+  EXPECT_EQ(output_facts.NumPoints(), 3);
+
+  for (const llvm::Function &function : *module_) {
+    for (const llvm::BasicBlock &block : function) {
+      for (const llvm::Instruction &inst : block) {
+        EXPECT_EQ(input_facts.Has(&inst), &inst == &block.front());
+        EXPECT_EQ(output_facts.Has(&inst), &inst == &block.back());
+      }
+      EXPECT_EQ(input_facts.GetEntry(block), input_facts.Get(&block.front()));
+      EXPECT_EQ(output_facts.GetExit(block), output_facts.Get(&block.back()));
+    }
+  }
+}
+
+// Tests that initializing every instruction shares the output fact of an
+// instruction with the input fact of the next one, and skips the functions
+// that are not analysed.
+TEST_F(FactTableTest, InitializesEveryInstruction) {
+  FactTable<TestFact> input_facts;
+  FactTable<TestFact> output_facts;
+  InitializeFactTables(
+      *module_, FactStorage::kEveryInstruction,
+      [](const llvm::Function &function) {
+        return function.getName() != "first";
+      },
+      &input_facts, &output_facts);
+
+  for (const llvm::BasicBlock &block : *module_->getFunction("first")) {
+    EXPECT_FALSE(input_facts.Has(&block.front()));
+  }
+  const llvm::BasicBlock &block = module_->getFunction("second")->front();
+  for (const llvm::Instruction &inst : block) {
+    ASSERT_TRUE(input_facts.Has(&inst));
+    ASSERT_TRUE(output_facts.Has(&inst));
+    if (&inst != &block.front()) {
+      EXPECT_EQ(input_facts.Get(&inst),
+                output_facts.Get(inst.getPrevNode()));
+    }
+  }
+}
+
+}  // namespace error_specifications
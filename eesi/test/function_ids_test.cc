@@ -0,0 +1,118 @@
+#include "function_ids.h"
+
+#include <memory>
+
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+const char *const kModule = R"(
+declare i32 @foo()
+
+define i32 @foo.1() {
+entry:
+  ret i32 0
+}
+
+define i32 @bar(i32 ()* %fp) {
+entry:
+  %x = call i32 @foo()
+  %y = call i32 %fp()
+  %z = call i32 @foo.1()
+  ret i32 %x
+}
+)";
+
+}  // namespace
+
+class FunctionIdsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseAssemblyString(kModule, err, llvm_context_);
+    if (!module_) {
+      err.print("function-ids-test", llvm::errs());
+    }
+    ASSERT_TRUE(module_);
+  }
+
+  llvm::LLVMContext llvm_context_;
+  std::unique_ptr<llvm::Module> module_;
+};
+
+// Tests that the functions of a module are interned by source name, in
+// module order, after the empty name.
+TEST_F(FunctionIdsTest, InternsSourceNames) {
+  FunctionIds function_ids(*module_);
+  EXPECT_EQ(function_ids.size(), 3);
+  EXPECT_EQ(function_ids.GetName(kUnresolvedFunctionId), "");
+  EXPECT_EQ(function_ids.GetId(*module_->getFunction("foo")), 1);
+  EXPECT_EQ(function_ids.GetId(*module_->getFunction("foo.1")), 1);
+  EXPECT_EQ(function_ids.GetId(*module_->getFunction("bar")), 2);
+  EXPECT_EQ(function_ids.GetName(1), "foo");
+  EXPECT_EQ(function_ids.GetName(2), "bar");
+
+  FunctionId id = kUnresolvedFunctionId;
+  EXPECT_TRUE(function_ids.Find("bar", &id));
+  EXPECT_EQ(id, 2);
+  EXPECT_FALSE(function_ids.Find("baz", &id));
+  EXPECT_EQ(function_ids.Intern("baz"), 3);
+  EXPECT_EQ(function_ids.Intern("foo"), 1);
+  EXPECT_TRUE(function_ids.Find("baz", &id));
+  EXPECT_EQ(id, 3);
+  EXPECT_EQ(function_ids.size(), 4);
+}
+
+// Tests that calls to functions have the ID of the callee, and indirect calls
+// the unresolved ID.
+TEST_F(FunctionIdsTest, GetsCalleeIds) {
+  const FunctionIds function_ids(*module_);
+  std::vector<FunctionId> callee_ids;
+  for (const llvm::Instruction &inst :
+       llvm::instructions(*module_->getFunction("bar"))) {
+    if (const auto *call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+      callee_ids.push_back(function_ids.GetCalleeId(*call));
+    }
+  }
+  EXPECT_EQ(callee_ids,
+            std::vector<FunctionId>({1, kUnresolvedFunctionId, 1}));
+}
+
+// Tests that a FunctionIdMap keeps its entries sorted by ID.
+TEST(FunctionIdMapTest, KeepsEntriesSorted) {
+  FunctionIdMap<int> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.Set(5, 50));
+  EXPECT_TRUE(map.Set(2, 20));
+  EXPECT_TRUE(map.Set(7, 70));
+  EXPECT_TRUE(map.Set(2, map.at(2) + 1));
+  EXPECT_FALSE(map.Set(5, 50));
+  EXPECT_EQ(map.size(), 3);
+
+  std::vector<std::pair<FunctionId, int>> entries(map.begin(), map.end());
+  EXPECT_EQ(entries, (std::vector<std::pair<FunctionId, int>>(
+                         {{2, 21}, {5, 50}, {7, 70}})));
+
+  ASSERT_NE(map.find(5), map.end());
+  EXPECT_EQ(map.find(5)->second, 50);
+  EXPECT_EQ(map.find(3), map.end());
+  EXPECT_EQ(map.find(8), map.end());
+
+  FunctionIdMap<int> other;
+  other.Set(7, 70);
+  other.Set(5, 50);
+  EXPECT_NE(map, other);
+  other.Set(2, 21);
+  EXPECT_EQ(map, other);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,129 @@
+#include "persistent_map.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+// Tests that copies share their entries until one of them changes, and that
+// changes that leave a set equal keep it shared.
+TEST(PersistentSetTest, CopiesShareEntriesUntilChanged) {
+  PersistentSet<int> set;
+  EXPECT_TRUE(set.Insert(3));
+  EXPECT_TRUE(set.Insert(1));
+  EXPECT_TRUE(set.Insert(2));
+  EXPECT_EQ(std::vector<int>(set.begin(), set.end()),
+            std::vector<int>({1, 2, 3}));
+
+  PersistentSet<int> copy = set;
+  EXPECT_EQ(&*copy.begin(), &*set.begin());
+  EXPECT_FALSE(copy.Insert(2));
+  EXPECT_EQ(&*copy.begin(), &*set.begin());
+
+  EXPECT_TRUE(copy.Insert(4));
+  EXPECT_NE(&*copy.begin(), &*set.begin());
+  EXPECT_EQ(set.size(), 3);
+  EXPECT_EQ(copy.size(), 4);
+  EXPECT_EQ(set.count(4), 0);
+  EXPECT_EQ(copy.count(4), 1);
+  EXPECT_NE(set, copy);
+}
+
+// Tests that sets with the same elements are equal and have the same hash,
+// whatever the order they were built in.
+TEST(PersistentSetTest, HashesElements) {
+  PersistentSet<int> set;
+  PersistentSet<int> reversed;
+  for (int i = 0; i < 10; i++) {
+    set.Insert(i);
+    reversed.Insert(9 - i);
+  }
+  EXPECT_EQ(set.Hash(), reversed.Hash());
+  EXPECT_EQ(set, reversed);
+
+  reversed.Insert(10);
+  EXPECT_NE(set.Hash(), reversed.Hash());
+  EXPECT_NE(set, reversed);
+  EXPECT_EQ(PersistentSet<int>().Hash(), 0);
+}
+
+// Tests that InsertAll shares the elements of the other set with an empty
+// set, and only changes a set that misses some of them.
+TEST(PersistentSetTest, InsertsAll) {
+  PersistentSet<int> set;
+  set.Insert(1);
+  set.Insert(3);
+
+  PersistentSet<int> empty;
+  EXPECT_TRUE(empty.InsertAll(set));
+  EXPECT_EQ(&*empty.begin(), &*set.begin());
+
+  PersistentSet<int> subset;
+  subset.Insert(3);
+  EXPECT_FALSE(set.InsertAll(subset));
+  EXPECT_FALSE(set.InsertAll(PersistentSet<int>()));
+
+  PersistentSet<int> other;
+  other.Insert(2);
+  other.Insert(3);
+  EXPECT_TRUE(set.InsertAll(other));
+  EXPECT_EQ(std::vector<int>(set.begin(), set.end()),
+            std::vector<int>({1, 2, 3}));
+
+  PersistentSet<int> expected;
+  expected.Insert(2);
+  expected.Insert(1);
+  expected.Insert(3);
+  EXPECT_EQ(set, expected);
+  EXPECT_EQ(set.Hash(), expected.Hash());
+}
+
+// Tests that setting a key to its value keeps a map shared, and that maps of
+// sets hash and compare their values.
+TEST(PersistentMapTest, SetsValues) {
+  PersistentSet<int> values;
+  values.Insert(7);
+
+  PersistentMap<int, PersistentSet<int>> map;
+  EXPECT_TRUE(map.Set(1, values));
+  EXPECT_TRUE(map.Set(0, PersistentSet<int>()));
+  ASSERT_EQ(map.size(), 2);
+  EXPECT_EQ(map.begin()->first, 0);
+  EXPECT_EQ(map.at(1), values);
+
+  PersistentMap<int, PersistentSet<int>> copy = map;
+  EXPECT_FALSE(copy.Set(1, values));
+  EXPECT_EQ(&*copy.begin(), &*map.begin());
+
+  PersistentSet<int> more_values = values;
+  more_values.Insert(8);
+  EXPECT_TRUE(copy.Set(1, more_values));
+  EXPECT_NE(map, copy);
+  EXPECT_NE(map.Hash(), copy.Hash());
+  EXPECT_EQ(map.at(1).size(), 1);
+  EXPECT_EQ(copy.at(1).size(), 2);
+
+  EXPECT_TRUE(copy.Set(1, values));
+  EXPECT_EQ(map, copy);
+  EXPECT_EQ(map.Hash(), copy.Hash());
+  EXPECT_EQ(map.find(2), map.end());
+}
+
+// Tests that the bytes of entries are divided among the maps that share
+// them.
+TEST(PersistentMapTest, DividesBytesAmongCopies) {
+  PersistentMap<int, int> map;
+  EXPECT_EQ(map.ApproximateBytes(), 0);
+  for (int i = 0; i < 16; i++) {
+    map.Set(i, i);
+  }
+  const uint64_t bytes = map.ApproximateBytes();
+  EXPECT_GE(bytes, 16 * sizeof(std::pair<int, int>));
+
+  PersistentMap<int, int> copy = map;
+  EXPECT_EQ(map.ApproximateBytes(), bytes / 2);
+  EXPECT_EQ(copy.ApproximateBytes(), bytes / 2);
+}
+
+}  // namespace error_specifications
@@ -36,18 +36,20 @@ struct FlowVertex {
   FlowVertex(std::string stack, llvm::Function *F) : stack(stack), F(F) {}
 
   // I should be nullptr only in unit tests
-  FlowVertex(std::string stack, Location loc, llvm::Instruction *I)
+  FlowVertex(std::string stack, ::Location loc, llvm::Instruction *I)
       : stack(stack), loc(loc), I(I) {
     if (I) {
       F = I->getParent()->getParent();
     }
   }
 
-  FlowVertex(unsigned stack, Location loc, llvm::Instruction *I)
+  FlowVertex(unsigned stack, ::Location loc, llvm::Instruction *I)
       : FlowVertex(std::to_string(stack), loc, I) {}
 
   std::string stack;
-  Location loc;
+  // The Location of location.h, not the proto message of the same name in
+  // this namespace.
+  ::Location loc;
   llvm::Instruction *I = nullptr;
 
   // This should always be set when creating vertices unless vertex is
@@ -4,14 +4,23 @@
 #ifndef ERROR_SPECIFICATIONS_GET_GRAPH_INCLUDE_GET_GRAPH_SERVER_H_
 #define ERROR_SPECIFICATIONS_GET_GRAPH_INCLUDE_GET_GRAPH_SERVER_H_
 
+#include <cstdint>
+#include <fstream>
+#include <memory>
 #include <string>
 
-#include "tbb/task.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include "async_server.h"
+#include "bitcode_client.h"
+#include "executor.h"
 #include "flow_graph.h"
+#include "memory_budget.h"
+#include "operation_progress.h"
 #include "operations_service.h"
 #include "proto/get_graph.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
+#include "result_cache.h"
 
 namespace error_specifications {
 
@@ -22,24 +31,74 @@ class GetGraphServiceImpl final : public GetGraphService::Service {
                         Operation *operation) override;
 
  public:
+  explicit GetGraphServiceImpl(
+      const std::string &bitcode_cache_directory = "",
+      const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+      const OperationExecutorOptions &executor_options =
+          OperationExecutorOptions(),
+      const std::string &trace_directory = "")
+      : bitcode_cache(bitcode_cache_directory),
+        result_cache(result_cache_options),
+        trace_directory(trace_directory),
+        executor(executor_options, "getgraph") {
+    operations_service.SetResultCache(&result_cache);
+  }
+
   // Because TBB can throw exceptions.
   ~GetGraphServiceImpl() throw() {}
 
+  // Serves the GetGraphService and operations RPCs on `server`, which must not
+  // outlive this service.
+  void AddToAsyncServer(AsyncServer *server);
+
   // The operations service for this GetGraph service.
   OperationsServiceImpl operations_service;
+
+  // Local copies of bitcode previously downloaded from the bitcode service.
+  LocalBitcodeCache bitcode_cache;
+
+  // Memoized results of finished GetGraph operations.
+  ResultCache result_cache;
+
+  // Directory the performance traces of finished operations are written
+  // to. No traces are written if it is empty.
+  const std::string trace_directory;
+
+  // Runs the GetGraph tasks. Declared last so that it is destroyed first,
+  // waiting for the tasks that still use the members above.
+  OperationExecutor executor;
 };
 
-// This is a TBB task that runs GetGraph on a bitcode file by
-// id. The Bitcode file is retrieved from the bitcode service and
+// Runs GetGraph on a bitcode file by id, on the service's executor.
+// The Bitcode file is retrieved from the bitcode service and
 // the operations service is updated when the task is complete.
-class GetGraphTask : public tbb::task {
+class GetGraphTask {
  public:
-  tbb::task *execute(void);
+  // Checks the output URI, fetches the bitcode and sets its size. Returns
+  // false if the operation is over.
+  bool Fetch(uint64_t *bitcode_bytes);
+
+  // Analyses the fetched bitcode once the memory budget admitted it, or
+  // reports that the operation was cancelled if `memory_reservation` is
+  // null.
+  void Analyze(std::unique_ptr<MemoryReservation> memory_reservation);
 
   std::string task_name;
   GetGraphRequest request;
   OperationsServiceImpl *operations_service;
+  LocalBitcodeCache *bitcode_cache;
   std::string bitcode_server_address;
+  std::shared_ptr<const CancellationToken> cancellation_token;
+  ResultCache *result_cache;
+  std::string result_key;
+  std::string trace_directory;
+  OperationExecutor *executor;
+
+  // Kept from Fetch to Analyze.
+  std::unique_ptr<OperationProgressReporter> progress;
+  std::ofstream output_file_stream;
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::unique_ptr<StepTimer> admission_timer;
 };
 
 class FileGetGraphWriter {
@@ -61,7 +120,17 @@ class FileGetGraphWriter {
   std::ofstream &output_file_stream_;
 };
 
-void RunGetGraphServer(const std::string &get_graph_server_address);
+// Start the GetGraph service. Downloaded bitcode is cached in
+// `bitcode_cache_directory` unless it is empty. The performance traces of
+// finished operations are written to `trace_directory` unless it is empty.
+void RunGetGraphServer(
+    const std::string &get_graph_server_address,
+    const std::string &bitcode_cache_directory = "",
+    const ResultCacheOptions &result_cache_options = ResultCacheOptions(),
+    const OperationExecutorOptions &executor_options =
+        OperationExecutorOptions(),
+    const AsyncServerOptions &async_server_options = AsyncServerOptions(),
+    const std::string &trace_directory = "");
 
 }  // namespace error_specifications
 
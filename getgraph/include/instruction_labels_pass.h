@@ -11,7 +11,7 @@
 namespace error_specifications {
 
 struct LabelVisitor : llvm::InstVisitor<LabelVisitor> {
-  LabelVisitor(NamesPass *names, FlowGraph &FG, ReturnPropagationPass *rpp)
+  LabelVisitor(NamesPass *names, FlowGraph &FG, const ReturnPropagation *rpp)
       : names(names), FG(FG), rpp(rpp) {}
 
   void visitInstruction(llvm::Instruction &I);
@@ -30,10 +30,10 @@ struct LabelVisitor : llvm::InstVisitor<LabelVisitor> {
 
   std::string ResolveIndirectName(llvm::Instruction *I,
                                   llvm::Value *indirect_value);
-  const llvm::Value *SelectRandom(std::unordered_set<const llvm::Value *> s);
+  const llvm::Value *SelectRandom(const ReturnPropagationFact::ValueSet &s);
   NamesPass *names;
   FlowGraph &FG;
-  ReturnPropagationPass *rpp;
+  const ReturnPropagation *rpp;
 };
 
 class InstructionLabelsPass : public llvm::ModulePass {
@@ -22,7 +22,7 @@ std::string getName(llvm::Function &F);
 
 enum class TriVal { T, F, N };
 
-Location GetSource(llvm::Instruction *);
+::Location GetSource(llvm::Instruction *);
 
 // Used by clients of DepthFirstVisitor to customize actions during DFS
 template <class GraphT>
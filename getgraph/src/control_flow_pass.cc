@@ -5,6 +5,8 @@
 #include <unistd.h>
 
 #include "glog/logging.h"
+#include "llvm.h"
+#include "progress.h"
 
 namespace error_specifications {
 
@@ -16,8 +18,23 @@ static llvm::cl::opt<std::string> DotStart(
     "dot-start", llvm::cl::desc("(Optional) function to start dot file at"));
 
 bool ControlFlowPass::runOnModule(llvm::Module &M) {
+  PassTimer pass_timer(this, "ControlFlowPass");
   names = &getAnalysis<NamesPass>();
 
+  ProgressReporter *progress = nullptr;
+  if (auto *progress_pass = getAnalysisIfAvailable<ProgressReporterPass>()) {
+    progress = progress_pass->GetProgressReporter();
+  }
+  const CancellationToken *cancellation_token = nullptr;
+  if (auto *cancellation_pass =
+          getAnalysisIfAvailable<CancellationTokenPass>()) {
+    cancellation_token = cancellation_pass->GetCancellationToken();
+  }
+  if (progress) {
+    progress->StartPass("ControlFlowPass", /*sccs_total=*/0,
+                        CountDefinedFunctions(M));
+  }
+
   llvm::Function *main = M.getFunction("main");
   FlowVertex main_v("main.0", main);
   FG.Add(main_v);
@@ -32,6 +49,10 @@ bool ControlFlowPass::runOnModule(llvm::Module &M) {
   }
 
   for (llvm::Module::iterator f = M.begin(), e = M.end(); f != e; ++f) {
+    if (IsCancelled(cancellation_token)) {
+      LOG(INFO) << "ControlFlowPass cancelled.";
+      return false;
+    }
     if (f->isIntrinsic() || f->isDeclaration()) {
       continue;
     }
@@ -55,6 +76,7 @@ bool ControlFlowPass::runOnModule(llvm::Module &M) {
     FG.Add(fn_v, entry_v);
 
     visitFunction(&*f);
+    if (progress) progress->FunctionAnalyzed();
   }
 
   for (llvm::Module::iterator f = M.begin(), e = M.end(); f != e; ++f) {
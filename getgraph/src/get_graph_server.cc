@@ -1,7 +1,5 @@
 #include "get_graph_server.h"
 
-#include <numeric>
-
 #include "glog/logging.h"
 #include "include/grpcpp/grpcpp.h"
 #include "llvm/IR/LLVMContext.h"
@@ -9,26 +7,35 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/SourceMgr.h"
-#include "tbb/task.h"
 
+#include "bitcode_client.h"
 #include "control_flow_pass.h"
+#include "dataflow_analyses.h"
 #include "flow_graph.h"
 #include "instruction_labels_pass.h"
+#include "llvm.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "metrics_server.h"
 #include "names_pass.h"
+#include "progress.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
 #include "servers.h"
 
 namespace error_specifications {
 
-tbb::task *GetGraphTask::execute(void) {
+bool GetGraphTask::Fetch(uint64_t *bitcode_bytes) {
   LOG(INFO) << task_name;
 
   Operation result;
   result.set_name(task_name);
 
+  // Every pass run by the pass manager can publish its progress.
+  progress = std::make_unique<OperationProgressReporter>(operations_service,
+                                                         task_name);
+
   // Checking the output URI.
-  std::ofstream output_file_stream;
   switch (request.output_graph_uri().scheme()) {
     case Scheme::SCHEME_FILE: {
       std::string output_path;
@@ -43,7 +50,7 @@ tbb::task *GetGraphTask::execute(void) {
         error_pb_message->set_message(err_msg);
         result.set_done(1);
         operations_service->UpdateOperation(task_name, result);
-        return NULL;
+        return false;
       }
       output_file_stream = std::ofstream(output_path);
     } break;
@@ -55,7 +62,7 @@ tbb::task *GetGraphTask::execute(void) {
       error_pb_message->set_message(err_msg);
       result.set_done(1);
       operations_service->UpdateOperation(task_name, result);
-      return NULL;
+      return false;
     } break;
     default: {
       const std::string &err_msg = "Unsupported scheme.";
@@ -65,48 +72,66 @@ tbb::task *GetGraphTask::execute(void) {
       error_pb_message->set_message(err_msg);
       result.set_done(1);
       operations_service->UpdateOperation(task_name, result);
-      return NULL;
+      return false;
     } break;
   }
 
-  // Connect to the bitcode service
-  std::shared_ptr<grpc::Channel> channel;
-  std::unique_ptr<BitcodeService::Stub> stub;
-  channel = grpc::CreateChannel(bitcode_server_address,
-                                grpc::InsecureChannelCredentials());
-  stub = BitcodeService::NewStub(channel);
-
-  grpc::ClientContext download_context;
-  DownloadBitcodeRequest download_req;
-  download_req.mutable_bitcode_id()->CopyFrom(request.bitcode_id());
-  std::unique_ptr<grpc::ClientReader<DataChunk>> reader(
-      stub->DownloadBitcode(&download_context, download_req));
-  std::vector<std::string> chunks;
-  DataChunk chunk;
-  while (reader->Read(&chunk)) {
-    chunks.push_back(chunk.content());
+  // Fetch the bitcode, from the local cache if possible, and parse it in
+  // place.
+  StepTimer download_timer(progress.get(), StepTimer::Kind::kPhase,
+                           "download");
+  grpc::Status download_status = bitcode_cache->GetBitcode(
+      bitcode_server_address, request.bitcode_id(), &buffer);
+  download_timer.Stop();
+  if (!download_status.ok()) {
+    LOG(ERROR) << "Unable to download bitcode.";
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(download_status.error_code());
+    error_pb_message->set_message(download_status.error_message());
+    result.set_done(1);
+    operations_service->UpdateOperation(task_name, result);
+    return false;
   }
 
-  std::string bitcode_bytes =
-      std::accumulate(chunks.begin(), chunks.end(), std::string(""));
+  admission_timer = std::make_unique<StepTimer>(
+      progress.get(), StepTimer::Kind::kPhase, "admission");
+  *bitcode_bytes = buffer->getBufferSize();
+  return true;
+}
+
+void GetGraphTask::Analyze(
+    std::unique_ptr<MemoryReservation> memory_reservation) {
+  admission_timer->Stop();
+  OperationProgressReporter &progress = *this->progress;
+  MemoryBudget *memory_budget = executor->GetMemoryBudget();
 
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+  Operation result;
+  result.set_name(task_name);
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic err;
   llvm::LLVMContext llvm_context;
-  std::unique_ptr<llvm::Module> module(
-      llvm::parseIR(buffer->getMemBufferRef(), err, llvm_context));
-
-  if (!module) {
-    err.print("getgraph-server", llvm::errs());
-    abort();
+  std::unique_ptr<llvm::Module> module;
+  if (memory_reservation) {
+    StepTimer parse_timer(&progress, StepTimer::Kind::kPhase, "parse");
+    module = llvm::parseIR(buffer->getMemBufferRef(), err, llvm_context);
+    if (!module) {
+      err.print("getgraph-server", llvm::errs());
+      abort();
+    }
+    RecordParsedModuleMetrics(*module, buffer->getBufferSize());
+    parse_timer.Stop();
   }
 
   // Setting up the passes for GetGraph.
+  // Caches the dataflow analyses that several passes share.
+  llvm::ModuleAnalysisManager analysis_manager;
+  RegisterDataflowAnalyses(&analysis_manager, cancellation_token.get());
+
   llvm::legacy::PassManager pass_manager;
+  pass_manager.add(new ProgressReporterPass(&progress));
+  pass_manager.add(new CancellationTokenPass(cancellation_token.get()));
+  pass_manager.add(new AnalysisManagerPass(&analysis_manager));
   NamesPass *names = new NamesPass();
   std::vector<ErrorCode> ec(request.error_codes().begin(),
                             request.error_codes().end());
@@ -118,18 +143,45 @@ tbb::task *GetGraphTask::execute(void) {
   pass_manager.add(cfp);
   pass_manager.add(ilp);
 
-  pass_manager.run(*module);
+  // Grow the reservation by the facts of the passes.
+  if (memory_reservation) {
+    StepTimer growth_timer(&progress, StepTimer::Kind::kPhase, "growth");
+    const bool grown = memory_budget->Grow(memory_reservation.get(),
+                                           CountInstructions(*module),
+                                           cancellation_token.get());
+    growth_timer.Stop();
+    if (grown) {
+      pass_manager.run(*module);
+    }
+  }
+
+  // The passes stop early once the operation is cancelled, so their partial
+  // results are dropped along with the module.
+  if (cancellation_token->IsCancelled()) {
+    LOG(INFO) << "Operation cancelled: " << task_name;
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(grpc::StatusCode::CANCELLED);
+    error_pb_message->set_message("Operation cancelled.");
+    result.set_done(1);
+    progress.FillMetadata(&result);
+    if (!trace_directory.empty()) {
+      progress.WriteTrace(trace_directory);
+    }
+    operations_service->UpdateOperation(task_name, result);
+    return;
+  }
 
   // Get the FlowGraph and write out to file.
+  StepTimer pack_timer(&progress, StepTimer::Kind::kPhase, "pack");
   FlowGraph flow_graph = cfp->GetFlowGraph();
   const auto graph_id_to_label = ilp->GetIdToLabel();
   FileGetGraphWriter fw(&output_file_stream);
   Edgelist out_edgelist = fw.WriteGraph(&flow_graph, graph_id_to_label);
 
   // Check that the generated file was successfully written.
-  std::string graph_data_str;
+  std::unique_ptr<llvm::MemoryBuffer> graph_buffer;
   grpc::Status read_graph_status =
-      ReadUriIntoString(request.output_graph_uri(), graph_data_str);
+      ReadUriIntoBuffer(request.output_graph_uri(), &graph_buffer);
   if (!read_graph_status.ok()) {
     const std::string err_msg = "Unable to read generated graph file!";
     LOG(ERROR) << err_msg;
@@ -138,12 +190,14 @@ tbb::task *GetGraphTask::execute(void) {
     error_pb_message->set_message(err_msg);
     result.set_done(1);
     operations_service->UpdateOperation(task_name, result);
-    return NULL;
+    return;
   }
 
   std::string out_graph_id;
   // Hash the bitcode file and use that as unique identifier (handle).
-  grpc::Status hash_err = HashString(graph_data_str, out_graph_id);
+  grpc::Status hash_err =
+      HashBytes(graph_buffer->getBufferStart(), graph_buffer->getBufferSize(),
+                out_graph_id);
   if (!hash_err.ok()) {
     const std::string err_msg = "Unable to hash graph data.";
     LOG(ERROR) << err_msg;
@@ -152,7 +206,7 @@ tbb::task *GetGraphTask::execute(void) {
     error_pb_message->set_message(err_msg);
     result.set_done(1);
     operations_service->UpdateOperation(task_name, result);
-    return NULL;
+    return;
   }
 
   // Build the response and pack in result.
@@ -161,14 +215,39 @@ tbb::task *GetGraphTask::execute(void) {
   graph_handle->set_id(out_graph_id);
   response.mutable_edgelist()->CopyFrom(out_edgelist);
   result.mutable_response()->PackFrom(response);
+  pack_timer.Stop();
+  progress.FillMetadata(&result);
+  if (!trace_directory.empty()) {
+    progress.WriteTrace(trace_directory);
+  }
 
   result.set_done(1);
+  result_cache->Insert(result_key, result);
   operations_service->UpdateOperation(task_name, result);
   LOG(INFO) << "GetGraph task finished.";
 
-  return NULL;
+  return;
 };
 
+// A memoized GetGraph result is only as good as the graph file it
+// describes, so it is reused only while the file still hashes to its graph
+// ID.
+static bool GraphFileMatches(const GetGraphRequest &request,
+                             const Operation &operation) {
+  GetGraphResponse response;
+  if (!operation.response().UnpackTo(&response)) {
+    return false;
+  }
+  std::unique_ptr<llvm::MemoryBuffer> graph_buffer;
+  if (!ReadUriIntoBuffer(request.output_graph_uri(), &graph_buffer).ok()) {
+    return false;
+  }
+  std::string graph_id;
+  grpc::Status hash_err = HashBytes(graph_buffer->getBufferStart(),
+                                    graph_buffer->getBufferSize(), graph_id);
+  return hash_err.ok() && graph_id == response.graph_id().id();
+}
+
 grpc::Status GetGraphServiceImpl::GetGraph(grpc::ServerContext *context,
                                            const GetGraphRequest *request,
                                            Operation *operation) {
@@ -183,16 +262,49 @@ grpc::Status GetGraphServiceImpl::GetGraph(grpc::ServerContext *context,
 
   // Return the name of the operation so client can check on progress.
   std::string task_name = GetTaskName("GetGraph", request->bitcode_id().id());
+  const std::string result_key =
+      ResultCache::MakeKey("GetGraph", request->bitcode_id().id(), *request);
+  if (operations_service.FinishFromResultCache(
+          task_name, result_key, operation,
+          [request](const Operation &cached_operation) {
+            return GraphFileMatches(*request, cached_operation);
+          })) {
+    return grpc::Status::OK;
+  }
   operation->set_name(task_name);
   operation->set_done(0);
+  // Identical requests made while this one runs share its task.
+  if (operations_service.AttachToRunningTask(task_name, result_key,
+                                             operation)) {
+    return grpc::Status::OK;
+  }
   operations_service.UpdateOperation(task_name, *operation);
 
-  GetGraphTask *task = new (tbb::task::allocate_root()) GetGraphTask();
+  auto task = std::make_shared<GetGraphTask>();
   task->operations_service = &operations_service;
+  task->bitcode_cache = &bitcode_cache;
   task->request = *request;
   task->task_name = task_name;
   task->bitcode_server_address = bitcode_server_address;
-  tbb::task::enqueue(*task);
+  task->cancellation_token = operations_service.GetCancellationToken(task_name);
+  task->result_cache = &result_cache;
+  task->result_key = result_key;
+  task->trace_directory = trace_directory;
+  task->executor = &executor;
+  // Wait, without holding a slot of the executor, until the analysis fits
+  // next to the running ones: first the parsed module, then the facts of the
+  // passes over its instructions. Admission only fails once the operation
+  // is cancelled, which the task handles.
+  grpc::Status submit_status = executor.SubmitAnalysis(
+      OperationPriority::kNormal, task->cancellation_token,
+      [task](uint64_t *bitcode_bytes) { return task->Fetch(bitcode_bytes); },
+      [task](std::unique_ptr<MemoryReservation> memory_reservation) {
+        task->Analyze(std::move(memory_reservation));
+      });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name, submit_status);
+    return submit_status;
+  }
 
   return grpc::Status::OK;
 }
@@ -243,12 +355,37 @@ Edgelist FileGetGraphWriter::WriteGraph(
   return edgelist;
 }
 
-void RunGetGraphServer(const std::string &server_address) {
-  GetGraphServiceImpl service;
+void GetGraphServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<GetGraphService::AsyncService>();
+  // Validating a memoized result hashes the graph file it describes.
+  server->AddUnary(async_service,
+                   &GetGraphService::AsyncService::RequestGetGraph, this,
+                   &GetGraphService::Service::GetGraph, /*blocking=*/true);
+  operations_service.AddToAsyncServer(server);
+}
+
+void RunGetGraphServer(const std::string &server_address,
+                       const std::string &bitcode_cache_directory,
+                       const ResultCacheOptions &result_cache_options,
+                       const OperationExecutorOptions &executor_options,
+                       const AsyncServerOptions &async_server_options,
+                       const std::string &trace_directory) {
+  GetGraphServiceImpl service(bitcode_cache_directory, result_cache_options,
+                              executor_options, trace_directory);
+  if (async_server_options.enabled) {
+    AsyncServer server(async_server_options);
+    service.AddToAsyncServer(&server);
+    if (server.Start(server_address).ok()) {
+      server.Wait();
+    }
+    return;
+  }
 
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder);
   // Register "service" as the instance through which we'll communicate with
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
@@ -14,7 +14,7 @@ namespace error_specifications {
 bool InstructionLabelsPass::runOnModule(llvm::Module &M) {
   LabelVisitor LV(&getAnalysis<NamesPass>(),
                   (&getAnalysis<ControlFlowPass>())->FG,
-                  &getAnalysis<ReturnPropagationPass>());
+                  &getAnalysis<ReturnPropagationPass>().GetResult());
   LV.visit(M);
 
   label_to_id = LV.FG.label_to_id;
@@ -173,12 +173,12 @@ std::unordered_map<int, std::string> InstructionLabelsPass::GetIdToLabel() {
 std::string LabelVisitor::ResolveIndirectName(llvm::Instruction *I,
                                               llvm::Value *indirect_value) {
   std::string indirect_name = "";
-  if (rpp->output_facts_.find(I) != rpp->output_facts_.end()) {
-    ReturnPropagationFact rpf = *(rpp->output_facts_.at(I));
+  if (rpp->HasFacts(I)) {
+    ReturnPropagationFact rpf = rpp->GetOutFact(I);
 
     if (rpf.value.find(indirect_value) != rpf.value.end()) {
-      std::unordered_set<const llvm::Value *> possible_values =
-          (rpf.value.at(indirect_value));
+      const ReturnPropagationFact::ValueSet &possible_values =
+          rpf.value.at(indirect_value);
       if (possible_values.size() == 0) {
         return "";
       }
@@ -200,7 +200,7 @@ std::string LabelVisitor::ResolveIndirectName(llvm::Instruction *I,
 }
 
 const llvm::Value *LabelVisitor::SelectRandom(
-    std::unordered_set<const llvm::Value *> s) {
+    const ReturnPropagationFact::ValueSet &s) {
   auto r = rand() % s.size();
   auto it = std::begin(s);
 
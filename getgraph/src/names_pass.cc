@@ -11,6 +11,7 @@
 #include <unordered_set>
 #include "glog/logging.h"
 #include "llvm/IR/BasicBlock.h"
+#include "progress.h"
 
 namespace error_specifications {
 
@@ -22,6 +23,7 @@ void NamesPass::SetErrorCodes(std::vector<ErrorCode> error_codes) {
 }
 
 bool NamesPass::runOnModule(llvm::Module &M) {
+  PassTimer pass_timer(this, "NamesPass");
   module_ = &M;
 
   // Collect global variables
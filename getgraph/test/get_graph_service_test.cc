@@ -4,6 +4,7 @@
 #include "getgraph/include/get_graph_server.h"
 
 #include <unistd.h>
+#include <future>
 #include <string>
 
 #include "gtest/gtest.h"
@@ -97,6 +98,24 @@ bool LabelInGraph(const Edgelist &edgelist, const std::string &label_to_find) {
   return LabelsInGraph(edgelist, {label_to_find});
 }
 
+// Keeps every slot of `executor` busy until it goes out of scope, so that
+// operations submitted in the meantime stay queued.
+class BusyExecutor {
+ public:
+  explicit BusyExecutor(OperationExecutor *executor) {
+    std::shared_future<void> released = release_.get_future().share();
+    for (int i = 0; i < kDefaultMaxConcurrentOperations; i++) {
+      executor->Submit(OperationPriority::kNormal,
+                       [released] { released.wait(); });
+    }
+  }
+
+  ~BusyExecutor() { release_.set_value(); }
+
+ private:
+  std::promise<void> release_;
+};
+
 TEST_F(GetGraphServiceTest, BazCoverBarGraph) {
   // Register the bitcode file.
   RegisterBitcodeRequest register_bitcode_req;
@@ -305,4 +324,69 @@ TEST_F(GetGraphServiceTest, IfFooNoReturn) {
                             {"F2V_CONDBR_SLT_ZERO", "F2V_CONDBR_SGT_ZERO"}));
 }
 
+// Tests that cancelling an operation that has not finished yet finishes it
+// with a CANCELLED error.
+TEST_F(GetGraphServiceTest, CancelGetGraph) {
+  RegisterBitcodeRequest register_bitcode_req;
+  RegisterBitcodeResponse register_bitcode_res;
+  grpc::ClientContext register_bitcode_context;
+  register_bitcode_req.mutable_uri()->CopyFrom(
+      FilePathToUri("testdata/programs/baz_cover_bar-reg2mem.ll"));
+  grpc::Status status = bitcode_stub_->RegisterBitcode(
+      &register_bitcode_context, register_bitcode_req, &register_bitcode_res);
+  ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+
+  GetGraphRequest get_graph_req;
+  get_graph_req.mutable_bitcode_id()->set_id(
+      register_bitcode_res.bitcode_id().id());
+  get_graph_req.mutable_bitcode_id()->set_authority(
+      test_bitcode_server_address_);
+  get_graph_req.mutable_output_graph_uri()->CopyFrom(
+      FilePathToUri(tmp_output_path_));
+
+  Operation get_graph_operation;
+  {
+    // The operation waits for a slot until it has been cancelled.
+    BusyExecutor busy_executor(&get_graph_service_.executor);
+    grpc::ClientContext get_graph_context;
+    status = get_graph_stub_->GetGraph(&get_graph_context, get_graph_req,
+                                       &get_graph_operation);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+    ASSERT_FALSE(get_graph_operation.done());
+
+    grpc::ClientContext cancel_context;
+    CancelOperationRequest cancel_req;
+    cancel_req.set_name(get_graph_operation.name());
+    google::protobuf::Empty cancel_res;
+    status = operations_stub_->CancelOperation(&cancel_context, cancel_req,
+                                               &cancel_res);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+  }
+
+  int number_of_tries = 0;
+  while (!get_graph_operation.done()) {
+    grpc::ClientContext get_operation_context;
+    GetOperationRequest get_operation_req;
+    get_operation_req.set_name(get_graph_operation.name());
+    status = operations_stub_->GetOperation(
+        &get_operation_context, get_operation_req, &get_graph_operation);
+    ASSERT_EQ(status.error_code(), grpc::OK) << status.error_message();
+    ASSERT_LE(number_of_tries, 10);
+    number_of_tries++;
+    usleep(100 * 1000);
+  }
+  EXPECT_EQ(get_graph_operation.error().code(), grpc::StatusCode::CANCELLED);
+}
+
+// Tests that cancelling an operation that does not exist fails.
+TEST_F(GetGraphServiceTest, CancelUnknownOperation) {
+  grpc::ClientContext cancel_context;
+  CancelOperationRequest cancel_req;
+  cancel_req.set_name("unknown");
+  google::protobuf::Empty cancel_res;
+  grpc::Status status = operations_stub_->CancelOperation(
+      &cancel_context, cancel_req, &cancel_res);
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+}
+
 }  // namespace error_specifications
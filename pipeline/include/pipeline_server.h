@@ -0,0 +1,100 @@
+// This file defines the C++ API for the PipelineService gRPC calls.
+// See proto/pipeline.proto for details about individual rpc calls.
+
+#ifndef ERROR_SPECIFICATIONS_PIPELINE_INCLUDE_PIPELINE_SERVER_H_
+#define ERROR_SPECIFICATIONS_PIPELINE_INCLUDE_PIPELINE_SERVER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "async_server.h"
+#include "cancellation.h"
+#include "executor.h"
+#include "memory_budget.h"
+#include "operation_progress.h"
+#include "operations_service.h"
+#include "proto/operations.grpc.pb.h"
+#include "proto/pipeline.grpc.pb.h"
+
+namespace error_specifications {
+
+// Logic and data behind the server's behavior.
+class PipelineServiceImpl final : public PipelineService::Service {
+  grpc::Status RunPipeline(grpc::ServerContext *context,
+                           const PipelineRequest *request,
+                           Operation *operation) override;
+
+ public:
+  explicit PipelineServiceImpl(
+      const OperationExecutorOptions &executor_options =
+          OperationExecutorOptions(),
+      const std::string &trace_directory = "")
+      : trace_directory(trace_directory),
+        executor(executor_options, "pipeline") {}
+
+  // Because TBB can throw exceptions.
+  ~PipelineServiceImpl() throw() {}
+
+  // Serves the PipelineService and operations RPCs on `server`, which must
+  // not outlive this service.
+  void AddToAsyncServer(AsyncServer *server);
+
+  // The operations service for this pipeline service.
+  OperationsServiceImpl operations_service;
+
+  // Directory the performance traces of finished operations are written
+  // to. No traces are written if it is empty.
+  const std::string trace_directory;
+
+  // Runs the pipeline tasks. Declared last so that it is destroyed first,
+  // waiting for the tasks that still use the members above.
+  OperationExecutor executor;
+};
+
+// Runs the whole analysis of a bitcode file on the service's executor. The
+// bitcode is read and parsed once, the annotate, EESI, checker, and getgraph
+// passes run over the module in one pass manager, and the resulting ICFG is
+// walked without being read back from disk. The operations service is
+// updated when the task is complete.
+class RunPipelineTask {
+ public:
+  // Checks the output URIs, reads the bitcode and sets its size. Returns
+  // false if the operation is over.
+  bool Fetch(uint64_t *bitcode_bytes);
+
+  // Analyses the read bitcode once the memory budget admitted it, or
+  // reports that the operation was cancelled if `memory_reservation` is
+  // null.
+  void Analyze(std::unique_ptr<MemoryReservation> memory_reservation);
+
+  std::string task_name;
+  PipelineRequest request;
+  OperationsServiceImpl *operations_service;
+  std::shared_ptr<const CancellationToken> cancellation_token;
+  std::string trace_directory;
+  OperationExecutor *executor;
+
+  // Kept from Fetch to Analyze.
+  std::unique_ptr<OperationProgressReporter> progress;
+  std::string annotated_bitcode_path;
+  std::string graph_path;
+  std::string walks_path;
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::unique_ptr<StepTimer> admission_timer;
+};
+
+// Start the pipeline service. The performance traces of finished operations
+// are written to `trace_directory` unless it is empty.
+void RunPipelineServer(
+    const std::string &server_address,
+    const OperationExecutorOptions &executor_options =
+        OperationExecutorOptions(),
+    const AsyncServerOptions &async_server_options = AsyncServerOptions(),
+    const std::string &trace_directory = "");
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_PIPELINE_INCLUDE_PIPELINE_SERVER_H_
@@ -0,0 +1,87 @@
+#include "pipeline_server.h"
+
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "glog/logging.h"
+
+#include "fact_storage.h"
+#include "metrics_server.h"
+#include "servers.h"
+
+ABSL_FLAG(std::string, listen, "localhost:50058", "The address to listen on.");
+ABSL_FLAG(int, max_concurrent_operations,
+          error_specifications::kDefaultMaxConcurrentOperations,
+          "Number of long-running operations to run at the same time.");
+ABSL_FLAG(int, max_queued_operations,
+          error_specifications::kDefaultMaxQueuedOperations,
+          "Number of operations that may wait to run. Further requests fail "
+          "with RESOURCE_EXHAUSTED.");
+ABSL_FLAG(uint64_t, memory_budget_bytes, 0,
+          "Estimated memory, in bytes, that running analyses may use "
+          "together. Analyses that do not fit wait for others to finish. 0 "
+          "disables the budget.");
+ABSL_FLAG(bool, async_server, false,
+          "Serve from completion queues polled by a few threads instead of "
+          "one thread per call.");
+ABSL_FLAG(int, async_polling_threads,
+          error_specifications::kDefaultAsyncPollingThreads,
+          "Number of threads polling for calls with --async_server.");
+ABSL_FLAG(int, async_worker_threads,
+          error_specifications::kDefaultAsyncWorkerThreads,
+          "Number of threads serving streaming and blocking calls with "
+          "--async_server.");
+ABSL_FLAG(int, async_max_queued_calls,
+          error_specifications::kDefaultAsyncMaxQueuedCalls,
+          "Number of streaming and blocking calls that may wait for a worker "
+          "thread with --async_server. Further calls fail with "
+          "RESOURCE_EXHAUSTED.");
+ABSL_FLAG(std::string, metrics_listen, "",
+          "The address to serve metrics on, in the Prometheus text format at "
+          "/metrics. Disabled if empty.");
+ABSL_FLAG(std::string, trace_dir, "",
+          "Directory to write a performance trace of every finished operation "
+          "to. Disabled if empty.");
+ABSL_FLAG(std::string, fact_storage, "every_instruction",
+          "Which dataflow facts the analyses keep: \"every_instruction\", or "
+          "\"block_boundaries\" to keep only those at the entry and exit of "
+          "basic blocks and recompute the others when needed, which uses "
+          "less memory.");
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging("pipeline-service");
+  absl::ParseCommandLine(argc, argv);
+  error_specifications::FactStorage fact_storage;
+  if (!error_specifications::ParseFactStorage(absl::GetFlag(FLAGS_fact_storage),
+                                              &fact_storage)) {
+    LOG(FATAL) << "Unknown --fact_storage "
+               << absl::GetFlag(FLAGS_fact_storage);
+  }
+  error_specifications::SetDefaultFactStorage(fact_storage);
+  std::string listen_address = absl::GetFlag(FLAGS_listen);
+  error_specifications::OperationExecutorOptions executor_options;
+  executor_options.max_concurrent_operations =
+      absl::GetFlag(FLAGS_max_concurrent_operations);
+  executor_options.max_queued_operations =
+      absl::GetFlag(FLAGS_max_queued_operations);
+  executor_options.memory_budget_bytes =
+      absl::GetFlag(FLAGS_memory_budget_bytes);
+  error_specifications::AsyncServerOptions async_server_options;
+  async_server_options.enabled = absl::GetFlag(FLAGS_async_server);
+  async_server_options.polling_threads =
+      absl::GetFlag(FLAGS_async_polling_threads);
+  async_server_options.worker_threads =
+      absl::GetFlag(FLAGS_async_worker_threads);
+  async_server_options.max_queued_calls =
+      absl::GetFlag(FLAGS_async_max_queued_calls);
+  error_specifications::MetricsEndpoint metrics_endpoint;
+  const std::string metrics_address = absl::GetFlag(FLAGS_metrics_listen);
+  if (!metrics_address.empty()) {
+    metrics_endpoint.Start(metrics_address);
+  }
+  error_specifications::RunPipelineServer(listen_address, executor_options,
+                                          async_server_options,
+                                          absl::GetFlag(FLAGS_trace_dir));
+  return 0;
+}
@@ -0,0 +1,486 @@
+#include "pipeline_server.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bitcode/src/annotate_pass.h"
+#include "control_flow_pass.h"
+#include "dataflow_analyses.h"
+#include "error_blocks_pass.h"
+#include "flow_graph.h"
+#include "get_graph_server.h"
+#include "glog/logging.h"
+#include "include/grpcpp/grpcpp.h"
+#include "instruction_labels_pass.h"
+#include "insufficient_checks_pass.h"
+#include "llvm.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "lpds.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "names_pass.h"
+#include "progress.h"
+#include "return_constraints_pass.h"
+#include "return_propagation_pass.h"
+#include "return_range_pass.h"
+#include "returned_values_pass.h"
+#include "servers.h"
+#include "synonym_finder.h"
+#include "unused_calls_pass.h"
+#include "walker.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Hands the specifications inferred by an ErrorBlocksPass to the checker
+// passes scheduled after it, so that the checkers run in the same pass
+// manager as EESI instead of waiting for its response.
+class ForwardSpecificationsPass : public llvm::ModulePass {
+ public:
+  static char ID;
+
+  // The passes are owned by the pass manager. The checker passes may be
+  // null if their violations were not requested.
+  ForwardSpecificationsPass(const ErrorBlocksPass *error_blocks,
+                            UnusedCallsPass *unused_calls,
+                            InsufficientChecksPass *insufficient_checks)
+      : llvm::ModulePass(ID),
+        error_blocks_(error_blocks),
+        unused_calls_(unused_calls),
+        insufficient_checks_(insufficient_checks) {}
+
+  bool runOnModule(llvm::Module &module) override {
+    GetViolationsRequest violations_request;
+    *violations_request.mutable_specifications() =
+        error_blocks_->GetSpecifications().specifications();
+    if (unused_calls_) {
+      violations_request.set_violation_type(
+          ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE);
+      unused_calls_->SetViolationsRequest(violations_request);
+    }
+    if (insufficient_checks_) {
+      violations_request.set_violation_type(
+          ViolationType::VIOLATION_TYPE_INSUFFICIENT_CHECK);
+      insufficient_checks_->SetViolationsRequest(violations_request);
+    }
+
+    return false;
+  }
+
+  void getAnalysisUsage(llvm::AnalysisUsage &au) const override {
+    au.setPreservesAll();
+  }
+
+ private:
+  const ErrorBlocksPass *error_blocks_;
+  UnusedCallsPass *unused_calls_;
+  InsufficientChecksPass *insufficient_checks_;
+};
+
+char ForwardSpecificationsPass::ID = 0;
+
+// Marks `result` as failed with `code` and `message`.
+void SetError(grpc::StatusCode code, const std::string &message,
+              Operation *result) {
+  google::rpc::Status *error_pb_message = result->mutable_error();
+  error_pb_message->set_code(code);
+  error_pb_message->set_message(message);
+  result->set_done(1);
+}
+
+// Converts `uri`, which must be a file:// URI, into a local path.
+grpc::Status GetOutputPath(const Uri &uri, const std::string &artifact,
+                           std::string *out_path) {
+  if (uri.scheme() != Scheme::SCHEME_FILE) {
+    const std::string &err_msg =
+        "Unsupported scheme for the " + artifact + " output URI.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+  grpc::Status convert_uri_status = ConvertUriToFilePath(uri, *out_path);
+  if (!convert_uri_status.ok()) {
+    const std::string &err_msg =
+        "Unable to parse the " + artifact + " output URI.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+
+  return grpc::Status::OK;
+}
+
+}  // namespace
+
+bool RunPipelineTask::Fetch(uint64_t *bitcode_bytes) {
+  LOG(INFO) << task_name;
+
+  Operation result;
+  result.set_name(task_name);
+
+  // Every pass run by the pass manager can publish its progress.
+  progress = std::make_unique<OperationProgressReporter>(operations_service,
+                                                         task_name);
+
+  // Check the output URIs before spending any time on the analysis.
+  grpc::Status output_status =
+      GetOutputPath(request.graph_request().output_graph_uri(), "graph",
+                    &graph_path);
+  if (output_status.ok()) {
+    output_status = GetOutputPath(request.walk_request().output_walks_uri(),
+                                  "walks", &walks_path);
+  }
+  if (output_status.ok() && request.has_annotated_bitcode_uri()) {
+    output_status = GetOutputPath(request.annotated_bitcode_uri(),
+                                  "annotated bitcode", &annotated_bitcode_path);
+  }
+  if (!output_status.ok()) {
+    SetError(output_status.error_code(), output_status.error_message(),
+             &result);
+    operations_service->UpdateOperation(task_name, result);
+    return false;
+  }
+
+  // Read the bitcode once for every analysis below.
+  StepTimer download_timer(progress.get(), StepTimer::Kind::kPhase,
+                           "download");
+  grpc::Status read_status = ReadUriIntoBuffer(request.bitcode_uri(), &buffer);
+  download_timer.Stop();
+  if (!read_status.ok()) {
+    LOG(ERROR) << "Unable to read bitcode.";
+    SetError(read_status.error_code(), read_status.error_message(), &result);
+    operations_service->UpdateOperation(task_name, result);
+    return false;
+  }
+
+  admission_timer = std::make_unique<StepTimer>(
+      progress.get(), StepTimer::Kind::kPhase, "admission");
+  *bitcode_bytes = buffer->getBufferSize();
+  return true;
+}
+
+void RunPipelineTask::Analyze(
+    std::unique_ptr<MemoryReservation> memory_reservation) {
+  admission_timer->Stop();
+  OperationProgressReporter &progress = *this->progress;
+  MemoryBudget *memory_budget = executor->GetMemoryBudget();
+  const bool write_annotated_bitcode = request.has_annotated_bitcode_uri();
+
+  Operation result;
+  result.set_name(task_name);
+
+  PipelineResponse response;
+  std::string bitcode_id;
+  grpc::Status hash_status =
+      HashBytes(buffer->getBufferStart(), buffer->getBufferSize(), bitcode_id);
+  if (!hash_status.ok()) {
+    SetError(grpc::StatusCode::DATA_LOSS, "Unable to hash bitcode data.",
+             &result);
+    operations_service->UpdateOperation(task_name, result);
+    return;
+  }
+  response.mutable_bitcode_id()->set_id(bitcode_id);
+
+  // Parse IR into an llvm Module.
+  llvm::SMDiagnostic err;
+  llvm::LLVMContext llvm_context;
+  std::unique_ptr<llvm::Module> module;
+  if (memory_reservation) {
+    StepTimer parse_timer(&progress, StepTimer::Kind::kPhase, "parse");
+    module = llvm::parseIR(buffer->getMemBufferRef(), err, llvm_context);
+    if (!module) {
+      err.print("pipeline-server", llvm::errs());
+      SetError(grpc::StatusCode::INVALID_ARGUMENT, "Unable to parse bitcode.",
+               &result);
+      operations_service->UpdateOperation(task_name, result);
+      return;
+    }
+    RecordParsedModuleMetrics(*module, buffer->getBufferSize());
+    parse_timer.Stop();
+  }
+
+  // One schedule for every pass. The analyses preserve the module, so the
+  // return propagation and constraints computed for EESI are reused by the
+  // checkers and getgraph instead of being run again.
+  // Caches the dataflow analyses that several passes share.
+  llvm::ModuleAnalysisManager analysis_manager;
+  RegisterDataflowAnalyses(&analysis_manager, cancellation_token.get());
+
+  llvm::legacy::PassManager pass_manager;
+  pass_manager.add(new ProgressReporterPass(&progress));
+  pass_manager.add(new CancellationTokenPass(cancellation_token.get()));
+  pass_manager.add(new AnalysisManagerPass(&analysis_manager));
+  if (write_annotated_bitcode) {
+    pass_manager.add(new AnnotatePass());
+  }
+
+  const GetSpecificationsRequest &specifications_request =
+      request.specifications_request();
+  std::unique_ptr<SynonymFinder> synonym_finder;
+  if (!specifications_request.embedding_id().authority().empty()) {
+    synonym_finder = std::make_unique<SynonymFinder>(
+        specifications_request.embedding_id(),
+        specifications_request.synonym_finder_parameters()
+            .expansion_operation());
+  }
+  ErrorBlocksPass *error_blocks = new ErrorBlocksPass();
+  error_blocks->SetSpecificationsRequest(specifications_request,
+                                         synonym_finder.get());
+  pass_manager.add(new ReturnPropagationPass());
+  pass_manager.add(new ReturnConstraintsPass());
+  pass_manager.add(new ReturnedValuesPass());
+  pass_manager.add(new ReturnRangePass());
+  pass_manager.add(error_blocks);
+
+  UnusedCallsPass *unused_calls = nullptr;
+  InsufficientChecksPass *insufficient_checks = nullptr;
+  for (int violation_type : request.violation_types()) {
+    if (violation_type == ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE &&
+        !unused_calls) {
+      unused_calls = new UnusedCallsPass();
+    } else if (violation_type ==
+                   ViolationType::VIOLATION_TYPE_INSUFFICIENT_CHECK &&
+               !insufficient_checks) {
+      insufficient_checks = new InsufficientChecksPass();
+    }
+  }
+  pass_manager.add(new ForwardSpecificationsPass(error_blocks, unused_calls,
+                                                 insufficient_checks));
+  if (unused_calls) {
+    pass_manager.add(unused_calls);
+  }
+  if (insufficient_checks) {
+    pass_manager.add(insufficient_checks);
+  }
+
+  const GetGraphRequest &graph_request = request.graph_request();
+  NamesPass *names = new NamesPass();
+  std::vector<ErrorCode> ec(graph_request.error_codes().begin(),
+                            graph_request.error_codes().end());
+  names->SetErrorCodes(ec);
+  ControlFlowPass *cfp = new ControlFlowPass();
+  cfp->remove_cross_folder = graph_request.remove_cross_folder();
+  InstructionLabelsPass *ilp = new InstructionLabelsPass();
+  pass_manager.add(names);
+  pass_manager.add(cfp);
+  pass_manager.add(ilp);
+
+  // Grow the reservation by the facts of the passes.
+  if (memory_reservation) {
+    StepTimer growth_timer(&progress, StepTimer::Kind::kPhase, "growth");
+    const bool grown = memory_budget->Grow(memory_reservation.get(),
+                                           CountInstructions(*module),
+                                           cancellation_token.get());
+    growth_timer.Stop();
+    if (grown) {
+      pass_manager.run(*module);
+    }
+  }
+
+  // The passes stop early once the operation is cancelled, so their partial
+  // results are dropped along with the module.
+  if (cancellation_token->IsCancelled()) {
+    LOG(INFO) << "Operation cancelled: " << task_name;
+    SetError(grpc::StatusCode::CANCELLED, "Operation cancelled.", &result);
+    progress.FillMetadata(&result);
+    if (!trace_directory.empty()) {
+      progress.WriteTrace(trace_directory);
+    }
+    operations_service->UpdateOperation(task_name, result);
+    return;
+  }
+
+  // Write out the annotated bitcode and the graph, and hash them into their
+  // handles.
+  StepTimer write_timer(&progress, StepTimer::Kind::kPhase, "write");
+  if (write_annotated_bitcode) {
+    std::error_code error_code;
+    llvm::raw_fd_ostream ostream(annotated_bitcode_path, error_code,
+                                 llvm::sys::fs::F_None);
+    if (error_code) {
+      SetError(grpc::StatusCode::DATA_LOSS,
+               "Unable to write annotated bitcode file.", &result);
+      operations_service->UpdateOperation(task_name, result);
+      return;
+    }
+    llvm::WriteBitcodeToFile(*module, ostream);
+    ostream.close();
+
+    std::string annotated_bitcode_id;
+    if (!HashFile(annotated_bitcode_path, annotated_bitcode_id).ok()) {
+      SetError(grpc::StatusCode::DATA_LOSS,
+               "Unable to hash annotated bitcode file.", &result);
+      operations_service->UpdateOperation(task_name, result);
+      return;
+    }
+    response.mutable_annotated_bitcode_id()->set_id(annotated_bitcode_id);
+  }
+
+  FlowGraph flow_graph = cfp->GetFlowGraph();
+  Edgelist edgelist;
+  {
+    std::ofstream graph_stream(graph_path);
+    FileGetGraphWriter graph_writer(&graph_stream);
+    edgelist = graph_writer.WriteGraph(&flow_graph, ilp->GetIdToLabel());
+  }
+  std::string graph_id;
+  if (!HashFile(graph_path, graph_id).ok()) {
+    SetError(grpc::StatusCode::DATA_LOSS, "Unable to hash graph file.",
+             &result);
+    operations_service->UpdateOperation(task_name, result);
+    return;
+  }
+  write_timer.Stop();
+
+  // Walk the graph straight from the edge list.
+  StepTimer walk_timer(&progress, StepTimer::Kind::kPhase, "walk");
+  Lpds lpds;
+  BuildLpdsFromEdgelist(edgelist, &lpds);
+  grpc::Status walk_status;
+  {
+    std::ofstream walks_stream(walks_path);
+    FileWalkWriter walk_writer(&walks_stream);
+    Walker walker(cancellation_token.get());
+    walk_status = walker.RandomWalk(&lpds, &walk_writer,
+                                    request.walk_request().walks_per_label(),
+                                    request.walk_request().walk_length());
+  }
+  walk_timer.Stop();
+  if (!walk_status.ok()) {
+    LOG(ERROR) << "Unable to complete random walk.";
+    SetError(walk_status.error_code(), walk_status.error_message(), &result);
+    progress.FillMetadata(&result);
+    if (!trace_directory.empty()) {
+      progress.WriteTrace(trace_directory);
+    }
+    operations_service->UpdateOperation(task_name, result);
+    return;
+  }
+
+  // Build the response and pack in result.
+  StepTimer pack_timer(&progress, StepTimer::Kind::kPhase, "pack");
+  *response.mutable_specifications() = error_blocks->GetSpecifications();
+  if (unused_calls) {
+    response.mutable_violations()->MergeFrom(unused_calls->GetViolations());
+  }
+  if (insufficient_checks) {
+    response.mutable_violations()->MergeFrom(
+        insufficient_checks->GetViolations());
+  }
+  response.mutable_graph()->mutable_graph_id()->set_id(graph_id);
+  *response.mutable_graph()->mutable_edgelist() = std::move(edgelist);
+  *response.mutable_walks_uri() = request.walk_request().output_walks_uri();
+
+  result.set_done(1);
+  result.mutable_response()->PackFrom(response);
+  pack_timer.Stop();
+  progress.FillMetadata(&result);
+  if (!trace_directory.empty()) {
+    progress.WriteTrace(trace_directory);
+  }
+
+  operations_service->UpdateOperation(task_name, result);
+  LOG(INFO) << "Pipeline task finished.";
+}
+
+grpc::Status PipelineServiceImpl::RunPipeline(grpc::ServerContext *context,
+                                              const PipelineRequest *request,
+                                              Operation *operation) {
+  LOG(INFO) << "RunPipeline rpc";
+
+  if (!request->has_bitcode_uri()) {
+    const std::string &err_msg = "Bitcode URI missing.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+
+  // Return the name of the operation so client can check on progress.
+  std::string request_hash;
+  HashString(request->SerializeAsString(), request_hash);
+  const std::string task_name = GetTaskName("RunPipeline", request_hash);
+  operation->set_name(task_name);
+  operation->set_done(0);
+  // Identical requests made while this one runs share its task.
+  if (operations_service.AttachToRunningTask(
+          task_name, "RunPipeline-" + request_hash, operation)) {
+    return grpc::Status::OK;
+  }
+  operations_service.UpdateOperation(task_name, *operation);
+
+  auto task = std::make_shared<RunPipelineTask>();
+  task->operations_service = &operations_service;
+  task->request = *request;
+  task->task_name = task_name;
+  task->cancellation_token = operations_service.GetCancellationToken(task_name);
+  task->trace_directory = trace_directory;
+  task->executor = &executor;
+  // Wait, without holding a slot of the executor, until the analysis fits
+  // next to the running ones: first the parsed module, then the facts of the
+  // passes over its instructions. Admission only fails once the operation
+  // is cancelled, which the task handles.
+  grpc::Status submit_status = executor.SubmitAnalysis(
+      OperationPriority::kNormal, task->cancellation_token,
+      [task](uint64_t *bitcode_bytes) { return task->Fetch(bitcode_bytes); },
+      [task](std::unique_ptr<MemoryReservation> memory_reservation) {
+        task->Analyze(std::move(memory_reservation));
+      });
+  if (!submit_status.ok()) {
+    operations_service.DiscardOperation(task_name, submit_status);
+    return submit_status;
+  }
+
+  return grpc::Status::OK;
+}
+
+void PipelineServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<PipelineService::AsyncService>();
+  server->AddUnary(async_service,
+                   &PipelineService::AsyncService::RequestRunPipeline, this,
+                   &PipelineService::Service::RunPipeline);
+  operations_service.AddToAsyncServer(server);
+}
+
+void RunPipelineServer(const std::string &server_address,
+                       const OperationExecutorOptions &executor_options,
+                       const AsyncServerOptions &async_server_options,
+                       const std::string &trace_directory) {
+  PipelineServiceImpl service(executor_options, trace_directory);
+  if (async_server_options.enabled) {
+    AsyncServer server(async_server_options);
+    service.AddToAsyncServer(&server);
+    if (server.Start(server_address).ok()) {
+      server.Wait();
+    }
+    return;
+  }
+
+  grpc::ServerBuilder builder;
+  // Listen on the given address without any authentication mechanism.
+  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder);
+  // Register "service" as the instance through which we'll communicate with
+  // clients. In this case it corresponds to an *synchronous* service.
+  builder.RegisterService(&service);
+  builder.RegisterService(&service.operations_service);
+  // Finally assemble the server.
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  std::cout << "Server listening on " << server_address << std::endl;
+
+  // Wait for the server to shutdown. Note that some other thread must be
+  // responsible for shutting down the server for this call to ever return.
+  server->Wait();
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,136 @@
+// This file contains end-to-end tests of the pipeline service that
+// go through the gRPC interface.
+
+#include "pipeline/include/pipeline_server.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/grpcpp/grpcpp.h"
+
+#include "proto/operations.grpc.pb.h"
+#include "proto/pipeline.grpc.pb.h"
+#include "servers.h"
+
+namespace error_specifications {
+
+// Starts the gRPC server before each test and shuts it down after.
+// Right now this relies on starting the server with an actual port.
+class PipelineServiceTest : public ::testing::Test {
+ protected:
+  PipelineServiceImpl pipeline_service_;
+  grpc::ServerBuilder pipeline_builder_;
+  std::unique_ptr<grpc::Server> pipeline_server_;
+  std::shared_ptr<grpc::Channel> pipeline_channel_;
+  std::unique_ptr<PipelineService::Stub> pipeline_stub_;
+  std::unique_ptr<OperationsService::Stub> operations_stub_;
+  std::string tmp_annotated_path_ = "testdata/programs/pipelinetest.bc";
+  std::string tmp_graph_path_ = "testdata/programs/pipelinetest.icfg";
+  std::string tmp_walks_path_ = "testdata/programs/pipelinetest.walks";
+
+  void SetUp() override {
+    constexpr char kTestPipelineServerAddress[] = "localhost:70058";
+    pipeline_builder_.AddListeningPort(kTestPipelineServerAddress,
+                                       grpc::InsecureServerCredentials());
+    pipeline_builder_.RegisterService(&pipeline_service_);
+    pipeline_builder_.RegisterService(&pipeline_service_.operations_service);
+    pipeline_server_ = pipeline_builder_.BuildAndStart();
+    pipeline_channel_ = grpc::CreateChannel(kTestPipelineServerAddress,
+                                            grpc::InsecureChannelCredentials());
+    pipeline_stub_ = PipelineService::NewStub(pipeline_channel_);
+    operations_stub_ = OperationsService::NewStub(pipeline_channel_);
+  }
+
+  void TearDown() override {
+    pipeline_server_->Shutdown();
+    remove(tmp_annotated_path_.c_str());
+    remove(tmp_graph_path_.c_str());
+    remove(tmp_walks_path_.c_str());
+  }
+};
+
+TEST_F(PipelineServiceTest, BazCoverBarPipeline) {
+  PipelineRequest pipeline_req;
+  pipeline_req.mutable_bitcode_uri()->CopyFrom(
+      FilePathToUri("testdata/programs/baz_cover_bar-reg2mem.ll"));
+  pipeline_req.mutable_annotated_bitcode_uri()->CopyFrom(
+      FilePathToUri(tmp_annotated_path_));
+  pipeline_req.add_violation_types(
+      ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE);
+  pipeline_req.mutable_graph_request()->mutable_output_graph_uri()->CopyFrom(
+      FilePathToUri(tmp_graph_path_));
+  RandomWalkLegacyIcfgRequest *walk_req = pipeline_req.mutable_walk_request();
+  walk_req->mutable_output_walks_uri()->CopyFrom(
+      FilePathToUri(tmp_walks_path_));
+  walk_req->set_walk_length(10);
+  walk_req->set_walks_per_label(2);
+
+  Operation pipeline_operation;
+  grpc::ClientContext pipeline_context;
+  grpc::Status status = pipeline_stub_->RunPipeline(
+      &pipeline_context, pipeline_req, &pipeline_operation);
+  if (status.error_code() != grpc::OK) {
+    std::cerr << status.error_message() << std::endl;
+  }
+  ASSERT_EQ(status.error_code(), grpc::OK);
+
+  // Get the status of the operation and wait until finished or error.
+  // Timeout after 30 seconds.
+  int number_of_tries = 0;
+  while (!pipeline_operation.done()) {
+    grpc::ClientContext get_operation_context;
+    GetOperationRequest get_operation_req;
+    get_operation_req.set_name(pipeline_operation.name());
+    status = operations_stub_->GetOperation(
+        &get_operation_context, get_operation_req, &pipeline_operation);
+
+    if (status.error_code() != grpc::OK) {
+      std::cerr << status.error_message() << std::endl;
+    }
+    ASSERT_EQ(status.error_code(), grpc::OK);
+    ASSERT_LE(number_of_tries, 30);
+    number_of_tries++;
+    usleep(1000 * 1000);
+  }
+  ASSERT_EQ(pipeline_operation.done(), true);
+  ASSERT_FALSE(pipeline_operation.has_error())
+      << pipeline_operation.error().message();
+
+  // Get the results of the operation.
+  PipelineResponse response;
+  pipeline_operation.response().UnpackTo(&response);
+
+  ASSERT_FALSE(response.bitcode_id().id().empty());
+  ASSERT_FALSE(response.annotated_bitcode_id().id().empty());
+  ASSERT_NE(response.annotated_bitcode_id().id(), response.bitcode_id().id());
+
+  // The same graph as the one the GetGraph service builds.
+  ASSERT_FALSE(response.graph().graph_id().id().empty());
+  ASSERT_EQ(response.graph().edgelist().edges().size(), 55)
+      << response.DebugString();
+
+  // The graph is walked without being read back.
+  ASSERT_EQ(response.walks_uri().path(), walk_req->output_walks_uri().path());
+  std::ifstream walks_stream(tmp_walks_path_);
+  std::string first_walk;
+  ASSERT_TRUE(std::getline(walks_stream, first_walk));
+  ASSERT_FALSE(first_walk.empty());
+
+  // The module is read and parsed only once.
+  ProgressMetadata progress;
+  ASSERT_TRUE(pipeline_operation.metadata().UnpackTo(&progress));
+  std::vector<std::string> phases;
+  for (const StepUsage &phase : progress.performance().phases()) {
+    phases.push_back(phase.name());
+  }
+  ASSERT_EQ(phases,
+            std::vector<std::string>({"download", "admission", "parse",
+                                      "growth", "write", "walk", "pack"}));
+}
+
+}  // namespace error_specifications
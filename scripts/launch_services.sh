@@ -1,11 +1,13 @@
 SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
 BAZEL=bazel-4.1.0
+BITCODE_CACHE_DIR=${BITCODE_CACHE_DIR:-${HOME}/.cache/error-specifications/bitcode}
+RESULT_CACHE_DIR=${RESULT_CACHE_DIR:-${HOME}/.cache/error-specifications/results}
 
-tmux new -d -s bitcode "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //bitcode:main"
-tmux new -d -s eesier "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //eesi:main"
+tmux new -d -s bitcode "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //bitcode:main -- --result_cache_dir=${RESULT_CACHE_DIR}/bitcode"
+tmux new -d -s eesier "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //eesi:main -- --bitcode_cache_dir=${BITCODE_CACHE_DIR} --result_cache_dir=${RESULT_CACHE_DIR}/eesi"
 tmux new -d -s embedding  "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //embedding:service"
 tmux new -d -s walker "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //walker:main"
-tmux new -d -s getgraph "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //getgraph:main"
-tmux new -d -s checker "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //checker:main"
+tmux new -d -s getgraph "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //getgraph:main -- --bitcode_cache_dir=${BITCODE_CACHE_DIR} --result_cache_dir=${RESULT_CACHE_DIR}/getgraph"
+tmux new -d -s checker "cd ${SCRIPT_DIR}/.. && ${BAZEL} run //checker:main -- --bitcode_cache_dir=${BITCODE_CACHE_DIR} --result_cache_dir=${RESULT_CACHE_DIR}/checker"
 mkdir -p ~/data/db
 tmux new -d -s mongo "mongod --dbpath ~/data/db"
@@ -25,6 +25,7 @@
 #include <stack>
 #include <vector>
 
+#include "cancellation.h"
 #include "include/grpcpp/grpcpp.h"
 #include "lpds.h"
 #include "proto/walker.grpc.pb.h"
@@ -38,19 +39,6 @@ class WalkWriter {
   virtual void WriteSentence(const Sentence &sentence) = 0;
 };
 
-// Write out sentences to a gRPC ServerWriter.
-class GrpcWalkWriter : public WalkWriter {
- public:
-  GrpcWalkWriter(grpc::ServerWriter<Sentence> *writer) : grpc_writer_(writer) {}
-  virtual void WriteSentence(const Sentence &sentence);
-
- private:
-  // Mutex for locking when writing to a gRPC ServerWriter.
-  tbb::mutex write_mutex_;
-  // gRPC ServerWriter for sentences.
-  grpc::ServerWriter<Sentence> *grpc_writer_ = nullptr;
-};
-
 // Write out sentences to a file.
 // The format used is "Label.label Label.label\nLabel.label Label.label\n..."
 class FileWalkWriter : public WalkWriter {
@@ -92,34 +80,39 @@ class GcsWalkWriter : public WalkWriter {
   std::ostream &output_stream_;
 };
 
+// Adds the nodes and edges of a getgraph edge list to `lpds`. Call and
+// may_return edges are marked, and the edges leaving a call node are also
+// labelled with the names of the functions it calls.
+void BuildLpdsFromEdgelist(const Edgelist &edgelist, Lpds *lpds);
+
 // Spawns walk workers to perform the actual walks.
 // State inside a walker is accessed concurrently.
 class Walker {
  public:
-  Walker();
+  // cancellation_token: if set, walks stop early once it is cancelled and
+  // the walk returns a CANCELLED status.
+  explicit Walker(const CancellationToken *cancellation_token = nullptr);
 
   // Performs a random walk over a legacy ICFG and writes it to a file.
   grpc::Status RandomWalkLegacyIcfgBackground(
       const RandomWalkLegacyIcfgRequest *request);
 
-  // Performs a random walk over a legacy ICFG and streams sentences
-  // out via gRPC.
-  grpc::Status RandomWalkLegacyIcfg(const RandomWalkLegacyIcfgRequest *request,
-                                    grpc::ServerWriter<Sentence> *writer);
-
   // Performs a random walk over all labels in an Lpds object.
   grpc::Status RandomWalk(const Lpds *lpds, WalkWriter *writer,
                           int num_walks_per_label, int walk_length);
 
+  // icfg_path: path to file containing legacy func2vec getgraph output.
+  // Returns true if parsing was successful
+  grpc::Status ReadLegacyIcfg(const Uri &icfg_uri, Lpds *lpds) const;
+
  private:
   // Reads a legacy func2vec ICFG and performs a random walk.
   // The output is written to `writer`.
   grpc::Status DoRandomWalkLegacyIcfg(
       const RandomWalkLegacyIcfgRequest *request, WalkWriter *writer);
 
-  // icfg_path: path to file containing legacy func2vec getgraph output.
-  // Returns true if parsing was successful
-  grpc::Status ReadLegacyIcfg(const Uri &icfg_uri, Lpds *lpds) const;
+  // Polled between walks. Not owned.
+  const CancellationToken *cancellation_token_;
 };
 
 // A walk worker performs a single random walk over all labels.
@@ -128,16 +121,23 @@ class WalkWorker {
  public:
   // lpds: the Lpds object to walk.
   // walk_number: which walk this is.
-  WalkWorker(const Lpds *lpds, int walk_number, WalkWriter *writer)
+  // cancellation_token: polled between labels, may be null.
+  WalkWorker(const Lpds *lpds, int walk_number, WalkWriter *writer,
+             const CancellationToken *cancellation_token = nullptr)
       : lpds_(lpds),
         walk_number_(walk_number),
         writer_(writer),
+        cancellation_token_(cancellation_token),
         mersenne_twister_((std::random_device())()) {}
 
   // Performs a single random walk over all labels in lpds_.
   grpc::Status SingleRandomWalk(const tbb::concurrent_vector<Label> &labels,
                                 int walk_length);
 
+  // Walks at most `walk_length` labels from a random edge with `label`, and
+  // returns them as one sentence.
+  Sentence WalkFromLabel(const Label &label, int walk_length);
+
  private:
   // Random number generator.
   std::mt19937 mersenne_twister_;
@@ -154,6 +154,9 @@ class WalkWorker {
   // Output writer.
   WalkWriter *writer_;
 
+  // Stops the walk early once cancelled. Not owned.
+  const CancellationToken *cancellation_token_;
+
   // Performs a random transition in the Lpds.
   const LpdsNode *RandomTransition(const LpdsNode *node, Sentence *sentence);
 
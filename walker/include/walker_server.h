@@ -6,9 +6,12 @@
 
 #include "proto/walker.grpc.pb.h"
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
+#include "async_server.h"
+#include "executor.h"
 #include "operations_service.h"
 #include "proto/bitcode.grpc.pb.h"
 
@@ -30,12 +33,34 @@ class WalkerServiceImpl final : public WalkerService::Service {
       grpc::ServerWriter<Sentence> *writer) override;
 
  public:
+  explicit WalkerServiceImpl(const OperationExecutorOptions &executor_options =
+                                 OperationExecutorOptions())
+      : executor_(executor_options, "walker") {}
+
+  // Reads the ICFG of a RandomWalkLegacyIcfg call and opens the walk, on
+  // both the synchronous and the asynchronous server.
+  grpc::Status OpenRandomWalkLegacyIcfg(
+      grpc::ServerContext *context, const RandomWalkLegacyIcfgRequest *request,
+      std::unique_ptr<ServerStream<Sentence>> *out_stream);
+
+  // Serves the WalkerService and operations RPCs on `server`, which must not
+  // outlive this service.
+  void AddToAsyncServer(AsyncServer *server);
+
   // The operations service for managing long-running tasks.
   OperationsServiceImpl operations_service_;
+
+  // Runs the background walk tasks. Declared last so that it is destroyed
+  // first, waiting for the tasks that still use the operations service.
+  OperationExecutor executor_;
 };
 
-// Start up the BitcodeService.
-void RunWalkerServer(std::string server_address);
+// Start up the WalkerService.
+void RunWalkerServer(
+    std::string server_address,
+    const OperationExecutorOptions &executor_options =
+        OperationExecutorOptions(),
+    const AsyncServerOptions &async_server_options = AsyncServerOptions());
 
 }  // namespace error_specifications.
 
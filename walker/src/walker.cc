@@ -9,13 +9,17 @@
 #include "glog/logging.h"
 #include "google/cloud/storage/client.h"
 #include "include/grpcpp/grpcpp.h"
+#include "metrics.h"
 #include "proto/get_graph.pb.h"
 #include "proto/walker.grpc.pb.h"
 #include "servers.h"
 
 namespace error_specifications {
 
-Walker::Walker() { std::srand(std::time(0)); }
+Walker::Walker(const CancellationToken *cancellation_token)
+    : cancellation_token_(cancellation_token) {
+  std::srand(std::time(0));
+}
 
 grpc::Status Walker::RandomWalkLegacyIcfgBackground(
     const RandomWalkLegacyIcfgRequest *request) {
@@ -57,16 +61,6 @@ grpc::Status Walker::RandomWalkLegacyIcfgBackground(
   }
 }
 
-grpc::Status Walker::RandomWalkLegacyIcfg(
-    const RandomWalkLegacyIcfgRequest *request,
-    grpc::ServerWriter<Sentence> *writer) {
-  LOG(INFO) << "Start RandomWalk";
-
-  GrpcWalkWriter grpc_writer(writer);
-
-  return DoRandomWalkLegacyIcfg(request, &grpc_writer);
-}
-
 grpc::Status Walker::DoRandomWalkLegacyIcfg(
     const RandomWalkLegacyIcfgRequest *request, WalkWriter *writer) {
   Lpds lpds;
@@ -99,27 +93,25 @@ grpc::Status Walker::RandomWalk(const Lpds *lpds, WalkWriter *writer,
 
                       for (int walk_number = walk_numbers.begin();
                            walk_number != walk_numbers.end(); ++walk_number) {
+                        if (IsCancelled(cancellation_token_)) return;
+
                         // Shuffle the labels before each walk.
                         std::random_shuffle(labels_for_this_walk.begin(),
                                             labels_for_this_walk.end());
 
                         // Start a walk over all labels.
-                        WalkWorker walk_worker(lpds, walk_number, writer);
+                        WalkWorker walk_worker(lpds, walk_number, writer,
+                                               cancellation_token_);
                         walk_worker.SingleRandomWalk(labels, walk_length);
                       }
                     });
 
-  return grpc::Status::OK;
-}
-
-void GrpcWalkWriter::WriteSentence(const Sentence &sentence) {
-  // No need to unlock at the end of the function.
-  // Lock is automatically released from a scoped_lock.
-  tbb::mutex::scoped_lock lock(write_mutex_);
-
-  assert(grpc_writer_ != nullptr);
+  if (IsCancelled(cancellation_token_)) {
+    LOG(INFO) << "Random walk cancelled.";
+    return grpc::Status(grpc::StatusCode::CANCELLED, "Random walk cancelled.");
+  }
 
-  grpc_writer_->Write(sentence);
+  return grpc::Status::OK;
 }
 
 void FileWalkWriter::WriteSentence(const Sentence &sentence) {
@@ -152,40 +144,51 @@ void GcsWalkWriter::WriteSentence(const Sentence &sentence) {
 
 grpc::Status WalkWorker::SingleRandomWalk(
     const tbb::concurrent_vector<Label> &labels, int walk_length) {
-  const LpdsEdge *random_edge;
-
   for (const auto &label : labels) {
-    Sentence sentence;
-
-    // Pick a random edge with that label to start walk.
-    const tbb::concurrent_vector<const LpdsEdge *> edges_with_label =
-        lpds_->GetEdgesForLabel(label);
-    assert(edges_with_label.size() != 0);
-    if (edges_with_label.size() == 1) {
-      random_edge = edges_with_label[0];
-    } else {
-      std::uniform_int_distribution<int> dist(0, edges_with_label.size() - 1);
-      random_edge = edges_with_label[dist(mersenne_twister_)];
+    if (IsCancelled(cancellation_token_)) {
+      return grpc::Status(grpc::StatusCode::CANCELLED, "Walk cancelled.");
     }
 
-    // Add the start label to the beginning of the walk.
-    Label *word = sentence.add_words();
-    word->CopyFrom(label);
+    writer_->WriteSentence(WalkFromLabel(label, walk_length));
+  }
 
-    int edges_visited = 0;
-    const LpdsNode *next_node = random_edge->target;
-    while (edges_visited < walk_length - 1 && next_node != nullptr) {
-      next_node = RandomTransition(next_node, &sentence);
-      edges_visited++;
-    }
+  return grpc::Status::OK;
+}
 
-    writer_->WriteSentence(sentence);
+Sentence WalkWorker::WalkFromLabel(const Label &label, int walk_length) {
+  // The rate of this counter is the number of sentences per second.
+  static Counter *sentences_written = MetricsRegistry::Global().GetCounter(
+      "walker_sentences_total", "Sentences written by random walks.");
+  Sentence sentence;
+  const LpdsEdge *random_edge;
 
-    // A walk of one label has finished. Clear the stack for the next label.
-    return_stack_ = std::stack<const LpdsEdge *>();
+  // Pick a random edge with that label to start walk.
+  const tbb::concurrent_vector<const LpdsEdge *> edges_with_label =
+      lpds_->GetEdgesForLabel(label);
+  assert(edges_with_label.size() != 0);
+  if (edges_with_label.size() == 1) {
+    random_edge = edges_with_label[0];
+  } else {
+    std::uniform_int_distribution<int> dist(0, edges_with_label.size() - 1);
+    random_edge = edges_with_label[dist(mersenne_twister_)];
   }
 
-  return grpc::Status::OK;
+  // Add the start label to the beginning of the walk.
+  Label *word = sentence.add_words();
+  word->CopyFrom(label);
+
+  int edges_visited = 0;
+  const LpdsNode *next_node = random_edge->target;
+  while (edges_visited < walk_length - 1 && next_node != nullptr) {
+    next_node = RandomTransition(next_node, &sentence);
+    edges_visited++;
+  }
+
+  // A walk of one label has finished. Clear the stack for the next label.
+  return_stack_ = std::stack<const LpdsEdge *>();
+  sentences_written->Increment();
+
+  return sentence;
 }
 
 // Returns nullptr if walk cannot continue (end of function, no may return
@@ -317,6 +320,12 @@ grpc::Status Walker::ReadLegacyIcfg(const Uri &icfg_uri, Lpds *lpds) const {
 
   LOG(INFO) << "Parsed ICFG.";
 
+  BuildLpdsFromEdgelist(edgelist, lpds);
+
+  return grpc::Status::OK;
+}
+
+void BuildLpdsFromEdgelist(const Edgelist &edgelist, Lpds *lpds) {
   auto label_id_to_str = edgelist.id_to_label();
 
   // Map from nodes IDs of call nodes to the function being called.
@@ -390,8 +399,6 @@ grpc::Status Walker::ReadLegacyIcfg(const Uri &icfg_uri, Lpds *lpds) const {
   }
 
   LOG(INFO) << "Created LPDS.";
-
-  return grpc::Status::OK;
 }
 
 }  // namespace error_specifications
@@ -2,7 +2,8 @@
 
 #include "glog/logging.h"
 #include "include/grpcpp/grpcpp.h"
-#include "tbb/task.h"
+#include "metrics.h"
+#include "metrics_server.h"
 
 #include "proto/walker.grpc.pb.h"
 #include "servers.h"
@@ -10,15 +11,15 @@
 
 namespace error_specifications {
 
-class RandomWalkLegacyIcfgTask : public tbb::task {
+class RandomWalkLegacyIcfgTask {
  public:
-  tbb::task *execute(void) {
+  void Run() {
     LOG(INFO) << "Executing " << task_name_;
 
     Operation result;
     result.set_name(task_name_);
 
-    Walker walker;
+    Walker walker(cancellation_token_.get());
     grpc::Status err = walker.RandomWalkLegacyIcfgBackground(&request_);
     if (!err.ok()) {
       LOG(ERROR) << "Unable to complete random walk.";
@@ -27,7 +28,7 @@ class RandomWalkLegacyIcfgTask : public tbb::task {
       error_pb_message->set_message(err.error_message());
       result.set_done(1);
       operations_service_->UpdateOperation(task_name_, result);
-      return NULL;
+      return;
     }
 
     // Currently we have nothing to put into the response.
@@ -40,13 +41,12 @@ class RandomWalkLegacyIcfgTask : public tbb::task {
     operations_service_->UpdateOperation(task_name_, result);
 
     LOG(INFO) << "RandomWalkLegacyIcfg task finished.";
-
-    return NULL;
   }
 
   std::string task_name_;
   RandomWalkLegacyIcfgRequest request_;
   OperationsServiceImpl *operations_service_;
+  std::shared_ptr<const CancellationToken> cancellation_token_;
 };
 
 grpc::Status WalkerServiceImpl::RandomWalkLegacyIcfgBackground(
@@ -67,12 +67,18 @@ grpc::Status WalkerServiceImpl::RandomWalkLegacyIcfgBackground(
   operation->set_done(0);
   operations_service_.UpdateOperation(task_name, *operation);
 
-  RandomWalkLegacyIcfgTask *task =
-      new (tbb::task::allocate_root()) RandomWalkLegacyIcfgTask();
+  auto task = std::make_shared<RandomWalkLegacyIcfgTask>();
   task->task_name_ = task_name;
   task->request_ = *request;
   task->operations_service_ = &operations_service_;
-  tbb::task::enqueue(*task);
+  task->cancellation_token_ =
+      operations_service_.GetCancellationToken(task_name);
+  grpc::Status submit_status = executor_.Submit(
+      OperationPriority::kNormal, [task] { task->Run(); });
+  if (!submit_status.ok()) {
+    operations_service_.DiscardOperation(task_name);
+    return submit_status;
+  }
   return grpc::Status::OK;
 
   LOG(INFO) << "Finish RandomWalk RPC";
@@ -80,29 +86,109 @@ grpc::Status WalkerServiceImpl::RandomWalkLegacyIcfgBackground(
   return grpc::Status::OK;
 }
 
+// The sentences of a random walk over an Lpds, walked one at a time as the
+// client reads them. Walk after walk, every label starts one sentence.
+class RandomWalkStream final : public ServerStream<Sentence> {
+ public:
+  RandomWalkStream(std::unique_ptr<Lpds> lpds, int num_walks_per_label,
+                   int walk_length)
+      : lpds_(std::move(lpds)),
+        labels_(lpds_->GetLabels()),
+        num_walks_per_label_(num_walks_per_label),
+        walk_length_(walk_length),
+        walk_worker_(lpds_.get(), 0, nullptr) {}
+
+  bool Next(Sentence *sentence, grpc::Status *status) override {
+    if (next_label_ == labels_.size()) {
+      next_label_ = 0;
+      walk_number_++;
+    }
+    if (walk_length_ <= 0 || labels_.empty() ||
+        walk_number_ >= num_walks_per_label_) {
+      *status = grpc::Status::OK;
+      return false;
+    }
+    *sentence = walk_worker_.WalkFromLabel(labels_[next_label_], walk_length_);
+    next_label_++;
+    return true;
+  }
+
+ private:
+  const std::unique_ptr<Lpds> lpds_;
+  const tbb::concurrent_vector<Label> labels_;
+  const int num_walks_per_label_;
+  const int walk_length_;
+  WalkWorker walk_worker_;
+  int walk_number_ = 0;
+  size_t next_label_ = 0;
+};
+
 grpc::Status WalkerServiceImpl::RandomWalkLegacyIcfg(
     grpc::ServerContext *context, const RandomWalkLegacyIcfgRequest *request,
     grpc::ServerWriter<Sentence> *writer) {
+  std::unique_ptr<ServerStream<Sentence>> stream;
+  grpc::Status open_status =
+      OpenRandomWalkLegacyIcfg(context, request, &stream);
+  if (!open_status.ok()) {
+    return open_status;
+  }
+
+  return WriteServerStream(stream.get(), writer);
+}
+
+grpc::Status WalkerServiceImpl::OpenRandomWalkLegacyIcfg(
+    grpc::ServerContext *context, const RandomWalkLegacyIcfgRequest *request,
+    std::unique_ptr<ServerStream<Sentence>> *out_stream) {
   LOG(INFO) << "Start RandomWalkLegacyIcfg RPC";
 
+  auto lpds = std::make_unique<Lpds>();
   Walker walker;
-  grpc::Status walk_status = walker.RandomWalkLegacyIcfg(request, writer);
-  if (!walk_status.ok()) {
-    LOG(ERROR) << "Unable to complete random walk.";
-    return walk_status;
+  grpc::Status read_icfg_status =
+      walker.ReadLegacyIcfg(request->input_icfg_uri(), lpds.get());
+  if (!read_icfg_status.ok()) {
+    LOG(ERROR) << "Unable to read the ICFG.";
+    return read_icfg_status;
   }
-
-  LOG(INFO) << "Finish RandomWalkLegacyIcfg RPC";
+  if (request->walk_length() <= 0) {
+    LOG(WARNING) << "Random walk of length " << request->walk_length()
+                 << " requested.";
+  }
+  *out_stream = std::make_unique<RandomWalkStream>(
+      std::move(lpds), request->walks_per_label(), request->walk_length());
 
   return grpc::Status::OK;
 }
 
-void RunWalkerServer(std::string server_address) {
-  WalkerServiceImpl service;
+void WalkerServiceImpl::AddToAsyncServer(AsyncServer *server) {
+  auto *async_service = server->AddService<WalkerService::AsyncService>();
+  server->AddUnary(
+      async_service,
+      &WalkerService::AsyncService::RequestRandomWalkLegacyIcfgBackground,
+      this, &WalkerService::Service::RandomWalkLegacyIcfgBackground);
+  server->AddServerStreaming(
+      async_service, &WalkerService::AsyncService::RequestRandomWalkLegacyIcfg,
+      this, &WalkerServiceImpl::OpenRandomWalkLegacyIcfg);
+  operations_service_.AddToAsyncServer(server);
+}
+
+void RunWalkerServer(std::string server_address,
+                     const OperationExecutorOptions &executor_options,
+                     const AsyncServerOptions &async_server_options) {
+  WalkerServiceImpl service(executor_options);
+  if (async_server_options.enabled) {
+    AsyncServer server(async_server_options);
+    service.AddToAsyncServer(&server);
+    if (server.Start(server_address).ok()) {
+      server.Wait();
+    }
+    return;
+  }
 
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // Record the latency and status of every call.
+  AddRpcMetrics(&builder);
   // Register "service" as the instance through which we'll communicate with
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);